@@ -2,10 +2,12 @@
 #include <stdio.h>
 #include <string.h>
 #include "cargo.h"
+#include "economy.h"
 
 void cargo_init(struct cargo *cargo)
 {
 	memset(cargo, 0, sizeof(*cargo));
+	cargo->amount = &cargo->own_amount;
 	ptrlist_init(&cargo->requires);
 	INIT_LIST_HEAD(&cargo->list);
 }
@@ -14,3 +16,49 @@ void cargo_free(struct cargo *cargo)
 {
 	ptrlist_free(&cargo->requires);
 }
+
+/*
+ * Port cargo in the economy is only brought up to date when it is used, so
+ * its amount must be read and changed through these. The items_lock of the
+ * port must be held, for writing to change it.
+ */
+long cargo_amount(const struct cargo *cargo)
+{
+	if (cargo->run)
+		return economy_amount(cargo->run, cargo->amount);
+
+	return *cargo->amount;
+}
+
+void cargo_set_amount(struct cargo *cargo, const long amount)
+{
+	if (cargo->run)
+		economy_settle(cargo->run);
+
+	*cargo->amount = amount;
+}
+
+/*
+ * A change worked out from the amount must be written as of the same tick
+ * the amount was read at, or whatever the economy made in between is lost.
+ * cargo_settle() brings the cargo, and the rest of its port's cargo with it,
+ * up to date. After that, and until the items_lock of the port is let go,
+ * the amount is read and changed as of that tick with the two below, however
+ * far the economy moves on meanwhile. cargo_amount() would already count the
+ * ticks after it.
+ */
+void cargo_settle(struct cargo *cargo)
+{
+	if (cargo->run)
+		economy_settle(cargo->run);
+}
+
+long cargo_settled_amount(const struct cargo *cargo)
+{
+	return *cargo->amount;
+}
+
+void cargo_set_settled(struct cargo *cargo, const long amount)
+{
+	*cargo->amount = amount;
+}
@@ -4,17 +4,28 @@
 #include "list.h"
 #include "ptrlist.h"
 
+struct economy_run;
+
 struct cargo {
 	struct item *item;
 	long min, max;
-	long amount;
+	long *amount;			/* In the economy for port cargo, see cargo_amount() */
+	long own_amount;		/* Where amount points otherwise */
+	struct economy_run *run;	/* NULL unless in the economy */
 	long daily_change;
-	long price;
+	long price;			/* Set by port_reprice() for port cargo */
+	long demand;			/* Bought from the port less sold to it, decaying */
+	unsigned long demand_tick;	/* The economy tick demand is as of */
 	struct ptrlist requires;
 	struct list_head list;
 };
 
 void cargo_init(struct cargo *cargo);
 void cargo_free(struct cargo *cargo);
+long cargo_amount(const struct cargo *cargo);
+void cargo_set_amount(struct cargo *cargo, const long amount);
+void cargo_settle(struct cargo *cargo);
+long cargo_settled_amount(const struct cargo *cargo);
+void cargo_set_settled(struct cargo *cargo, const long amount);
 
 #endif
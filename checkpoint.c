@@ -0,0 +1,237 @@
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "checkpoint.h"
+#include "log.h"
+#include "snapshot.h"
+#include "universe.h"
+#include "wal.h"
+
+static pthread_t thread;
+static int terminate;
+static char *checkpoint_file;
+static unsigned long checkpoint_interval;
+
+static pthread_condattr_t termination_attr;
+static pthread_cond_t termination_cond;
+static pthread_mutex_t termination_lock;
+
+/* Only one child at a time, whether from the timer or the console */
+static pthread_mutex_t checkpoint_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Port updates and trades hold ports_lock for reading while they change a
+ * port or a ship, so holding it for writing over the fork means the child
+ * never sees one halfway through. Taking the lock of every port instead
+ * would work too, but unlocking them after the fork writes to every page
+ * with a port on it, and the kernel copies all of them.
+ */
+static void lock_universe(struct universe *u)
+{
+	pthread_rwlock_wrlock(&u->ports_lock);
+	pthread_rwlock_rdlock(&u->players_lock);
+}
+
+static void unlock_universe(struct universe *u)
+{
+	pthread_rwlock_unlock(&u->players_lock);
+	pthread_rwlock_unlock(&u->ports_lock);
+}
+
+static double seconds_since(const struct timespec * const start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static long minor_faults()
+{
+	struct rusage usage;
+
+	if (getrusage(RUSAGE_SELF, &usage))
+		return 0;
+
+	return usage.ru_minflt;
+}
+
+/*
+ * Writes a snapshot of u to file from a forked child and waits for it. The
+ * snapshot is written to a temporary file and renamed, so file is always
+ * either the old checkpoint or the new one. The WAL is then cut at the LSN
+ * read before the fork, which the child's snapshot reflects at least.
+ *
+ * Page faults in the parent while the child runs are mostly copies of pages
+ * the server wrote to, which is the price of not stopping it.
+ */
+int checkpoint(struct universe *u, const char * const file, struct checkpoint_stats *stats)
+{
+	struct timespec start;
+	struct rusage child;
+	uint64_t lsn;
+	long faults;
+	pid_t pid;
+	int status, r;
+
+	memset(stats, 0, sizeof(*stats));
+
+	pthread_mutex_lock(&checkpoint_lock);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	lock_universe(u);
+	lsn = wal_last_lsn(&wal);
+
+	pid = fork();
+	if (pid == 0) {
+		unlock_universe(u);
+		_exit(snapshot_save(u, file) ? EXIT_FAILURE : EXIT_SUCCESS);
+	}
+
+	faults = minor_faults();
+	unlock_universe(u);
+	stats->pause = seconds_since(&start);
+
+	if (pid < 0) {
+		log_printfn(LOG_MAIN, "could not fork checkpoint: %s", strerror(errno));
+		pthread_mutex_unlock(&checkpoint_lock);
+		return -1;
+	}
+
+	while ((r = wait4(pid, &status, 0, &child)) < 0 && errno == EINTR);
+
+	stats->duration = seconds_since(&start);
+	stats->parent_faults = minor_faults() - faults;
+
+	pthread_mutex_unlock(&checkpoint_lock);
+
+	if (r < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+		log_printfn(LOG_MAIN, "checkpoint to %s failed", file);
+		return -1;
+	}
+
+	stats->child_faults = child.ru_minflt;
+	stats->child_rss_kb = child.ru_maxrss;
+
+	log_printfn(LOG_MAIN, "checkpoint to %s: paused %.3f ms, done in %.3f s, "
+			"%ld page faults in the server, %ld in the child using %ld KiB RSS",
+			file, stats->pause * 1000, stats->duration, stats->parent_faults,
+			stats->child_faults, stats->child_rss_kb);
+
+	wal_saved(&wal, file, lsn);
+
+	return 0;
+}
+
+static void* checkpoint_worker(void *ptr)
+{
+	struct checkpoint_stats stats;
+	struct timespec next, now;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &next))
+		goto clock_err;
+
+	pthread_mutex_lock(&termination_lock);
+	while (!terminate) {
+		next.tv_sec += checkpoint_interval;
+
+		do {
+			pthread_cond_timedwait(&termination_cond, &termination_lock, &next);
+			if (clock_gettime(CLOCK_MONOTONIC, &now))
+				goto clock_err_unlock;
+		} while (!terminate && now.tv_sec < next.tv_sec);
+
+		if (terminate)
+			break;
+
+		pthread_mutex_unlock(&termination_lock);
+		checkpoint(&univ, checkpoint_file, &stats);
+		pthread_mutex_lock(&termination_lock);
+	}
+	pthread_mutex_unlock(&termination_lock);
+
+	return NULL;
+
+clock_err_unlock:
+	pthread_mutex_unlock(&termination_lock);
+clock_err:
+	log_printfn(LOG_MAIN, "clock_gettime() failed, no more checkpoints");
+	return NULL;
+}
+
+int start_checkpoints(const char * const file, const unsigned long interval)
+{
+	sigset_t old, new;
+
+	checkpoint_file = strdup(file);
+	if (!checkpoint_file)
+		goto err;
+	checkpoint_interval = interval;
+	terminate = 0;
+
+	sigfillset(&new);
+
+	if (pthread_condattr_init(&termination_attr))
+		goto err_free_file;
+
+	if (pthread_condattr_setclock(&termination_attr, CLOCK_MONOTONIC))
+		goto err_free_attr;
+
+	if (pthread_mutex_init(&termination_lock, NULL))
+		goto err_free_attr;
+
+	if (pthread_cond_init(&termination_cond, &termination_attr))
+		goto err_free_mutex;
+
+	if (pthread_sigmask(SIG_SETMASK, &new, &old))
+		goto err_free_cond;
+
+	if (pthread_create(&thread, NULL, checkpoint_worker, NULL))
+		goto err_free_cond;
+
+	if (pthread_sigmask(SIG_SETMASK, &old, NULL))
+		goto err_cancel_thread;
+
+	log_printfn(LOG_MAIN, "writing a checkpoint to %s every %lu s", file, interval);
+
+	return 0;
+
+err_cancel_thread:
+	pthread_cancel(thread);
+err_free_cond:
+	pthread_cond_destroy(&termination_cond);
+err_free_mutex:
+	pthread_mutex_destroy(&termination_lock);
+err_free_attr:
+	pthread_condattr_destroy(&termination_attr);
+err_free_file:
+	free(checkpoint_file);
+err:
+	return -1;
+}
+
+/*
+ * Waits for a checkpoint that is being written to finish.
+ */
+void stop_checkpoints(void)
+{
+	pthread_mutex_lock(&termination_lock);
+	terminate = 1;
+	pthread_cond_signal(&termination_cond);
+	pthread_mutex_unlock(&termination_lock);
+
+	pthread_join(thread, NULL);
+
+	pthread_cond_destroy(&termination_cond);
+	pthread_condattr_destroy(&termination_attr);
+	pthread_mutex_destroy(&termination_lock);
+	free(checkpoint_file);
+}
@@ -0,0 +1,28 @@
+#ifndef _HAS_CHECKPOINT_H
+#define _HAS_CHECKPOINT_H
+
+#include "universe.h"
+
+/*
+ * A checkpoint is a snapshot of the running universe. Instead of locking the
+ * economy while the whole universe is written, the server stops just long
+ * enough to fork(). The child writes the snapshot from its copy-on-write view
+ * of memory, which can't change under it, while the parent keeps serving.
+ *
+ * The cost moves from the pause to the pages the parent writes to while the
+ * child runs, as the kernel copies each one of them the first time.
+ */
+struct checkpoint_stats {
+	double pause;			/* Seconds the server was stopped to fork */
+	double duration;		/* Seconds until the child was done */
+	long parent_faults;		/* Page faults in the server while the child ran */
+	long child_faults;		/* Page faults in the child */
+	long child_rss_kb;
+};
+
+int checkpoint(struct universe *u, const char * const file, struct checkpoint_stats *stats);
+
+int start_checkpoints(const char * const file, const unsigned long interval);
+void stop_checkpoints(void);
+
+#endif
@@ -3,6 +3,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <dirent.h>
+#include <time.h>
 #include "common.h"
 #include "log.h"
 #include "mtrandom.h"
@@ -10,74 +11,150 @@
 #include "ptrlist.h"
 #include "system.h"
 #include "parseconfig.h"
+#include "progress.h"
 #include "universe.h"
 #include "list.h"
 
+/*
+ * A system owned by a civ is a border system if there are unowned systems
+ * but no systems belonging to other civs within CIV_MIN_BORDER_WIDTH of it.
+ * Civs only grow from border systems, which leaves some room between them.
+ *
+ * Rather than looking at the neighbourhood of a system every time we need to
+ * know if it is a border system, every owned system keeps count of its
+ * unowned and foreign neighbours. The counts are updated as systems are
+ * claimed, which only requires looking at the neighbourhood of the newly
+ * claimed system. As systems never lose their owner, a system that is no
+ * longer a border system never becomes one again.
+ */
 #define CIV_MIN_BORDER_WIDTH (200 * TICK_PER_LY)
-static int is_border_system(struct system *system, struct civ *c)
+static int is_border_system(const struct system * const system)
+{
+	return system->border_unowned > 0 && system->border_foreign == 0;
+}
+
+static void frontier_swap(struct civ *c, const size_t i, const size_t j)
+{
+	struct civ_frontier_entry tmp = c->frontier[i];
+	c->frontier[i] = c->frontier[j];
+	c->frontier[j] = tmp;
+}
+
+#define CIV_FRONTIER_MIN_ALLOC 64
+static int frontier_push(struct civ *c, const unsigned long distance,
+		struct system *system, struct system *from)
+{
+	struct civ_frontier_entry *frontier;
+	size_t alloc, i;
+
+	if (c->frontier_len == c->frontier_alloc) {
+		alloc = MAX(c->frontier_alloc * 2, CIV_FRONTIER_MIN_ALLOC);
+		frontier = realloc(c->frontier, alloc * sizeof(*frontier));
+		if (!frontier)
+			return -1;
+		c->frontier = frontier;
+		c->frontier_alloc = alloc;
+	}
+
+	i = c->frontier_len++;
+	c->frontier[i].distance = distance;
+	c->frontier[i].system = system;
+	c->frontier[i].from = from;
+
+	while (i > 0 && c->frontier[(i - 1) / 2].distance > c->frontier[i].distance) {
+		frontier_swap(c, i, (i - 1) / 2);
+		i = (i - 1) / 2;
+	}
+
+	return 0;
+}
+
+static struct civ_frontier_entry frontier_pop(struct civ *c)
+{
+	struct civ_frontier_entry top = c->frontier[0];
+	size_t i, min, child;
+
+	c->frontier[0] = c->frontier[--c->frontier_len];
+
+	i = 0;
+	while (1) {
+		min = i;
+		for (child = 2 * i + 1; child <= 2 * i + 2 && child < c->frontier_len; child++) {
+			if (c->frontier[child].distance < c->frontier[min].distance)
+				min = child;
+		}
+		if (min == i)
+			break;
+		frontier_swap(c, i, min);
+		i = min;
+	}
+
+	return top;
+}
+
+/*
+ * Gives system to c and updates the border bookkeeping of it and all its
+ * neighbours. All unowned neighbours become candidates for further growth.
+ */
+static int claim_system(struct civ *c, struct system *system, struct system *from)
 {
 	struct ptrlist neigh;
 	struct list_head *lh;
 	struct system *s;
-	int is_border = 0;
+	int r = 0;
 
-	ptrlist_init(&neigh);
+	system->owner = c;
+	if (from)
+		linksystems(system, from);
+	ptrlist_push(&c->systems, system);
 
+	system->border_unowned = 0;
+	system->border_foreign = 0;
+
+	ptrlist_init(&neigh);
 	get_neighbouring_systems(&neigh, system, CIV_MIN_BORDER_WIDTH);
+
 	ptrlist_for_each_entry(s, &neigh, lh) {
+		if (s == system)
+			continue;
+
 		if (!s->owner) {
-			is_border = 1;
-		} else if (s->owner && s->owner != c) {
-			is_border = 0;
-			break;
+			system->border_unowned++;
+			if (frontier_push(c, system_distance(system, s), s, system))
+				r = -1;
+			continue;
+		}
+
+		/* system was counted as unowned when s was claimed */
+		s->border_unowned--;
+		if (s->owner != c) {
+			s->border_foreign++;
+			system->border_foreign++;
 		}
 	}
 
 	ptrlist_free(&neigh);
 
-	return is_border;
+	return r;
 }
 
-#define CIV_GROW_MIN_LY (10 * TICK_PER_LY)
-#define CIV_GROW_STEP_LY (10 * TICK_PER_LY)
 static int grow_civ(struct universe *u, struct civ *c)
 {
-	struct system *s, *t;
-	struct ptrlist neigh;
-	struct list_head *lh;
-	unsigned long radius;
-
-	if (ptrlist_len(&c->border_systems) == 0)
-		return 1;
-
-	t = ptrlist_entry(&c->border_systems, 0);
-	radius = CIV_GROW_MIN_LY;
+	struct civ_frontier_entry e;
 
+	/*
+	 * Entries are never removed from the frontier when their system is
+	 * claimed or the system they grow from stops being a border system,
+	 * they are simply skipped here.
+	 */
 	do {
-		ptrlist_init(&neigh);
-		s = NULL;
+		if (c->frontier_len == 0)
+			return 1;
+		e = frontier_pop(c);
+	} while (e.system->owner || !is_border_system(e.from));
 
-		get_neighbouring_systems(&neigh, t, radius);
-		ptrlist_for_each_entry(s, &neigh, lh) {
-			if (!s->owner)
-				break;
-		}
-		if ((s == NULL) || (s->owner))
-			radius += CIV_GROW_STEP_LY;
-
-		ptrlist_free(&neigh);
-	} while ((s == NULL) || (s->owner));
-
-	s->owner = c;
-	linksystems(s, t);
-	ptrlist_push(&c->systems, s);
-
-	if (is_border_system(s, c))
-		ptrlist_push(&c->border_systems, s);
-	if (!is_border_system(t, c))
-		ptrlist_rm(&c->border_systems, 0);
-
-	printf("Growing civ %s into %s at %ldx%ld\n", c->name, s->name, s->x, s->y);
+	if (claim_system(c, e.system, e.from))
+		log_printfn(LOG_MAIN, "civ %s lost growth candidates due to lack of memory", c->name);
 
 	return 0;
 }
@@ -119,15 +196,14 @@ static void spawn_civilizations(struct universe *u)
 			break;
 
 		printf("Chose %s as home system for %s\n", s->name, c->name);
-		s->owner = c;
 		c->home = s;
-		ptrlist_push(&c->systems, s);
-		ptrlist_push(&c->border_systems, s);
+		if (claim_system(c, s, NULL))
+			log_printfn(LOG_MAIN, "civ %s lost growth candidates due to lack of memory", c->name);
 		u->inhabited_systems++;
 	}
 }
 
-static void remove_civs_without_homes(struct list_head *civs)
+void civ_remove_homeless(struct list_head *civs)
 {
 	struct civ *c, *_c;
 
@@ -146,10 +222,15 @@ static void grow_all_civs(struct universe *u)
 {
 	unsigned long goal_hab, total_power;
 	struct civ *c, *_c;
+	struct progress progress;
+
+	struct timespec start, end;
 
 	printf("Growing civilizations ...\n");
+	clock_gettime(CLOCK_MONOTONIC, &start);
 
 	goal_hab = ptrlist_len(&u->systems) * UNIVERSE_CIV_FRAC;
+	progress_init(&progress, "systems inhabited", goal_hab);
 
 	total_power = 0;
 	list_for_each_entry(c, &u->civs, list) {
@@ -166,13 +247,16 @@ static void grow_all_civs(struct universe *u)
 				continue;
 
 			if (!grow_civ(u, c))
-				u->inhabited_systems++;
+				progress_update(&progress, ++u->inhabited_systems);
 			else
 				list_del(&c->growing);
 		}
 	}
 
+	clock_gettime(CLOCK_MONOTONIC, &end);
 	printf("done.\n");
+	log_printfn(LOG_MAIN, "grew civilizations to %lu systems in %.3f s", u->inhabited_systems,
+			(end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
 }
 
 void civ_spawncivs(struct universe *u)
@@ -181,7 +265,7 @@ void civ_spawncivs(struct universe *u)
 
 	spawn_civilizations(u);
 
-	remove_civs_without_homes(&u->civs);
+	civ_remove_homeless(&u->civs);
 
 	grow_all_civs(u);
 
@@ -197,7 +281,6 @@ void civ_init(struct civ *c)
 	ptrlist_init(&c->presystems);
 	ptrlist_init(&c->availnames);
 	ptrlist_init(&c->systems);
-	ptrlist_init(&c->border_systems);
 	INIT_LIST_HEAD(&c->list);
 	INIT_LIST_HEAD(&c->growing);
 }
@@ -254,7 +337,7 @@ void civ_free(struct civ *civ)
 	char *c;
 	struct list_head *lh;
 	ptrlist_free(&civ->systems);
-	ptrlist_free(&civ->border_systems);
+	free(civ->frontier);
 	ptrlist_free(&civ->presystems);
 	ptrlist_for_each_entry(c, &civ->availnames, lh)
 		free(c);
@@ -7,6 +7,16 @@
 
 struct universe;
 
+/*
+ * A candidate for growth: an unowned system and the border system of the
+ * civ that would grow into it.
+ */
+struct civ_frontier_entry {
+	unsigned long distance;
+	struct system *system;
+	struct system *from;
+};
+
 struct civ {
 	char* name;
 	struct system* home;
@@ -14,7 +24,9 @@ struct civ {
 	struct ptrlist presystems;
 	struct ptrlist availnames;
 	struct ptrlist systems;
-	struct ptrlist border_systems;
+	struct civ_frontier_entry *frontier;	/* Binary min-heap on distance */
+	size_t frontier_len;
+	size_t frontier_alloc;
 	struct list_head list;
 	struct list_head growing;
 };
@@ -24,6 +36,7 @@ void civ_init(struct civ *c);
 int load_civs_from_file(const char * const file, struct universe * const universe);
 
 void civ_spawncivs(struct universe *u);
+void civ_remove_homeless(struct list_head *civs);
 void civ_free(struct civ *civ);
 
 #endif
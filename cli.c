@@ -3,6 +3,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include "cli.h"
+#include "cli_stats.h"
 #include "common.h"
 #include "stringtrie.h"
 
@@ -10,6 +11,7 @@ struct cli_data {
 	int (*func)(void*, char*);
 	char *help;
 	void *data;
+	unsigned int stat;		/* ID in cli_stats */
 };
 
 void cli_tree_destroy(struct st_root *root)
@@ -62,6 +64,7 @@ int cli_add_cmd(struct st_root *root, char *cmd,
 	node->data = ptr;
 	node->help = help;
 	node->func = func;
+	node->stat = cli_stats_id(cmd);
 
 	if (st_add_string(root, cmd, node)) {
 		free(node);
@@ -86,14 +89,17 @@ int cli_rm_cmd(struct st_root *root, char *cmd)
 int cli_run_cmd(struct st_root * const root, const char * const string)
 {
 	int r;
-	unsigned int i, len;
+	unsigned int i, len, stat;
 	char *cmd, *param;
 	char *line = NULL;
 	struct cli_data *node;
+	uint64_t start;
 
 	if (!string)
 		return -1;
 
+	start = cli_stats_now();
+
 	line = strdup(string);
 	if (!line)
 		return -1;
@@ -115,12 +121,17 @@ int cli_run_cmd(struct st_root * const root, const char * const string)
 		param = NULL;
 
 	node = st_lookup_string(root, cmd);
-	if (node && node->func)
+	if (node && node->func) {
+		/* Commands may remove themselves, as going somewhere does */
+		stat = node->stat;
 		r = node->func(node->data, param);
-	else
+	} else {
 		r = -1;
+		stat = CLI_STATS_UNKNOWN;
+	}
 
 	free(line);
+	cli_stats_record(stat, r, start);
 	return r;
 }
 
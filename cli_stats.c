@@ -0,0 +1,214 @@
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cli_stats.h"
+#include "histogram.h"
+#include "list.h"
+#include "stringtrie.h"
+
+/*
+ * The names are only added to, so an ID stays the name's once given
+ */
+static struct st_root names;
+static char *id_names[CLI_STATS_MAX_CMDS];
+static unsigned int num_ids;
+static pthread_rwlock_t names_lock = PTHREAD_RWLOCK_INITIALIZER;
+static pthread_once_t names_once = PTHREAD_ONCE_INIT;
+
+/*
+ * The counters of one thread, with those of a command allocated by the
+ * thread when it first runs it
+ */
+struct thread_stats {
+	struct cli_cmd_stats *cmds[CLI_STATS_MAX_CMDS];
+	struct list_head list;
+};
+
+static LIST_HEAD(threads);
+static pthread_mutex_t threads_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread struct thread_stats *mine;
+
+static void init_names(void)
+{
+	st_init(&names);
+	id_names[CLI_STATS_UNKNOWN] = "(unknown)";
+	num_ids = CLI_STATS_UNKNOWN + 1;
+}
+
+/*
+ * Returns the ID of cmd, giving it one if it has none, or CLI_STATS_NONE if
+ * all are taken
+ */
+unsigned int cli_stats_id(const char * const cmd)
+{
+	void *id;
+	char *name;
+
+	pthread_once(&names_once, init_names);
+
+	pthread_rwlock_rdlock(&names_lock);
+	id = st_lookup_exact(&names, cmd);
+	pthread_rwlock_unlock(&names_lock);
+	if (id)
+		return (uintptr_t)id;
+
+	pthread_rwlock_wrlock(&names_lock);
+
+	id = st_lookup_exact(&names, cmd);
+	if (id)
+		goto unlock;
+
+	id = (void*)(uintptr_t)CLI_STATS_NONE;
+	if (num_ids == CLI_STATS_MAX_CMDS)
+		goto unlock;
+
+	name = strdup(cmd);
+	if (!name)
+		goto unlock;
+	if (st_add_string(&names, name, (void*)(uintptr_t)num_ids)) {
+		free(name);
+		goto unlock;
+	}
+
+	id = (void*)(uintptr_t)num_ids;
+	/* Read without the lock once num_ids says it is there */
+	__atomic_store_n(&id_names[num_ids], name, __ATOMIC_RELAXED);
+	__atomic_store_n(&num_ids, num_ids + 1, __ATOMIC_RELEASE);
+
+unlock:
+	pthread_rwlock_unlock(&names_lock);
+	return (uintptr_t)id;
+}
+
+static struct cli_cmd_stats* my_stats(const unsigned int id)
+{
+	struct cli_cmd_stats *stats;
+
+	if (!mine) {
+		mine = calloc(1, sizeof(*mine));
+		if (!mine)
+			return NULL;
+
+		pthread_mutex_lock(&threads_lock);
+		list_add_tail(&mine->list, &threads);
+		pthread_mutex_unlock(&threads_lock);
+	}
+
+	stats = mine->cmds[id];
+	if (!stats) {
+		stats = calloc(1, sizeof(*stats));
+		if (!stats)
+			return NULL;
+		__atomic_store_n(&mine->cmds[id], stats, __ATOMIC_RELEASE);
+	}
+
+	return stats;
+}
+
+/*
+ * Records a call of command id that returned ret, which started at start as
+ * given by cli_stats_now()
+ */
+void cli_stats_record(const unsigned int id, const int ret, const uint64_t start)
+{
+	uint64_t now = cli_stats_now();
+	struct cli_cmd_stats *stats;
+
+	if (id >= CLI_STATS_MAX_CMDS)
+		return;
+
+	stats = my_stats(id);
+	if (!stats)
+		return;
+
+	histogram_bump(stats->calls, 1);
+	if (ret)
+		histogram_bump(stats->errors, 1);
+	histogram_add(&stats->latency, now - start);
+}
+
+/*
+ * The number of IDs given so far, all of which are below it
+ */
+unsigned int cli_stats_num(void)
+{
+	pthread_once(&names_once, init_names);
+
+	return __atomic_load_n(&num_ids, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Sums up the counters of command id of all threads into stats. Returns its
+ * name, or NULL if id hasn't been given.
+ */
+const char* cli_stats_get(const unsigned int id, struct cli_cmd_stats *stats)
+{
+	struct thread_stats *t;
+	struct cli_cmd_stats *s;
+
+	memset(stats, 0, sizeof(*stats));
+	if (id >= cli_stats_num())
+		return NULL;
+
+	pthread_mutex_lock(&threads_lock);
+	list_for_each_entry(t, &threads, list) {
+		s = __atomic_load_n(&t->cmds[id], __ATOMIC_ACQUIRE);
+		if (!s)
+			continue;
+
+		stats->calls += __atomic_load_n(&s->calls, __ATOMIC_RELAXED);
+		stats->errors += __atomic_load_n(&s->errors, __ATOMIC_RELAXED);
+		histogram_merge(&stats->latency, &s->latency);
+	}
+	pthread_mutex_unlock(&threads_lock);
+
+	return __atomic_load_n(&id_names[id], __ATOMIC_RELAXED);
+}
+
+/*
+ * Writes the stats of every command that has been run to file as CSV, with
+ * the latencies in microseconds
+ */
+int cli_stats_export(const char * const file)
+{
+	struct cli_cmd_stats *stats;
+	const char *name;
+	FILE *f;
+	int r = 0;
+
+	stats = malloc(sizeof(*stats));
+	if (!stats)
+		return -1;
+
+	f = fopen(file, "w");
+	if (!f) {
+		free(stats);
+		return -1;
+	}
+
+	fprintf(f, "command,calls,errors,mean_us,p50_us,p99_us,p999_us,max_us\n");
+	for (unsigned int i = 0; i < cli_stats_num(); i++) {
+		name = cli_stats_get(i, stats);
+		if (!stats->calls)
+			continue;
+
+		fprintf(f, "%s,%"PRIu64",%"PRIu64",%.1f,%.1f,%.1f,%.1f,%.1f\n",
+				name, stats->calls, stats->errors,
+				histogram_mean(&stats->latency) / 1000,
+				histogram_percentile(&stats->latency, 50) / 1000.0,
+				histogram_percentile(&stats->latency, 99) / 1000.0,
+				histogram_percentile(&stats->latency, 99.9) / 1000.0,
+				stats->latency.max / 1000.0);
+	}
+
+	if (ferror(f))
+		r = -1;
+	if (fclose(f))
+		r = -1;
+	free(stats);
+
+	return r;
+}
@@ -0,0 +1,45 @@
+#ifndef _HAS_CLI_STATS_H
+#define _HAS_CLI_STATS_H
+
+#include <stdint.h>
+#include <time.h>
+#include "histogram.h"
+
+/*
+ * Calls, errors and latencies of the commands run by cli_run_cmd(), kept by
+ * command name whatever tree the command is in. Every name is given an ID
+ * when a command is added, and cli_run_cmd() records under the ID of the
+ * command it runs, or under CLI_STATS_UNKNOWN for commands that don't exist.
+ *
+ * Every thread records into counters of its own, which only it writes, so
+ * recording takes no locks and shares no cache lines. Reading them sums up
+ * the counters of all threads, including those of threads that have exited,
+ * which are kept. A command is an error when it returns anything but 0.
+ */
+#define CLI_STATS_MAX_CMDS 256
+#define CLI_STATS_UNKNOWN 0
+#define CLI_STATS_NONE CLI_STATS_MAX_CMDS	/* Past the last ID, not recorded */
+
+struct cli_cmd_stats {
+	uint64_t calls;
+	uint64_t errors;
+	struct histogram latency;	/* in ns */
+};
+
+static inline uint64_t cli_stats_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+unsigned int cli_stats_id(const char * const cmd);
+void cli_stats_record(const unsigned int id, const int ret, const uint64_t start);
+
+unsigned int cli_stats_num(void);
+const char* cli_stats_get(const unsigned int id, struct cli_cmd_stats *stats);
+int cli_stats_export(const char * const file);
+
+#endif
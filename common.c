@@ -46,6 +46,29 @@ unsigned int limit_long_to_uint(const long l)
 		return l;
 }
 
+/*
+ * a + b and a - b, limited to what fits in a long instead of overflowing
+ */
+long limit_add_long(const long a, const long b)
+{
+	long r;
+
+	if (__builtin_add_overflow(a, b, &r))
+		return (b > 0 ? LONG_MAX : LONG_MIN);
+
+	return r;
+}
+
+long limit_sub_long(const long a, const long b)
+{
+	long r;
+
+	if (__builtin_sub_overflow(a, b, &r))
+		return (b < 0 ? LONG_MAX : LONG_MIN);
+
+	return r;
+}
+
 int str_to_long(const char * const str, long *out)
 {
 	long l;
@@ -63,6 +63,8 @@ enum msg {
 void chomp(char *s);
 int limit_long_to_int(const long l);
 unsigned int limit_long_to_uint(const long l);
+long limit_add_long(const long a, const long b);
+long limit_sub_long(const long a, const long b);
 int str_to_long(const char * const str, long *out);
 
 /* Greek alphabet */
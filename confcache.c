@@ -0,0 +1,1073 @@
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "cargo.h"
+#include "civ.h"
+#include "common.h"
+#include "confcache.h"
+#include "item.h"
+#include "log.h"
+#include "names.h"
+#include "planet_type.h"
+#include "port_type.h"
+#include "ptrarray.h"
+#include "ptrlist.h"
+#include "ship_type.h"
+#include "stringtrie.h"
+#include "universe.h"
+
+static const size_t record_size[CONFCACHE_SECTION_NUM] = {
+	[CONFCACHE_STRINGS]      = sizeof(char),
+	[CONFCACHE_SOURCES]      = sizeof(struct confcache_source_file),
+	[CONFCACHE_ITEMS]        = sizeof(struct confcache_item),
+	[CONFCACHE_SHIP_TYPES]   = sizeof(struct confcache_ship_type),
+	[CONFCACHE_PORT_TYPES]   = sizeof(struct confcache_port_type),
+	[CONFCACHE_CARGO]        = sizeof(struct confcache_cargo),
+	[CONFCACHE_PLANET_TYPES] = sizeof(struct confcache_planet_type),
+	[CONFCACHE_CIVS]         = sizeof(struct confcache_civ),
+	[CONFCACHE_INDICES]      = sizeof(uint32_t),
+	[CONFCACHE_NAMES]        = sizeof(uint32_t),
+};
+
+#define CONFCACHE_ALIGN(x) (((x) + 7) & ~(uint64_t)7)
+
+/* The cache that names are borrowed from, see confcache_release() */
+static void *cache_map;
+static size_t cache_size;
+
+static struct name_list* name_list(struct universe *u, const enum confcache_name_lists list)
+{
+	switch (list) {
+	case CONFCACHE_CONSTELLATION_NAMES:
+		return &u->avail_constellations;
+	case CONFCACHE_PORT_NAMES:
+		return &u->avail_port_names;
+	case CONFCACHE_PLAYER_NAMES:
+		return &u->avail_player_names;
+	default:
+		bug("%s", "illegal execution point");
+	}
+}
+
+static struct ptrarray** name_part(struct name_list *l, const enum confcache_name_parts part)
+{
+	switch (part) {
+	case CONFCACHE_PREFIX:
+		return &l->prefix;
+	case CONFCACHE_FIRST:
+		return &l->first;
+	case CONFCACHE_SECOND:
+		return &l->second;
+	case CONFCACHE_SUFFIX:
+		return &l->suffix;
+	default:
+		bug("%s", "illegal execution point");
+	}
+}
+
+/*
+ * FNV-1a, to tell whether a file that has been touched has really changed
+ * and whether the cache itself is intact.
+ */
+#define CONFCACHE_HASH_BASIS 14695981039346656037ULL
+#define CONFCACHE_HASH_PRIME 1099511628211ULL
+static uint64_t hash(uint64_t h, const void *data, const size_t len)
+{
+	const unsigned char *p = data;
+
+	for (size_t i = 0; i < len; i++)
+		h = (h ^ p[i]) * CONFCACHE_HASH_PRIME;
+
+	return h;
+}
+
+static int hash_file(const char * const file, const size_t size, uint64_t *h)
+{
+	void *map;
+	int fd;
+
+	*h = CONFCACHE_HASH_BASIS;
+	if (!size)
+		return 0;
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return -1;
+
+	*h = hash(*h, map, size);
+	munmap(map, size);
+
+	return 0;
+}
+
+struct confcache_buf {
+	char *data;
+	size_t len;
+	size_t alloc;
+};
+
+struct confcache_writer {
+	struct confcache_buf sections[CONFCACHE_SECTION_NUM];
+	struct st_root items;		/* Item name to index + 1 */
+	int failed;
+};
+
+#define CONFCACHE_BUF_MIN_ALLOC 4096
+static void* push(struct confcache_writer *w, const enum confcache_sections section,
+		const size_t size)
+{
+	struct confcache_buf *b = &w->sections[section];
+	size_t alloc;
+	char *data;
+
+	if (b->len + size > b->alloc) {
+		alloc = MAX(b->alloc * 2, MAX(b->len + size, CONFCACHE_BUF_MIN_ALLOC));
+		data = realloc(b->data, alloc);
+		if (!data) {
+			w->failed = 1;
+			return NULL;
+		}
+		b->data = data;
+		b->alloc = alloc;
+	}
+
+	data = b->data + b->len;
+	b->len += size;
+	memset(data, 0, size);
+
+	return data;
+}
+
+static void* push_record(struct confcache_writer *w, const enum confcache_sections section)
+{
+	return push(w, section, record_size[section]);
+}
+
+static uint32_t num_records(const struct confcache_writer * const w,
+		const enum confcache_sections section)
+{
+	return w->sections[section].len / record_size[section];
+}
+
+static uint32_t add_string(struct confcache_writer *w, const char * const string)
+{
+	size_t offset = w->sections[CONFCACHE_STRINGS].len;
+	char *dst;
+
+	if (!string)
+		return CONFCACHE_NO_STRING;
+
+	dst = push(w, CONFCACHE_STRINGS, strlen(string) + 1);
+	if (!dst)
+		return CONFCACHE_NO_STRING;
+	strcpy(dst, string);
+
+	return offset;
+}
+
+static void add_index(struct confcache_writer *w, const enum confcache_sections section,
+		const uint32_t idx)
+{
+	uint32_t *rec = push_record(w, section);
+
+	if (rec)
+		*rec = idx;
+}
+
+static int save_sources(struct confcache_writer *w, const struct confcache_source * const sources,
+		const size_t num)
+{
+	struct confcache_source_file *rec;
+	struct stat st;
+	uint64_t h;
+
+	for (size_t i = 0; i < num; i++) {
+		if (stat(sources[i].file, &st) || hash_file(sources[i].file, st.st_size, &h)) {
+			log_printfn(LOG_CONFIG, "could not read %s for the config cache: %s",
+					sources[i].file, strerror(errno));
+			return -1;
+		}
+
+		rec = push_record(w, CONFCACHE_SOURCES);
+		if (!rec)
+			return -1;
+		rec->key = add_string(w, sources[i].key);
+		rec->file = add_string(w, sources[i].file);
+		rec->mtime_sec = st.st_mtim.tv_sec;
+		rec->mtime_nsec = st.st_mtim.tv_nsec;
+		rec->size = st.st_size;
+		rec->hash = h;
+	}
+
+	return 0;
+}
+
+static void save_items(struct confcache_writer *w, struct universe *u)
+{
+	struct confcache_item *rec;
+	struct item *item;
+
+	list_for_each_entry(item, &u->items, list) {
+		if (st_add_string(&w->items, item->name, (void*)(uintptr_t)(num_records(w, CONFCACHE_ITEMS) + 1)))
+			w->failed = 1;
+
+		rec = push_record(w, CONFCACHE_ITEMS);
+		if (!rec)
+			return;
+		rec->name = add_string(w, item->name);
+		rec->weight = item->weight;
+		rec->base_price = item->base_price;
+	}
+}
+
+static void save_ship_types(struct confcache_writer *w, struct universe *u)
+{
+	struct confcache_ship_type *rec;
+	struct ship_type *type;
+
+	list_for_each_entry(type, &u->ship_types, list) {
+		rec = push_record(w, CONFCACHE_SHIP_TYPES);
+		if (!rec)
+			return;
+		rec->name = add_string(w, type->name);
+		rec->desc = add_string(w, type->desc);
+		rec->carry_weight = type->carry_weight;
+		rec->speed = type->speed;
+	}
+}
+
+static uint32_t cargo_index(const struct list_head * const head, const struct cargo * const cargo)
+{
+	struct cargo *c;
+	uint32_t i = 0;
+
+	list_for_each_entry(c, head, list) {
+		if (c == cargo)
+			return i;
+		i++;
+	}
+
+	bug("%s", "required cargo is not in its port type");
+}
+
+static void save_cargo(struct confcache_writer *w, struct port_type *type)
+{
+	struct confcache_cargo *rec;
+	struct cargo *cargo, *req;
+	struct list_head *lh;
+	uintptr_t item;
+
+	list_for_each_entry(cargo, &type->items, list) {
+		item = (uintptr_t)st_lookup_exact(&w->items, cargo->item->name);
+		if (!item)
+			bug("item %s is not in the universe", cargo->item->name);
+
+		rec = push_record(w, CONFCACHE_CARGO);
+		if (!rec)
+			return;
+		rec->item = item - 1;
+		rec->min = cargo->min;
+		rec->max = cargo->max;
+		rec->amount = *cargo->amount;
+		rec->daily_change = cargo->daily_change;
+		rec->price = cargo->price;
+
+		rec->first_require = num_records(w, CONFCACHE_INDICES);
+		ptrlist_for_each_entry(req, &cargo->requires, lh) {
+			add_index(w, CONFCACHE_INDICES, cargo_index(&type->items, req));
+			rec = (struct confcache_cargo*)w->sections[CONFCACHE_CARGO].data +
+				num_records(w, CONFCACHE_CARGO) - 1;
+			rec->num_requires++;
+		}
+	}
+}
+
+static void save_port_types(struct confcache_writer *w, struct universe *u)
+{
+	struct confcache_port_type rec;
+	struct confcache_port_type *dst;
+	struct port_type *type;
+
+	list_for_each_entry(type, &u->port_types, list) {
+		memset(&rec, 0, sizeof(rec));
+		rec.name = add_string(w, type->name);
+		rec.desc = add_string(w, type->desc);
+		for (int i = 0; i < PORT_ZONE_NUM; i++) {
+			if (type->zones[i])
+				rec.zones |= 1 << i;
+		}
+
+		rec.first_cargo = num_records(w, CONFCACHE_CARGO);
+		save_cargo(w, type);
+		rec.num_cargo = num_records(w, CONFCACHE_CARGO) - rec.first_cargo;
+
+		dst = push_record(w, CONFCACHE_PORT_TYPES);
+		if (!dst)
+			return;
+		*dst = rec;
+	}
+}
+
+static uint32_t port_type_index(struct universe *u, const struct port_type * const type)
+{
+	struct port_type *t;
+	uint32_t i = 0;
+
+	list_for_each_entry(t, &u->port_types, list) {
+		if (t == type)
+			return i;
+		i++;
+	}
+
+	bug("port type %s is not in the universe", type->name);
+}
+
+static void save_planet_types(struct confcache_writer *w, struct universe *u)
+{
+	struct confcache_planet_type *rec;
+	struct planet_type *type;
+	struct port_type *port_type;
+	struct list_head *lh;
+	uint32_t first;
+
+	list_for_each_entry(type, &u->planet_types, list) {
+		first = num_records(w, CONFCACHE_INDICES);
+		ptrlist_for_each_entry(port_type, &type->port_types, lh)
+			add_index(w, CONFCACHE_INDICES, port_type_index(u, port_type));
+
+		rec = push_record(w, CONFCACHE_PLANET_TYPES);
+		if (!rec)
+			return;
+		rec->name = add_string(w, type->name);
+		rec->desc = add_string(w, type->desc);
+		rec->surface = add_string(w, type->surface);
+		rec->atmo = add_string(w, type->atmo);
+		rec->c = (unsigned char)type->c;
+		for (int i = 0; i < PLANET_ZONE_NUM; i++) {
+			if (type->zones[i])
+				rec->zones |= 1 << i;
+		}
+		rec->mindia = type->mindia;
+		rec->maxdia = type->maxdia;
+		rec->minlife = type->minlife;
+		rec->maxlife = type->maxlife;
+		rec->first_port_type = first;
+		rec->num_port_types = num_records(w, CONFCACHE_INDICES) - first;
+	}
+}
+
+static void save_civs(struct confcache_writer *w, struct universe *u)
+{
+	struct confcache_civ *rec;
+	struct list_head *lh;
+	struct civ *civ;
+	char *name;
+	uint32_t first;
+
+	list_for_each_entry(civ, &u->civs, list) {
+		first = num_records(w, CONFCACHE_NAMES);
+		ptrlist_for_each_entry(name, &civ->availnames, lh)
+			add_index(w, CONFCACHE_NAMES, add_string(w, name));
+
+		rec = push_record(w, CONFCACHE_CIVS);
+		if (!rec)
+			return;
+		rec->name = add_string(w, civ->name);
+		rec->power = civ->power;
+		rec->first_name = first;
+		rec->num_names = num_records(w, CONFCACHE_NAMES) - first;
+	}
+}
+
+static void save_names(struct confcache_writer *w, struct universe *u,
+		struct confcache_header *header)
+{
+	struct confcache_range *range;
+	struct ptrarray *a;
+
+	for (int i = 0; i < CONFCACHE_NAME_LIST_NUM; i++) {
+		for (int j = 0; j < CONFCACHE_NAME_PART_NUM; j++) {
+			a = *name_part(name_list(u, i), j);
+			range = &header->names[i][j];
+
+			range->first = num_records(w, CONFCACHE_NAMES);
+			for (size_t k = 0; k < a->used; k++)
+				add_index(w, CONFCACHE_NAMES, add_string(w, a->array[k]));
+			range->num = num_records(w, CONFCACHE_NAMES) - range->first;
+		}
+	}
+}
+
+static int write_all(const int fd, const void *data, size_t len)
+{
+	const char *p = data;
+	ssize_t r;
+
+	while (len) {
+		r = write(fd, p, len);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r < 0)
+			return -1;
+		p += r;
+		len -= r;
+	}
+
+	return 0;
+}
+
+/*
+ * Like a snapshot, the cache is written to a temporary file and renamed, so
+ * a server starting at the same time never sees half of it. Unlike a
+ * snapshot it is not synced, as it can always be built again.
+ */
+static int write_cache(struct confcache_writer *w, struct confcache_header *header,
+		const char * const file)
+{
+	static const char padding[8];
+	uint64_t offset, h;
+	char *tmp;
+	int fd;
+
+	h = CONFCACHE_HASH_BASIS;
+	offset = CONFCACHE_ALIGN(sizeof(*header));
+	for (int i = 0; i < CONFCACHE_SECTION_NUM; i++) {
+		header->sections[i].offset = offset;
+		header->sections[i].num = w->sections[i].len / record_size[i];
+		header->sections[i].size = record_size[i];
+		offset += CONFCACHE_ALIGN(w->sections[i].len);
+
+		h = hash(h, w->sections[i].data, w->sections[i].len);
+		h = hash(h, padding, CONFCACHE_ALIGN(w->sections[i].len) - w->sections[i].len);
+	}
+	header->hash = h;
+
+	tmp = malloc(strlen(file) + strlen(".tmp") + 1);
+	if (!tmp)
+		return -1;
+	sprintf(tmp, "%s.tmp", file);
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		goto err;
+
+	if (write_all(fd, header, sizeof(*header)))
+		goto err_close;
+	if (write_all(fd, padding, CONFCACHE_ALIGN(sizeof(*header)) - sizeof(*header)))
+		goto err_close;
+
+	for (int i = 0; i < CONFCACHE_SECTION_NUM; i++) {
+		if (write_all(fd, w->sections[i].data, w->sections[i].len))
+			goto err_close;
+		if (write_all(fd, padding, CONFCACHE_ALIGN(w->sections[i].len) - w->sections[i].len))
+			goto err_close;
+	}
+
+	if (close(fd))
+		goto err_unlink;
+	if (rename(tmp, file))
+		goto err_unlink;
+
+	free(tmp);
+	return 0;
+
+err_close:
+	close(fd);
+err_unlink:
+	unlink(tmp);
+err:
+	log_printfn(LOG_CONFIG, "could not write config cache %s: %s", tmp, strerror(errno));
+	free(tmp);
+	return -1;
+}
+
+/*
+ * Writes everything loaded from sources to the cache file. Must be called
+ * right after the config has been loaded, before genesis or a snapshot adds
+ * to it.
+ */
+int confcache_save(struct universe *u, const char * const cache,
+		const struct confcache_source * const sources, const size_t num)
+{
+	struct confcache_writer w;
+	struct confcache_header header;
+	int r = -1;
+
+	memset(&w, 0, sizeof(w));
+	memset(&header, 0, sizeof(header));
+	st_init(&w.items);
+
+	memcpy(header.magic, CONFCACHE_MAGIC, sizeof(header.magic));
+	header.version = CONFCACHE_VERSION;
+	header.byte_order = CONFCACHE_BYTE_ORDER;
+
+	if (save_sources(&w, sources, num))
+		goto out;
+
+	save_items(&w, u);
+	save_ship_types(&w, u);
+	save_port_types(&w, u);
+	save_planet_types(&w, u);
+	save_civs(&w, u);
+	save_names(&w, u, &header);
+
+	if (w.failed)
+		goto out;
+
+	r = write_cache(&w, &header, cache);
+
+out:
+	if (r)
+		log_printfn(LOG_CONFIG, "saving config cache %s failed", cache);
+	else
+		log_printfn(LOG_CONFIG, "saved config from %zu files to cache %s", num, cache);
+
+	for (int i = 0; i < CONFCACHE_SECTION_NUM; i++)
+		free(w.sections[i].data);
+	st_destroy(&w.items, ST_DONT_FREE_DATA);
+
+	return r;
+}
+
+/*
+ * The cache is checked completely before anything is built from it, so that
+ * a cache that can't be used leaves the universe as it was.
+ */
+struct confcache_reader {
+	const char *map;
+	size_t size;
+	const struct confcache_header *header;
+	const void *sections[CONFCACHE_SECTION_NUM];
+	uint64_t num[CONFCACHE_SECTION_NUM];
+	struct universe *u;
+	struct item **items;
+	struct port_type **port_types;
+};
+
+static int check_header(struct confcache_reader *r)
+{
+	const struct confcache_header *h = r->header;
+	const struct confcache_section *section;
+	const char *strings;
+	uint64_t sum;
+
+	if (r->size < sizeof(*h) || memcmp(h->magic, CONFCACHE_MAGIC, sizeof(h->magic)) ||
+			h->version != CONFCACHE_VERSION || h->byte_order != CONFCACHE_BYTE_ORDER)
+		return -1;
+
+	for (int i = 0; i < CONFCACHE_SECTION_NUM; i++) {
+		section = &h->sections[i];
+
+		if (section->size != record_size[i] || section->offset % 8 ||
+				section->num >= UINT32_MAX || section->offset > r->size ||
+				section->num * section->size > r->size - section->offset)
+			return -1;
+
+		r->sections[i] = r->map + section->offset;
+		r->num[i] = section->num;
+	}
+
+	if (r->size < CONFCACHE_ALIGN(sizeof(*h)))
+		return -1;
+	sum = hash(CONFCACHE_HASH_BASIS, r->map + CONFCACHE_ALIGN(sizeof(*h)),
+			r->size - CONFCACHE_ALIGN(sizeof(*h)));
+	if (sum != h->hash)
+		return -1;
+
+	strings = r->sections[CONFCACHE_STRINGS];
+	if (r->num[CONFCACHE_STRINGS] && strings[r->num[CONFCACHE_STRINGS] - 1] != '\0')
+		return -1;
+
+	return 0;
+}
+
+static const char* get_string(const struct confcache_reader * const r, const uint32_t offset)
+{
+	if (offset >= r->num[CONFCACHE_STRINGS])
+		return NULL;
+
+	return (const char*)r->sections[CONFCACHE_STRINGS] + offset;
+}
+
+static int is_string_valid(const struct confcache_reader * const r, const uint32_t offset)
+{
+	return offset == CONFCACHE_NO_STRING || offset < r->num[CONFCACHE_STRINGS];
+}
+
+static int is_range_valid(const struct confcache_reader * const r,
+		const enum confcache_sections section, const uint32_t first, const uint32_t num)
+{
+	return (uint64_t)first + num <= r->num[section];
+}
+
+static int are_indices_valid(const struct confcache_reader * const r, const uint32_t first,
+		const uint32_t num, const uint64_t max)
+{
+	const uint32_t *idx = r->sections[CONFCACHE_INDICES];
+
+	if (!is_range_valid(r, CONFCACHE_INDICES, first, num))
+		return 0;
+
+	for (uint32_t i = 0; i < num; i++) {
+		if (idx[first + i] >= max)
+			return 0;
+	}
+
+	return 1;
+}
+
+static int are_names_valid(const struct confcache_reader * const r, const uint32_t first,
+		const uint32_t num)
+{
+	const uint32_t *names = r->sections[CONFCACHE_NAMES];
+
+	if (!is_range_valid(r, CONFCACHE_NAMES, first, num))
+		return 0;
+
+	for (uint32_t i = 0; i < num; i++) {
+		if (names[first + i] >= r->num[CONFCACHE_STRINGS])
+			return 0;
+	}
+
+	return 1;
+}
+
+static int check_records(const struct confcache_reader * const r)
+{
+	const struct confcache_item *item = r->sections[CONFCACHE_ITEMS];
+	const struct confcache_ship_type *ship = r->sections[CONFCACHE_SHIP_TYPES];
+	const struct confcache_port_type *port = r->sections[CONFCACHE_PORT_TYPES];
+	const struct confcache_cargo *cargo;
+	const struct confcache_planet_type *planet = r->sections[CONFCACHE_PLANET_TYPES];
+	const struct confcache_civ *civ = r->sections[CONFCACHE_CIVS];
+	const struct confcache_range *range;
+
+	for (uint64_t i = 0; i < r->num[CONFCACHE_ITEMS]; i++) {
+		if (!get_string(r, item[i].name))
+			return -1;
+	}
+
+	for (uint64_t i = 0; i < r->num[CONFCACHE_SHIP_TYPES]; i++) {
+		if (!get_string(r, ship[i].name) || !is_string_valid(r, ship[i].desc))
+			return -1;
+	}
+
+	for (uint64_t i = 0; i < r->num[CONFCACHE_PORT_TYPES]; i++) {
+		if (!get_string(r, port[i].name) || !is_string_valid(r, port[i].desc) ||
+				!is_range_valid(r, CONFCACHE_CARGO, port[i].first_cargo, port[i].num_cargo))
+			return -1;
+
+		cargo = (const struct confcache_cargo*)r->sections[CONFCACHE_CARGO] + port[i].first_cargo;
+		for (uint32_t j = 0; j < port[i].num_cargo; j++) {
+			if (cargo[j].item >= r->num[CONFCACHE_ITEMS] ||
+					!are_indices_valid(r, cargo[j].first_require,
+						cargo[j].num_requires, port[i].num_cargo))
+				return -1;
+		}
+	}
+
+	for (uint64_t i = 0; i < r->num[CONFCACHE_PLANET_TYPES]; i++) {
+		if (!is_string_valid(r, planet[i].name) || !is_string_valid(r, planet[i].desc) ||
+				!is_string_valid(r, planet[i].surface) ||
+				!is_string_valid(r, planet[i].atmo) ||
+				planet[i].minlife >= PLANET_LIFE_NUM || planet[i].maxlife >= PLANET_LIFE_NUM ||
+				!are_indices_valid(r, planet[i].first_port_type, planet[i].num_port_types,
+					r->num[CONFCACHE_PORT_TYPES]))
+			return -1;
+	}
+
+	for (uint64_t i = 0; i < r->num[CONFCACHE_CIVS]; i++) {
+		if (!is_string_valid(r, civ[i].name) ||
+				!are_names_valid(r, civ[i].first_name, civ[i].num_names))
+			return -1;
+	}
+
+	for (int i = 0; i < CONFCACHE_NAME_LIST_NUM; i++) {
+		for (int j = 0; j < CONFCACHE_NAME_PART_NUM; j++) {
+			range = &r->header->names[i][j];
+			if (!are_names_valid(r, range->first, range->num))
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Is the cache made from exactly these files, as they are now?
+ */
+static int check_sources(const struct confcache_reader * const r,
+		const struct confcache_source * const sources, const size_t num)
+{
+	const struct confcache_source_file *rec = r->sections[CONFCACHE_SOURCES];
+	const char *key, *file;
+	struct stat st;
+	uint64_t h;
+
+	if (r->num[CONFCACHE_SOURCES] != num)
+		return -1;
+
+	for (size_t i = 0; i < num; i++) {
+		key = get_string(r, rec[i].key);
+		file = get_string(r, rec[i].file);
+		if (!key || !file || strcmp(key, sources[i].key) || strcmp(file, sources[i].file))
+			return -1;
+
+		if (stat(file, &st) || (uint64_t)st.st_size != rec[i].size)
+			return -1;
+
+		if (st.st_mtim.tv_sec == rec[i].mtime_sec && st.st_mtim.tv_nsec == rec[i].mtime_nsec)
+			continue;
+
+		if (hash_file(file, st.st_size, &h) || h != rec[i].hash)
+			return -1;
+	}
+
+	return 0;
+}
+
+static char* dup_string(const struct confcache_reader * const r, const uint32_t offset)
+{
+	if (offset == CONFCACHE_NO_STRING)
+		return NULL;
+
+	return strdup(get_string(r, offset));
+}
+
+static int load_items(struct confcache_reader *r)
+{
+	const struct confcache_item *rec = r->sections[CONFCACHE_ITEMS];
+	struct item *item;
+
+	for (uint64_t i = 0; i < r->num[CONFCACHE_ITEMS]; i++) {
+		item = malloc(sizeof(*item));
+		if (!item)
+			return -1;
+		item_init(item);
+
+		item->name = dup_string(r, rec[i].name);
+		item->weight = rec[i].weight;
+		item->base_price = rec[i].base_price;
+		if (!item->name || st_add_string(&r->u->item_names, item->name, item)) {
+			item_free(item);
+			free(item);
+			return -1;
+		}
+
+		item->id = r->u->num_items++;
+		list_add_tail(&item->list, &r->u->items);
+		r->items[i] = item;
+	}
+
+	return 0;
+}
+
+static int load_ship_types(struct confcache_reader *r)
+{
+	const struct confcache_ship_type *rec = r->sections[CONFCACHE_SHIP_TYPES];
+	struct ship_type *type;
+
+	for (uint64_t i = 0; i < r->num[CONFCACHE_SHIP_TYPES]; i++) {
+		type = malloc(sizeof(*type));
+		if (!type)
+			return -1;
+		memset(type, 0, sizeof(*type));
+
+		type->name = dup_string(r, rec[i].name);
+		type->desc = dup_string(r, rec[i].desc);
+		type->carry_weight = rec[i].carry_weight;
+		type->speed = rec[i].speed;
+		if (!type->name || st_add_string(&r->u->ship_type_names, type->name, type)) {
+			ship_type_free(type);
+			free(type);
+			return -1;
+		}
+
+		list_add_tail(&type->list, &r->u->ship_types);
+	}
+
+	return 0;
+}
+
+static int load_cargo(struct confcache_reader *r, const struct confcache_port_type * const rec,
+		struct port_type *type)
+{
+	const struct confcache_cargo *c;
+	const uint32_t *idx = r->sections[CONFCACHE_INDICES];
+	struct cargo **cargo;
+	int ret = -1;
+
+	cargo = calloc(MAX(rec->num_cargo, 1), sizeof(*cargo));
+	if (!cargo)
+		return -1;
+
+	c = (const struct confcache_cargo*)r->sections[CONFCACHE_CARGO] + rec->first_cargo;
+	for (uint32_t i = 0; i < rec->num_cargo; i++) {
+		cargo[i] = malloc(sizeof(*cargo[i]));
+		if (!cargo[i])
+			goto out;
+		cargo_init(cargo[i]);
+
+		cargo[i]->item = r->items[c[i].item];
+		cargo[i]->min = c[i].min;
+		cargo[i]->max = c[i].max;
+		*cargo[i]->amount = c[i].amount;
+		cargo[i]->daily_change = c[i].daily_change;
+		cargo[i]->price = c[i].price;
+		list_add_tail(&cargo[i]->list, &type->items);
+
+		if (st_add_string(&type->item_names, cargo[i]->item->name, cargo[i]))
+			goto out;
+	}
+
+	/* Requirements can be on cargo further down the list */
+	for (uint32_t i = 0; i < rec->num_cargo; i++) {
+		for (uint32_t j = 0; j < c[i].num_requires; j++)
+			ptrlist_push(&cargo[i]->requires, cargo[idx[c[i].first_require + j]]);
+	}
+
+	ret = 0;
+out:
+	free(cargo);
+	return ret;
+}
+
+static int load_port_types(struct confcache_reader *r)
+{
+	const struct confcache_port_type *rec = r->sections[CONFCACHE_PORT_TYPES];
+	struct port_type *type;
+
+	for (uint64_t i = 0; i < r->num[CONFCACHE_PORT_TYPES]; i++) {
+		type = malloc(sizeof(*type));
+		if (!type)
+			return -1;
+		memset(type, 0, sizeof(*type));
+		INIT_LIST_HEAD(&type->items);
+		st_init(&type->item_names);
+
+		type->name = dup_string(r, rec[i].name);
+		type->desc = dup_string(r, rec[i].desc);
+		for (int j = 0; j < PORT_ZONE_NUM; j++)
+			type->zones[j] = !!(rec[i].zones & (1 << j));
+
+		if (!type->name || load_cargo(r, &rec[i], type) ||
+				st_add_string(&r->u->port_type_names, type->name, type)) {
+			port_type_free(type);
+			free(type);
+			return -1;
+		}
+
+		list_add_tail(&type->list, &r->u->port_types);
+		r->port_types[i] = type;
+	}
+
+	return 0;
+}
+
+static int load_planet_types(struct confcache_reader *r)
+{
+	const struct confcache_planet_type *rec = r->sections[CONFCACHE_PLANET_TYPES];
+	const uint32_t *idx = r->sections[CONFCACHE_INDICES];
+	struct planet_type *type;
+
+	for (uint64_t i = 0; i < r->num[CONFCACHE_PLANET_TYPES]; i++) {
+		type = malloc(sizeof(*type));
+		if (!type)
+			return -1;
+		memset(type, 0, sizeof(*type));
+		ptrlist_init(&type->port_types);
+
+		type->c = rec[i].c;
+		type->name = dup_string(r, rec[i].name);
+		type->desc = dup_string(r, rec[i].desc);
+		type->surface = dup_string(r, rec[i].surface);
+		type->atmo = dup_string(r, rec[i].atmo);
+		for (int j = 0; j < PLANET_ZONE_NUM; j++)
+			type->zones[j] = !!(rec[i].zones & (1 << j));
+		type->mindia = rec[i].mindia;
+		type->maxdia = rec[i].maxdia;
+		type->minlife = rec[i].minlife;
+		type->maxlife = rec[i].maxlife;
+
+		for (uint32_t j = 0; j < rec[i].num_port_types; j++)
+			ptrlist_push(&type->port_types, r->port_types[idx[rec[i].first_port_type + j]]);
+
+		list_add_tail(&type->list, &r->u->planet_types);
+	}
+
+	return 0;
+}
+
+static int load_civs(struct confcache_reader *r)
+{
+	const struct confcache_civ *rec = r->sections[CONFCACHE_CIVS];
+	const uint32_t *names = r->sections[CONFCACHE_NAMES];
+	struct civ *civ;
+	char *name;
+
+	for (uint64_t i = 0; i < r->num[CONFCACHE_CIVS]; i++) {
+		civ = malloc(sizeof(*civ));
+		if (!civ)
+			return -1;
+		civ_init(civ);
+
+		civ->name = dup_string(r, rec[i].name);
+		civ->power = rec[i].power;
+		list_add_tail(&civ->list, &r->u->civs);
+
+		for (uint32_t j = 0; j < rec[i].num_names; j++) {
+			name = strdup(get_string(r, names[rec[i].first_name + j]));
+			if (!name)
+				return -1;
+			ptrlist_push(&civ->availnames, name);
+		}
+	}
+
+	return 0;
+}
+
+static int load_names(struct confcache_reader *r)
+{
+	const uint32_t *names = r->sections[CONFCACHE_NAMES];
+	const struct confcache_range *range;
+	struct ptrarray *parts[CONFCACHE_NAME_PART_NUM];
+
+	for (int i = 0; i < CONFCACHE_NAME_LIST_NUM; i++) {
+		for (int j = 0; j < CONFCACHE_NAME_PART_NUM; j++) {
+			range = &r->header->names[i][j];
+
+			parts[j] = ptrarray_create();
+			for (uint32_t k = 0; parts[j] && k < range->num; k++)
+				parts[j] = ptrarray_add(parts[j], (char*)get_string(r, names[range->first + k]));
+
+			if (!parts[j] || parts[j]->used != range->num) {
+				while (j >= 0)
+					free(parts[j--]);
+				return -1;
+			}
+		}
+
+		names_borrow(name_list(r->u, i), parts[CONFCACHE_PREFIX], parts[CONFCACHE_FIRST],
+				parts[CONFCACHE_SECOND], parts[CONFCACHE_SUFFIX]);
+	}
+
+	return 0;
+}
+
+static int load_config(struct confcache_reader *r)
+{
+	r->items = calloc(MAX(r->num[CONFCACHE_ITEMS], 1), sizeof(*r->items));
+	r->port_types = calloc(MAX(r->num[CONFCACHE_PORT_TYPES], 1), sizeof(*r->port_types));
+	if (!r->items || !r->port_types)
+		return -1;
+
+	if (load_items(r))
+		return -1;
+	if (load_ship_types(r))
+		return -1;
+	if (load_port_types(r))
+		return -1;
+	if (load_planet_types(r))
+		return -1;
+	if (load_civs(r))
+		return -1;
+
+	return load_names(r);
+}
+
+/*
+ * Loads the config from the cache file if it was built from sources as they
+ * are now. Returns 1, leaving the universe alone, if the cache is missing,
+ * stale or damaged, in which case the config must be parsed as usual.
+ *
+ * Returns -1 if building the config failed half way, which leaves the
+ * universe partly loaded.
+ */
+int confcache_load(struct universe *u, const char * const cache,
+		const struct confcache_source * const sources, const size_t num)
+{
+	struct confcache_reader r;
+	struct stat st;
+	void *map;
+	int fd;
+	int ret = 1;
+
+	assert(!cache_map);
+
+	memset(&r, 0, sizeof(r));
+	r.u = u;
+
+	fd = open(cache, O_RDONLY);
+	if (fd < 0)
+		return 1;
+
+	if (fstat(fd, &st) || st.st_size == 0) {
+		close(fd);
+		return 1;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return 1;
+
+	r.map = map;
+	r.size = st.st_size;
+	r.header = map;
+
+	if (check_header(&r) || check_records(&r)) {
+		log_printfn(LOG_CONFIG, "config cache %s is damaged, ignoring it", cache);
+		goto out;
+	}
+
+	if (check_sources(&r, sources, num)) {
+		log_printfn(LOG_CONFIG, "config cache %s is out of date", cache);
+		goto out;
+	}
+
+	ret = load_config(&r);
+	if (ret)
+		log_printfn(LOG_CONFIG, "loading config cache %s failed", cache);
+	else
+		log_printfn(LOG_CONFIG, "loaded config from cache %s", cache);
+
+out:
+	/* Names point into the map from now on */
+	if (ret) {
+		munmap(map, st.st_size);
+	} else {
+		cache_map = map;
+		cache_size = st.st_size;
+	}
+
+	free(r.port_types);
+	free(r.items);
+
+	return ret;
+}
+
+/*
+ * Unmaps the cache the names were loaded from. Must not be called until the
+ * name lists have been freed.
+ */
+void confcache_release(void)
+{
+	if (!cache_map)
+		return;
+
+	munmap(cache_map, cache_size);
+	cache_map = NULL;
+	cache_size = 0;
+}
@@ -0,0 +1,143 @@
+#ifndef _HAS_CONFCACHE_H
+#define _HAS_CONFCACHE_H
+
+#include <stdint.h>
+#include "universe.h"
+
+/*
+ * The config cache holds everything loaded from the data files (items, port,
+ * planet and ship types, civs and names) so a server can start without
+ * running them through the config parser again. It is laid out like a
+ * snapshot, see snapshot.h: a header, then sections of fixed size records
+ * that refer to each other by index and to strings by offset.
+ *
+ * The cache lists the files it was built from. It is only used if the same
+ * files are given in the same order and every one of them either has the
+ * modification time and size it had, or the same contents (by hash) if it
+ * has merely been touched. Otherwise the files are parsed and a new cache is
+ * written.
+ *
+ * Names, which are by far the most numerous strings, are not copied when
+ * the cache is loaded but used where they are in the mapped file. The
+ * mapping is kept until confcache_release().
+ */
+#define CONFCACHE_MAGIC "YASTGCFG"
+#define CONFCACHE_VERSION 2
+#define CONFCACHE_BYTE_ORDER 0x01020304
+#define CONFCACHE_NO_STRING UINT32_MAX
+
+enum confcache_sections {
+	CONFCACHE_STRINGS,		/* char, null terminated strings */
+	CONFCACHE_SOURCES,		/* struct confcache_source_file */
+	CONFCACHE_ITEMS,		/* struct confcache_item */
+	CONFCACHE_SHIP_TYPES,		/* struct confcache_ship_type */
+	CONFCACHE_PORT_TYPES,		/* struct confcache_port_type */
+	CONFCACHE_CARGO,		/* struct confcache_cargo */
+	CONFCACHE_PLANET_TYPES,		/* struct confcache_planet_type */
+	CONFCACHE_CIVS,			/* struct confcache_civ */
+	CONFCACHE_INDICES,		/* uint32_t record indices */
+	CONFCACHE_NAMES,		/* uint32_t string offsets */
+	CONFCACHE_SECTION_NUM
+};
+
+enum confcache_name_lists {
+	CONFCACHE_CONSTELLATION_NAMES,
+	CONFCACHE_PORT_NAMES,
+	CONFCACHE_PLAYER_NAMES,
+	CONFCACHE_NAME_LIST_NUM
+};
+
+enum confcache_name_parts {
+	CONFCACHE_PREFIX,
+	CONFCACHE_FIRST,
+	CONFCACHE_SECOND,
+	CONFCACHE_SUFFIX,
+	CONFCACHE_NAME_PART_NUM
+};
+
+struct confcache_section {
+	uint64_t offset;		/* From the start of the file */
+	uint64_t num;			/* Number of records */
+	uint64_t size;			/* Size of one record */
+};
+
+struct confcache_range {
+	uint32_t first, num;
+};
+
+struct confcache_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	uint64_t hash;			/* Of everything after the header */
+	struct confcache_range names[CONFCACHE_NAME_LIST_NUM][CONFCACHE_NAME_PART_NUM];
+	struct confcache_section sections[CONFCACHE_SECTION_NUM];
+};
+
+struct confcache_source_file {
+	uint32_t key;
+	uint32_t file;
+	int64_t mtime_sec, mtime_nsec;
+	uint64_t size;
+	uint64_t hash;
+};
+
+struct confcache_item {
+	uint32_t name;
+	uint32_t unused;
+	int64_t weight;
+	int64_t base_price;
+};
+
+struct confcache_ship_type {
+	uint32_t name, desc;
+	int64_t carry_weight;
+	uint64_t speed;
+};
+
+struct confcache_port_type {
+	uint32_t name, desc;
+	uint32_t zones;			/* Bit n set for zone n */
+	uint32_t first_cargo, num_cargo;
+};
+
+struct confcache_cargo {
+	uint32_t item;
+	uint32_t first_require, num_requires;	/* Cargo of the same port type */
+	uint32_t unused;
+	int64_t min, max;
+	int64_t amount;
+	int64_t daily_change;
+	int64_t price;
+};
+
+struct confcache_planet_type {
+	uint32_t name, desc, surface, atmo;
+	uint32_t c;
+	uint32_t zones;			/* Bit n set for zone n */
+	uint32_t mindia, maxdia;
+	uint32_t minlife, maxlife;
+	uint32_t first_port_type, num_port_types;
+};
+
+struct confcache_civ {
+	uint32_t name;
+	int32_t power;
+	uint32_t first_name, num_names;
+};
+
+/*
+ * A data file the config was loaded from, and the key it was given under
+ */
+struct confcache_source {
+	const char *key;
+	const char *file;
+};
+
+int confcache_load(struct universe *u, const char * const cache,
+		const struct confcache_source * const sources, const size_t num);
+int confcache_save(struct universe *u, const char * const cache,
+		const struct confcache_source * const sources, const size_t num);
+void confcache_release(void);
+
+#endif
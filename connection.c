@@ -31,6 +31,7 @@
 #include "planet.h"
 #include "player.h"
 #include "mtrandom.h"
+#include "wal.h"
 
 int conn_init(struct connection *conn)
 {
@@ -59,12 +60,13 @@ void connection_free(struct connection *conn)
 
 	pthread_mutex_destroy(&conn->worker_lock);
 
+	/* First, so that an arrival doesn't talk to the player meanwhile */
+	if (conn->pl)
+		player_detach(conn->pl);
 	if (conn->peerfd)
 		close(conn->peerfd);
 	buffer_free(&conn->send);
 	buffer_free(&conn->recv);
-	if (conn->pl)
-		player_free(conn->pl);
 }
 
 __attribute__((format(printf, 2, 3)))
@@ -78,7 +80,8 @@ void conn_error(struct connection *data, char *fmt, ...)
 	va_end(ap);
 	msg[sizeof(msg) - 1] = '\0';
 
-	conn_send(data, "Oops! An internal error occured: %s.\nYour current state is NOT saved and you are being forcibly disconnected.\nSorry!", msg);
+	conn_send(data, "Oops! An internal error occured: %s.\nYour current state is %s and you are being forcibly disconnected.\nSorry!",
+			msg, (wal_is_open(&wal) ? "saved" : "NOT saved"));
 	server_disconnect_nicely(data);
 }
 
@@ -88,6 +91,7 @@ void* connection_worker(void *_w)
 	struct conn_worker_list *w = _w;
 	struct conn_data *data = w->conn_data;
 	struct connection *conn;
+	struct player *pl;
 
 	do {
 		/*
@@ -128,10 +132,20 @@ void* connection_worker(void *_w)
 		conn->worker = 1;
 		pthread_mutex_unlock(&conn->worker_lock);
 
-		if (conn->recv.buf[0] != '\0' && cli_run_cmd(&conn->pl->cli, conn->recv.buf) < 0)
+		pl = conn->pl;
+		pthread_mutex_lock(&pl->lock);
+		if (conn->recv.buf[0] != '\0' && cli_run_cmd(&pl->cli, conn->recv.buf) < 0)
 			conn_send(conn, "Unknown command or syntax error: \"%s\"\n", conn->recv.buf);
+		pthread_mutex_unlock(&pl->lock);
+
+		/* Left behind by resuming another player */
+		if (conn->pl != pl)
+			player_destroy(pl);
+
 		buffer_reset(&conn->recv);
+		pthread_mutex_lock(&conn->pl->lock);
 		conn_send(conn, PROMPT);
+		pthread_mutex_unlock(&conn->pl->lock);
 
 		pthread_mutex_lock(&conn->worker_lock);
 		conn->worker = 0;
@@ -142,28 +156,29 @@ void* connection_worker(void *_w)
 	return NULL;
 }
 
-int conn_fulfixinit(struct connection *data)
+static void conn_attach(void *conn, struct player *player)
 {
-	log_printfn(LOG_CONN, "initializing connection from peer %s", data->peer);
+	((struct connection*)conn)->pl = player;
+}
 
-	if (list_len(&univ.ship_types) == 0)
-		return -1;
+static void conn_quit(void *conn)
+{
+	server_disconnect_nicely(conn);
+}
 
-	data->pl = malloc(sizeof(*data->pl));
-	if (!data->pl)
-		return -1;
+static const struct client_ops conn_client_ops = {
+	.print = conn_send,
+	.attach = conn_attach,
+	.quit = conn_quit,
+};
 
-	if (player_init(data->pl))
-		return -1;
+int conn_fulfixinit(struct connection *data)
+{
+	log_printfn(LOG_CONN, "initializing connection from peer %s", data->peer);
 
-	data->pl->conn = data;
-	if (new_ship_to_player(list_first_entry(&univ.ship_types, struct ship_type, list), data->pl))
+	data->pl = player_login(&conn_client_ops, data);
+	if (!data->pl)
 		return -1;
-	data->pl->pos = list_first_entry(&data->pl->ships, struct ship, list);
-	data->pl->postype = SHIP;
-	data->pl->credits = 100000;
-
-	player_go(data->pl, SYSTEM, ptrlist_entry(&univ.systems, 0));
 
 	conn_send(data, PROMPT);
 
@@ -1,17 +1,21 @@
 #include <dlfcn.h>
+#include <inttypes.h>
 #include <malloc.h>
 #include <pthread.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <ev.h>
 #include <config.h>
 #include "console.h"
 #include "common.h"
 #include "buffer.h"
+#include "checkpoint.h"
 #include "cli.h"
+#include "cli_stats.h"
 #include "item.h"
 #include "list.h"
 #include "log.h"
@@ -19,7 +23,9 @@
 #include "planet.h"
 #include "planet_type.h"
 #include "port.h"
+#include "port_update.h"
 #include "server.h"
+#include "snapshot.h"
 #include "universe.h"
 
 static void write_msg(int fd, struct signal *msg, char *msgdata)
@@ -201,6 +207,50 @@ static int cmd_rmmod(void *console, char *name)
 	return 0;
 }
 
+/*
+ * Players change their own orders, ships and credits under nothing but
+ * their own lock, so the running universe can't be walked as it is. A
+ * checkpoint saves the copy a forked child sees instead.
+ */
+static int cmd_save(void *console, char *file)
+{
+	struct console *c = console;
+	struct checkpoint_stats stats;
+
+	if (!file)
+		file = SNAPSHOT_DEFAULT_FILE;
+
+	if (checkpoint(&univ, file, &stats)) {
+		c->print(c, "Error saving universe to %s, see the log for details\n", file);
+		return 0;
+	}
+
+	c->print(c, "Saved universe to %s in %.3f s\n", file, stats.duration);
+
+	return 0;
+}
+
+static int cmd_checkpoint(void *console, char *file)
+{
+	struct console *c = console;
+	struct checkpoint_stats stats;
+
+	if (!file)
+		file = SNAPSHOT_DEFAULT_FILE;
+
+	if (checkpoint(&univ, file, &stats)) {
+		c->print(c, "Error writing checkpoint to %s, see the log for details\n", file);
+		return 0;
+	}
+
+	c->print(c, "Wrote checkpoint to %s in %.3f s after pausing for %.3f ms\n",
+			file, stats.duration, stats.pause * 1000);
+	c->print(c, "Page faults: %ld in the server while it ran, %ld in the child using %ld KiB RSS\n",
+			stats.parent_faults, stats.child_faults, stats.child_rss_kb);
+
+	return 0;
+}
+
 static int cmd_ships(void *console, char *param)
 {
 	struct console *c = console;
@@ -235,6 +285,7 @@ static int cmd_memstat(void *console, char *param)
 static int cmd_stats(void *console, char *param)
 {
 	struct console *c = console;
+	struct port_update_stats updates;
 	struct tm t;
 	char created[32];
 	memset(created, 0, sizeof(created));
@@ -250,6 +301,61 @@ static int cmd_stats(void *console, char *param)
 			ptrlist_len(&univ.systems),
 			created,
 			"FIXME", "FIXME");
+
+	port_update_get_stats(&updates);
+	c->print(c, "Port updates:\n"
+			"  Updates done:              %lu, %lu of them overran the %d s interval\n"
+			"  Last update:               %lu pending ports in %.3f s (%.0f ports/s)\n"
+			"  Slowest update:            %.3f s\n"
+			"  Shards in last update:     %lu of up to %lu ports, slowest %.3f s\n"
+			"  Shards past deadline:      %lu\n",
+			updates.ticks, updates.overruns, PORT_UPDATE_INTERVAL,
+			updates.ports, updates.duration, updates.ports_per_second,
+			updates.max_duration,
+			updates.shards, updates.shard_size, updates.slowest_shard,
+			updates.shard_overruns);
+	return 0;
+}
+
+/*
+ * Shows the stats of every command run so far, or writes them to file
+ */
+static int cmd_cmdstats(void *console, char *file)
+{
+	struct console *c = console;
+	struct cli_cmd_stats *stats;
+	const char *name;
+
+	if (file) {
+		if (cli_stats_export(file))
+			c->print(c, "Error writing command statistics to %s\n", file);
+		else
+			c->print(c, "Wrote command statistics to %s\n", file);
+		return 0;
+	}
+
+	stats = malloc(sizeof(*stats));
+	if (!stats)
+		return 0;
+
+	c->print(c, "%-16s %-10s %-8s %-10s %-10s %-10s %-10s %-10s\n",
+			"Command", "Calls", "Errors", "Mean us", "p50 us", "p99 us",
+			"p99.9 us", "Max us");
+	for (unsigned int i = 0; i < cli_stats_num(); i++) {
+		name = cli_stats_get(i, stats);
+		if (!stats->calls)
+			continue;
+
+		c->print(c, "%-16.16s %-10"PRIu64" %-8"PRIu64" %-10.1f %-10.1f %-10.1f %-10.1f %-10.1f\n",
+				name, stats->calls, stats->errors,
+				histogram_mean(&stats->latency) / 1000,
+				histogram_percentile(&stats->latency, 50) / 1000.0,
+				histogram_percentile(&stats->latency, 99) / 1000.0,
+				histogram_percentile(&stats->latency, 99.9) / 1000.0,
+				stats->latency.max / 1000.0);
+	}
+
+	free(stats);
 	return 0;
 }
 
@@ -266,6 +372,8 @@ static int register_console_commands(struct console * console)
 {
 	if (cli_add_cmd(&console->cli, "ports", cmd_ports, console, "List available ports"))
 		goto err;
+	if (cli_add_cmd(&console->cli, "checkpoint", cmd_checkpoint, console, "Fork and save the universe while it runs"))
+		goto err;
 	if (cli_add_cmd(&console->cli, "help", cmd_help, console, "Display this help text"))
 		goto err;
 	if (cli_add_cmd(&console->cli, "insmod", cmd_insmod, console, "Insert a loadable module"))
@@ -284,10 +392,14 @@ static int register_console_commands(struct console * console)
 		goto err;
 	if (cli_add_cmd(&console->cli, "rmmod", cmd_rmmod, console, "Unload a loadable module"))
 		goto err;
+	if (cli_add_cmd(&console->cli, "save", cmd_save, console, "Save the universe to a snapshot file"))
+		goto err;
 	if (cli_add_cmd(&console->cli, "ships", cmd_ships, console, "List available ship types"))
 		goto err;
 	if (cli_add_cmd(&console->cli, "stats", cmd_stats, console, "Display statistics"))
 		goto err;
+	if (cli_add_cmd(&console->cli, "cmdstats", cmd_cmdstats, console, "Display statistics of commands run, or write them to a file"))
+		goto err;
 	if (cli_add_cmd(&console->cli, "memstat", cmd_memstat, console, "Display memory statistics"))
 		goto err;
 	if (cli_add_cmd(&console->cli, "quit", cmd_quit, console, "Terminate the server"))
@@ -7,49 +7,91 @@
 #include "common.h"
 #include "log.h"
 #include "mtrandom.h"
+#include "names.h"
+#include "planet.h"
+#include "port.h"
+#include "progress.h"
 #include "universe.h"
 #include "constellation.h"
 #include "system.h"
 #include "star.h"
 #include "ptrlist.h"
 #include "stringtrie.h"
+#include "threadpool.h"
 
-static int addconstellation(const char * const cname)
+/*
+ * Genesis is done in three phases:
+ *
+ * 1. All systems are created and placed, one constellation at a time. This
+ *    has to be serial as every placement depends on where the earlier
+ *    systems ended up.
+ * 2. The constellations are populated with stars, planets and ports in
+ *    parallel on the worker threads.
+ * 3. The ports are named and registered with the universe, again serially
+ *    and in a fixed order. The order is that of the x tree, which makes the
+ *    item indices (also sorted on x) cheap to build as they are only ever
+ *    appended to.
+ *
+ * Each constellation draws all its random numbers in phase 1 and 2 from its
+ * own stream, seeded from the master seed and the constellation's index.
+ * Phase 3 uses the calling thread's stream. The universe therefore only
+ * depends on the master seed and not on the number of threads or their
+ * scheduling.
+ */
+struct constellation {
+	char *name;
+	unsigned long size;		/* Number of systems */
+	struct ptrlist systems;
+	struct mtrandom_stream rng;
+	int err;
+};
+
+/*
+ * Systems are named after their constellation, with Greek letters for the
+ * first ones and numbers for the rest (like Flamsteed's "61 Cygni").
+ */
+#define SYSTEM_NUMBER_LEN 20
+static void name_system(char *string, const unsigned long num, const char *constellation)
+{
+	if (num < GREEK_N)
+		sprintf(string, "%s %s", greek[num], constellation);
+	else
+		sprintf(string, "%lu %s", num + 1, constellation);
+}
+
+static int place_constellation(struct constellation *c)
 {
-	unsigned long nums, numc, i;
+	unsigned long numc;
+	long x, y;
 	char *string;
 	struct system *fs, *s;
 	struct ptrlist work;
 	double phi;
 	unsigned long r;
 
-	string = malloc(strlen(cname)+GREEK_LEN+2);
+	string = malloc(strlen(c->name) + MAX(GREEK_LEN, SYSTEM_NUMBER_LEN) + 2);
 	if (!string)
 		return -1;
 
 	ptrlist_init(&work);
 
-	/* Determine number of systems in constellation */
-	nums = mtrandom_uint(GREEK_N);
-	if (nums == 0)
-		nums = 1;
-
-	printf("addconstellation: will create %lu systems (universe has %lu so far)\n", nums, ptrlist_len(&univ.systems));
-
 	pthread_rwlock_wrlock(&univ.systemnames_lock);
 
 	fs = NULL;
-	for (numc = 0; numc < nums; numc++) {
+	for (numc = 0; numc < c->size; numc++) {
 
 		/* Create a new system and put it in s */
 		s = malloc(sizeof(*s));
 		if (!s)
 			goto err;
-		sprintf(string, "%s %s", greek[numc], cname);
-		if (system_create(s, string))
+		name_system(string, numc, c->name);
+		if (system_create(s, string)) {
+			free(s);
 			goto err;
+		}
 
 		ptrlist_push(&univ.systems, s);
+		ptrlist_push(&c->systems, s);
 		st_add_string(&univ.systemnames, s->name, s);
 
 		if (fs == NULL) {
@@ -64,13 +106,13 @@ static int addconstellation(const char * const cname)
 				/* All others are randomly distributed */
 				phi = mtrandom_uint(UINT_MAX) / (double)UINT_MAX*2*M_PI;
 				r = 0;
-				i = 2;
-				while (i > 1) {
+				do {
 					r += mtrandom_ulong(CONSTELLATION_RANDOM_DISTANCE);
 					phi += mtrandom_double(CONSTELLATION_PHI_RANDOM);
-					if (!system_move(s, POLTOX(phi, r), POLTOY(phi, r)))
-						i = get_neighbouring_systems(NULL, s, CONSTELLATION_MIN_DISTANCE);
-				}
+					x = POLTOX(phi, r);
+					y = POLTOY(phi, r);
+				} while (is_system_near(x, y, CONSTELLATION_MIN_DISTANCE) ||
+						system_move(s, x, y));
 			}
 			ptrlist_push(&work, s);
 		} else if (ptrlist_len(&work) == 0) {
@@ -86,9 +128,6 @@ static int addconstellation(const char * const cname)
 			if (mtrandom_uint(UINT_MAX) < UINT_MAX/CONSTELLATION_NEIGHBOUR_CHANCE)
 				ptrlist_pull(&work);
 		}
-
-		printf("Created %s (%p) at %ldx%ld\n", s->name, s, s->x, s->y);
-
 	}
 
 	pthread_rwlock_unlock(&univ.systemnames_lock);
@@ -100,21 +139,165 @@ static int addconstellation(const char * const cname)
 
 err:
 	pthread_rwlock_unlock(&univ.systemnames_lock);
+	free(string);
+	ptrlist_free(&work);
 	return -1;
 }
 
+static void populate_constellation(void *_cons, unsigned long idx)
+{
+	struct constellation *c = &((struct constellation*)_cons)[idx];
+	struct mtrandom_stream *prev;
+	struct list_head *lh;
+	struct system *s;
+
+	prev = mtrandom_set_stream(&c->rng);
+
+	ptrlist_for_each_entry(s, &c->systems, lh) {
+		if (system_populate(s)) {
+			c->err = 1;
+			break;
+		}
+	}
+
+	mtrandom_set_stream(prev);
+}
+
+static unsigned long count_ports(struct constellation *c)
+{
+	struct list_head *lh, *li;
+	struct system *s;
+	struct planet *planet;
+	unsigned long num = 0;
+
+	ptrlist_for_each_entry(s, &c->systems, lh) {
+		num += ptrlist_len(&s->ports);
+		ptrlist_for_each_entry(planet, &s->planets, li)
+			num += ptrlist_len(&planet->ports);
+	}
+
+	return num;
+}
+
+/*
+ * Decides the size of every constellation up front, drawn from the
+ * constellation's own stream, until the universe has the number of systems
+ * asked for. The last constellation is cut short if needed.
+ */
+static struct constellation* size_constellations(const struct universe_settings * const settings,
+		size_t *num)
+{
+	struct constellation *cons = NULL, *c;
+	struct mtrandom_stream *prev;
+	unsigned long total = 0;
+	size_t alloc = 0;
+
+	*num = 0;
+	while (total < settings->systems) {
+		if (*num == alloc) {
+			alloc = MAX(alloc * 2, 64);
+			c = realloc(cons, alloc * sizeof(*cons));
+			if (!c) {
+				free(cons);
+				return NULL;
+			}
+			cons = c;
+		}
+
+		c = &cons[*num];
+		memset(c, 0, sizeof(*c));
+		mtrandom_stream_init(&c->rng, *num);
+
+		prev = mtrandom_set_stream(&c->rng);
+		c->size = settings->constellation_min +
+			mtrandom_ulong(settings->constellation_max - settings->constellation_min + 1);
+		mtrandom_set_stream(prev);
+
+		c->size = MIN(c->size, settings->systems - total);
+		total += c->size;
+		(*num)++;
+	}
+
+	for (size_t i = 0; i < *num; i++)
+		ptrlist_init(&cons[i].systems);
+
+	return cons;
+}
+
+/*
+ * The constellations are populated a batch at a time to be able to show
+ * progress, but the batches are large enough to keep all workers busy.
+ */
+#define POPULATE_BATCHES 20
 int spawn_constellations(struct universe *u)
 {
-	char *name;
-	for (size_t ncons = 0; ncons < CONSTELLATION_MAXNUM; ncons++) {
-		name = create_unique_name(&u->avail_constellations);
-		printf("Adding constellation %s\n", name);
-		if (addconstellation(name)) {
-			free(name);
-			return -1;
+	struct constellation *cons;
+	struct mtrandom_stream *prev;
+	struct progress progress;
+	struct rb_node *node;
+	unsigned long nports, placed;
+	size_t ncons, i, batch;
+	int r = -1;
+
+	cons = size_constellations(&u->settings, &ncons);
+	if (!cons)
+		return -1;
+
+	printf("Placing %lu systems in %zu constellations\n", u->settings.systems, ncons);
+	progress_init(&progress, "systems placed", u->settings.systems);
+
+	placed = 0;
+	for (i = 0; i < ncons; i++) {
+		cons[i].name = create_numbered_name(&u->avail_constellations);
+		if (!cons[i].name)
+			goto out;
+
+		prev = mtrandom_set_stream(&cons[i].rng);
+		if (place_constellation(&cons[i])) {
+			mtrandom_set_stream(prev);
+			goto out;
 		}
-		free(name);
+		mtrandom_set_stream(prev);
+
+		placed += cons[i].size;
+		progress_update(&progress, placed);
 	}
 
-	return 0;
+	printf("Populating %zu constellations using %u worker threads\n",
+			ncons, workers.num);
+	progress_init(&progress, "constellations populated", ncons);
+
+	batch = MAX(ncons / POPULATE_BATCHES, 1);
+	for (i = 0; i < ncons; i += batch) {
+		threadpool_for(&workers, MIN(batch, ncons - i), populate_constellation, &cons[i]);
+		progress_update(&progress, MIN(i + batch, ncons));
+	}
+
+	nports = 0;
+	for (i = 0; i < ncons; i++) {
+		if (cons[i].err)
+			goto out;
+		nports += count_ports(&cons[i]);
+	}
+
+	printf("Registering %lu ports\n", nports);
+	progress_init(&progress, "systems registered", u->settings.systems);
+
+	placed = 0;
+	for (node = rb_first(&u->x_rbtree); node; node = rb_next(node)) {
+		if (port_register_system(rb_entry(node, struct system, x_rbtree)))
+			goto out;
+		progress_update(&progress, ++placed);
+	}
+
+	r = 0;
+
+out:
+	for (i = 0; i < ncons; i++) {
+		free(cons[i].name);
+		ptrlist_free(&cons[i].systems);
+	}
+	free(cons);
+
+	return r;
 }
@@ -0,0 +1,441 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cargo.h"
+#include "common.h"
+#include "economy.h"
+#include "list.h"
+#include "port.h"
+
+void economy_init(struct economy *e, const unsigned long ticks_per_day)
+{
+	memset(e, 0, sizeof(*e));
+	e->ticks_per_day = ticks_per_day;
+	INIT_LIST_HEAD(&e->pending);
+	pthread_mutex_init(&e->pending_lock, NULL);
+}
+
+void economy_free(struct economy *e)
+{
+	for (unsigned long i = 0; i < e->num_blocks; i++) {
+		free(e->blocks[i]->requires);
+		free(e->blocks[i]);
+	}
+	free(e->blocks);
+	e->blocks = NULL;
+	e->num_blocks = e->alloc_blocks = 0;
+	INIT_LIST_HEAD(&e->pending);
+	pthread_mutex_destroy(&e->pending_lock);
+}
+
+/*
+ * daily_change / ticks_per_day in fixed point, without shifting daily_change
+ * itself out of range. The whole part is rounded down, so the fraction is
+ * never negative.
+ */
+static void set_increment(const struct economy * const e, struct economy_block *b,
+		const unsigned int slot, const long daily_change)
+{
+	const int64_t ticks = e->ticks_per_day;
+	const int64_t one = (int64_t)1 << ECONOMY_FRACTION_BITS;
+	int64_t increment;
+
+	increment = (daily_change / ticks) * one + (daily_change % ticks) * one / ticks;
+
+	b->increment[slot] = increment >> ECONOMY_FRACTION_BITS;
+	b->increment_fraction[slot] = increment & UINT32_MAX;
+}
+
+#define ECONOMY_MIN_ALLOC_BLOCKS 16
+static struct economy_block* block_with_room(struct economy *e, const unsigned int num)
+{
+	struct economy_block *b, **blocks;
+	unsigned long alloc;
+
+	if (e->num_blocks) {
+		b = e->blocks[e->num_blocks - 1];
+		if (b->used + num <= ECONOMY_BLOCK_SLOTS)
+			return b;
+	}
+
+	if (e->num_blocks == e->alloc_blocks) {
+		alloc = MAX(e->alloc_blocks * 2, ECONOMY_MIN_ALLOC_BLOCKS);
+		blocks = realloc(e->blocks, alloc * sizeof(*blocks));
+		if (!blocks)
+			return NULL;
+		e->blocks = blocks;
+		e->alloc_blocks = alloc;
+	}
+
+	b = calloc(1, sizeof(*b));
+	if (!b)
+		return NULL;
+	b->economy = e;
+	e->blocks[e->num_blocks++] = b;
+
+	return b;
+}
+
+#define ECONOMY_MIN_ALLOC_REQUIRES 64
+static int add_require(struct economy_block *b, const unsigned int slot)
+{
+	uint16_t *requires;
+	size_t alloc;
+
+	if (b->used_requires == b->alloc_requires) {
+		alloc = MAX(b->alloc_requires * 2, ECONOMY_MIN_ALLOC_REQUIRES);
+		requires = realloc(b->requires, alloc * sizeof(*requires));
+		if (!requires)
+			return -1;
+		b->requires = requires;
+		b->alloc_requires = alloc;
+	}
+
+	b->requires[b->used_requires++] = slot;
+
+	return 0;
+}
+
+/*
+ * Moves the stock of a port into a run of slots and points its cargo there.
+ * Must be called with ports_lock held for writing, as it is when the port is
+ * registered.
+ */
+int economy_add_port(struct economy *e, struct port *port)
+{
+	struct economy_block *b;
+	struct economy_run *run;
+	struct cargo *cargo, *req;
+	struct list_head *lh;
+	unsigned int num = 0, slot;
+
+	list_for_each_entry(cargo, &port->items, list)
+		num++;
+
+	if (!num)
+		return 0;
+	if (num > ECONOMY_BLOCK_SLOTS)
+		return -1;
+
+	b = block_with_room(e, num);
+	if (!b)
+		return -1;
+
+	run = &b->runs[b->num_runs];
+	run->port = port;
+	run->block = b;
+	run->first = b->used;
+	run->num = num;
+	run->last_tick = __atomic_load_n(&e->tick, __ATOMIC_ACQUIRE);
+	run->ticked = 0;
+	run->pending = 0;
+	INIT_LIST_HEAD(&run->list);
+
+	slot = b->used;
+	list_for_each_entry(cargo, &port->items, list) {
+		b->amount[slot] = *cargo->amount;
+		b->max[slot] = cargo->max;
+		set_increment(e, b, slot, cargo->daily_change);
+		b->fraction[slot] = 0;
+		b->num_requires[slot] = 0;
+		cargo->amount = &b->amount[slot];
+		cargo->run = run;
+		slot++;
+	}
+
+	/* Required cargo is in the same run, and where its amount points tells which slot */
+	list_for_each_entry(cargo, &port->items, list) {
+		slot = cargo->amount - b->amount;
+		b->first_require[slot] = b->used_requires;
+		ptrlist_for_each_entry(req, &cargo->requires, lh) {
+			if (add_require(b, req->amount - b->amount))
+				goto err;
+			b->num_requires[slot]++;
+			run->ticked = 1;
+		}
+	}
+
+	b->used += num;
+	b->num_runs++;
+	port->economy = b;
+	port->economy_run = run - b->runs;
+
+	if (run->ticked) {
+		run->pending = 1;
+		pthread_mutex_lock(&e->pending_lock);
+		list_add_tail(&run->list, &e->pending);
+		pthread_mutex_unlock(&e->pending_lock);
+	}
+
+	return 0;
+
+err:
+	list_for_each_entry(cargo, &port->items, list) {
+		cargo->own_amount = *cargo->amount;
+		cargo->amount = &cargo->own_amount;
+		cargo->run = NULL;
+	}
+	return -1;
+}
+
+/*
+ * Moves the stock of a port back into its cargo. The slots are not reused.
+ */
+void economy_rm_port(struct economy *e, struct port *port)
+{
+	struct economy_block *b = port->economy;
+	struct economy_run *run;
+	struct cargo *cargo;
+
+	if (!b)
+		return;
+
+	run = &b->runs[port->economy_run];
+
+	list_for_each_entry(cargo, &port->items, list) {
+		cargo->own_amount = economy_amount(run, cargo->amount);
+		cargo->amount = &cargo->own_amount;
+		cargo->run = NULL;
+	}
+
+	if (run->pending) {
+		pthread_mutex_lock(&e->pending_lock);
+		list_del_init(&run->list);
+		pthread_mutex_unlock(&e->pending_lock);
+		run->pending = 0;
+	}
+
+	for (unsigned int i = run->first; i < run->first + run->num; i++) {
+		b->amount[i] = 0;
+		b->max[i] = 0;
+		b->increment[i] = 0;
+		b->increment_fraction[i] = 0;
+		b->fraction[i] = 0;
+		b->num_requires[i] = 0;
+	}
+	run->port = NULL;
+	run->ticked = 0;
+
+	port->economy = NULL;
+}
+
+/*
+ * A change of c to slot i, no more than there is of what it requires
+ */
+static long limit_by_requires(const struct economy_block *b, const unsigned int i, long c)
+{
+	long req;
+
+	for (unsigned int j = 0; j < b->num_requires[i]; j++) {
+		req = b->amount[b->requires[b->first_require[i] + j]];
+		if (c > 0 && req < c)
+			c = req;
+		else if (c < 0 && req < -c)
+			c = -req;
+	}
+
+	return c;
+}
+
+/*
+ * Advances slots [first, end) of a block by one tick, which must be whole
+ * runs. The caller holds the items_lock of their ports for writing.
+ *
+ * Slots that require other cargo are done last, and see this tick's
+ * production of what they require.
+ */
+void economy_update(struct economy_block *b, const unsigned int first, const unsigned int end)
+{
+	long change[ECONOMY_BLOCK_SLOTS];
+	long c, up, down;
+	uint32_t fraction;
+
+	/*
+	 * Whole units due this tick, no more than there is or there is room
+	 * for. Written without branches so that the compiler can vectorize it.
+	 */
+	for (unsigned int i = first; i < end; i++) {
+		fraction = b->fraction[i] + b->increment_fraction[i];
+		c = b->increment[i] + (fraction < b->fraction[i]);
+		b->fraction[i] = fraction;
+
+		up = MIN(c, b->max[i] - b->amount[i]);
+		down = MAX(c, -b->amount[i]);
+		c = c > 0 ? up : (c < 0 ? down : 0);
+
+		change[i] = c;
+		b->amount[i] += b->num_requires[i] ? 0 : c;
+	}
+
+	/* Either way, a change uses up as much of everything it requires */
+	for (unsigned int i = first; i < end; i++) {
+		if (!b->num_requires[i] || !change[i])
+			continue;
+
+		c = limit_by_requires(b, i, change[i]);
+
+		b->amount[i] += c;
+		for (unsigned int j = 0; j < b->num_requires[i]; j++)
+			b->amount[b->requires[b->first_require[i] + j]] -= labs(c);
+	}
+}
+
+/*
+ * The amount of slot i after n more ticks with nothing required, and its
+ * fraction then. Every tick changes it in the same direction, and then
+ * clamping it once at the end is the same as clamping it every tick.
+ */
+static long slot_after(const struct economy_block *b, const unsigned int i,
+		const unsigned long n, uint32_t *fraction)
+{
+	uint64_t f = b->fraction[i] + (uint64_t)n * b->increment_fraction[i];
+	long c = (long)n * b->increment[i] + (long)(f >> ECONOMY_FRACTION_BITS);
+
+	if (fraction)
+		*fraction = f;
+
+	if (c > 0)
+		return b->amount[i] + MIN(c, b->max[i] - b->amount[i]);
+	else if (c < 0)
+		return b->amount[i] + MAX(c, -b->amount[i]);
+	else
+		return b->amount[i];
+}
+
+/*
+ * The current value of the amount in a slot of run. Nothing is stored, so
+ * the items_lock of its port only needs to be held for reading.
+ */
+long economy_amount(const struct economy_run *run, const long *amount)
+{
+	const struct economy_block *b = run->block;
+	unsigned long n;
+
+	if (run->ticked)
+		return *amount;
+
+	n = __atomic_load_n(&b->economy->tick, __ATOMIC_ACQUIRE) - run->last_tick;
+	if (!n)
+		return *amount;
+
+	return slot_after(b, amount - b->amount, n, NULL);
+}
+
+/*
+ * Brings the amounts of run up to date before they are changed. A run with
+ * requirements is made pending, as the change may give its next tick
+ * something to do. The caller holds the items_lock of its port for writing.
+ */
+void economy_settle(struct economy_run *run)
+{
+	struct economy_block *b = run->block;
+	struct economy *e = b->economy;
+	unsigned long now, n;
+	uint32_t fraction;
+
+	now = __atomic_load_n(&e->tick, __ATOMIC_ACQUIRE);
+	n = now - run->last_tick;
+
+	if (!run->ticked) {
+		for (unsigned int i = run->first; i < run->first + run->num; i++) {
+			b->amount[i] = slot_after(b, i, n, &fraction);
+			b->fraction[i] = fraction;
+		}
+		run->last_tick = now;
+		return;
+	}
+
+	/* Pending runs are brought up to date by their next tick */
+	if (run->pending)
+		return;
+
+	/* Nothing has changed since it stopped but the fractions */
+	for (unsigned int i = run->first; i < run->first + run->num; i++)
+		b->fraction[i] += (uint32_t)(n * b->increment_fraction[i]);
+	run->last_tick = now;
+
+	run->pending = 1;
+	pthread_mutex_lock(&e->pending_lock);
+	list_add_tail(&run->list, &e->pending);
+	pthread_mutex_unlock(&e->pending_lock);
+}
+
+/*
+ * Moves time on by a number of ticks and returns the new tick. Pending runs
+ * are then a number of ticks behind, see economy_tick_run().
+ */
+unsigned long economy_advance(struct economy *e, const unsigned long ticks)
+{
+	return __atomic_add_fetch(&e->tick, ticks, __ATOMIC_ACQ_REL);
+}
+
+/*
+ * Moves the pending runs to runs, so that they can be ticked without holding
+ * pending_lock. Runs made pending meanwhile wait for the next tick.
+ */
+void economy_take_pending(struct economy *e, struct list_head *runs)
+{
+	pthread_mutex_lock(&e->pending_lock);
+	list_splice_tail_init(&e->pending, runs);
+	pthread_mutex_unlock(&e->pending_lock);
+}
+
+/*
+ * Gives back the runs that are still pending after their tick
+ */
+void economy_put_pending(struct economy *e, struct list_head *runs)
+{
+	pthread_mutex_lock(&e->pending_lock);
+	list_splice_tail_init(runs, &e->pending);
+	pthread_mutex_unlock(&e->pending_lock);
+}
+
+/*
+ * Whether no tick could change the amounts in [first, end), as they are.
+ * The limits on a change don't depend on its size, only on its direction,
+ * so it is enough to try a change of one unit the way each slot grows.
+ */
+static int is_settled(const struct economy_block *b, const unsigned int first,
+		const unsigned int end)
+{
+	long c;
+
+	for (unsigned int i = first; i < end; i++) {
+		if (b->increment[i] < 0)
+			c = MAX(-1, -b->amount[i]);
+		else if (b->increment[i] || b->increment_fraction[i])
+			c = MIN(1, b->max[i] - b->amount[i]);
+		else
+			continue;
+
+		if (c && b->num_requires[i])
+			c = limit_by_requires(b, i, c);
+
+		if (c)
+			return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * Ticks a pending run up to the current tick, and takes it off the list it
+ * is on if it has settled. The caller holds the items_lock of its port for
+ * writing.
+ */
+void economy_tick_run(struct economy_run *run)
+{
+	struct economy_block *b = run->block;
+	struct economy *e = b->economy;
+	const unsigned long now = __atomic_load_n(&e->tick, __ATOMIC_ACQUIRE);
+
+	for (; run->last_tick != now; run->last_tick++)
+		economy_update(b, run->first, run->first + run->num);
+
+	if (is_settled(b, run->first, run->first + run->num)) {
+		run->pending = 0;
+		pthread_mutex_lock(&e->pending_lock);
+		list_del_init(&run->list);
+		pthread_mutex_unlock(&e->pending_lock);
+	}
+}
@@ -0,0 +1,86 @@
+#ifndef _HAS_ECONOMY_H
+#define _HAS_ECONOMY_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include "list.h"
+
+struct port;
+
+/*
+ * The stock of every registered port lives here instead of in its struct
+ * cargo, one array per quantity, so that a port update is a few passes over
+ * contiguous memory rather than a walk over lists of cargo spread all over
+ * the heap. A port's cargo points to its slots, see cargo.h.
+ *
+ * Slots are handed out in blocks. All cargo of a port is in one block, next
+ * to each other and in the order of port->items, which is called a run.
+ * Blocks never move and are not freed until the economy is.
+ *
+ * Stock grows by daily_change spread evenly over the ticks of a day, which is
+ * kept as an increment per tick in whole units and 1/2^32 fractions of one.
+ * A tick adds the fraction and one more unit whenever that carries over, so
+ * it is only additions and comparisons on 32 and 64 bit integers.
+ *
+ * Most ports are left alone between two ticks, so their stock is only
+ * brought up to date when it is used. Without requirements, the stock after
+ * any number of ticks follows from the increments alone, and cargo_amount()
+ * works it out from the amount at the run's last_tick without storing it.
+ * A run where some cargo requires other cargo is ticked one tick at a time
+ * instead, and only for as long as that changes anything: once a tick
+ * can't, it is left until a trade wakes it up again, see economy_settle().
+ * The runs being ticked are called pending.
+ */
+#define ECONOMY_BLOCK_SLOTS 4096
+#define ECONOMY_FRACTION_BITS 32
+
+struct economy_run {
+	struct port *port;		/* NULL once the port has left */
+	struct economy_block *block;
+	unsigned int first, num;	/* Slots */
+	unsigned long last_tick;	/* The amounts are as of this tick */
+	int ticked;			/* Has requirements */
+	int pending;			/* Ticked on every tick, and in economy->pending */
+	struct list_head list;
+};
+
+struct economy_block {
+	struct economy *economy;
+	long amount[ECONOMY_BLOCK_SLOTS];
+	long max[ECONOMY_BLOCK_SLOTS];
+	long increment[ECONOMY_BLOCK_SLOTS];		/* Whole units per tick */
+	uint32_t increment_fraction[ECONOMY_BLOCK_SLOTS];	/* And fractions of a unit */
+	uint32_t fraction[ECONOMY_BLOCK_SLOTS];		/* Not yet a whole unit */
+	uint32_t first_require[ECONOMY_BLOCK_SLOTS];
+	uint16_t num_requires[ECONOMY_BLOCK_SLOTS];
+	uint16_t *requires;		/* Slots required by other slots in the same run */
+	size_t used_requires, alloc_requires;
+	struct economy_run runs[ECONOMY_BLOCK_SLOTS];
+	unsigned int used;		/* Slots */
+	unsigned int num_runs;
+};
+
+struct economy {
+	struct economy_block **blocks;
+	unsigned long num_blocks, alloc_blocks;
+	unsigned long ticks_per_day;
+	unsigned long tick;		/* Read atomically */
+	struct list_head pending;
+	pthread_mutex_t pending_lock;	/* Protects the lists of pending runs */
+};
+
+void economy_init(struct economy *e, const unsigned long ticks_per_day);
+void economy_free(struct economy *e);
+int economy_add_port(struct economy *e, struct port *port);
+void economy_rm_port(struct economy *e, struct port *port);
+void economy_update(struct economy_block *b, const unsigned int first, const unsigned int end);
+
+long economy_amount(const struct economy_run *run, const long *amount);
+void economy_settle(struct economy_run *run);
+
+unsigned long economy_advance(struct economy *e, const unsigned long ticks);
+void economy_take_pending(struct economy *e, struct list_head *runs);
+void economy_put_pending(struct economy *e, struct list_head *runs);
+void economy_tick_run(struct economy_run *run);
+
+#endif
@@ -0,0 +1,366 @@
+/*
+ * Fast-forwards the economy of a universe by a number of game days, as fast
+ * as the worker pool can, and reports how the stock of every item develops
+ * and how fast it got there. It reads the same config files as the server,
+ * and creates the universe the same way, or loads it from a snapshot.
+ *
+ * Usage: yastg-economy [-d days] [-r days] [-l snapshot] [-s seed]
+ *
+ * -d is the number of days to simulate and -r how often to report on them.
+ */
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "cargo.h"
+#include "civ.h"
+#include "common.h"
+#include "confcache.h"
+#include "item.h"
+#include "loadconfig.h"
+#include "log.h"
+#include "mtrandom.h"
+#include "names.h"
+#include "port.h"
+#include "port_update.h"
+#include "snapshot.h"
+#include "system.h"
+#include "threadpool.h"
+#include "universe.h"
+
+#define DEFAULT_DAYS 30
+#define SIM_SHARD_SIZE 1024		/* Pending ports per shard */
+#define SAMPLE_CHUNK_PORTS 256
+
+const char* options = "d:l:r:s:";
+unsigned long days = DEFAULT_DAYS;
+unsigned long report_every = 1;
+int seeded = 0;
+uint64_t seed;
+char *snapshot_file = NULL;
+
+struct item_stats {
+	long stock, capacity;
+	unsigned long cargo;		/* Ports trading the item */
+	unsigned long empty, full;	/* Of those */
+};
+
+/*
+ * Every port is looked at on every report, in chunks on the worker pool
+ * that each add up to their own row of stats.
+ */
+struct sample {
+	struct port **ports;
+	unsigned long num_ports;
+	struct item **items;
+	unsigned long num_items;
+	struct item_stats *rows;	/* num_items per chunk */
+};
+
+static int parse_ulong(const char * const s, unsigned long *value)
+{
+	char *end;
+
+	errno = 0;
+	*value = strtoul(s, &end, 0);
+
+	return (errno || end == s || *end != '\0') ? -1 : 0;
+}
+
+static int parse_command_line(int argc, char **argv)
+{
+	char *end;
+	int c;
+
+	while ((c = getopt(argc, argv, options)) > 0) {
+		switch (c) {
+		case 'd':
+			if (parse_ulong(optarg, &days))
+				return -1;
+			break;
+		case 'l':
+			snapshot_file = optarg;
+			break;
+		case 'r':
+			if (parse_ulong(optarg, &report_every) || !report_every)
+				return -1;
+			break;
+		case 's':
+			errno = 0;
+			seed = strtoull(optarg, &end, 0);
+			if (errno || end == optarg || *end != '\0')
+				return -1;
+			seeded = 1;
+			break;
+		default:
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static double elapsed(const struct timespec * const start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static int sample_init(struct sample *s, struct universe *u)
+{
+	struct port *port;
+	struct item *item;
+	unsigned long chunks;
+
+	memset(s, 0, sizeof(*s));
+
+	list_for_each_entry(port, &u->ports, list)
+		s->num_ports++;
+	list_for_each_entry(item, &u->items, list)
+		s->num_items++;
+
+	chunks = (s->num_ports + SAMPLE_CHUNK_PORTS - 1) / SAMPLE_CHUNK_PORTS;
+
+	s->ports = malloc(MAX(s->num_ports, 1) * sizeof(*s->ports));
+	s->items = malloc(MAX(s->num_items, 1) * sizeof(*s->items));
+	s->rows = malloc(MAX(chunks * s->num_items, 1) * sizeof(*s->rows));
+	if (!s->ports || !s->items || !s->rows)
+		return -1;
+
+	s->num_ports = 0;
+	list_for_each_entry(port, &u->ports, list)
+		s->ports[s->num_ports++] = port;
+	s->num_items = 0;
+	list_for_each_entry(item, &u->items, list)
+		s->items[s->num_items++] = item;
+
+	return 0;
+}
+
+static void sample_free(struct sample *s)
+{
+	free(s->rows);
+	free(s->items);
+	free(s->ports);
+}
+
+static unsigned long item_index(const struct sample *s, const struct item *item)
+{
+	unsigned long i;
+
+	for (i = 0; i < s->num_items && s->items[i] != item; i++);
+
+	return i;
+}
+
+static void sample_chunk(void *data, unsigned long chunk)
+{
+	struct sample *s = data;
+	struct item_stats *row = &s->rows[chunk * s->num_items];
+	unsigned long first = chunk * SAMPLE_CHUNK_PORTS;
+	unsigned long last = MIN(first + SAMPLE_CHUNK_PORTS, s->num_ports);
+	struct item_stats *st;
+	struct cargo *cargo;
+	unsigned long i, idx;
+	long amount;
+
+	memset(row, 0, s->num_items * sizeof(*row));
+
+	for (i = first; i < last; i++) {
+		pthread_rwlock_rdlock(&s->ports[i]->items_lock);
+		list_for_each_entry(cargo, &s->ports[i]->items, list) {
+			idx = item_index(s, cargo->item);
+			if (idx == s->num_items)
+				continue;
+
+			st = &row[idx];
+			amount = cargo_amount(cargo);
+			st->stock += amount;
+			st->capacity += cargo->max;
+			st->cargo++;
+			st->empty += (amount <= 0);
+			st->full += (amount >= cargo->max);
+		}
+		pthread_rwlock_unlock(&s->ports[i]->items_lock);
+	}
+}
+
+/*
+ * Adds up the stats of every item, num_items of them, into totals
+ */
+static void take_sample(struct sample *s, struct item_stats *totals)
+{
+	unsigned long chunks = (s->num_ports + SAMPLE_CHUNK_PORTS - 1) / SAMPLE_CHUNK_PORTS;
+	struct item_stats *row;
+
+	threadpool_for(&workers, chunks, sample_chunk, s);
+
+	memset(totals, 0, s->num_items * sizeof(*totals));
+	for (unsigned long c = 0; c < chunks; c++) {
+		row = &s->rows[c * s->num_items];
+		for (unsigned long i = 0; i < s->num_items; i++) {
+			totals[i].stock += row[i].stock;
+			totals[i].capacity += row[i].capacity;
+			totals[i].cargo += row[i].cargo;
+			totals[i].empty += row[i].empty;
+			totals[i].full += row[i].full;
+		}
+	}
+}
+
+static double percent(const double part, const double whole)
+{
+	return whole ? 100 * part / whole : 0;
+}
+
+static void print_header(const struct sample *s)
+{
+	printf("%5s", "Day");
+	for (unsigned long i = 0; i < s->num_items; i++)
+		printf("  %-24.24s", s->items[i]->name);
+	printf("\n%5s", "");
+	for (unsigned long i = 0; i < s->num_items; i++)
+		printf("  %7s %7s %7s ", "stock", "empty", "full");
+	printf("\n");
+}
+
+static void print_sample(const struct sample *s, const unsigned long day,
+		const struct item_stats *totals)
+{
+	const struct item_stats *t;
+
+	printf("%5lu", day);
+	for (unsigned long i = 0; i < s->num_items; i++) {
+		t = &totals[i];
+		printf("  %6.1f%% %6.1f%% %6.1f%% ", percent(t->stock, t->capacity),
+				percent(t->empty, t->cargo), percent(t->full, t->cargo));
+	}
+	printf("\n");
+}
+
+static int create_universe(struct universe * const u)
+{
+	if (snapshot_file)
+		return snapshot_load(u, snapshot_file);
+	else
+		return universe_genesis(u);
+}
+
+static void free_universe(struct universe * const u)
+{
+	struct list_head *lh;
+	struct system *s;
+	struct civ *cv, *_cv;
+
+	ptrlist_for_each_entry(s, &u->systems, lh)
+		system_free(s);
+
+	list_for_each_entry_safe(cv, _cv, &u->civs, list) {
+		list_del(&cv->list);
+		civ_free(cv);
+		free(cv);
+	}
+
+	names_free(&u->avail_constellations);
+	names_free(&u->avail_port_names);
+	names_free(&u->avail_player_names);
+	confcache_release();
+
+	universe_free(u);
+}
+
+int main(int argc, char **argv)
+{
+	struct port_update_stats stats;
+	struct item_stats *totals;
+	struct sample s;
+	struct timespec start, step;
+	double update_secs = 0, sample_secs = 0, secs;
+	unsigned long slots = 0;
+	struct cargo *cargo;
+
+	if (parse_command_line(argc, argv))
+		die("%s", "Syntax error on command line");
+
+	log_init("yastg-economy.log");
+
+	if (seeded)
+		mtrandom_seed(seed);
+	else
+		mtrandom_init();
+	printf("PRNG master seed is %"PRIu64"\n", mtrandom_master_seed());
+
+	if (threadpool_init(&workers, threadpool_default_size()))
+		die("%s", "Could not start worker threads");
+
+	universe_init(&univ);
+	names_init(&univ.avail_constellations);
+	names_init(&univ.avail_port_names);
+	names_init(&univ.avail_player_names);
+
+	if (parse_config_files(&univ))
+		die("%s", "Could not parse config files");
+
+	if (create_universe(&univ))
+		die("%s", "Could not create universe");
+
+	if (sample_init(&s, &univ))
+		die("%s", "Out of memory");
+
+	totals = malloc(MAX(s.num_items, 1) * sizeof(*totals));
+	if (!totals)
+		die("%s", "Out of memory");
+
+	for (unsigned long i = 0; i < s.num_ports; i++) {
+		list_for_each_entry(cargo, &s.ports[i]->items, list)
+			slots++;
+	}
+
+	printf("Simulating %lu days of %lu ports with %lu cargo, using %u threads\n\n",
+			days, s.num_ports, slots, workers.num);
+
+	print_header(&s);
+	take_sample(&s, totals);
+	print_sample(&s, 0, totals);
+
+	memset(&stats, 0, sizeof(stats));
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (unsigned long day = 1; day <= days; day++) {
+		clock_gettime(CLOCK_MONOTONIC, &step);
+		update_ports(&univ, PORT_UPDATE_TICKS_PER_DAY, SIM_SHARD_SIZE, &stats);
+		update_secs += elapsed(&step);
+
+		if (day % report_every && day != days)
+			continue;
+
+		clock_gettime(CLOCK_MONOTONIC, &step);
+		take_sample(&s, totals);
+		sample_secs += elapsed(&step);
+		print_sample(&s, day, totals);
+	}
+
+	secs = elapsed(&start);
+
+	printf("\n%lu days (%lu ticks) in %.3f s, %.3f s of it updating ports and %.3f s reporting\n",
+			days, days * PORT_UPDATE_TICKS_PER_DAY, secs, update_secs, sample_secs);
+	printf("%.0f ticks/s, %.0f cargo ticks/s, %lu ports were pending on the last day\n",
+			secs > 0 ? days * PORT_UPDATE_TICKS_PER_DAY / secs : 0,
+			secs > 0 ? (double)days * PORT_UPDATE_TICKS_PER_DAY * slots / secs : 0,
+			stats.ports);
+
+	free(totals);
+	sample_free(&s);
+	free_universe(&univ);
+	threadpool_free(&workers);
+	log_close();
+
+	return 0;
+}
@@ -0,0 +1,130 @@
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include "headless.h"
+#include "buffer.h"
+#include "cli.h"
+#include "player.h"
+
+__attribute__((format(printf, 2, 3)))
+static void headless_print(void *_client, const char *fmt, ...)
+{
+	struct headless *client = _client;
+	va_list ap;
+
+	va_start(ap, fmt);
+	vbufprintf(&client->out, fmt, ap);
+	va_end(ap);
+}
+
+static void headless_attach(void *client, struct player *player)
+{
+	((struct headless*)client)->player = player;
+}
+
+static void headless_quit(void *client)
+{
+	((struct headless*)client)->quit = 1;
+}
+
+static const struct client_ops headless_client_ops = {
+	.print = headless_print,
+	.attach = headless_attach,
+	.quit = headless_quit,
+};
+
+/*
+ * Logs in as a new player, just as a new connection does
+ */
+int headless_init(struct headless *client)
+{
+	memset(client, 0, sizeof(*client));
+	buffer_init(&client->out);
+
+	client->player = player_login(&headless_client_ops, client);
+	if (!client->player)
+		return -1;
+
+	return 0;
+}
+
+/*
+ * The player is kept, waiting to be resumed, as when a connection goes away
+ */
+void headless_free(struct headless *client)
+{
+	if (client->player)
+		player_detach(client->player);
+
+	buffer_free(&client->out);
+	memset(client, 0, sizeof(*client));
+}
+
+/*
+ * out is reset under the player's lock, as other players write to it under
+ * that lock too, see player_arrive().
+ */
+static int run_cmd(struct headless *client, const char * const cmd, const int reset)
+{
+	struct player *player = client->player;
+	int r;
+
+	pthread_mutex_lock(&player->lock);
+	if (reset)
+		buffer_reset(&client->out);
+	r = cli_run_cmd(&player->cli, cmd);
+	pthread_mutex_unlock(&player->lock);
+
+	/* Left behind by resuming another player */
+	if (client->player != player)
+		player_destroy(player);
+
+	return r;
+}
+
+/*
+ * Runs a command as the player and returns what cli_run_cmd() did, which is
+ * negative for commands that don't exist. The output starts over with each
+ * command, so out has what the player was told since it was run.
+ */
+int headless_run(struct headless *client, const char * const cmd)
+{
+	return run_cmd(client, cmd, 1);
+}
+
+/*
+ * Runs a command per line of script, skipping empty lines, until the player
+ * quits. Returns the number of commands that failed. The output starts over
+ * with the first of them and is kept for all of them, up to the size a
+ * buffer can grow to.
+ */
+int headless_run_script(struct headless *client, const char * const script)
+{
+	const char *line = script, *end;
+	char *cmd;
+	int failed = 0, reset = 1;
+
+	while (*line && !client->quit) {
+		end = strchrnul(line, '\n');
+		if (end != line) {
+			cmd = strndup(line, end - line);
+			if (!cmd || run_cmd(client, cmd, reset) < 0)
+				failed++;
+			if (cmd)
+				reset = 0;
+			free(cmd);
+		}
+		line = *end ? end + 1 : end;
+	}
+
+	return failed;
+}
+
+/*
+ * What the player was told by the last command, as a string
+ */
+const char* headless_output(struct headless *client)
+{
+	return client->out.idx ? client->out.buf : "";
+}
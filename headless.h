@@ -0,0 +1,25 @@
+#ifndef _HAS_HEADLESS_H
+#define _HAS_HEADLESS_H
+
+#include "buffer.h"
+#include "player.h"
+
+/*
+ * A client run in the server process rather than over a connection, for
+ * driving players from tests, benchmarks and anything else that wants to
+ * run commands without sockets. Commands are run just as the worker of a
+ * connection runs them, and everything the player is told goes to out.
+ */
+struct headless {
+	struct player *player;
+	struct buffer out;
+	int quit;			/* Set by the quit command */
+};
+
+int headless_init(struct headless *client);
+void headless_free(struct headless *client);
+int headless_run(struct headless *client, const char * const cmd);
+int headless_run_script(struct headless *client, const char * const script);
+const char* headless_output(struct headless *client);
+
+#endif
@@ -0,0 +1,84 @@
+#include <string.h>
+#include "histogram.h"
+
+void histogram_init(struct histogram *h)
+{
+	memset(h, 0, sizeof(*h));
+}
+
+/*
+ * Adds from to to, which must not be added to meanwhile, while from may be
+ */
+void histogram_merge(struct histogram *to, const struct histogram *from)
+{
+	uint64_t max = __atomic_load_n(&from->max, __ATOMIC_RELAXED);
+
+	for (unsigned int i = 0; i < HISTOGRAM_BUCKETS; i++)
+		to->buckets[i] += __atomic_load_n(&from->buckets[i], __ATOMIC_RELAXED);
+
+	to->count += __atomic_load_n(&from->count, __ATOMIC_RELAXED);
+	to->sum += __atomic_load_n(&from->sum, __ATOMIC_RELAXED);
+	if (max > to->max)
+		to->max = max;
+}
+
+/*
+ * The largest value counted in bucket
+ */
+uint64_t histogram_bucket_max(const unsigned int bucket)
+{
+	unsigned int exp;
+	uint64_t sub;
+
+	if (bucket < HISTOGRAM_SUB_BUCKETS)
+		return bucket;
+
+	exp = bucket / HISTOGRAM_SUB_BUCKETS + HISTOGRAM_SUB_BITS - 1;
+	sub = bucket % HISTOGRAM_SUB_BUCKETS + HISTOGRAM_SUB_BUCKETS;
+
+	return ((sub + 1) << (exp - HISTOGRAM_SUB_BITS)) - 1;
+}
+
+/*
+ * The value that percentile percent of the values are at or below, rounded
+ * up to the largest of its bucket but never above the largest value. The
+ * count is taken from the buckets rather than from count, so that it adds up
+ * even if h is being added to.
+ */
+uint64_t histogram_percentile(const struct histogram *h, const double percentile)
+{
+	uint64_t total = 0, seen = 0, rank;
+	uint64_t max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+	uint64_t counts[HISTOGRAM_BUCKETS];
+	unsigned int i;
+
+	for (i = 0; i < HISTOGRAM_BUCKETS; i++) {
+		counts[i] = __atomic_load_n(&h->buckets[i], __ATOMIC_RELAXED);
+		total += counts[i];
+	}
+
+	if (!total)
+		return 0;
+
+	/* The rank of the value, counting from 1 */
+	rank = (uint64_t)(percentile / 100.0 * total + 0.5);
+	if (rank < 1)
+		rank = 1;
+	if (rank > total)
+		rank = total;
+
+	for (i = 0; i < HISTOGRAM_BUCKETS; i++) {
+		seen += counts[i];
+		if (seen >= rank)
+			break;
+	}
+
+	return histogram_bucket_max(i) < max ? histogram_bucket_max(i) : max;
+}
+
+double histogram_mean(const struct histogram *h)
+{
+	uint64_t count = __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+
+	return count ? (double)__atomic_load_n(&h->sum, __ATOMIC_RELAXED) / count : 0;
+}
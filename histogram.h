@@ -0,0 +1,61 @@
+#ifndef _HAS_HISTOGRAM_H
+#define _HAS_HISTOGRAM_H
+
+#include <stdint.h>
+
+/*
+ * Histograms of values such as latencies, with buckets that grow with the
+ * value as in HDR histograms: values below 2^HISTOGRAM_SUB_BITS each have a
+ * bucket of their own, and every power of two above that is split into
+ * 2^HISTOGRAM_SUB_BITS buckets. Any value is therefore within about 3% of
+ * the bucket it is counted in, and a histogram covers every uint64_t in a
+ * fixed number of buckets.
+ *
+ * Only one thread may add to a histogram, but any thread may read or merge
+ * it meanwhile without locking: the counters are written and read with
+ * relaxed atomics, so a reader sees each counter whole, if not all of them
+ * from the same moment.
+ */
+#define HISTOGRAM_SUB_BITS 5
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS ((64 - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+
+struct histogram {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t max;
+	uint64_t buckets[HISTOGRAM_BUCKETS];
+};
+
+static inline unsigned int histogram_bucket(const uint64_t value)
+{
+	unsigned int exp;
+
+	if (value < HISTOGRAM_SUB_BUCKETS)
+		return value;
+
+	exp = 63 - __builtin_clzll(value);
+
+	return (exp - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS +
+		(value >> (exp - HISTOGRAM_SUB_BITS)) - HISTOGRAM_SUB_BUCKETS;
+}
+
+#define histogram_bump(FIELD, VALUE) \
+	__atomic_store_n(&(FIELD), __atomic_load_n(&(FIELD), __ATOMIC_RELAXED) + (VALUE), __ATOMIC_RELAXED)
+
+static inline void histogram_add(struct histogram *h, const uint64_t value)
+{
+	histogram_bump(h->buckets[histogram_bucket(value)], 1);
+	histogram_bump(h->count, 1);
+	histogram_bump(h->sum, value);
+	if (value > __atomic_load_n(&h->max, __ATOMIC_RELAXED))
+		__atomic_store_n(&h->max, value, __ATOMIC_RELAXED);
+}
+
+void histogram_init(struct histogram *h);
+void histogram_merge(struct histogram *to, const struct histogram *from);
+uint64_t histogram_bucket_max(const unsigned int bucket);
+uint64_t histogram_percentile(const struct histogram *h, const double percentile);
+double histogram_mean(const struct histogram *h);
+
+#endif
@@ -3,11 +3,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "common.h"
 #include "item.h"
 #include "log.h"
 #include "list.h"
 #include "parseconfig.h"
+#include "port.h"
 #include "stringtrie.h"
+#include "system.h"
 #include "universe.h"
 
 static void set_base_price(struct item *item, struct config *conf)
@@ -45,18 +48,21 @@ int load_items_from_file(const char * const file, struct universe * const univer
 		item = malloc(sizeof(*item));
 		if (!item)
 			goto err;
+		item_init(item);
 
 		item->name = strdup(conf->key);
 		if (!item->name) {
+			item_free(item);
 			free(item);
 			goto err;
 		}
 
 		if (st_add_string(&universe->item_names, item->name, item)) {
-			free(item->name);
+			item_free(item);
 			free(item);
 			goto err;
 		}
+		item->id = universe->num_items++;
 
 		list_for_each_entry(child, &conf->children, list) {
 			func = st_lookup_string(&cmd_root, child->key);
@@ -81,7 +87,157 @@ err:
 	return -1;
 }
 
+void item_init(struct item * const item)
+{
+	memset(item, 0, sizeof(*item));
+	pthread_rwlock_init(&item->postings_lock, NULL);
+	price_index_init(&item->prices);
+	INIT_LIST_HEAD(&item->list);
+}
+
 void item_free(struct item * const item)
 {
+	free(item->postings);
+	pthread_rwlock_destroy(&item->postings_lock);
+	price_index_free(&item->prices);
 	free(item->name);
 }
+
+/*
+ * Returns the index of the first posting with an x coordinate of at least x.
+ * Must be called with the postings lock held.
+ */
+static size_t first_posting_after_x(const struct item * const item, const long x)
+{
+	size_t lo = 0, hi = item->num_postings, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (item->postings[mid].x < x)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+#define ITEM_POSTINGS_MIN_ALLOC 16
+int item_add_port(struct item * const item, struct port * const port)
+{
+	struct item_posting *postings;
+	size_t alloc, idx;
+
+	pthread_rwlock_wrlock(&item->postings_lock);
+
+	if (item->num_postings == item->alloc_postings) {
+		alloc = MAX(item->alloc_postings * 2, ITEM_POSTINGS_MIN_ALLOC);
+		postings = realloc(item->postings, alloc * sizeof(*postings));
+		if (!postings) {
+			pthread_rwlock_unlock(&item->postings_lock);
+			return -1;
+		}
+		item->postings = postings;
+		item->alloc_postings = alloc;
+	}
+
+	idx = first_posting_after_x(item, port->system->x);
+	memmove(&item->postings[idx + 1], &item->postings[idx],
+			(item->num_postings - idx) * sizeof(*item->postings));
+
+	item->postings[idx].port = port;
+	item->postings[idx].x = port->system->x;
+	item->postings[idx].y = port->system->y;
+	item->num_postings++;
+
+	pthread_rwlock_unlock(&item->postings_lock);
+
+	return 0;
+}
+
+/*
+ * It is not an error to remove a port that was never added; port_free()
+ * relies on this when cleaning up after a half constructed port. A posting
+ * recorded with other coordinates than the system has now, as it would be
+ * if the port was added before its system was placed, is still found by
+ * looking through all postings when it isn't where x says it should be.
+ * Leaving it would leave a pointer to a freed port behind.
+ */
+void item_rm_port(struct item * const item, struct port * const port)
+{
+	size_t idx;
+
+	pthread_rwlock_wrlock(&item->postings_lock);
+
+	for (idx = first_posting_after_x(item, port->system->x);
+			idx < item->num_postings && item->postings[idx].x == port->system->x;
+			idx++) {
+		if (item->postings[idx].port == port)
+			goto found;
+	}
+
+	for (idx = 0; idx < item->num_postings; idx++) {
+		if (item->postings[idx].port == port)
+			goto found;
+	}
+
+	goto unlock;
+
+found:
+	item->num_postings--;
+	memmove(&item->postings[idx], &item->postings[idx + 1],
+			(item->num_postings - idx) * sizeof(*item->postings));
+unlock:
+	pthread_rwlock_unlock(&item->postings_lock);
+}
+
+/*
+ * Adds all ports trading item within max_distance of origin to ports (which
+ * may be NULL if only the count is of interest). If origin is NULL, all ports
+ * trading the item are returned. Returns the number of ports found.
+ */
+unsigned long item_get_ports(struct ptrlist * const ports, struct item * const item,
+		const struct system * const origin, const long max_distance)
+{
+	struct item_posting *p, *end;
+	unsigned long num = 0;
+	long min_x = 0, max_x = 0, min_y = 0, max_y = 0;
+	double dx, dy;
+
+	/* Any distance may be asked for, so the bounds stop at what a long holds */
+	if (origin) {
+		min_x = limit_sub_long(origin->x, max_distance);
+		max_x = limit_add_long(origin->x, max_distance);
+		min_y = limit_sub_long(origin->y, max_distance);
+		max_y = limit_add_long(origin->y, max_distance);
+	}
+
+	pthread_rwlock_rdlock(&item->postings_lock);
+
+	p = item->postings;
+	end = item->postings + item->num_postings;
+	if (origin)
+		p += first_posting_after_x(item, min_x);
+
+	for (; p < end; p++) {
+		if (origin) {
+			if (p->x > max_x)
+				break;
+			if (p->y < min_y || p->y > max_y)
+				continue;
+
+			dx = p->x - origin->x;
+			dy = p->y - origin->y;
+			if (dx * dx + dy * dy >= (double)max_distance * max_distance)
+				continue;
+		}
+
+		num++;
+		if (ports)
+			ptrlist_push(ports, p->port);
+	}
+
+	pthread_rwlock_unlock(&item->postings_lock);
+
+	return num;
+}
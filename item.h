@@ -1,17 +1,45 @@
 #ifndef _HAS_ITEM_H
 #define _HAS_ITEM_H
 
+#include <pthread.h>
 #include "list.h"
+#include "price_index.h"
+#include "ptrlist.h"
 #include "universe.h"
 
+struct port;
+
+/*
+ * A posting records that a port trades an item. The coordinates of the port's
+ * system are copied into the posting so spatial queries never have to
+ * dereference the port. They are copied when the port is added, so ports must
+ * only be added once their system has been placed, see port_register().
+ */
+struct item_posting {
+	struct port *port;
+	long x, y;
+};
+
 struct item {
 	char *name;
+	unsigned int id;		/* Dense, from 0 to univ.num_items, see port_cargo() */
 	long weight;
 	long base_price;
+	struct item_posting *postings;	/* Ports trading this item, sorted by x */
+	size_t num_postings;
+	size_t alloc_postings;
+	pthread_rwlock_t postings_lock;
+	struct price_index prices;	/* At every port trading this item */
 	struct list_head list;
 };
 
 int load_items_from_file(const char * const file, struct universe * const universe);
+void item_init(struct item * const item);
 void item_free(struct item * const item);
 
+int item_add_port(struct item * const item, struct port * const port);
+void item_rm_port(struct item * const item, struct port * const port);
+unsigned long item_get_ports(struct ptrlist * const ports, struct item * const item,
+		const struct system * const origin, const long max_distance);
+
 #endif
@@ -2,9 +2,11 @@
 #include <assert.h>
 #include <basedir.h>
 #include <basedir_fs.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "confcache.h"
 #include "list.h"
 #include "loadconfig.h"
 #include "log.h"
@@ -101,6 +103,65 @@ err:
 	return -1;
 }
 
+/*
+ * Lists the data files in the order they are loaded, which is what the config
+ * cache is checked against.
+ */
+static struct confcache_source* list_sources(const struct config_type configs[],
+		const size_t len, size_t *num)
+{
+	struct confcache_source *sources;
+	struct file_list *f;
+	size_t i, n = 0;
+
+	for (i = 0; i < len; i++) {
+		list_for_each_entry(f, &configs[i].head, list)
+			n++;
+	}
+
+	sources = malloc(MAX(n, 1) * sizeof(*sources));
+	if (!sources)
+		return NULL;
+
+	n = 0;
+	for (i = 0; i < len; i++) {
+		list_for_each_entry(f, &configs[i].head, list) {
+			sources[n].key = configs[i].key;
+			sources[n].file = f->name;
+			n++;
+		}
+	}
+
+	*num = n;
+	return sources;
+}
+
+#define CACHE_DIR "/yastg"
+#define CACHE_FILE CACHE_DIR "/config.cache"
+static char* get_cache_file()
+{
+	const char *home;
+	char *file;
+
+	home = xdgCacheHome(&xdg_handle);
+	if (!home)
+		return NULL;
+
+	file = malloc(strlen(home) + sizeof(CACHE_FILE));
+	if (!file)
+		return NULL;
+
+	sprintf(file, "%s" CACHE_DIR, home);
+	if (xdgMakePath(file, 0700)) {
+		log_printfn(LOG_CONFIG, "could not create cache directory \"%s\"", file);
+		free(file);
+		return NULL;
+	}
+
+	sprintf(file, "%s" CACHE_FILE, home);
+	return file;
+}
+
 static int do_load_from_files(const struct config_type configs[], const size_t len,
 		struct universe * const universe)
 {
@@ -195,9 +256,129 @@ err:
 	return -1;
 }
 
+struct key_val {
+	char *key;
+	unsigned long *val;
+};
+
+/*
+ * Settings blocks hold numbers only. Keys that are left out keep their
+ * defaults.
+ */
+static int load_settings(const struct config * const conf, const struct key_val * const key_vals,
+		const size_t num)
+{
+	struct st_root cmd_root;
+	struct config *child;
+	unsigned long *val;
+	int r = -1;
+
+	st_init(&cmd_root);
+
+	for (size_t i = 0; i < num; i++) {
+		if (st_add_string(&cmd_root, key_vals[i].key, key_vals[i].val))
+			goto out;
+	}
+
+	list_for_each_entry(child, &conf->children, list) {
+		val = st_lookup_string(&cmd_root, child->key);
+		if (!val) {
+			log_printfn(LOG_CONFIG, "unknown %s key: \"%s\"", conf->key, child->key);
+			goto out;
+		}
+
+		if (child->str || child->l < 0) {
+			log_printfn(LOG_CONFIG, "%s key \"%s\" must be a positive number",
+					conf->key, child->key);
+			goto out;
+		}
+
+		*val = child->l;
+	}
+
+	r = 0;
+out:
+	st_destroy(&cmd_root, ST_DONT_FREE_DATA);
+	return r;
+}
+
+/*
+ * The universe block sets the size of the universe, see struct
+ * universe_settings.
+ */
+static int load_universe_settings(struct universe * const universe, const struct config * const conf)
+{
+	struct key_val key_vals[] = {
+		{ .key = "systems",		.val = &universe->settings.systems },
+		{ .key = "constellationmin",	.val = &universe->settings.constellation_min },
+		{ .key = "constellationmax",	.val = &universe->settings.constellation_max },
+		{ .key = "planetsmax",		.val = &universe->settings.planets_max },
+		{ .key = "portsmax",		.val = &universe->settings.ports_max },
+		{ .key = "memorymb",		.val = &universe->settings.memory_mb },
+	};
+
+	return load_settings(conf, key_vals, ARRAY_SIZE(key_vals));
+}
+
+/*
+ * The checkpoint block sets how often the running universe is written to
+ * its snapshot file, see checkpoint.h.
+ */
+static int load_checkpoint_settings(struct universe * const universe, const struct config * const conf)
+{
+	struct key_val key_vals[] = {
+		{ .key = "interval",		.val = &universe->settings.checkpoint_interval },
+	};
+
+	return load_settings(conf, key_vals, ARRAY_SIZE(key_vals));
+}
+
+/*
+ * The clock block sets how fast game time runs, see scheduler.h.
+ */
+static int load_clock_settings(struct universe * const universe, const struct config * const conf)
+{
+	struct key_val key_vals[] = {
+		{ .key = "rate",		.val = &universe->settings.clock_rate },
+	};
+
+	return load_settings(conf, key_vals, ARRAY_SIZE(key_vals));
+}
+
+/*
+ * The npc block sets how many NPC traders the server runs, see npc.h.
+ */
+static int load_npc_settings(struct universe * const universe, const struct config * const conf)
+{
+	struct key_val key_vals[] = {
+		{ .key = "traders",		.val = &universe->settings.npcs },
+	};
+
+	return load_settings(conf, key_vals, ARRAY_SIZE(key_vals));
+}
+
+/*
+ * The players block sets how many players that nobody plays are kept, and
+ * for how long, see player_detach().
+ */
+static int load_player_settings(struct universe * const universe, const struct config * const conf)
+{
+	struct key_val key_vals[] = {
+		{ .key = "detached_max",	.val = &universe->settings.detached_max },
+		{ .key = "detached_expiry",	.val = &universe->settings.detached_expiry },
+	};
+
+	return load_settings(conf, key_vals, ARRAY_SIZE(key_vals));
+}
+
 static int load_config(struct universe * const universe, struct list_head * const config_root)
 {
+	struct list_head settings = LIST_HEAD_INIT(settings);
+	struct config *conf, *_conf;
 	struct file_list *f, *_f;
+	struct confcache_source *sources = NULL;
+	size_t num_sources = 0;
+	char *cache = NULL;
 	int r = 0;
 
 	/*
@@ -222,10 +403,42 @@ static int load_config(struct universe * const universe, struct list_head * cons
 	for (size_t i = 0; i < ARRAY_SIZE(configs); i++)
 		INIT_LIST_HEAD(&configs[i].head);
 
+	/* Settings blocks aren't file names, so move them out of the way first */
+	list_for_each_entry_safe(conf, _conf, config_root, list) {
+		if (!strcasecmp(conf->key, "universe") || !strcasecmp(conf->key, "checkpoint") ||
+				!strcasecmp(conf->key, "clock") || !strcasecmp(conf->key, "npc") ||
+				!strcasecmp(conf->key, "players"))
+			list_move_tail(&conf->list, &settings);
+	}
+
+	list_for_each_entry(conf, &settings, list) {
+		if (!strcasecmp(conf->key, "universe"))
+			r = load_universe_settings(universe, conf);
+		else if (!strcasecmp(conf->key, "checkpoint"))
+			r = load_checkpoint_settings(universe, conf);
+		else if (!strcasecmp(conf->key, "npc"))
+			r = load_npc_settings(universe, conf);
+		else if (!strcasecmp(conf->key, "players"))
+			r = load_player_settings(universe, conf);
+		else
+			r = load_clock_settings(universe, conf);
+		if (r)
+			goto cleanup;
+	}
+
 	r = build_list_of_file_names(configs, ARRAY_SIZE(configs), config_root);
 	if (r)
 		goto cleanup;
 
+	/* Without a cache, everything is simply parsed every time */
+	sources = list_sources(configs, ARRAY_SIZE(configs), &num_sources);
+	cache = get_cache_file();
+	if (sources && cache) {
+		r = confcache_load(universe, cache, sources, num_sources);
+		if (r <= 0)
+			goto cleanup;
+	}
+
 	r = do_load_from_files(configs, ARRAY_SIZE(configs), universe);
 	if (r)
 		goto cleanup;
@@ -234,7 +447,13 @@ static int load_config(struct universe * const universe, struct list_head * cons
 	if (r)
 		goto cleanup;
 
+	if (sources && cache)
+		confcache_save(universe, cache, sources, num_sources);
+
 cleanup:
+	free(cache);
+	free(sources);
+	destroy_config(&settings);
 	for (size_t i = 0; i < ARRAY_SIZE(configs); i++) {
 		list_for_each_entry_safe(f, _f, &configs[i].head, list) {
 			list_del(&f->list);
@@ -280,19 +499,51 @@ static int is_config_sane(struct universe * const universe)
 		r = 0;
 	}
 
+	if (!universe->settings.systems) {
+		log_printfn(LOG_CONFIG, "error: universe must have at least one system");
+		r = 0;
+	}
+
+	if (!universe->settings.constellation_min ||
+			universe->settings.constellation_min > universe->settings.constellation_max) {
+		log_printfn(LOG_CONFIG, "error: constellations must have between %lu and %lu systems",
+				universe->settings.constellation_min,
+				universe->settings.constellation_max);
+		r = 0;
+	}
+
+	if (!universe->settings.planets_max) {
+		log_printfn(LOG_CONFIG, "error: systems must be allowed at least one planet");
+		r = 0;
+	}
+
+	if (!universe->settings.clock_rate) {
+		log_printfn(LOG_CONFIG, "error: the clock rate must be at least 1");
+		r = 0;
+	}
+
 	if (!is_names_loaded(&universe->avail_constellations)) {
 		log_printfn(LOG_CONFIG, "error: no constellations loaded");
 		r = 0;
+	} else {
+		log_printfn(LOG_CONFIG, "%"PRIu64" unique constellation names available",
+				names_capacity(&universe->avail_constellations));
 	}
 
 	if (!is_names_loaded(&universe->avail_port_names)) {
 		log_printfn(LOG_CONFIG, "error: no port names loaded");
 		r = 0;
+	} else {
+		log_printfn(LOG_CONFIG, "%"PRIu64" unique port names available",
+				names_capacity(&universe->avail_port_names));
 	}
 
 	if (!is_names_loaded(&universe->avail_player_names)) {
 		log_printfn(LOG_CONFIG, "error: no player names loaded");
 		r = 0;
+	} else {
+		log_printfn(LOG_CONFIG, "%"PRIu64" unique player names available",
+				names_capacity(&universe->avail_player_names));
 	}
 
 	return r;
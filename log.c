@@ -19,11 +19,34 @@ static const char subsystems[LOG_SUBSYSTEM_NUM][16] = {
 	"main",
 	"panic",
 	"port_update",
+	"scheduler",
 	"server"
 };
 
+/*
+ * A child forked while another thread is logging would inherit a locked
+ * mutex it can never unlock, so fork() waits for the log to be free.
+ */
+static void log_prepare_fork()
+{
+	pthread_mutex_lock(&log_mutex);
+}
+
+static void log_after_fork()
+{
+	pthread_mutex_unlock(&log_mutex);
+}
+
+static pthread_once_t log_atfork_once = PTHREAD_ONCE_INIT;
+static void log_register_atfork()
+{
+	if (pthread_atfork(log_prepare_fork, log_after_fork, log_after_fork))
+		die("%s", "Failed registering log fork handlers");
+}
+
 void log_init(const char * const name)
 {
+	pthread_once(&log_atfork_once, log_register_atfork);
 	if (pthread_mutex_init(&log_mutex, NULL) != 0)
 		die("%s", "Failed initializing log mutex");
 	if ((log_fd = fopen(name, "a+")) == NULL)
@@ -32,6 +55,7 @@ void log_init(const char * const name)
 
 void log_init_stdout()
 {
+	pthread_once(&log_atfork_once, log_register_atfork);
 	if (pthread_mutex_init(&log_mutex, NULL) != 0)
 		die("%s", "Failed initializing log mutex");
 	log_fd = stdout;
@@ -7,6 +7,7 @@ enum log_subsystems {
 	LOG_MAIN,
 	LOG_PANIC,
 	LOG_PORT_UPDATE,
+	LOG_SCHED,
 	LOG_SERVER,
 	LOG_SUBSYSTEM_NUM
 };
@@ -1,3 +1,5 @@
+#include <errno.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
@@ -8,19 +10,23 @@
 #include <time.h>
 #include <math.h>
 #include <pthread.h>
+#include <sys/resource.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <malloc.h>
 #include <dlfcn.h>
 
 #include "config.h"
+#include "checkpoint.h"
 #include "common.h"
+#include "confcache.h"
 #include "loadconfig.h"
 #include "console.h"
 #include "log.h"
 #include "mtrandom.h"
 #include "cli.h"
 #include "ptrlist.h"
+#include "scheduler.h"
 #include "server.h"
 #include "system.h"
 #include "port.h"
@@ -35,18 +41,26 @@
 #include "parseconfig.h"
 #include "civ.h"
 #include "names.h"
+#include "snapshot.h"
 #include "module.h"
+#include "threadpool.h"
+#include "wal.h"
 
 #define PORT "2049"
 #define BACKLOG 16
 
-const char* options = "d";
+const char* options = "dl:s:w:";
 int detached = 0;
+int seeded = 0;
+uint64_t seed;
+char *snapshot_file = NULL;
+char *wal_file = NULL;
 
 extern int sockfd;
 
 static int parse_command_line(int argc, char **argv)
 {
+	char *end;
 	char c;
 	while ((c = getopt(argc, argv, options)) > 0) {
 		switch (c) {
@@ -54,6 +68,19 @@ static int parse_command_line(int argc, char **argv)
 			printf("Detached mode\n");
 			detached = 1;
 			break;
+		case 'l':
+			snapshot_file = optarg;
+			break;
+		case 's':
+			errno = 0;
+			seed = strtoull(optarg, &end, 0);
+			if (errno || end == optarg || *end != '\0')
+				return -1;
+			seeded = 1;
+			break;
+		case 'w':
+			wal_file = optarg;
+			break;
 		default:
 			return -1;
 		}
@@ -69,12 +96,41 @@ static void open_log_file()
 	log_printfn(LOG_MAIN, "This is %s, built %s %s", PACKAGE_VERSION, __DATE__, __TIME__);
 }
 
+static long max_rss_kb()
+{
+	struct rusage usage;
+
+	if (getrusage(RUSAGE_SELF, &usage))
+		return 0;
+
+	return usage.ru_maxrss;
+}
+
+/*
+ * The universe is either loaded from a snapshot or created from scratch. Both
+ * are timed, along with the peak RSS, so the two can be compared.
+ */
 static int create_universe(struct universe * const u)
 {
-	printf("Creating universe\n");
+	struct timespec start, end;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	if (snapshot_file) {
+		printf("Loading universe from %s\n", snapshot_file);
+		if (snapshot_load(u, snapshot_file))
+			return -1;
+	} else {
+		printf("Creating universe\n");
+		if (universe_genesis(u))
+			return -1;
+	}
 
-	if (universe_genesis(u))
-		return -1;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	log_printfn(LOG_MAIN, "universe with %lu systems %s in %.3f s using %ld KiB RSS (seed %"PRIu64")",
+			ptrlist_len(&u->systems), (snapshot_file ? "loaded" : "created"),
+			(end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9,
+			max_rss_kb(), mtrandom_master_seed());
 
 	return 0;
 }
@@ -126,7 +182,14 @@ int main(int argc, char **argv)
 		die("%s", "Syntax error on command line");
 
 	srand(time(NULL));
-	mtrandom_init();
+	if (seeded)
+		mtrandom_seed(seed);
+	else
+		mtrandom_init();
+	printf("PRNG master seed is %"PRIu64"\n", mtrandom_master_seed());
+
+	if (threadpool_init(&workers, threadpool_default_size()))
+		die("%s", "Could not start worker threads");
 
 	universe_init(&univ);
 	names_init(&univ.avail_constellations);
@@ -139,6 +202,21 @@ int main(int argc, char **argv)
 	if (create_universe(&univ))
 		die("%s", "Could not create universe");
 
+	if (wal_file) {
+		if (wal_replay(&wal, wal_file, univ.wal_lsn))
+			die("Could not replay write-ahead log %s", wal_file);
+		if (wal_open(&wal, wal_file, snapshot_file ? snapshot_file : SNAPSHOT_DEFAULT_FILE))
+			die("Could not open write-ahead log %s", wal_file);
+	}
+
+	if (univ.settings.checkpoint_interval &&
+			start_checkpoints(snapshot_file ? snapshot_file : SNAPSHOT_DEFAULT_FILE,
+				univ.settings.checkpoint_interval))
+		die("%s", "Could not start checkpoint thread");
+
+	if (sched_init(&sched, univ.settings.clock_rate) || sched_start(&sched))
+		die("%s", "Could not start scheduler thread");
+
 	if (start_server(&server))
 		die("%s", "Could not start server thread");
 
@@ -156,12 +234,22 @@ int main(int argc, char **argv)
 	stop_server(&server);
 	pthread_join(console.thread, NULL);
 	pthread_join(server.thread, NULL);
+	sched_stop(&sched);
+	if (univ.settings.checkpoint_interval)
+		stop_checkpoints();
+	wal_close(&wal);
 
 	log_printfn(LOG_MAIN, "cleaning up");
 	printf("Cleaning up ... ");
 
 	console_free(&console);
 
+	struct player *p, *_p;
+	list_for_each_entry_safe(p, _p, &univ.players, list) {
+		list_del(&p->list);
+		player_free(p);
+	}
+
 	struct list_head *lh;
 	struct system *s;
 	ptrlist_for_each_entry(s, &univ.systems, lh) {
@@ -178,8 +266,11 @@ int main(int argc, char **argv)
 	names_free(&univ.avail_constellations);
 	names_free(&univ.avail_port_names);
 	names_free(&univ.avail_player_names);
+	confcache_release();
 
 	universe_free(&univ);
+	sched_free(&sched);
+	threadpool_free(&workers);
 	log_close();
 
 	printf("done.\n");
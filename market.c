@@ -0,0 +1,606 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "market.h"
+#include "common.h"
+#include "item.h"
+#include "player.h"
+#include "port.h"
+#include "ship.h"
+#include "trade.h"
+#include "universe.h"
+#include "wal.h"
+
+void market_init(struct market *market)
+{
+	memset(market, 0, sizeof(*market));
+	pthread_rwlock_init(&market->lock, NULL);
+	market->next_id = 1;
+}
+
+void market_free(struct market *market)
+{
+	if (market->books) {
+		for (unsigned int i = 0; i < univ.num_items; i++) {
+			free(market->books[i].bids.levels);
+			free(market->books[i].asks.levels);
+		}
+		free(market->books);
+	}
+
+	for (unsigned long i = 0; i < market->num_chunks; i++)
+		free(market->chunks[i]);
+	free(market->chunks);
+
+	pthread_rwlock_destroy(&market->lock);
+}
+
+static struct order* alloc_order(struct market *market)
+{
+	struct order *order, *chunk, **chunks;
+
+	if (!market->free) {
+		chunks = realloc(market->chunks, (market->num_chunks + 1) * sizeof(*chunks));
+		if (!chunks)
+			return NULL;
+		market->chunks = chunks;
+
+		chunk = malloc(MARKET_POOL_CHUNK * sizeof(*chunk));
+		if (!chunk)
+			return NULL;
+		chunks[market->num_chunks++] = chunk;
+
+		for (unsigned long i = MARKET_POOL_CHUNK; i-- > 0;) {
+			chunk[i].next = market->free;
+			market->free = &chunk[i];
+		}
+	}
+
+	order = market->free;
+	market->free = order->next;
+
+	memset(order, 0, sizeof(*order));
+	INIT_LIST_HEAD(&order->owner_list);
+
+	return order;
+}
+
+static void free_order(struct market *market, struct order *order)
+{
+	order->next = market->free;
+	market->free = order;
+}
+
+static struct order_book* get_book(struct market *market, struct item *item)
+{
+	if (!market->books) {
+		market->books = calloc(MAX(univ.num_items, 1), sizeof(*market->books));
+		if (!market->books)
+			return NULL;
+	}
+
+	return &market->books[item->id];
+}
+
+static struct book_side* book_side(struct order_book *book, const enum order_side side)
+{
+	return side == ORDER_BUY ? &book->bids : &book->asks;
+}
+
+/*
+ * Whether price a is better than price b for an order on side. Bids are
+ * kept with the price going up and asks with it going down.
+ */
+static int better(const enum order_side side, const long a, const long b)
+{
+	return side == ORDER_BUY ? a > b : a < b;
+}
+
+/*
+ * The index of the level at price, or of where it would go
+ */
+static unsigned long find_level(const struct book_side * const bs,
+		const enum order_side side, const long price)
+{
+	unsigned long lo = 0, hi = bs->num_levels, mid;
+
+	/* Nearly every price is at or next to the best one */
+	if (!hi || better(side, price, bs->levels[hi - 1].price))
+		return hi;
+	if (bs->levels[hi - 1].price == price)
+		return hi - 1;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (better(side, price, bs->levels[mid].price))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+static struct price_level* get_level(struct book_side *bs, const enum order_side side,
+		const long price)
+{
+	unsigned long i = find_level(bs, side, price);
+	struct price_level *levels;
+	unsigned long alloc;
+
+	if (i < bs->num_levels && bs->levels[i].price == price)
+		return &bs->levels[i];
+
+	if (bs->num_levels == bs->alloc_levels) {
+		alloc = MAX(bs->alloc_levels * 2, 16);
+		levels = realloc(bs->levels, alloc * sizeof(*levels));
+		if (!levels)
+			return NULL;
+		bs->levels = levels;
+		bs->alloc_levels = alloc;
+	}
+
+	memmove(&bs->levels[i + 1], &bs->levels[i], (bs->num_levels - i) * sizeof(*bs->levels));
+	bs->num_levels++;
+
+	memset(&bs->levels[i], 0, sizeof(bs->levels[i]));
+	bs->levels[i].price = price;
+
+	return &bs->levels[i];
+}
+
+static void rm_level(struct book_side *bs, struct price_level *level)
+{
+	unsigned long i = level - bs->levels;
+
+	memmove(&bs->levels[i], &bs->levels[i + 1], (bs->num_levels - i - 1) * sizeof(*bs->levels));
+	bs->num_levels--;
+}
+
+/*
+ * Puts order at its price level after every order posted before it, which
+ * is last unless it is being restored.
+ */
+static int add_to_book(struct order_book *book, struct order *order)
+{
+	struct book_side *bs = book_side(book, order->side);
+	struct price_level *level = get_level(bs, order->side, order->price);
+	struct order *prev;
+
+	if (!level)
+		return -1;
+
+	for (prev = level->last; prev && prev->id > order->id; prev = prev->prev)
+		;
+
+	order->prev = prev;
+	order->next = prev ? prev->next : level->first;
+	if (order->next)
+		order->next->prev = order;
+	else
+		level->last = order;
+	if (prev)
+		prev->next = order;
+	else
+		level->first = order;
+
+	level->amount += order->amount;
+	order->in_book = 1;
+
+	return 0;
+}
+
+static void rm_from_book(struct order_book *book, struct order *order)
+{
+	struct book_side *bs = book_side(book, order->side);
+	unsigned long i = find_level(bs, order->side, order->price);
+	struct price_level *level = &bs->levels[i];
+
+	assert(i < bs->num_levels && level->price == order->price);
+
+	if (order->prev)
+		order->prev->next = order->next;
+	else
+		level->first = order->next;
+	if (order->next)
+		order->next->prev = order->prev;
+	else
+		level->last = order->prev;
+
+	level->amount -= order->amount;
+	order->in_book = 0;
+
+	if (!level->first)
+		rm_level(bs, level);
+}
+
+/*
+ * The buyer gets the goods and whatever it offered above price back, the
+ * seller gets price for every one
+ */
+static void fill(struct order *buy, struct order *sell, const long amount, const long price)
+{
+	buy->amount -= amount;
+	buy->goods += amount;
+	buy->credits += (buy->price - price) * amount;
+
+	sell->amount -= amount;
+	sell->credits += price * amount;
+}
+
+static int crosses(const struct order * const order, const long price)
+{
+	return order->side == ORDER_BUY ? price <= order->price : price >= order->price;
+}
+
+/*
+ * Fills order from the other side of book, best price first and oldest
+ * first at every price. Returns how much was filled.
+ */
+static long match(struct order_book *book, struct order *order)
+{
+	struct book_side *bs = book_side(book, order->side == ORDER_BUY ? ORDER_SELL : ORDER_BUY);
+	struct price_level *level;
+	struct order *maker;
+	long amount, filled = 0;
+
+	while (order->amount && bs->num_levels) {
+		level = &bs->levels[bs->num_levels - 1];
+		if (!crosses(order, level->price))
+			break;
+
+		maker = level->first;
+		amount = MIN(order->amount, maker->amount);
+		if (order->side == ORDER_BUY)
+			fill(order, maker, amount, level->price);
+		else
+			fill(maker, order, amount, level->price);
+		level->amount -= amount;
+		filled += amount;
+
+		if (!maker->amount) {
+			level->first = maker->next;
+			if (level->first)
+				level->first->prev = NULL;
+			else
+				level->last = NULL;
+			maker->in_book = 0;
+
+			if (!level->first)
+				bs->num_levels--;
+		}
+
+		wal_log_order(&wal, maker);
+	}
+
+	return filled;
+}
+
+/*
+ * Hands the owner what is waiting in order, as far as it fits in the hold
+ * of ship, and frees the order if nothing is left of it. Returns 0 if there
+ * was nothing to do.
+ */
+static int collect(struct market *market, struct order *order, struct ship *ship)
+{
+	struct player *player = order->owner;
+	struct item *item = order->item;
+	long held, amount;
+
+	if (!order->goods && !order->credits && order->amount)
+		return 0;
+
+	player->credits += order->credits;
+	order->credits = 0;
+
+	held = ship_cargo_amount(ship, item);
+	amount = MIN(order->goods, ship_room(ship, item));
+	amount = MIN(amount, LONG_MAX - held);
+	ship_set_cargo(ship, item, held + amount);
+	order->goods -= amount;
+
+	wal_log_order(&wal, order);
+	wal_log_hold(&wal, player, item);
+
+	if (!order->amount && !order->goods) {
+		list_del(&order->owner_list);
+		free_order(market, order);
+	}
+
+	return 1;
+}
+
+static void collect_all(struct port *port, struct player *player, struct ship *ship)
+{
+	struct order *order, *_order;
+
+	list_for_each_entry_safe(order, _order, &player->orders, owner_list) {
+		if (order->port == port)
+			collect(&port->market, order, ship);
+	}
+}
+
+static unsigned int lock_market(struct port *port, struct ship *ship, struct trade_lock *locks)
+{
+	locks[0] = (struct trade_lock){ TRADE_LOCK_MARKET, &port->market.lock };
+	locks[1] = (struct trade_lock){ TRADE_LOCK_SHIP, &ship->cargo_lock };
+
+	pthread_rwlock_rdlock(&univ.ports_lock);
+	trade_lock_all(locks, 2);
+
+	return 2;
+}
+
+static void unlock_market(struct trade_lock *locks, const unsigned int num)
+{
+	trade_unlock_all(locks, num);
+	pthread_rwlock_unlock(&univ.ports_lock);
+}
+
+/*
+ * Posts an order for amount of item at price on the market of port, where
+ * the player's current ship must be docked. What the order offers is taken
+ * from the player right away, see market.h. The new order's ID is stored in
+ * id, and how much of it was filled at once in filled.
+ *
+ * Must be called with the player's lock held, see struct player.
+ */
+enum trade_status market_post(struct port *port, struct player *player, struct item *item,
+		const enum order_side side, const long price, const long amount,
+		uint64_t *id, long *filled)
+{
+	struct market *market = &port->market;
+	struct ship *ship = player->pos;
+	enum trade_status status = TRADE_OK;
+	struct trade_lock locks[2];
+	struct order_book *book;
+	struct order *order;
+	unsigned int num;
+
+	if (amount <= 0 || price <= 0)
+		return TRADE_ERROR;
+
+	num = lock_market(port, ship, locks);
+
+	book = get_book(market, item);
+	if (!book) {
+		status = TRADE_ERROR;
+		goto unlock;
+	}
+
+	if (side == ORDER_SELL && ship_cargo_amount(ship, item) < amount) {
+		status = TRADE_NOT_ENOUGH;
+		goto unlock;
+	} else if (side == ORDER_BUY && amount > MAX(player->credits, 0) / price) {
+		status = TRADE_NO_CREDITS;
+		goto unlock;
+	}
+
+	order = alloc_order(market);
+	if (!order) {
+		status = TRADE_ERROR;
+		goto unlock;
+	}
+
+	order->id = market->next_id++;
+	order->owner = player;
+	order->port = port;
+	order->item = item;
+	order->side = side;
+	order->price = price;
+	order->amount = amount;
+
+	if (side == ORDER_SELL)
+		ship_set_cargo(ship, item, ship_cargo_amount(ship, item) - amount);
+	else
+		player->credits -= price * amount;
+	list_add_tail(&order->owner_list, &player->orders);
+
+	*id = order->id;
+	*filled = match(book, order);
+
+	if (order->amount && add_to_book(book, order)) {
+		/* Nowhere to put it, so it is cancelled */
+		if (side == ORDER_BUY)
+			order->credits += price * order->amount;
+		else
+			order->goods += order->amount;
+		order->amount = 0;
+	}
+
+	wal_log_order(&wal, order);
+	if (!collect(market, order, ship))
+		wal_log_hold(&wal, player, item);
+
+unlock:
+	unlock_market(locks, num);
+
+	return status;
+}
+
+/*
+ * Cancels the player's order id on the market of port and hands back what
+ * it still offers. Returns -1 if there is no such order.
+ *
+ * Must be called with the player's lock held, see struct player.
+ */
+int market_cancel(struct port *port, struct player *player, const uint64_t id)
+{
+	struct market *market = &port->market;
+	struct ship *ship = player->pos;
+	struct trade_lock locks[2];
+	struct order *order;
+	unsigned int num;
+
+	num = lock_market(port, ship, locks);
+
+	order = market_find_order(player, port, id);
+	if (!order) {
+		unlock_market(locks, num);
+		return -1;
+	}
+
+	if (order->in_book)
+		rm_from_book(&market->books[order->item->id], order);
+
+	if (order->side == ORDER_BUY)
+		order->credits += order->price * order->amount;
+	else
+		order->goods += order->amount;
+	order->amount = 0;
+
+	collect(market, order, ship);
+
+	unlock_market(locks, num);
+
+	return 0;
+}
+
+/*
+ * Hands the player what is waiting in its orders at port
+ *
+ * Must be called with the player's lock held, see struct player.
+ */
+void market_collect(struct port *port, struct player *player)
+{
+	struct trade_lock locks[2];
+	unsigned int num;
+
+	num = lock_market(port, player->pos, locks);
+	collect_all(port, player, player->pos);
+	unlock_market(locks, num);
+}
+
+/*
+ * Takes the orders of a player that is going away out of their books.
+ * Whatever they hold goes with the player.
+ */
+void market_drop_player(struct player *player)
+{
+	struct order *order, *_order;
+	struct market *market;
+
+	pthread_rwlock_rdlock(&univ.ports_lock);
+
+	list_for_each_entry_safe(order, _order, &player->orders, owner_list) {
+		market = &order->port->market;
+		pthread_rwlock_wrlock(&market->lock);
+
+		if (order->in_book)
+			rm_from_book(&market->books[order->item->id], order);
+		list_del(&order->owner_list);
+		free_order(market, order);
+
+		pthread_rwlock_unlock(&market->lock);
+	}
+
+	pthread_rwlock_unlock(&univ.ports_lock);
+}
+
+/*
+ * Must be called with the player's lock held, see struct player
+ */
+struct order* market_find_order(struct player *player, struct port *port, const uint64_t id)
+{
+	struct order *order;
+
+	/* Orders are nearly always looked up soon after they are posted */
+	list_for_each_entry_reverse(order, &player->orders, owner_list) {
+		if (order->port == port && order->id == id)
+			return order;
+	}
+
+	return NULL;
+}
+
+/*
+ * Sets an order of player to what was saved of it, creating it if need be,
+ * and puts it back in the book where it was. This is how snapshots and the
+ * write-ahead log put the markets back. An order that holds nothing any
+ * more is removed.
+ */
+int market_restore_order(struct player *player, struct port *port, struct item *item,
+		const uint64_t id, const enum order_side side, const long price,
+		const long amount, const long goods, const long credits)
+{
+	struct market *market = &port->market;
+	struct order_book *book;
+	struct order *order;
+	int r = -1;
+
+	if (price <= 0 || amount < 0 || goods < 0 || credits < 0)
+		return -1;
+
+	pthread_rwlock_wrlock(&market->lock);
+
+	book = get_book(market, item);
+	if (!book)
+		goto unlock;
+
+	order = market_find_order(player, port, id);
+	if (order && (order->item != item || order->side != side))
+		goto unlock;
+
+	if (!order) {
+		if (!amount && !goods && !credits) {
+			r = 0;
+			goto unlock;
+		}
+
+		order = alloc_order(market);
+		if (!order)
+			goto unlock;
+		order->id = id;
+		order->owner = player;
+		order->port = port;
+		order->item = item;
+		order->side = side;
+		list_add_tail(&order->owner_list, &player->orders);
+	}
+
+	if (order->in_book)
+		rm_from_book(book, order);
+
+	order->price = price;
+	order->amount = amount;
+	order->goods = goods;
+	order->credits = credits;
+	market->next_id = MAX(market->next_id, id + 1);
+
+	if (!amount && !goods && !credits) {
+		list_del(&order->owner_list);
+		free_order(market, order);
+	} else if (amount && add_to_book(book, order)) {
+		goto unlock;
+	}
+	r = 0;
+
+unlock:
+	pthread_rwlock_unlock(&market->lock);
+
+	return r;
+}
+
+/*
+ * Copies the best num price levels of one side of the book of item at port
+ * to levels, best first. Returns how many there were.
+ */
+unsigned long market_depth(struct port *port, struct item *item, const enum order_side side,
+		struct price_level *levels, const unsigned long num)
+{
+	struct market *market = &port->market;
+	struct book_side *bs;
+	unsigned long i = 0;
+
+	pthread_rwlock_rdlock(&market->lock);
+
+	if (market->books) {
+		bs = book_side(&market->books[item->id], side);
+		for (i = 0; i < num && i < bs->num_levels; i++)
+			levels[i] = bs->levels[bs->num_levels - 1 - i];
+	}
+
+	pthread_rwlock_unlock(&market->lock);
+
+	return i;
+}
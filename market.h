@@ -0,0 +1,97 @@
+#ifndef _HAS_MARKET_H
+#define _HAS_MARKET_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include "item.h"
+#include "list.h"
+#include "trade.h"
+
+struct player;
+struct port;
+
+/*
+ * Every port has a market where players trade with each other by limit
+ * orders, with an order book for every item. Orders are matched by price and
+ * then by time: an order is filled as far as it can be by the orders already
+ * in the book, at their prices and best first, and whatever is left of it is
+ * put in the book.
+ *
+ * What an order offers is taken from its owner when it is posted: the goods
+ * from the hold of the current ship for a sell order, the credits for a buy
+ * order. What it gets, and what is left when it is cancelled, is kept in the
+ * order until the owner collects it with market_collect() at the port, or
+ * right away for what the order got when it was posted. Matching never
+ * touches any player but the one posting, so it only needs that player's
+ * lock.
+ *
+ * A side of a book keeps its price levels in an array with the best price
+ * last, as nearly everything is posted and filled close to it. The orders
+ * come from a pool of the market, so posting doesn't allocate.
+ */
+#define MARKET_POOL_CHUNK 1024		/* Orders allocated at once */
+
+enum order_side {
+	ORDER_BUY,
+	ORDER_SELL
+};
+
+struct order {
+	uint64_t id;			/* Within the port, later orders are higher */
+	struct player *owner;
+	struct port *port;
+	struct item *item;
+	enum order_side side;
+	int in_book;
+	long price;
+	long amount;			/* Left to fill */
+	long goods;			/* Waiting for the owner */
+	long credits;			/* Waiting for the owner */
+	struct order *prev, *next;	/* At the price level, or the free list */
+	struct list_head owner_list;	/* In the orders of the owner */
+};
+
+struct price_level {
+	long price;
+	long amount;			/* Of all the orders at this price */
+	struct order *first, *last;
+};
+
+struct book_side {
+	struct price_level *levels;	/* Best price last */
+	unsigned long num_levels;
+	unsigned long alloc_levels;
+};
+
+struct order_book {
+	struct book_side bids, asks;
+};
+
+struct market {
+	pthread_rwlock_t lock;		/* Taken as TRADE_LOCK_MARKET */
+	struct order_book *books;	/* By item ID, allocated when first used */
+	struct order *free;
+	struct order **chunks;		/* Where the orders are allocated */
+	unsigned long num_chunks;
+	uint64_t next_id;
+};
+
+void market_init(struct market *market);
+void market_free(struct market *market);
+
+enum trade_status market_post(struct port *port, struct player *player, struct item *item,
+		const enum order_side side, const long price, const long amount,
+		uint64_t *id, long *filled);
+int market_cancel(struct port *port, struct player *player, const uint64_t id);
+void market_collect(struct port *port, struct player *player);
+void market_drop_player(struct player *player);
+
+struct order* market_find_order(struct player *player, struct port *port, const uint64_t id);
+int market_restore_order(struct player *player, struct port *port, struct item *item,
+		const uint64_t id, const enum order_side side, const long price,
+		const long amount, const long goods, const long credits);
+
+unsigned long market_depth(struct port *port, struct item *item, const enum order_side side,
+		struct price_level *levels, const unsigned long num);
+
+#endif
@@ -5,59 +5,186 @@
 #include <limits.h>
 #include <stdint.h>
 #include "mtrandom.h"
-#include "mt19937ar-cok.h"
 
 #define RANDOM_DEV "/dev/urandom"
 
+/*
+ * The output function is the finalizer of SplitMix64 (Stafford's "mix13"),
+ * applied to key + n * gamma. Gammas are odd and have roughly as many bit
+ * transitions as a random number, like in Java's SplittableRandom.
+ */
+#define GOLDEN_GAMMA 0x9e3779b97f4a7c15ULL
+
+/* Separates the thread streams from the streams handed out to callers */
+#define THREAD_STREAM_DOMAIN (1ULL << 63)
+
+static uint64_t master_seed;
+static unsigned long num_thread_streams;
+
+static __thread struct mtrandom_stream thread_stream;
+static __thread int thread_stream_initialized;
+static __thread struct mtrandom_stream *current_stream;
+
+static inline uint64_t mix64(uint64_t z)
+{
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+static uint64_t mix_gamma(uint64_t z)
+{
+	z = mix64(z) | 1;
+
+	if (__builtin_popcountll(z ^ (z >> 1)) < 24)
+		z ^= 0xaaaaaaaaaaaaaaaaULL;
+
+	return z;
+}
+
+static void stream_init(struct mtrandom_stream *stream, const uint64_t id)
+{
+	stream->key = mix64(master_seed ^ mix64(id + GOLDEN_GAMMA));
+	stream->gamma = mix_gamma(stream->key + GOLDEN_GAMMA);
+	stream->ctr = 0;
+}
+
+static struct mtrandom_stream* stream(void)
+{
+	if (current_stream)
+		return current_stream;
+
+	if (!thread_stream_initialized) {
+		stream_init(&thread_stream, THREAD_STREAM_DOMAIN |
+				__atomic_fetch_add(&num_thread_streams, 1, __ATOMIC_RELAXED));
+		thread_stream_initialized = 1;
+	}
+
+	return &thread_stream;
+}
+
+static inline uint64_t next(void)
+{
+	struct mtrandom_stream *s = stream();
+
+	return mix64(s->key + ++s->ctr * s->gamma);
+}
+
+/*
+ * Sets the master seed, which all streams are derived from. This must be
+ * done before any other thread draws random numbers.
+ */
+void mtrandom_seed(const uint64_t seed)
+{
+	master_seed = seed;
+	num_thread_streams = 0;
+	thread_stream_initialized = 0;
+	current_stream = NULL;
+}
+
 void mtrandom_init()
 {
 	FILE *f;
-	uint32_t seed;
-	unsigned int n;
+	uint64_t seed = (uint64_t)time(0);
+	size_t n, r;
 	if (!(f = fopen(RANDOM_DEV, "r"))) {
 		printf("No %s, initializing PRNG from system time\n", RANDOM_DEV);
-		seed = (unsigned long)time(0);
 	} else {
 		printf("%s detected, will use for PRNG initialization\n", RANDOM_DEV);
 		n = 0;
-		while (n < sizeof(seed))
-			n += fread(&seed + n, 1, sizeof(seed) - n, f);
+		while (n < sizeof(seed)) {
+			r = fread((char*)&seed + n, 1, sizeof(seed) - n, f);
+			if (!r)
+				break;
+			n += r;
+		}
 		fclose(f);
 	}
-	mt_init_genrand(seed);
+	mtrandom_seed(seed);
 }
 
-int64_t mtrandom_int64(int64_t range)
+uint64_t mtrandom_master_seed(void)
+{
+	return master_seed;
+}
+
+/*
+ * Seeds stream from the master seed and id. The same master seed and id
+ * always give the same sequence, no matter which thread uses the stream or
+ * how many other streams there are.
+ */
+void mtrandom_stream_init(struct mtrandom_stream *stream, const uint64_t id)
+{
+	assert(!(id & THREAD_STREAM_DOMAIN));
+	stream_init(stream, id);
+}
+
+/*
+ * Makes stream the current stream of the calling thread and returns the one
+ * it replaces. Pass NULL to go back to the thread's own stream.
+ */
+struct mtrandom_stream* mtrandom_set_stream(struct mtrandom_stream *stream)
+{
+	struct mtrandom_stream *prev = current_stream;
+
+	current_stream = stream;
+
+	return prev;
+}
+
+/*
+ * Fills buf with the next num numbers of the current stream. This gives the
+ * same numbers as num separate draws would, but as the numbers don't depend
+ * on each other the compiler is free to vectorize the loop.
+ */
+void mtrandom_fill(uint64_t *buf, const size_t num)
+{
+	struct mtrandom_stream *s = stream();
+	const uint64_t key = s->key, gamma = s->gamma, ctr = s->ctr;
+
+	for (size_t i = 0; i < num; i++)
+		buf[i] = mix64(key + (ctr + 1 + i) * gamma);
+
+	s->ctr += num;
+}
+
+/*
+ * Reduces a raw number from mtrandom_fill() to [0, range), or (range, 0]
+ * for negative ranges, the same way the single number functions do.
+ */
+unsigned long mtrandom_to_ulong(const uint64_t r, const unsigned long range)
 {
-	int64_t r = 0;
 	if (range == 0)
 		return range;
 
-	/*
-	 * The 31 bit shift guarantees the number is positive.
-	 * We only return a negative number if the range is negative.
-	 */
-	r |= mt_genrand_int32();
-	r <<= 31;
-	r |= mt_genrand_int32();
+	return r % range;
+}
+
+long mtrandom_to_long(const uint64_t r, const long range)
+{
+	/* The shift guarantees the number is positive */
+	const int64_t p = r >> 1;
+
+	if (range == 0)
+		return range;
 
 	if (range > 0)
-		return r % range;
+		return p % range;
 	else
-		return -(r % -range);
+		return -(p % -range);
+}
+
+int64_t mtrandom_int64(int64_t range)
+{
+	return mtrandom_to_long(next(), range);
 }
 
 uint64_t mtrandom_uint64(uint64_t range)
 {
-	uint64_t r = 0;
 	if (range == 0)
 		return range;
 
-	r |= mt_genrand_int32();
-	r <<= 32;
-	r |= mt_genrand_int32();
-
-	return r % range;
+	return next() % range;
 }
 
 unsigned int mtrandom_uint(unsigned int range)
@@ -65,15 +192,12 @@ unsigned int mtrandom_uint(unsigned int range)
 	if (range == 0)
 		return range;
 
-	return mt_genrand_int32() % range;
+	return (uint32_t)(next() >> 32) % range;
 }
 
 int mtrandom_int(int range)
 {
-	if (range == 0)
-		return range;
-
-	return mt_genrand_int32() % range;
+	return mtrandom_to_long(next(), range);
 }
 
 unsigned long mtrandom_ulong(unsigned long range)
@@ -88,13 +212,12 @@ long mtrandom_long(long range)
 
 double mtrandom_double(double range)
 {
-	/* This method will actually generate a numerical distribution error
-	   of range * 2^(-32), but it is good enough for our purposes. */
-	double r = floor(mt_genrand_real2() * range);
+	/* 53 random bits, which is all a double can hold */
+	double r = floor((next() >> 11) * 0x1.0p-53 * range);
 	return r;
 }
 
 int mtrandom_bool()
 {
-	return mt_genrand_int32() & 0x1;
+	return next() & 0x1;
 }
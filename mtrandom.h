@@ -1,9 +1,35 @@
 #ifndef _HAS_MTRANDOM_H
 #define _HAS_MTRANDOM_H
 
+#include <stddef.h>
 #include <stdint.h>
 
+/*
+ * Random numbers come from counter-based streams: the n:th number of a
+ * stream only depends on the stream's key and n, not on any other state.
+ * Streams are therefore cheap to create, and filling a buffer with numbers
+ * is a loop without dependencies between iterations.
+ *
+ * All mtrandom_* functions draw from the calling thread's current stream.
+ * Unless another one has been selected with mtrandom_set_stream(), every
+ * thread gets its own stream, derived from the master seed and the order in
+ * which threads first asked for a random number.
+ */
+struct mtrandom_stream {
+	uint64_t key;
+	uint64_t gamma;
+	uint64_t ctr;
+};
+
 void mtrandom_init();
+void mtrandom_seed(const uint64_t seed);
+uint64_t mtrandom_master_seed(void);
+void mtrandom_stream_init(struct mtrandom_stream *stream, const uint64_t id);
+struct mtrandom_stream* mtrandom_set_stream(struct mtrandom_stream *stream);
+
+void mtrandom_fill(uint64_t *buf, const size_t num);
+unsigned long mtrandom_to_ulong(const uint64_t r, const unsigned long range);
+long mtrandom_to_long(const uint64_t r, const long range);
 
 int64_t mtrandom_int64(int64_t range);
 uint64_t mtrandom_uint64(uint64_t range);
@@ -1,6 +1,7 @@
 #include <assert.h>
 #include <limits.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "common.h"
 #include "log.h"
@@ -11,7 +12,9 @@
 
 void names_init(struct name_list *l)
 {
+	memset(l, 0, sizeof(*l));
 	st_init(&l->taken);
+	pthread_mutex_init(&l->lock, NULL);
 	l->prefix = ptrarray_create();
 	l->first  = ptrarray_create();
 	l->second = ptrarray_create();
@@ -21,10 +24,18 @@ void names_init(struct name_list *l)
 void names_free(struct name_list *l)
 {
 	st_destroy(&l->taken, ST_DONT_FREE_DATA);
-	ptrarray_free(l->prefix);
-	ptrarray_free(l->first);
-	ptrarray_free(l->second);
-	ptrarray_free(l->suffix);
+	if (l->borrowed) {
+		free(l->prefix);
+		free(l->first);
+		free(l->second);
+		free(l->suffix);
+	} else {
+		ptrarray_free(l->prefix);
+		ptrarray_free(l->first);
+		ptrarray_free(l->second);
+		ptrarray_free(l->suffix);
+	}
+	pthread_mutex_destroy(&l->lock);
 }
 
 void names_load(struct name_list *l, const char * const prefix, const char * const first,
@@ -40,35 +51,110 @@ void names_load(struct name_list *l, const char * const prefix, const char * con
 		l->suffix = file_to_ptrarray(suffix, l->suffix);
 }
 
-static char* create_name(struct name_list *l)
+/*
+ * Like names_load(), but for names kept in memory that outlives the list,
+ * such as the config cache. The arrays are taken over but the names in them
+ * are never copied or freed. The list must not have any names yet.
+ */
+void names_borrow(struct name_list *l, struct ptrarray *prefix, struct ptrarray *first,
+		struct ptrarray *second, struct ptrarray *suffix)
 {
+	assert(!is_names_loaded(l) && !l->borrowed);
+
+	ptrarray_free(l->prefix);
+	ptrarray_free(l->first);
+	ptrarray_free(l->second);
+	ptrarray_free(l->suffix);
+
+	l->prefix = prefix;
+	l->first = first;
+	l->second = second;
+	l->suffix = suffix;
+	l->borrowed = 1;
+}
+
+/*
+ * A combination is numbered as ((affix * first) + first) * second + second,
+ * where the affixes are all prefixes followed by all suffixes. Empty lists
+ * count as a single empty choice so every other list can still be used.
+ */
+static uint64_t num_affixes(const struct name_list *l)
+{
+	return MAX(l->prefix->used + l->suffix->used, 1);
+}
+
+static uint64_t num_firsts(const struct name_list *l)
+{
+	return MAX(l->first->used, 1);
+}
+
+static uint64_t num_seconds(const struct name_list *l)
+{
+	return MAX(l->second->used, 1);
+}
+
+uint64_t names_capacity(struct name_list *l)
+{
+	if (!is_names_loaded(l))
+		return 0;
+
+	return num_affixes(l) * num_firsts(l) * num_seconds(l);
+}
+
+/*
+ * Returns how many more names create_unique_name() can hand out at most. It
+ * may hand out fewer if different combinations happen to spell the same
+ * name.
+ */
+uint64_t names_left(struct name_list *l)
+{
+	uint64_t capacity, left;
+
+	pthread_mutex_lock(&l->lock);
+	capacity = names_capacity(l);
+	left = (l->next < capacity ? capacity - l->next : 0);
+	pthread_mutex_unlock(&l->lock);
+
+	return left;
+}
+
+static char* create_name(struct name_list *l, uint64_t idx)
+{
+	char number[24] = "";
 	char *pr = NULL;
 	char *fi = NULL;
 	char *se = NULL;
 	char *su = NULL;
 	size_t len = 0;
+	unsigned long affix;
+
+	se = ptrarray_get(l->second, idx % num_seconds(l));
+	if (se)
+		len += strlen(se);
+	idx /= num_seconds(l);
 
-	if (mtrandom_uint(2) == 0) {
-		pr = ptrarray_get(l->prefix, mtrandom_uint(l->prefix->used));
+	fi = ptrarray_get(l->first, idx % num_firsts(l));
+	if (fi)
+		len += strlen(fi);
+	idx /= num_firsts(l);
+
+	affix = idx;
+	if (affix < l->prefix->used) {
+		pr = ptrarray_get(l->prefix, affix);
 		if (pr)
 			len += strlen(pr);
 	} else {
-		su = ptrarray_get(l->suffix, mtrandom_uint(l->suffix->used));
+		su = ptrarray_get(l->suffix, affix - l->prefix->used);
 		if (su)
 			len += strlen(su);
 	}
 
-	fi = ptrarray_get(l->first, mtrandom_uint(l->first->used));
-	if (fi)
-		len += strlen(fi);
-
-	se = ptrarray_get(l->second, mtrandom_uint(l->second->used));
-	if (se)
-		len += strlen(se);
-
 	assert(len > 0);	/* Fails if no names are loaded */
 
-	len += 4;		/* Spaces between words and ending null */
+	if (l->round)
+		len += snprintf(number, sizeof(number), "%lu", l->round + 1);
+
+	len += 5;		/* Spaces between words and ending null */
 	char *name;
 	name = malloc(len);
 	if (!name)
@@ -100,6 +186,12 @@ static char* create_name(struct name_list *l)
 		*p = ' ';
 		p++;
 	}
+	if (*number) {
+		strcpy(p, number);
+		p += strlen(number);
+		*p = ' ';
+		p++;
+	}
 	assert(*name);		/* Fails if nothing has been added to the string at all */
 	if (*(p - 1) == ' ')
 		*(p - 1) = '\0';
@@ -107,28 +199,164 @@ static char* create_name(struct name_list *l)
 	return name;
 }
 
-char* create_unique_name(struct name_list *l)
+static uint64_t mix64(uint64_t z)
 {
-	char *name = NULL;
+	z = (z ^ (z >> 33)) * 0xff51afd7ed558ccdULL;
+	z = (z ^ (z >> 33)) * 0xc4ceb9fe1a85ec53ULL;
+	return z ^ (z >> 33);
+}
+
+/*
+ * Maps idx to its place in a permutation of [0, num) chosen by key. This is a
+ * balanced Feistel network over the smallest even number of bits that can
+ * hold num, which is a permutation of [0, 4^half). Results outside [0, num)
+ * are fed through again ("cycle walking") until they land inside, which
+ * takes less than four rounds on average as num > 4^half / 4.
+ */
+#define NAMES_FEISTEL_ROUNDS 4
+static uint64_t permute(const uint64_t key, const uint64_t idx, const uint64_t num)
+{
+	unsigned int half = 1;
+	uint64_t mask, left, right, tmp;
+	uint64_t x = idx;
+
+	while (half < 32 && (1ULL << (2 * half)) < num)
+		half++;
+	mask = (1ULL << half) - 1;
 
 	do {
+		left = x >> half;
+		right = x & mask;
+		for (int r = 0; r < NAMES_FEISTEL_ROUNDS; r++) {
+			tmp = right;
+			right = left ^ (mix64(right ^ key ^ ((uint64_t)r << 56)) & mask);
+			left = tmp;
+		}
+		x = (left << half) | right;
+	} while (x >= num);
+
+	return x;
+}
+
+/*
+ * Walks the rest of the current round of the permutation, skipping names
+ * that are already taken. Must be called with l->lock held.
+ */
+static char* next_name(struct name_list *l)
+{
+	char *name = NULL;
+	uint64_t capacity;
+
+	if (!l->keyed) {
+		l->key = mtrandom_uint64(UINT64_MAX);
+		l->keyed = 1;
+	}
+
+	capacity = names_capacity(l);
+	while (l->next < capacity) {
+		name = create_name(l, permute(l->key, l->next++, capacity));
+		if (!name)
+			break;
+
+		if (!st_lookup_exact(&l->taken, name)) {
+			/*
+			 * The data pointer in the string tree merely needs to evaluate to true,
+			 * because it will never be dereferenced. Using the name string itself
+			 * is fine, even though it might not be a valid pointer in the future.
+			 */
+			if (st_add_string(&l->taken, name, name)) {
+				free(name);
+				name = NULL;
+			}
+			break;
+		}
+
 		free(name);
-		name = create_name(l);
-	} while (st_lookup_exact(&l->taken, name));
-
-	/*
-	 * The data pointer in the string tree merely needs to evaluate to true,
-	 * because it will never be dereferenced. Using the name string itself
-	 * is fine, even though it might not be a valid pointer in the future.
-	 */
-	if (st_add_string(&l->taken, name, name)) {
-		free(name);
-		return NULL;
+		name = NULL;
+	}
+
+	return name;
+}
+
+/*
+ * Hands out the names in the order of a permutation of all combinations,
+ * seeded from the PRNG on first use. Every call is a constant amount of work
+ * rather than a retry until an untaken name turns up. The taken tree is still
+ * kept, as different combinations could spell the same name.
+ *
+ * Returns NULL when the name list is exhausted.
+ */
+char* create_unique_name(struct name_list *l)
+{
+	char *name;
+
+	pthread_mutex_lock(&l->lock);
+	name = next_name(l);
+	pthread_mutex_unlock(&l->lock);
+
+	return name;
+}
+
+/*
+ * Like create_unique_name(), but when the list is exhausted it starts over
+ * and numbers the names ("Name 2", then "Name 3" and so on) instead of
+ * giving up. Returns NULL only if no names are loaded or on allocation
+ * failure.
+ */
+char* create_numbered_name(struct name_list *l)
+{
+	char *name;
+
+	pthread_mutex_lock(&l->lock);
+
+	name = next_name(l);
+	while (!name && names_capacity(l) && l->next >= names_capacity(l)) {
+		l->round++;
+		l->next = 0;
+		name = next_name(l);
 	}
 
+	pthread_mutex_unlock(&l->lock);
+
 	return name;
 }
 
+/*
+ * Marks name as handed out, so it won't be handed out again. The caller must
+ * keep name around for as long as the name list is used.
+ */
+int names_take(struct name_list *l, const char * const name)
+{
+	int r = 0;
+
+	pthread_mutex_lock(&l->lock);
+	if (!st_lookup_exact(&l->taken, name))
+		r = st_add_string(&l->taken, name, (void*)name);
+	pthread_mutex_unlock(&l->lock);
+
+	return r;
+}
+
+void names_get_state(struct name_list *l, struct names_state *state)
+{
+	pthread_mutex_lock(&l->lock);
+	state->key = l->key;
+	state->next = l->next;
+	state->round = l->round;
+	state->keyed = l->keyed;
+	pthread_mutex_unlock(&l->lock);
+}
+
+void names_set_state(struct name_list *l, const struct names_state * const state)
+{
+	pthread_mutex_lock(&l->lock);
+	l->key = state->key;
+	l->next = state->next;
+	l->round = state->round;
+	l->keyed = state->keyed;
+	pthread_mutex_unlock(&l->lock);
+}
+
 int is_names_loaded(struct name_list *l)
 {
 	if (l->prefix->used || l->first->used || l->second->used || l->suffix->used)
@@ -1,23 +1,55 @@
 #ifndef _HAS_NAMES_H
 #define _HAS_NAMES_H
 
+#include <pthread.h>
+#include <stdint.h>
 #include "list.h"
 #include "ptrarray.h"
 #include "stringtrie.h"
 
+/*
+ * Names are combinations of a prefix or a suffix, a first and a second part,
+ * where any list may be empty. Unique names are handed out by walking a
+ * pseudo-random permutation of all combinations, see create_unique_name().
+ */
 struct name_list {
 	struct ptrarray *prefix;
 	struct ptrarray *first;
 	struct ptrarray *second;
 	struct ptrarray *suffix;
 	struct st_root taken;
+	pthread_mutex_t lock;
+	uint64_t next;			/* Position in the permutation */
+	unsigned long round;		/* Times the permutation has been used up */
+	uint64_t key;
+	int keyed;			/* Is key set? Done on first use */
+	int borrowed;			/* Names belong to someone else, see names_borrow() */
+};
+
+/*
+ * Where a name list is in its permutation, so that it can be saved and later
+ * carry on handing out names where it left off.
+ */
+struct names_state {
+	uint64_t key;
+	uint64_t next;
+	uint64_t round;
+	uint64_t keyed;
 };
 
 void names_init(struct name_list *l);
 void names_free(struct name_list *l);
 void names_load(struct name_list *l, const char * const prefix, const char * const first,
 		const char * const second, const char * const suffix);
+void names_borrow(struct name_list *l, struct ptrarray *prefix, struct ptrarray *first,
+		struct ptrarray *second, struct ptrarray *suffix);
 char* create_unique_name(struct name_list *l);
+char* create_numbered_name(struct name_list *l);
+int names_take(struct name_list *l, const char * const name);
+void names_get_state(struct name_list *l, struct names_state *state);
+void names_set_state(struct name_list *l, const struct names_state * const state);
+uint64_t names_capacity(struct name_list *l);
+uint64_t names_left(struct name_list *l);
 int is_names_loaded(struct name_list *l);
 
 #endif
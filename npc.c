@@ -0,0 +1,419 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "npc.h"
+#include "cargo.h"
+#include "common.h"
+#include "item.h"
+#include "list.h"
+#include "log.h"
+#include "mtrandom.h"
+#include "player.h"
+#include "port.h"
+#include "price_index.h"
+#include "scheduler.h"
+#include "ship.h"
+#include "ship_type.h"
+#include "system.h"
+#include "threadpool.h"
+#include "trade.h"
+#include "universe.h"
+
+#define NPC_CREDITS 10000
+#define NPC_CANDIDATES 4		/* Most expensive ports looked at per item */
+#define NPC_IDLE_WAIT (10 * 60 * 1000)	/* in ms of game time */
+#define NPC_TRIP_WEIGHT (60 * 60 * 1000)	/* A trip this long halves what it is worth */
+
+static struct player* create_player(const unsigned long idx)
+{
+	struct ship_type *type = list_first_entry(&univ.ship_types, struct ship_type, list);
+	struct player *player;
+	char name[32];
+
+	player = malloc(sizeof(*player));
+	if (!player)
+		return NULL;
+
+	/* Not one of univ.players, so the name only shows in logs */
+	snprintf(name, sizeof(name), "NPC %lu", idx);
+	if (player_init(player, name)) {
+		free(player);
+		return NULL;
+	}
+
+	if (new_ship_to_player(type, player))
+		goto err;
+
+	player->pos = list_first_entry(&player->ships, struct ship, list);
+	player->postype = SHIP;
+	player->credits = NPC_CREDITS;
+
+	return player;
+
+err:
+	player_free(player);
+	return NULL;
+}
+
+/*
+ * The agents start out docked at random ports, all due at now
+ */
+int npc_pool_init(struct npc_pool *pool, const unsigned long num, const uint64_t now)
+{
+	struct port **ports = NULL, *port;
+	unsigned long num_ports = 0, i;
+	struct npc *npc;
+
+	memset(pool, 0, sizeof(*pool));
+	if (!num)
+		return 0;
+	if (list_empty(&univ.ship_types))
+		return -1;
+
+	pthread_rwlock_rdlock(&univ.ports_lock);
+	list_for_each_entry(port, &univ.ports, list)
+		num_ports++;
+	if (num_ports)
+		ports = malloc(num_ports * sizeof(*ports));
+	i = 0;
+	if (ports) {
+		list_for_each_entry(port, &univ.ports, list)
+			ports[i++] = port;
+	}
+	pthread_rwlock_unlock(&univ.ports_lock);
+
+	if (!ports)
+		return -1;
+
+	pool->agents = calloc(num, sizeof(*pool->agents));
+	pool->due = calloc(num, sizeof(*pool->due));
+	if (!pool->agents || !pool->due)
+		goto err;
+
+	for (i = 0; i < num; i++) {
+		npc = &pool->agents[i];
+		npc->player = create_player(i);
+		if (!npc->player)
+			goto err;
+		pool->num++;
+
+		npc->ship = npc->player->pos;
+		npc->port = ports[mtrandom_ulong(num_ports)];
+		npc->state = NPC_DOCKED;
+		ship_go(npc->ship, PORT, npc->port);
+		pool->due[i] = now;
+	}
+
+	free(ports);
+	return 0;
+
+err:
+	free(ports);
+	npc_pool_free(pool);
+	return -1;
+}
+
+void npc_pool_free(struct npc_pool *pool)
+{
+	for (unsigned long i = 0; i < pool->num; i++)
+		player_free(pool->agents[i].player);
+
+	free(pool->agents);
+	free(pool->due);
+	memset(pool, 0, sizeof(*pool));
+}
+
+/*
+ * Sells everything in the hold the port trades. Returns whether anything
+ * was sold.
+ */
+static int sell_hold(struct npc *npc)
+{
+	struct trade trade;
+	struct item *item;
+
+	trade_init(&trade, npc->player, npc->ship, npc->port);
+	trade.partial = 1;
+
+	list_for_each_entry(item, &univ.items, list) {
+		if (ship_cargo_amount(npc->ship, item) > 0 &&
+				trade_add_leg(&trade, item, TRADE_ALL, TRADE_SELL))
+			break;
+	}
+
+	if (!trade.num_legs)
+		return 0;
+
+	trade_run(&trade);
+
+	for (unsigned int i = 0; i < trade.num_legs; i++) {
+		if (trade.legs[i].done)
+			return 1;
+	}
+
+	return 0;
+}
+
+struct npc_plan {
+	struct item *item;
+	struct port *dest;
+	uint64_t duration;
+	long worth;
+};
+
+/*
+ * Finds the item at the agent's port that is worth the most when taken to
+ * one of the ports paying the most for it, with what the trip takes counted
+ * against it. Must be called with ports_lock held.
+ */
+static void plan_trip(struct npc *npc, struct npc_plan *plan)
+{
+	struct price_entry dearest[NPC_CANDIDATES];
+	struct price_summary summary;
+	struct port *port = npc->port;
+	struct cargo *c;
+	unsigned long n;
+	uint64_t duration;
+	long amount, worth;
+
+	memset(plan, 0, sizeof(*plan));
+
+	pthread_rwlock_rdlock(&port->items_lock);
+
+	list_for_each_entry(c, &port->items, list) {
+		if (c->price <= 0)
+			continue;
+
+		amount = MIN(cargo_amount(c), ship_room(npc->ship, c->item));
+		amount = MIN(amount, npc->player->credits / c->price);
+		if (amount <= 0)
+			continue;
+
+		n = price_index_get(&c->item->prices, &summary, NULL, dearest, NPC_CANDIDATES);
+		for (unsigned long i = 0; i < n && dearest[i].price > c->price; i++) {
+			if (dearest[i].port == port)
+				continue;
+
+			duration = ship_travel_time(npc->ship, port->system, dearest[i].port->system);
+			worth = (dearest[i].price - c->price) * amount *
+				(double)NPC_TRIP_WEIGHT / (NPC_TRIP_WEIGHT + duration);
+			if (worth > plan->worth) {
+				plan->item = c->item;
+				plan->dest = dearest[i].port;
+				plan->duration = duration;
+				plan->worth = worth;
+			}
+		}
+	}
+
+	pthread_rwlock_unlock(&port->items_lock);
+}
+
+/*
+ * With nothing worth buying here, the agent goes where some item is
+ * cheapest, picked at random, unless that is here too.
+ */
+static void plan_move(struct npc *npc, struct npc_plan *plan)
+{
+	struct price_entry cheapest;
+	struct price_summary summary;
+	struct item *item;
+	unsigned long k = mtrandom_ulong(univ.num_items);
+
+	memset(plan, 0, sizeof(*plan));
+
+	list_for_each_entry(item, &univ.items, list) {
+		if (k--)
+			continue;
+
+		if (price_index_get(&item->prices, &summary, &cheapest, NULL, 1) &&
+				cheapest.port != npc->port) {
+			plan->dest = cheapest.port;
+			plan->duration = ship_travel_time(npc->ship, npc->port->system,
+					cheapest.port->system);
+		}
+		break;
+	}
+}
+
+static void depart(struct npc_pool *pool, const unsigned long i, const uint64_t now,
+		const struct npc_plan * const plan)
+{
+	struct npc *npc = &pool->agents[i];
+
+	npc->port = plan->dest;
+	npc->state = NPC_IN_FLIGHT;
+	pool->due[i] = now + MAX(plan->duration, 1);
+}
+
+/*
+ * Everything an agent does when it is due: arriving, selling what it
+ * brought, and buying something to take somewhere else.
+ */
+static void decide(struct npc_pool *pool, const unsigned long i, const uint64_t now,
+		struct npc_stats *stats)
+{
+	struct npc *npc = &pool->agents[i];
+	struct npc_plan plan;
+	struct trade trade;
+
+	pthread_mutex_lock(&npc->player->lock);
+	stats->decisions++;
+
+	if (npc->state == NPC_IN_FLIGHT) {
+		ship_go(npc->ship, PORT, npc->port);
+		npc->state = NPC_DOCKED;
+		stats->arrivals++;
+	}
+
+	if (npc->ship->load > 0 && sell_hold(npc))
+		stats->trades++;
+
+	pthread_rwlock_rdlock(&univ.ports_lock);
+	plan_trip(npc, &plan);
+	pthread_rwlock_unlock(&univ.ports_lock);
+
+	if (plan.item) {
+		trade_init(&trade, npc->player, npc->ship, npc->port);
+		trade.partial = 1;
+		trade_add_leg(&trade, plan.item, TRADE_ALL, TRADE_BUY);
+		trade_run(&trade);
+		if (trade.legs[0].done) {
+			stats->trades++;
+			depart(pool, i, now, &plan);
+			goto unlock;
+		}
+	}
+
+	stats->idle++;
+	pthread_rwlock_rdlock(&univ.ports_lock);
+	plan_move(npc, &plan);
+	pthread_rwlock_unlock(&univ.ports_lock);
+
+	if (plan.dest)
+		depart(pool, i, now, &plan);
+	else
+		pool->due[i] = now + NPC_IDLE_WAIT;
+
+unlock:
+	pthread_mutex_unlock(&npc->player->lock);
+}
+
+struct npc_tick {
+	struct npc_pool *pool;
+	uint64_t now;
+};
+
+static void run_batch(void *data, unsigned long idx)
+{
+	struct npc_tick *tick = data;
+	struct npc_pool *pool = tick->pool;
+	unsigned long first = idx * NPC_BATCH;
+	unsigned long last = MIN(first + NPC_BATCH, pool->num);
+	struct npc_stats stats;
+
+	memset(&stats, 0, sizeof(stats));
+
+	for (unsigned long i = first; i < last; i++) {
+		if (pool->due[i] <= tick->now)
+			decide(pool, i, tick->now, &stats);
+	}
+
+	__atomic_add_fetch(&pool->stats.decisions, stats.decisions, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&pool->stats.trades, stats.trades, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&pool->stats.arrivals, stats.arrivals, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&pool->stats.idle, stats.idle, __ATOMIC_RELAXED);
+}
+
+/*
+ * Runs every agent that is due by now, in batches on the worker pool
+ */
+void npc_tick(struct npc_pool *pool, const uint64_t now)
+{
+	struct npc_tick tick = { pool, now };
+
+	threadpool_for(&workers, (pool->num + NPC_BATCH - 1) / NPC_BATCH, run_batch, &tick);
+}
+
+void npc_get_stats(struct npc_pool *pool, struct npc_stats *stats)
+{
+	stats->decisions = __atomic_load_n(&pool->stats.decisions, __ATOMIC_RELAXED);
+	stats->trades = __atomic_load_n(&pool->stats.trades, __ATOMIC_RELAXED);
+	stats->arrivals = __atomic_load_n(&pool->stats.arrivals, __ATOMIC_RELAXED);
+	stats->idle = __atomic_load_n(&pool->stats.idle, __ATOMIC_RELAXED);
+}
+
+/*
+ * The agents of the server tick as a scheduler event every
+ * NPC_TICK_INTERVAL of game time, which adds itself back until stop_npcs(),
+ * just as port updates do.
+ */
+static struct npc_pool npcs;
+static struct sched_event npc_event;
+static pthread_mutex_t npc_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t npc_cond = PTHREAD_COND_INITIALIZER;
+static int ticking, stopped, started;
+
+static void npc_tick_event(struct sched_event *ev)
+{
+	pthread_mutex_lock(&npc_lock);
+	if (stopped) {
+		pthread_mutex_unlock(&npc_lock);
+		return;
+	}
+	ticking = 1;
+	pthread_mutex_unlock(&npc_lock);
+
+	npc_tick(&npcs, ev->when);
+
+	pthread_mutex_lock(&npc_lock);
+	ticking = 0;
+	if (!stopped)
+		sched_add(&sched, ev, ev->when + NPC_TICK_INTERVAL);
+	pthread_cond_broadcast(&npc_cond);
+	pthread_mutex_unlock(&npc_lock);
+}
+
+/*
+ * Creates num agents and starts ticking them. The scheduler must be running.
+ */
+int start_npcs(const unsigned long num)
+{
+	if (!num)
+		return 0;
+	if (npc_pool_init(&npcs, num, sched_now(&sched)))
+		return -1;
+
+	log_printfn(LOG_MAIN, "%lu NPC traders are starting", npcs.num);
+
+	pthread_mutex_lock(&npc_lock);
+	stopped = 0;
+	started = 1;
+	sched_event_init(&npc_event, npc_tick_event);
+	sched_add(&sched, &npc_event, sched_now(&sched));
+	pthread_mutex_unlock(&npc_lock);
+
+	return 0;
+}
+
+/*
+ * Returns once no tick is running and no more will be, with the agents gone
+ */
+void stop_npcs(void)
+{
+	pthread_mutex_lock(&npc_lock);
+	if (!started) {
+		pthread_mutex_unlock(&npc_lock);
+		return;
+	}
+	started = 0;
+	stopped = 1;
+	sched_cancel(&sched, &npc_event);
+	while (ticking)
+		pthread_cond_wait(&npc_cond, &npc_lock);
+	pthread_mutex_unlock(&npc_lock);
+
+	npc_pool_free(&npcs);
+}
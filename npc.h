@@ -0,0 +1,60 @@
+#ifndef _HAS_NPC_H
+#define _HAS_NPC_H
+
+#include <stdint.h>
+#include "player.h"
+#include "port.h"
+#include "ship.h"
+
+/*
+ * NPC traders are agents run by the server itself. Each one is a player with
+ * a ship, but without a connection or any commands: it isn't one of
+ * univ.players and isn't saved, and it trades and travels by calling
+ * trade_run() and moving its ship rather than through the text of commands.
+ *
+ * An agent buys what it can make the most of at its port, going by the price
+ * indexes of the items, flies to where that sells best, sells it there and
+ * starts over. The game time it is next due is kept in an array of its own,
+ * so finding the due agents of a tick is a pass over contiguous memory.
+ * Agents are handed to the worker pool in batches of NPC_BATCH, which is the
+ * unit of work one thread takes at a time. Agents share nothing but the ports
+ * they trade at, which trade_run() locks.
+ */
+#define NPC_BATCH 256
+#define NPC_TICK_INTERVAL 1000		/* in ms of game time */
+
+enum npc_state {
+	NPC_DOCKED,
+	NPC_IN_FLIGHT
+};
+
+struct npc {
+	struct player *player;
+	struct ship *ship;
+	struct port *port;		/* Where it is, or is going */
+	enum npc_state state;
+};
+
+struct npc_stats {
+	unsigned long decisions;
+	unsigned long trades;		/* That moved anything */
+	unsigned long arrivals;
+	unsigned long idle;		/* Decisions that found nothing worth buying */
+};
+
+struct npc_pool {
+	struct npc *agents;
+	uint64_t *due;			/* By agent, in ms of game time */
+	unsigned long num;
+	struct npc_stats stats;		/* Added to atomically */
+};
+
+int npc_pool_init(struct npc_pool *pool, const unsigned long num, const uint64_t now);
+void npc_pool_free(struct npc_pool *pool);
+void npc_tick(struct npc_pool *pool, const uint64_t now);
+void npc_get_stats(struct npc_pool *pool, struct npc_stats *stats);
+
+int start_npcs(const unsigned long num);
+void stop_npcs(void);
+
+#endif
@@ -16,7 +16,7 @@
 #include "stringtrie.h"
 #include "system.h"
 
-static void planet_init(struct planet *p)
+void planet_init(struct planet *p)
 {
 	memset(p, 0, sizeof(*p));
 
@@ -52,16 +52,14 @@ void planet_free(struct planet *p)
 	free(p);
 }
 
-#define PLANET_MUL_ODDS 2
-#define PLANET_MUL_MAX 10 
 static int planet_gennum()
 {
-	int num = 1;
+	unsigned long num = 1;
 	unsigned int ran;
 	while ((ran = mtrandom_uint(UINT_MAX)) < UINT_MAX/PLANET_MUL_ODDS)
 		num++;
-	if (num > PLANET_MUL_MAX)
-		num = PLANET_MUL_MAX;
+	if (num > univ.settings.planets_max)
+		num = univ.settings.planets_max;
 	return num;
 }
 
@@ -125,18 +123,17 @@ static int cmp_planet_distances(const void *_p1, const void *_p2, void *data)
 		return 0;
 }
 
+#define PLANET_NUMBER_LEN 11
 int planet_populate_system(struct system* system)
 {
 	struct planet *p;
 	int num = planet_gennum();
 	int i;
 
-	pthread_rwlock_wrlock(&univ.planetnames_lock);
-
 	for (i = 0; i < num; i++) {
 		p = malloc(sizeof(*p));
 		if (!p)
-			goto err;
+			return -1;
 
 		planet_init(p);
 		planet_genesis(p, system);
@@ -145,16 +142,25 @@ int planet_populate_system(struct system* system)
 
 	ptrlist_sort(&system->planets, NULL, cmp_planet_distances);
 
+	/*
+	 * Only the naming touches the universe, so planets of different
+	 * systems can be generated in parallel.
+	 */
+	pthread_rwlock_wrlock(&univ.planetnames_lock);
+
 	struct list_head *lh;
 	i = 0;
 	ptrlist_for_each_entry(p, &system->planets, lh) {
-		p->name = malloc(strlen(system->name) + ROMAN_LEN + 2);
+		p->name = malloc(strlen(system->name) + MAX(ROMAN_LEN, PLANET_NUMBER_LEN) + 2);
 		if (!p->name) {
 			free(p);
 			goto err;
 		}
 
-		sprintf(p->name, "%s %s", system->name, roman[i]);
+		if (i < ROMAN_N)
+			sprintf(p->name, "%s %s", system->name, roman[i]);
+		else
+			sprintf(p->name, "%s %d", system->name, i + 1);
 		st_add_string(&univ.planetnames, p->name, p);
 		if (p->gname)
 			st_add_string(&univ.planetnames, p->gname, p);
@@ -5,6 +5,9 @@
 #include "ptrlist.h"
 #include "system.h"
 
+/* Every planet after the first is added with a chance of 1 in PLANET_MUL_ODDS */
+#define PLANET_MUL_ODDS 2
+
 struct planet {
 	char *name;
 	char *gname;
@@ -19,6 +22,7 @@ struct planet {
 	struct list_head list;
 };
 
+void planet_init(struct planet *p);
 void planet_free(struct planet *p);
 struct planet* createplanet();
 int planet_populate_system(struct system* system);
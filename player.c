@@ -2,18 +2,20 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <string.h>
 #include <assert.h>
+#include <inttypes.h>
 #include <ctype.h>
 #include <limits.h>
 #include "universe.h"
 #include "cargo.h"
 #include "cli.h"
 #include "common.h"
-#include "connection.h"
 #include "item.h"
 #include "log.h"
 #include "map.h"
+#include "market.h"
 #include "names.h"
 #include "port.h"
 #include "port_type.h"
@@ -21,14 +23,22 @@
 #include "planet_type.h"
 #include "player.h"
 #include "ptrlist.h"
-#include "server.h"
+#include "scan.h"
+#include "scheduler.h"
 #include "ship.h"
+#include "ship_type.h"
 #include "star.h"
 #include "stringtrie.h"
 #include "system.h"
+#include "trade.h"
+#include "wal.h"
 
-#define player_talk(PLAYER, ...)	\
-	conn_send(PLAYER->conn, __VA_ARGS__)
+/* Players without a client are waiting to be resumed and hear nothing */
+#define player_talk(PLAYER, ...)						\
+	do {									\
+		if ((PLAYER)->client)						\
+			(PLAYER)->client_ops->print((PLAYER)->client, __VA_ARGS__);	\
+	} while (0)
 
 void player_free(struct player *player)
 {
@@ -42,6 +52,7 @@ void player_free(struct player *player)
 		free(s);
 	}
 
+	pthread_mutex_destroy(&player->lock);
 	free(player);
 }
 
@@ -198,7 +209,8 @@ static void player_showplanet(struct player *player, struct planet *planet)
 static int cmd_help(void *ptr, char *param)
 {
 	struct player *player = ptr;
-	cli_print_help(&player->cli, conn_send, player->conn);
+	if (player->client)
+		cli_print_help(&player->cli, player->client_ops->print, player->client);
 	return 0;
 }
 static char cmd_help_help[] = "Short help on available commands";
@@ -207,7 +219,8 @@ static int cmd_quit(void *ptr, char *param)
 {
 	struct player *player = ptr;
 	player_talk(player, "Bye!\n");
-	server_disconnect_nicely(player->conn);
+	if (player->client)
+		player->client_ops->quit(player->client);
 	return 0;
 }
 static char cmd_quit_help[] = "Log off and terminate connection";
@@ -217,6 +230,14 @@ static int cmd_look(void *ptr, char *param)
 	struct player *player = ptr;
 	assert(player->postype == SHIP);
 	struct ship *ship = player->pos;
+
+	if (ship->in_flight) {
+		player_talk(player, "In flight to %s, arriving in %"PRIu64" s.\n",
+				ship_destination_name(ship),
+				(ship->arrival.when - MIN(sched_now(&sched), ship->arrival.when) + 999) / 1000);
+		return 0;
+	}
+
 	switch (ship->postype) {
 	case SYSTEM:
 		player_showsystem(player, ship->pos);
@@ -263,8 +284,8 @@ static int cmd_hyper(void *ptr, char *param)
 	}
 
 	if (ok) {
-		player_talk(player, "Entering %s\n", system->name);
-		player_go(player, SYSTEM, system);
+		player_talk(player, "Entering hyperspace for %s\n", system->name);
+		player_travel(player, SYSTEM, system, ship_travel_time(ship, pos, system));
 		return 0;
 	} else {
 		player_talk(player, "No hyperspace link found.\n");
@@ -277,6 +298,9 @@ static char cmd_hyper_help[] = "Travel by hyperspace to system";
 static int cmd_jump(void *ptr, char *param)
 {
 	struct player *player = ptr;
+	assert(player->postype == SHIP);
+	struct ship *ship = player->pos;
+	assert(ship->postype == SYSTEM);
 	struct system *system;
 
 	pthread_rwlock_rdlock(&univ.systemnames_lock);
@@ -285,7 +309,8 @@ static int cmd_jump(void *ptr, char *param)
 
 	if (system != NULL) {
 		player_talk(player, "Jumping to %s\n", system->name);
-		player_go(player, SYSTEM, system);
+		player_travel(player, SYSTEM, system,
+				ship_travel_time(ship, ship->pos, system) * SHIP_JUMP_SLOWDOWN);
 		return 0;
 	}
 
@@ -332,7 +357,7 @@ static int cmd_orbit(void *ptr, char *param)
 
 	if (planet && planet->system == system) {
 		player_talk(player, "Entering orbit around %s\n", planet->name);
-		player_go(player, PLANET, planet);
+		player_travel(player, PLANET, planet, SHIP_SUBLIGHT_TIME);
 		return 0;
 	}
 
@@ -369,7 +394,7 @@ static int cmd_leave_planet(void *ptr, char *param)
 	struct planet *planet = ship->pos;
 	assert(planet->system);
 	player_talk(player, "Leaving orbit around %s\n", planet->name);
-	player_go(player, SYSTEM, planet->system);
+	player_travel(player, SYSTEM, planet->system, SHIP_SUBLIGHT_TIME);
 	return 0;
 }
 static char cmd_leave_planet_help[] = "Leave planet orbit";
@@ -383,7 +408,9 @@ static int cmd_show_ships(void *ptr, char *param)
 			"Name", "Type", "Position");
 	list_for_each_entry(ship, &player->ships, list) {
 		char pos[64];
-		switch (ship->postype) {
+		if (ship->in_flight) {
+			snprintf(pos, sizeof(pos), "In flight to %s", ship_destination_name(ship));
+		} else switch (ship->postype) {
 		case SYSTEM:
 			snprintf(pos, sizeof(pos), "In %s", ((struct system*)ship->pos)->name);
 			break;
@@ -394,7 +421,7 @@ static int cmd_show_ships(void *ptr, char *param)
 			snprintf(pos, sizeof(pos), "Orbiting %s", ((struct planet*)ship->pos)->name);
 			break;
 		default:
-			bug("I don't know where player %s with connection %p is\n", player->name, player->conn);
+			bug("I don't know where player %s with client %p is\n", player->name, player->client);
 		}
 		pos[sizeof(pos) - 1] = '\0';
 
@@ -406,34 +433,6 @@ static int cmd_show_ships(void *ptr, char *param)
 }
 static char cmd_show_ships_help[] = "Information about your ships";
 
-static int cmd_trade(void *ptr, char *param)
-{
-	struct player *player = ptr;
-
-	assert(player->postype == SHIP);
-	struct ship *ship = player->pos;
-
-	assert(ship->postype == PORT);
-	struct port *port = ship->pos;
-
-	pthread_rwlock_rdlock(&port->items_lock);
-
-	struct cargo *c;
-	player_talk(player, "%-26s %-12s %-12s %-12s %-12s\n",
-			"Item", "In stock", "Max stock", "Daily change", "Price");
-	list_for_each_entry(c, &port->items, list) {
-		player_talk(player, "%-26.26s %-12ld %-12ld %-12ld %-12ld\n",
-				c->item->name, c->amount, c->max, c->daily_change, c->price);
-	}
-
-	pthread_rwlock_unlock(&port->items_lock);
-
-	player_talk(player, "\nYou have %ld credits.\n", player->credits);
-
-	return 0;
-}
-static char cmd_trade_help[] = "Trade with port";
-
 static int parse_buysell_cargo(char * const input, long *amount, char **name)
 {
 	if (!input)
@@ -447,7 +446,7 @@ static int parse_buysell_cargo(char * const input, long *amount, char **name)
 	*end = '\0';
 	*name = end + 1;
 	while (isspace(**name))
-		name++;
+		(*name)++;
 
 	if (!strcmp(input, "all")) {
 		*amount = LONG_MAX;
@@ -462,6 +461,87 @@ static int parse_buysell_cargo(char * const input, long *amount, char **name)
 	return 0;
 }
 
+/*
+ * Tells the player why leg of a trade at port could not be done
+ */
+static void talk_trade_status(struct player *player, struct port *port,
+		const struct trade_leg * const leg, const enum trade_status status)
+{
+	const char *name = leg->item->name;
+
+	switch (status) {
+	case TRADE_OK:
+		break;
+	case TRADE_NOT_TRADED:
+		if (leg->dir == TRADE_BUY)
+			player_talk(player, "%s does not supply %s\n", port->name, name);
+		else
+			player_talk(player, "%s does not accept %s\n", port->name, name);
+		break;
+	case TRADE_NOT_ENOUGH:
+		if (leg->dir == TRADE_BUY)
+			player_talk(player, "%s does not have that much %s\n", port->name, name);
+		else
+			player_talk(player, "You don't have that much %s\n", name);
+		break;
+	case TRADE_NO_CREDITS:
+		player_talk(player, "You cannot afford that much %s\n", name);
+		break;
+	case TRADE_NO_ROOM:
+		if (leg->dir == TRADE_BUY)
+			player_talk(player, "There is no room for that much %s in your hold\n", name);
+		else
+			player_talk(player, "%s has no room for that much %s\n", port->name, name);
+		break;
+	case TRADE_ERROR:
+		player_talk(player, "Something went wrong, please try again later\n");
+		break;
+	}
+}
+
+static void talk_trade_leg(struct player *player, struct port *port,
+		const struct trade_leg * const leg)
+{
+	if (leg->dir == TRADE_BUY)
+		player_talk(player, "Bought %ld %s from %s for %ld credits\n",
+				leg->done, leg->item->name, port->name, leg->credits);
+	else
+		player_talk(player, "Sold %ld %s to %s for %ld credits\n",
+				leg->done, leg->item->name, port->name, -leg->credits);
+}
+
+/*
+ * Buys or sells as much as possible of up to amount of an item
+ */
+static void buysell(struct player *player, const enum trade_dir dir,
+		const long amount, const char * const name)
+{
+	struct ship *ship = player->pos;
+	struct port *port = ship->pos;
+	enum trade_status status;
+	struct trade trade;
+	struct item *item;
+
+	item = st_lookup_string(&univ.item_names, name);
+	if (!item) {
+		if (dir == TRADE_BUY)
+			player_talk(player, "%s does not supply %s\n", port->name, name);
+		else
+			player_talk(player, "You don't have any %s\n", name);
+		return;
+	}
+
+	trade_init(&trade, player, ship, port);
+	trade.partial = 1;
+	trade_add_leg(&trade, item, amount, dir);
+
+	status = trade_run(&trade);
+	if (trade.legs[0].done)
+		talk_trade_leg(player, port, &trade.legs[0]);
+	else
+		talk_trade_status(player, port, &trade.legs[0], status);
+}
+
 static const char cmd_buy_syntax[] = "syntax: buy <amount|all> <cargo>\n";
 static int cmd_buy(void *ptr, char *param)
 {
@@ -471,56 +551,205 @@ static int cmd_buy(void *ptr, char *param)
 	struct ship *ship = player->pos;
 
 	assert(ship->postype == PORT);
-	struct port *port = ship->pos;
 
 	char *name;
 	long amount;
 	if (parse_buysell_cargo(param, &amount, &name))
 		goto syntax_err;
 
-	pthread_rwlock_wrlock(&port->items_lock);
+	buysell(player, TRADE_BUY, amount, name);
+	return 0;
 
-	struct cargo *c = st_lookup_string(&port->item_names, name);
-	if (!c) {
-		pthread_rwlock_unlock(&port->items_lock);
-		player_talk(player, "%s does not supply %s\n", port->name, name);
+syntax_err:
+	player_talk(player, "%s", cmd_buy_syntax);
+	return 0;
+}
+static char cmd_buy_help[] = "Buy goods from port";
+
+static const char cmd_sell_syntax[] = "syntax: sell <amount|all> <cargo>\n";
+static int cmd_sell(void *ptr, char *param)
+{
+	struct player *player = ptr;
+
+	assert(player->postype == SHIP);
+	struct ship *ship = player->pos;
+
+	assert(ship->postype == PORT);
+
+	char *name;
+	long amount;
+	if (parse_buysell_cargo(param, &amount, &name))
+		goto syntax_err;
+
+	buysell(player, TRADE_SELL, amount, name);
+	return 0;
+
+syntax_err:
+	player_talk(player, "%s", cmd_sell_syntax);
+	return 0;
+}
+static char cmd_sell_help[] = "Sell goods to port";
+
+static void show_market(struct player *player, struct port *port)
+{
+	struct cargo *c;
+
+	pthread_rwlock_rdlock(&port->items_lock);
+
+	player_talk(player, "%-26s %-12s %-12s %-12s %-12s\n",
+			"Item", "In stock", "Max stock", "Daily change", "Price");
+	list_for_each_entry(c, &port->items, list) {
+		player_talk(player, "%-26.26s %-12ld %-12ld %-12ld %-12ld\n",
+				c->item->name, cargo_amount(c), c->max, c->daily_change, c->price);
+	}
+
+	pthread_rwlock_unlock(&port->items_lock);
+
+	player_talk(player, "\nYou have %ld credits.\n", player->credits);
+}
+
+/*
+ * Parses "buy <amount|all> <cargo>" or "sell <amount|all> <cargo>" into a
+ * leg of trade. Returns -1 if it doesn't parse, or 1 if there is no cargo
+ * called name.
+ */
+static int parse_trade_leg(char *input, struct trade *trade, char **name)
+{
+	enum trade_dir dir;
+	struct item *item;
+	char *end;
+	long amount;
+
+	while (isspace(*input))
+		input++;
+
+	end = input + strlen(input);
+	while (end > input && isspace(*(end - 1)))
+		*--end = '\0';
+
+	if (!strncmp(input, "buy ", 4))
+		dir = TRADE_BUY;
+	else if (!strncmp(input, "sell ", 5))
+		dir = TRADE_SELL;
+	else
+		return -1;
+
+	input = strchr(input, ' ') + 1;
+	if (parse_buysell_cargo(input, &amount, name))
+		return -1;
+
+	item = st_lookup_string(&univ.item_names, *name);
+	if (!item)
+		return 1;
+
+	if (amount == LONG_MAX)
+		amount = TRADE_ALL;
+
+	return trade_add_leg(trade, item, amount, dir);
+}
+
+static const char cmd_trade_syntax[] = "syntax: trade [buy|sell <amount|all> <cargo>[, ...]]\n";
+static int cmd_trade(void *ptr, char *param)
+{
+	struct player *player = ptr;
+
+	assert(player->postype == SHIP);
+	struct ship *ship = player->pos;
+
+	assert(ship->postype == PORT);
+	struct port *port = ship->pos;
+
+	enum trade_status status;
+	struct trade trade;
+	char *leg, *save, *name;
+	int r;
+
+	if (!param) {
+		show_market(player, port);
 		return 0;
 	}
 
-	if (c->price) {
-		amount = MIN(amount, player->credits / c->price);
-		if (!amount) {
-			pthread_rwlock_unlock(&port->items_lock);
-			player_talk(player, "You cannot afford any %s\n", c->item->name);
+	trade_init(&trade, player, ship, port);
+	for (leg = strtok_r(param, ",", &save); leg; leg = strtok_r(NULL, ",", &save)) {
+		r = parse_trade_leg(leg, &trade, &name);
+		if (r < 0)
+			goto syntax_err;
+		if (r > 0) {
+			player_talk(player, "There is no such thing as %s\n", name);
 			return 0;
 		}
 	}
 
-	pthread_rwlock_wrlock(&ship->cargo_lock);
+	status = trade_run(&trade);
+	if (status != TRADE_OK) {
+		talk_trade_status(player, port, &trade.legs[trade.failed], status);
+		player_talk(player, "Nothing was traded.\n");
+		return 0;
+	}
 
-	amount = move_cargo_to_ship(ship, c, amount);
-	long price = amount * c->price;
-	player->credits -= price;
+	for (unsigned int i = 0; i < trade.num_legs; i++)
+		talk_trade_leg(player, port, &trade.legs[i]);
+	player_talk(player, "You have %ld credits.\n", player->credits);
 
-	pthread_rwlock_unlock(&ship->cargo_lock);
-	pthread_rwlock_unlock(&port->items_lock);
+	return 0;
 
-	if (amount)
-		player_talk(player, "Bought %ld %s from %s for %ld credits\n",
-				amount, c->item->name, port->name, price);
+syntax_err:
+	player_talk(player, "%s", cmd_trade_syntax);
+	return 0;
+}
+static char cmd_trade_help[] = "Show what the port trades, or buy and sell several goods at once";
+
+static const char* order_side_name(const enum order_side side)
+{
+	return side == ORDER_BUY ? "buy" : "sell";
+}
+
+/*
+ * Parses "<buy|sell> <amount> <cargo> at <price>"
+ */
+static int parse_order(char *input, enum order_side *side, long *amount,
+		char **name, long *price)
+{
+	char *end, *at, *p;
+
+	if (!input)
+		return -1;
+
+	if (!strncmp(input, "buy ", 4))
+		*side = ORDER_BUY;
+	else if (!strncmp(input, "sell ", 5))
+		*side = ORDER_SELL;
 	else
-		player_talk(player, "Cannot buy any %s\n", c->item->name);
+		return -1;
 
-	return 0;
+	input = strchr(input, ' ') + 1;
+	*amount = strtol(input, &end, 10);
+	if (end == input || !isspace(*end) || *amount <= 0)
+		return -1;
+
+	/* The name of the cargo may have " at " in it, the price doesn't */
+	at = NULL;
+	for (p = strstr(end, " at "); p; p = strstr(p + 1, " at "))
+		at = p;
+	if (!at)
+		return -1;
+
+	*price = strtol(at + 4, &p, 10);
+	if (p == at + 4 || *p != '\0' || *price <= 0)
+		return -1;
+
+	*at = '\0';
+	*name = end;
+	while (isspace(**name))
+		(*name)++;
+	if (**name == '\0')
+		return -1;
 
-syntax_err:
-	player_talk(player, "%s", cmd_buy_syntax);
 	return 0;
 }
-static char cmd_buy_help[] = "Buy goods from port";
 
-static const char cmd_sell_syntax[] = "syntax: sell <amount|all> <cargo>\n";
-static int cmd_sell(void *ptr, char *param)
+static const char cmd_post_syntax[] = "syntax: post <buy|sell> <amount> <cargo> at <price>\n";
+static int cmd_post(void *ptr, char *param)
 {
 	struct player *player = ptr;
 
@@ -530,51 +759,158 @@ static int cmd_sell(void *ptr, char *param)
 	assert(ship->postype == PORT);
 	struct port *port = ship->pos;
 
+	enum order_side side;
+	enum trade_status status;
+	long amount, price, filled;
+	struct item *item;
 	char *name;
-	long amount;
-	if (parse_buysell_cargo(param, &amount, &name))
-		goto syntax_err;
+	uint64_t id;
 
-	pthread_rwlock_wrlock(&port->items_lock);
-	pthread_rwlock_wrlock(&ship->cargo_lock);
+	if (parse_order(param, &side, &amount, &name, &price)) {
+		player_talk(player, "%s", cmd_post_syntax);
+		return 0;
+	}
 
-	if (!st_lookup_string(&ship->cargo_names, name)) {
-		player_talk(player, "You don't have any %s\n", name);
-		goto unlock;
+	item = st_lookup_string(&univ.item_names, name);
+	if (!item) {
+		player_talk(player, "There is no such thing as %s\n", name);
+		return 0;
 	}
 
-	struct cargo *c = st_lookup_string(&port->item_names, name);
-	if (!c) {
-		player_talk(player, "%s does not accept %s\n", port->name, name);
-		goto unlock;
+	status = market_post(port, player, item, side, price, amount, &id, &filled);
+	switch (status) {
+	case TRADE_OK:
+		player_talk(player, "Order %"PRIu64" to %s %ld %s at %ld posted, %ld filled at once\n",
+				id, order_side_name(side), amount, item->name, price, filled);
+		break;
+	case TRADE_NOT_ENOUGH:
+		player_talk(player, "You don't have that much %s\n", item->name);
+		break;
+	case TRADE_NO_CREDITS:
+		player_talk(player, "You cannot afford that much %s\n", item->name);
+		break;
+	default:
+		player_talk(player, "Something went wrong, please try again later\n");
 	}
-	long price;
 
-	amount = move_cargo_from_ship(ship, c, amount);
-	price = amount * c->price;
-	player->credits += price;
+	return 0;
+}
+static char cmd_post_help[] = "Post an order on the market of the port";
 
-	pthread_rwlock_unlock(&port->items_lock);
-	pthread_rwlock_unlock(&ship->cargo_lock);
+static const char cmd_cancel_syntax[] = "syntax: cancel <order>\n";
+static int cmd_cancel(void *ptr, char *param)
+{
+	struct player *player = ptr;
 
-	if (amount)
-		player_talk(player, "Sold %ld %s to %s for %ld credits\n",
-				amount, c->item->name, port->name, price);
+	assert(player->postype == SHIP);
+	struct ship *ship = player->pos;
+
+	assert(ship->postype == PORT);
+	struct port *port = ship->pos;
+
+	unsigned long long id;
+	char *end;
+
+	if (!param) {
+		player_talk(player, "%s", cmd_cancel_syntax);
+		return 0;
+	}
+
+	id = strtoull(param, &end, 10);
+	if (end == param || *end != '\0') {
+		player_talk(player, "%s", cmd_cancel_syntax);
+		return 0;
+	}
+
+	if (market_cancel(port, player, id))
+		player_talk(player, "You have no order %llu at %s\n", id, port->name);
 	else
-		player_talk(player, "Cannot sell any %s\n", c->item->name);
+		player_talk(player, "Order %llu cancelled\n", id);
 
 	return 0;
+}
+static char cmd_cancel_help[] = "Cancel an order on the market of the port";
+
+static int cmd_orders(void *ptr, char *param)
+{
+	struct player *player = ptr;
+
+	assert(player->postype == SHIP);
+	struct ship *ship = player->pos;
+
+	struct order *order;
+
+	if (ship->postype == PORT)
+		market_collect(ship->pos, player);
+
+	if (list_empty(&player->orders)) {
+		player_talk(player, "You have no orders.\n");
+		return 0;
+	}
+
+	player_talk(player, "%-8s %-26s %-5s %-10s %-20s %-10s %-10s %-10s\n",
+			"Order", "Port", "Side", "Amount", "Item", "Price",
+			"Goods", "Credits");
+	list_for_each_entry(order, &player->orders, owner_list) {
+		pthread_rwlock_rdlock(&order->port->market.lock);
+		player_talk(player, "%-8"PRIu64" %-26.26s %-5s %-10ld %-20.20s %-10ld %-10ld %-10ld\n",
+				order->id, order->port->name, order_side_name(order->side),
+				order->amount, order->item->name, order->price,
+				order->goods, order->credits);
+		pthread_rwlock_unlock(&order->port->market.lock);
+	}
+
+	if (ship->postype != PORT)
+		player_talk(player, "\nGoods and credits are handed over when you dock at the port.\n");
 
-unlock:
-	pthread_rwlock_unlock(&port->items_lock);
-	pthread_rwlock_unlock(&ship->cargo_lock);
 	return 0;
+}
+static char cmd_orders_help[] = "List your orders on markets";
+
+#define BOOK_DEPTH 5
+static const char cmd_book_syntax[] = "syntax: book <cargo>\n";
+static int cmd_book(void *ptr, char *param)
+{
+	struct player *player = ptr;
+
+	assert(player->postype == SHIP);
+	struct ship *ship = player->pos;
+
+	assert(ship->postype == PORT);
+	struct port *port = ship->pos;
+
+	struct price_level bids[BOOK_DEPTH], asks[BOOK_DEPTH];
+	unsigned long num_bids, num_asks;
+	struct item *item;
+
+	if (!param) {
+		player_talk(player, "%s", cmd_book_syntax);
+		return 0;
+	}
+
+	item = st_lookup_string(&univ.item_names, param);
+	if (!item) {
+		player_talk(player, "There is no such thing as %s\n", param);
+		return 0;
+	}
+
+	num_bids = market_depth(port, item, ORDER_BUY, bids, BOOK_DEPTH);
+	num_asks = market_depth(port, item, ORDER_SELL, asks, BOOK_DEPTH);
+	if (!num_bids && !num_asks) {
+		player_talk(player, "Nobody is trading %s at %s.\n", item->name, port->name);
+		return 0;
+	}
+
+	player_talk(player, "Orders for %s at %s\n%-6s %-12s %-12s\n",
+			item->name, port->name, "Side", "Price", "Amount");
+	for (unsigned long i = num_asks; i-- > 0;)
+		player_talk(player, "%-6s %-12ld %-12ld\n", "sell", asks[i].price, asks[i].amount);
+	for (unsigned long i = 0; i < num_bids; i++)
+		player_talk(player, "%-6s %-12ld %-12ld\n", "buy", bids[i].price, bids[i].amount);
 
-syntax_err:
-	player_talk(player, "%s", cmd_sell_syntax);
 	return 0;
 }
-static char cmd_sell_help[] = "Sell goods to port";
+static char cmd_book_help[] = "Show the best orders for goods on the market of the port";
 
 static int cmd_inventory(void *ptr, char *param)
 {
@@ -583,24 +919,29 @@ static int cmd_inventory(void *ptr, char *param)
 	assert(player->postype == SHIP);
 	struct ship *ship = player->pos;
 
+	struct item *item;
+	int empty = 1;
+
 	pthread_rwlock_rdlock(&ship->cargo_lock);
 
-	if (list_empty(&ship->cargo)) {
-		pthread_rwlock_unlock(&ship->cargo_lock);
-		player_talk(player, "Cargo hold of %s is empty.\n", ship->name);
-		return 0;
-	}
+	list_for_each_entry(item, &univ.items, list) {
+		if (!ship_cargo_amount(ship, item))
+			continue;
 
-	player_talk(player, "Cargo manifest of %s\n%-26s %-10s\n",
-			ship->name, "Name", "Amount");
+		if (empty)
+			player_talk(player, "Cargo manifest of %s\n%-26s %-10s\n",
+					ship->name, "Name", "Amount");
+		empty = 0;
 
-	struct cargo *c;
-	list_for_each_entry(c, &ship->cargo, list)
 		player_talk(player, "%-26.26s %-12ld\n",
-				c->item->name, c->amount);
+				item->name, ship_cargo_amount(ship, item));
+	}
 
 	pthread_rwlock_unlock(&ship->cargo_lock);
 
+	if (empty)
+		player_talk(player, "Cargo hold of %s is empty.\n", ship->name);
+
 	return 0;
 }
 static char cmd_inventory_help[] = "Display ship cargo manifest";
@@ -626,14 +967,14 @@ static struct system* current_player_system(struct player *player)
 		case PLANET:
 			return ((struct planet*)ship->pos)->system;
 		default:
-			bug("I don't know where ship %s (player %s, connection %p) is"
+			bug("I don't know where ship %s (player %s, client %p) is"
 					"(postype is %d)\n",
-					ship->name, player->name, player->conn,
+					ship->name, player->name, player->client,
 					player->postype);
 		}
 	default:
-		bug("I don't know where player %s with connection %p is (postype is %d)\n",
-				player->name, player->conn, player->postype);
+		bug("I don't know where player %s with client %p is (postype is %d)\n",
+				player->name, player->client, player->postype);
 	}
 }
 
@@ -679,10 +1020,205 @@ end:
 }
 static char cmd_ports_help[] = "List ports within radius; if none is specified, default is " DEF_PORT_RADIUS;
 
-void player_go(struct player *player, enum postype postype, void *pos)
+#define SCAN_TOP_N 10
+#define MAX_RADIUS (LONG_MAX / TICK_PER_LY)	/* in lys, so that it fits in ticks */
+static const char cmd_scan_syntax[] = "syntax: scan <radius> [item]\n";
+static int cmd_scan(void *_player, char *param)
+{
+	struct player *player = _player;
+	struct system *origin = current_player_system(player);
+	struct scan_pair pairs[SCAN_TOP_N];
+	struct item *item = NULL;
+	char *name = NULL;
+	long dist, num;
+
+	if (!param)
+		goto syntax_err;
+
+	name = strchr(param, ' ');
+	if (name) {
+		*name = '\0';
+		name++;
+		while (isspace(*name))
+			name++;
+	}
+
+	if (str_to_long(param, &dist) || dist <= 0 || dist > MAX_RADIUS)
+		goto syntax_err;
+	dist *= TICK_PER_LY;
+
+	if (name && *name) {
+		item = st_lookup_string(&univ.item_names, name);
+		if (!item) {
+			player_talk(player, "There is no such item as %s\n", name);
+			return 0;
+		}
+	}
+
+	num = scan_trade_routes(origin, dist, item, pairs, ARRAY_SIZE(pairs));
+	if (num < 0) {
+		player_talk(player, "error: scan failed\n");
+		return 0;
+	} else if (num == 0) {
+		player_talk(player, "No profitable trades found within %ld lys\n",
+				dist / TICK_PER_LY);
+		return 0;
+	}
+
+	player_talk(player, "Best trades within %ld lys\n"
+			"%-16s %-22s %-7s %-22s %-7s %-9s %-9s %-10s\n",
+			dist / TICK_PER_LY,
+			"Item", "Buy at", "Price", "Sell at", "Price",
+			"Amount", "Light yrs", "Profit");
+
+	for (long i = 0; i < num; i++)
+		player_talk(player, "%-16.16s %-22.22s %-7ld %-22.22s %-7ld %-9ld %9.1f %-10ld\n",
+				pairs[i].item->name,
+				pairs[i].buy->name, pairs[i].buy_price,
+				pairs[i].sell->name, pairs[i].sell_price,
+				pairs[i].amount,
+				pairs[i].distance / (double)TICK_PER_LY,
+				(pairs[i].sell_price - pairs[i].buy_price) * pairs[i].amount);
+
+	return 0;
+
+syntax_err:
+	player_talk(player, "%s", cmd_scan_syntax);
+	return 0;
+}
+static char cmd_scan_help[] = "Find the most profitable trades within radius, optionally for one item";
+
+static int cmp_port_distances(const void *_port1, const void *_port2, void *_origin)
+{
+	const struct port *port1 = _port1;
+	const struct port *port2 = _port2;
+
+	return cmp_system_distances(port1->system, port2->system, _origin);
+}
+
+static const char cmd_where_syntax[] = "syntax: where <item> [radius]\n";
+static int cmd_where(void *_player, char *param)
+{
+	struct player *player = _player;
+	struct system *origin = current_player_system(player);
+	struct list_head *lh;
+	struct ptrlist ports;
+	struct port *port;
+	struct cargo *c;
+	struct item *item;
+	char *last;
+	long dist = -1;
+
+	if (!param)
+		goto syntax_err;
+
+	/* Item names may contain spaces, so the radius is the last word, if any */
+	last = strrchr(param, ' ');
+	if (last && !str_to_long(last + 1, &dist)) {
+		if (dist <= 0 || dist > MAX_RADIUS)
+			goto syntax_err;
+		dist *= TICK_PER_LY;
+		*last = '\0';
+	} else {
+		dist = -1;
+	}
+
+	item = st_lookup_string(&univ.item_names, param);
+	if (!item) {
+		player_talk(player, "There is no such item as %s\n", param);
+		return 0;
+	}
+
+	ptrlist_init(&ports);
+	item_get_ports(&ports, item, (dist < 0 ? NULL : origin), dist);
+
+	if (!ptrlist_len(&ports)) {
+		if (dist < 0)
+			player_talk(player, "No port trades %s\n", item->name);
+		else
+			player_talk(player, "No port within %ld lys trades %s\n",
+					dist / TICK_PER_LY, item->name);
+		goto end;
+	}
+
+	ptrlist_sort(&ports, origin, cmp_port_distances);
+
+	player_talk(player, "Ports trading %s (%lu ports)\n"
+			"%-26s %-26s %-12s %-12s %-9s\n",
+			item->name, ptrlist_len(&ports),
+			"Name", "System", "In stock", "Price", "Light yrs");
+
+	ptrlist_for_each_entry(port, &ports, lh) {
+		pthread_rwlock_rdlock(&port->items_lock);
+		c = port_cargo(port, item);
+		player_talk(player, "%-26.26s %-26.26s %-12ld %-12ld %9.1f\n",
+				port->name, port->system->name, cargo_amount(c), c->price,
+				system_distance(origin, port->system) / (double)TICK_PER_LY);
+		pthread_rwlock_unlock(&port->items_lock);
+	}
+
+end:
+	ptrlist_free(&ports);
+	return 0;
+
+syntax_err:
+	player_talk(player, "%s", cmd_where_syntax);
+	return 0;
+}
+static char cmd_where_help[] = "List ports trading an item, optionally only those within radius";
+
+static void talk_price_entries(struct player *player, const char * const what,
+		struct price_entry *entries, const unsigned long num)
+{
+	player_talk(player, "%s\n", what);
+	for (unsigned long i = 0; i < num; i++)
+		player_talk(player, "  %-26.26s %-26.26s %-12ld\n", entries[i].port->name,
+				entries[i].port->system->name, entries[i].price);
+}
+
+#define PRICES_TOP 5
+static const char cmd_prices_syntax[] = "syntax: prices <item>\n";
+static int cmd_prices(void *_player, char *param)
+{
+	struct player *player = _player;
+	struct price_entry cheapest[PRICES_TOP], dearest[PRICES_TOP];
+	struct price_summary summary;
+	struct item *item;
+	unsigned long num;
+
+	if (!param) {
+		player_talk(player, "%s", cmd_prices_syntax);
+		return 0;
+	}
+
+	item = st_lookup_string(&univ.item_names, param);
+	if (!item) {
+		player_talk(player, "There is no such item as %s\n", param);
+		return 0;
+	}
+
+	/* The ports in the index stay around for as long as ports_lock is held */
+	pthread_rwlock_rdlock(&univ.ports_lock);
+
+	num = price_index_get(&item->prices, &summary, cheapest, dearest, PRICES_TOP);
+	if (!summary.ports) {
+		player_talk(player, "No port trades %s\n", item->name);
+		goto unlock;
+	}
+
+	player_talk(player, "Prices of %s at %lu ports: lowest %ld, highest %ld, average %ld\n",
+			item->name, summary.ports, summary.min, summary.max, summary.avg);
+	talk_price_entries(player, "Cheapest:", cheapest, num);
+	talk_price_entries(player, "Most expensive:", dearest, num);
+
+unlock:
+	pthread_rwlock_unlock(&univ.ports_lock);
+	return 0;
+}
+static char cmd_prices_help[] = "Show the lowest, highest and average price of an item, and where to find them";
+
+static void rm_position_cmds(struct player *player, struct ship *ship)
 {
-	assert(player->postype == SHIP);
-	struct ship *ship = player->pos;
 	switch (ship->postype) {
 	case SYSTEM:
 		cli_rm_cmd(&player->cli, "go");
@@ -692,8 +1228,11 @@ void player_go(struct player *player, enum postype postype, void *pos)
 		cli_rm_cmd(&player->cli, "orbit");
 		break;
 	case PORT:
+		cli_rm_cmd(&player->cli, "book");
 		cli_rm_cmd(&player->cli, "buy");
+		cli_rm_cmd(&player->cli, "cancel");
 		cli_rm_cmd(&player->cli, "leave");
+		cli_rm_cmd(&player->cli, "post");
 		cli_rm_cmd(&player->cli, "sell");
 		cli_rm_cmd(&player->cli, "trade");
 		break;
@@ -704,14 +1243,12 @@ void player_go(struct player *player, enum postype postype, void *pos)
 	case NONE:
 		break;
 	default:
-		bug("I don't know where player %s with connection %p is\n", player->name, player->conn);
+		bug("I don't know where player %s with client %p is\n", player->name, player->client);
 	}
+}
 
-	if (ship_go(ship, postype, pos))
-		player_talk(player, "You're not allowed to go there from here.\n");
-	else
-		cmd_look(player, NULL);
-
+static void add_position_cmds(struct player *player, struct ship *ship)
+{
 	switch (ship->postype) {
 	case SYSTEM:
 		cli_add_cmd(&player->cli, "go", cmd_hyper, player, cmd_hyper_help);
@@ -721,8 +1258,11 @@ void player_go(struct player *player, enum postype postype, void *pos)
 		cli_add_cmd(&player->cli, "orbit", cmd_orbit, player, cmd_orbit_help);
 		break;
 	case PORT:
+		cli_add_cmd(&player->cli, "book", cmd_book, player, cmd_book_help);
 		cli_add_cmd(&player->cli, "buy", cmd_buy, player, cmd_buy_help);
+		cli_add_cmd(&player->cli, "cancel", cmd_cancel, player, cmd_cancel_help);
 		cli_add_cmd(&player->cli, "leave", cmd_leave_port, player, cmd_leave_port_help);
+		cli_add_cmd(&player->cli, "post", cmd_post, player, cmd_post_help);
 		cli_add_cmd(&player->cli, "sell", cmd_sell, player, cmd_sell_help);
 		cli_add_cmd(&player->cli, "trade", cmd_trade, player, cmd_trade_help);
 		break;
@@ -733,27 +1273,397 @@ void player_go(struct player *player, enum postype postype, void *pos)
 	case NONE:
 		/* Fall through to default as NONE is only valid right after init */
 	default:
-		bug("I don't know where player %s with connection %p is\n", player->name, player->conn);
+		bug("I don't know where player %s with client %p is\n", player->name, player->client);
+	}
+}
+
+/*
+ * Moves the player's current ship to pos and makes the commands available
+ * there, without telling the player or saving anything. See player_go().
+ */
+int player_place(struct player *player, enum postype postype, void *pos)
+{
+	int r;
+
+	assert(player->postype == SHIP);
+	struct ship *ship = player->pos;
+
+	rm_position_cmds(player, ship);
+	r = ship_go(ship, postype, pos);
+	add_position_cmds(player, ship);
+
+	return r;
+}
+
+void player_go(struct player *player, enum postype postype, void *pos)
+{
+	if (player_place(player, postype, pos)) {
+		player_talk(player, "You're not allowed to go there from here.\n");
+		return;
 	}
+
+	wal_log_move(&wal, player);
+	cmd_look(player, NULL);
+}
+
+static void player_arrive(struct sched_event *ev)
+{
+	struct ship *ship = container_of(ev, struct ship, arrival);
+	struct player *player = ship->owner;
+
+	pthread_mutex_lock(&player->lock);
+
+	ship->in_flight = 0;
+	ship_go(ship, ship->dest_type, ship->dest);
+	add_position_cmds(player, ship);
+
+	wal_log_move(&wal, player);
+	player_talk(player, "\n%s has arrived.\n", ship->name);
+	cmd_look(player, NULL);
+
+	pthread_mutex_unlock(&player->lock);
+}
+
+/*
+ * Sets the player's current ship off for pos, where it arrives after
+ * duration ms of game time, or right away if that is 0. There is nothing to
+ * do in flight but look around, so the commands for where the ship was are
+ * taken away until it arrives. Arrivals are events on the scheduler, so
+ * ships in flight cost no more than that.
+ */
+void player_travel(struct player *player, enum postype postype, void *pos, const uint64_t duration)
+{
+	assert(player->postype == SHIP);
+	struct ship *ship = player->pos;
+
+	if (!duration) {
+		player_go(player, postype, pos);
+		return;
+	}
+
+	rm_position_cmds(player, ship);
+	ship->dest_type = postype;
+	ship->dest = pos;
+	ship->in_flight = 1;
+	ship->arrival.func = player_arrive;
+	sched_add(&sched, &ship->arrival, sched_now(&sched) + duration);
+
+	player_talk(player, "Arriving in %"PRIu64" s.\n", (duration + 999) / 1000);
+}
+
+/*
+ * Must be called with univ.players_lock held for writing
+ */
+static void add_detached(struct player *player)
+{
+	player->detached_at = time(NULL);
+	list_add_tail(&player->detached, &univ.detached_players);
+	univ.num_detached++;
+}
+
+/*
+ * Must be called with univ.players_lock held for writing
+ */
+static void rm_detached(struct player *player)
+{
+	if (list_empty(&player->detached))
+		return;
+
+	list_del_init(&player->detached);
+	univ.num_detached--;
+}
+
+/*
+ * Compares every digit, so that how long it takes doesn't tell how much of
+ * the secret was right.
+ */
+static int is_secret(const struct player * const player, const char * const secret)
+{
+	unsigned char diff = 0;
+
+	if (!player->secret[0] || strlen(secret) != PLAYER_SECRET_LEN)
+		return 0;
+
+	for (int i = 0; i < PLAYER_SECRET_LEN; i++)
+		diff |= player->secret[i] ^ secret[i];
+
+	return !diff;
+}
+
+/*
+ * Takes over a player left behind by an earlier client, given its secret.
+ * The player this client started out as is thrown away.
+ */
+static const char cmd_resume_syntax[] = "syntax: resume <name> <secret>\n";
+static int cmd_resume(void *ptr, char *param)
+{
+	struct player *player = ptr;
+	struct player *saved;
+	char *secret;
+
+	/* Player names contain spaces, so the secret is the last word */
+	secret = (param ? strrchr(param, ' ') : NULL);
+	if (!secret) {
+		player_talk(player, "%s", cmd_resume_syntax);
+		return 0;
+	}
+	*secret++ = '\0';
+
+	pthread_rwlock_wrlock(&univ.players_lock);
+	saved = st_lookup_exact(&univ.playernames, param);
+	if (!saved || list_empty(&saved->detached) || !is_secret(saved, secret)) {
+		pthread_rwlock_unlock(&univ.players_lock);
+		log_printfn(LOG_CONN, "player %s failed to resume as %s", player->name, param);
+		player_talk(player, "There is no player called %s with that secret waiting to be resumed.\n",
+				param);
+		return 0;
+	}
+	pthread_mutex_lock(&saved->lock);
+	rm_detached(saved);
+	saved->client_ops = player->client_ops;
+	saved->client = player->client;
+	saved->client_ops->attach(saved->client, saved);
+	player->client = NULL;
+	pthread_rwlock_unlock(&univ.players_lock);
+
+	log_printfn(LOG_CONN, "player %s resumed as %s", player->name, saved->name);
+	player_talk(saved, "Welcome back, %s.\n", saved->name);
+	cmd_look(saved, NULL);
+	pthread_mutex_unlock(&saved->lock);
+
+	/* The client destroys this player once the command is done */
+
+	return 0;
 }
+static char cmd_resume_help[] = "Continue as a player from an earlier session, given its secret";
 
-int player_init(struct player *player)
+/*
+ * A name is drawn for the player unless name is given, which is how saved
+ * players are brought back.
+ */
+int player_init(struct player *player, const char * const name)
 {
 	memset(player, 0, sizeof(*player));
-	player->name = create_unique_name(&univ.avail_player_names);
-	if (!player->name)
-		return -1;
+	if (name) {
+		player->name = strdup(name);
+		if (!player->name)
+			return -1;
+		if (names_take(&univ.avail_player_names, player->name)) {
+			free(player->name);
+			return -1;
+		}
+	} else {
+		player->name = create_numbered_name(&univ.avail_player_names);
+		if (!player->name)
+			return -1;
+	}
 
 	INIT_LIST_HEAD(&player->list);
+	INIT_LIST_HEAD(&player->detached);
 	st_init(&player->cli);
 	INIT_LIST_HEAD(&player->ships);
+	INIT_LIST_HEAD(&player->orders);
+	pthread_mutex_init(&player->lock, NULL);
 
 	cli_add_cmd(&player->cli, "help", cmd_help, player, cmd_help_help);
 	cli_add_cmd(&player->cli, "inventory", cmd_inventory, player, cmd_inventory_help);
+	cli_add_cmd(&player->cli, "orders", cmd_orders, player, cmd_orders_help);
 	cli_add_cmd(&player->cli, "quit", cmd_quit, player, cmd_quit_help);
 	cli_add_cmd(&player->cli, "look", cmd_look, player, cmd_look_help);
 	cli_add_cmd(&player->cli, "ships", cmd_show_ships, player, cmd_show_ships_help);
 	cli_add_cmd(&player->cli, "ports", cmd_ports, player, cmd_ports_help);
+	cli_add_cmd(&player->cli, "prices", cmd_prices, player, cmd_prices_help);
+	cli_add_cmd(&player->cli, "scan", cmd_scan, player, cmd_scan_help);
+	cli_add_cmd(&player->cli, "where", cmd_where, player, cmd_where_help);
+	cli_add_cmd(&player->cli, "resume", cmd_resume, player, cmd_resume_help);
 
 	return 0;
 }
+
+/*
+ * Creates a player and adds it to the players of the universe. It has no
+ * client, so it waits to be resumed, just as when a client goes away.
+ */
+struct player* player_create(const char * const name)
+{
+	struct player *player;
+
+	player = malloc(sizeof(*player));
+	if (!player)
+		return NULL;
+
+	if (player_init(player, name)) {
+		free(player);
+		return NULL;
+	}
+
+	pthread_rwlock_wrlock(&univ.players_lock);
+	if (st_lookup_exact(&univ.playernames, player->name) ||
+			st_add_string(&univ.playernames, player->name, player)) {
+		pthread_rwlock_unlock(&univ.players_lock);
+		player_free(player);
+		return NULL;
+	}
+	list_add_tail(&player->list, &univ.players);
+	add_detached(player);
+	pthread_rwlock_unlock(&univ.players_lock);
+
+	return player;
+}
+
+static void unlink_player(struct player *player)
+{
+	pthread_rwlock_wrlock(&univ.players_lock);
+	/* An expired player's name is already gone, and may be someone else's now */
+	if (st_lookup_exact(&univ.playernames, player->name) == player)
+		st_rm_string(&univ.playernames, player->name);
+	list_del(&player->list);
+	rm_detached(player);
+	pthread_rwlock_unlock(&univ.players_lock);
+}
+
+#define RANDOM_DEV "/dev/urandom"
+static int create_secret(char *secret)
+{
+	unsigned char bytes[PLAYER_SECRET_LEN / 2];
+	size_t n = 0, r;
+	FILE *f;
+
+	f = fopen(RANDOM_DEV, "r");
+	if (!f)
+		return -1;
+
+	while (n < sizeof(bytes)) {
+		r = fread(bytes + n, 1, sizeof(bytes) - n, f);
+		if (!r)
+			break;
+		n += r;
+	}
+	fclose(f);
+
+	if (n < sizeof(bytes))
+		return -1;
+
+	for (size_t i = 0; i < sizeof(bytes); i++)
+		sprintf(secret + 2 * i, "%02x", bytes[i]);
+
+	return 0;
+}
+
+/*
+ * Creates a new player for client, which it is attached to, the way every
+ * player starts out: in a ship of the first type, in the first system.
+ *
+ * Player names are seen by everyone, so resuming a player also takes a
+ * secret. It is drawn from the system's random device rather than the game's
+ * generator, which is seeded and can be replayed, and is only ever told to
+ * the client creating the player.
+ */
+#define START_CREDITS 100000
+struct player* player_login(const struct client_ops * const ops, void *client)
+{
+	struct player *player;
+
+	if (list_empty(&univ.ship_types))
+		return NULL;
+
+	player = player_create(NULL);
+	if (!player)
+		return NULL;
+
+	pthread_rwlock_wrlock(&univ.players_lock);
+	rm_detached(player);
+	player->client_ops = ops;
+	player->client = client;
+	pthread_rwlock_unlock(&univ.players_lock);
+
+	if (create_secret(player->secret) ||
+			new_ship_to_player(list_first_entry(&univ.ship_types, struct ship_type, list), player)) {
+		/* Never saved, so there is nothing to log */
+		unlink_player(player);
+		player_free(player);
+		return NULL;
+	}
+	player->pos = list_first_entry(&player->ships, struct ship, list);
+	player->postype = SHIP;
+	player->credits = START_CREDITS;
+
+	wal_log_player(&wal, player);
+	player_talk(player, "You are %s, and your secret is %s. Use \"resume <name> <secret>\" to continue\n"
+			"as this player in a later session. The secret is not shown again.\n",
+			player->name, player->secret);
+	player_go(player, SYSTEM, ptrlist_entry(&univ.systems, 0));
+
+	return player;
+}
+
+/*
+ * Removes a player from the universe for good.
+ */
+void player_destroy(struct player *player)
+{
+	struct ship *ship;
+
+	/* An arrival would be saved after the player is gone */
+	list_for_each_entry(ship, &player->ships, list)
+		ship_cancel_flight(ship);
+
+	market_drop_player(player);
+	wal_log_player_rm(&wal, player);
+	unlink_player(player);
+
+	player_free(player);
+}
+
+/*
+ * Must be called with univ.players_lock held for writing. Moves the players
+ * that have waited too long, or that there are too many of, to expired. The
+ * longest waiting are first on univ.detached_players. Their names are taken
+ * out of univ.playernames at once, so nothing can look them up, let alone
+ * resume them, before they are destroyed.
+ */
+static void take_expired(struct list_head *expired)
+{
+	const unsigned long max = univ.settings.detached_max;
+	const unsigned long expiry = univ.settings.detached_expiry;
+	const time_t now = time(NULL);
+	struct player *p, *_p;
+
+	list_for_each_entry_safe(p, _p, &univ.detached_players, detached) {
+		if ((!max || univ.num_detached <= max) &&
+				(!expiry || now - p->detached_at <= (time_t)expiry))
+			break;
+
+		st_rm_string(&univ.playernames, p->name);
+		list_move_tail(&p->detached, expired);
+		univ.num_detached--;
+	}
+}
+
+/*
+ * Called when the player's client goes away. The player is kept, waiting to
+ * be resumed, for as long as the settings allow; making room for it may
+ * remove others for good. Without that, every client that ever connected
+ * would stay in the universe, and in every snapshot.
+ */
+void player_detach(struct player *player)
+{
+	LIST_HEAD(expired);
+	struct player *p, *_p;
+
+	pthread_rwlock_wrlock(&univ.players_lock);
+	pthread_mutex_lock(&player->lock);
+	player->client = NULL;
+	pthread_mutex_unlock(&player->lock);
+	add_detached(player);
+	take_expired(&expired);
+	pthread_rwlock_unlock(&univ.players_lock);
+
+	/* No longer in univ.playernames, so they can't be resumed meanwhile */
+	list_for_each_entry_safe(p, _p, &expired, detached) {
+		list_del_init(&p->detached);
+		log_printfn(LOG_CONN, "removing player %s, who nobody has played for %ld s",
+				p->name, (long)(time(NULL) - p->detached_at));
+		player_destroy(p);
+	}
+}
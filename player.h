@@ -1,25 +1,58 @@
 #ifndef _HAS_PLAYER_H
 #define _HAS_PLAYER_H
 
+#include <pthread.h>
+#include <time.h>
 #include "list.h"
 #include "ship.h"
 #include "stringtrie.h"
 
+struct player;
+
+/*
+ * What a player is attached to: a connection, or a headless client run in
+ * the server process (see headless.h). Each function is given the client.
+ * attach() tells it that it now plays as player, which happens on resume.
+ */
+struct client_ops {
+	void (*print)(void *client, const char *fmt, ...);
+	void (*attach)(void *client, struct player *player);
+	void (*quit)(void *client);
+};
+
+#define PLAYER_SECRET_LEN 16		/* Hex digits */
+
 struct player {
 	char *name;
+	char secret[PLAYER_SECRET_LEN + 1];	/* Needed to resume it, empty if it can't be */
 	long credits;
 	enum postype postype;
 	void *pos;
 	struct list_head ships;
+	struct list_head orders;	/* On markets, see market.h */
 	struct list_head list;
+	struct list_head detached;	/* On univ.detached_players while waiting to be resumed */
+	time_t detached_at;
 	struct st_root cli;
-	struct connection *conn;
+	const struct client_ops *client_ops;
+	void *client;			/* NULL unless attached */
+	/*
+	 * Held while anything is done as the player: by its client while
+	 * running a command, and by an arrival. It also keeps client from going
+	 * away.
+	 */
+	pthread_mutex_t lock;
 };
 
-int player_init(struct player *player);
+int player_init(struct player *player, const char * const name);
+struct player* player_create(const char * const name);
+struct player* player_login(const struct client_ops * const ops, void *client);
+void player_destroy(struct player *player);
+void player_detach(struct player *player);
 void player_free(struct player *player);
-void player_talk(struct player *player, char *format, ...);
+int player_place(struct player *player, enum postype postype, void *pos);
 void player_go(struct player *player, enum postype postype, void *pos);
+void player_travel(struct player *player, enum postype postype, void *pos, const uint64_t duration);
 void player_change_ship(struct player *player, struct ship *ship);
 
 #endif
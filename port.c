@@ -1,3 +1,4 @@
+#include <assert.h>
 #include <limits.h>
 #include <stdlib.h>
 #include <string.h>
@@ -6,12 +7,16 @@
 #include "port.h"
 #include "cargo.h"
 #include "common.h"
+#include "economy.h"
 #include "stringtrie.h"
 #include "item.h"
 #include "log.h"
+#include "market.h"
 #include "mtrandom.h"
 #include "planet.h"
 #include "planet_type.h"
+#include "price_index.h"
+#include "system.h"
 #include "universe.h"
 
 void port_free(struct port *b)
@@ -21,37 +26,186 @@ void port_free(struct port *b)
 		free(b->name);
 	}
 
+	economy_rm_port(&univ.economy, b);
+
 	struct cargo *c, *_c;
 	list_for_each_entry_safe(c, _c, &b->items, list) {
+		item_rm_port(c->item, b);
+		price_index_rm(&c->item->prices, b, c->price);
 		list_del(&c->list);
 		cargo_free(c);
 		free(c);
 	}
 
 	pthread_rwlock_destroy(&b->items_lock);
-	st_destroy(&b->item_names, ST_DONT_FREE_DATA);
+	free(b->item_cargo);
+	market_free(&b->market);
 	ptrlist_free(&b->players);
 	free(b);
 }
 
-static void port_init(struct port *port)
+void port_init(struct port *port)
 {
 	memset(port, 0, sizeof(*port));
 	INIT_LIST_HEAD(&port->items);
 	pthread_rwlock_init(&port->items_lock, NULL);
-	st_init(&port->item_names);
 	ptrlist_init(&port->players);
+	market_init(&port->market);
+}
+
+/*
+ * Adds cargo to the items of the port. A port trades an item at most once.
+ */
+int port_add_cargo(struct port *port, struct cargo *cargo)
+{
+	if (!port->item_cargo) {
+		port->item_cargo = calloc(MAX(univ.num_items, 1), sizeof(*port->item_cargo));
+		if (!port->item_cargo)
+			return -1;
+	}
+
+	assert(cargo->item->id < univ.num_items);
+	if (port->item_cargo[cargo->item->id])
+		return -1;
+
+	port->item_cargo[cargo->item->id] = cargo;
+	list_add_tail(&cargo->list, &port->items);
+
+	return 0;
+}
+
+/*
+ * The price of port cargo goes from PRICE_EMPTY times the base price of the
+ * item with nothing in stock down to PRICE_FULL times it at the max. Demand
+ * moves it further, up when players have been buying and down when they
+ * have been selling, by up to PRICE_DEMAND of it once they have traded as
+ * much as the port holds. Demand halves every PRICE_DEMAND_HALF_LIFE days.
+ */
+#define PRICE_EMPTY 2.0
+#define PRICE_FULL 0.5
+#define PRICE_DEMAND 0.5
+#define PRICE_DEMAND_HALF_LIFE 1.0
+
+static long decay_demand(const struct cargo *cargo, const unsigned long now)
+{
+	double days;
+
+	if (!cargo->demand || now <= cargo->demand_tick)
+		return cargo->demand;
+
+	days = (double)(now - cargo->demand_tick) / univ.economy.ticks_per_day;
+
+	return cargo->demand * exp2(-days / PRICE_DEMAND_HALF_LIFE);
+}
+
+static long quote(const struct cargo *cargo)
+{
+	const long base = cargo->item->base_price;
+	double fill = 0, demand = 0, factor;
+
+	if (cargo->max > 0) {
+		fill = MIN(MAX((double)cargo_amount(cargo) / cargo->max, 0.0), 1.0);
+		demand = MIN(MAX((double)cargo->demand / cargo->max, -1.0), 1.0);
+	}
+
+	factor = (PRICE_EMPTY - (PRICE_EMPTY - PRICE_FULL) * fill) * (1 + demand * PRICE_DEMAND);
+
+	return MAX(lround(base * factor), MIN(base, 1));
+}
+
+static unsigned long economy_now()
+{
+	return __atomic_load_n(&univ.economy.tick, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * The demand for cargo as of now. Must be called with the items_lock of the
+ * port held.
+ */
+long port_demand(const struct cargo *cargo)
+{
+	return decay_demand(cargo, economy_now());
+}
+
+/*
+ * Brings the price of cargo at port up to date with its stock and demand,
+ * and the price index of the item with it once the port is registered. Must
+ * be called with the items_lock of the port held for writing.
+ */
+void port_reprice(struct port *port, struct cargo *cargo)
+{
+	const unsigned long now = economy_now();
+	const long old = cargo->price;
+
+	cargo->demand = decay_demand(cargo, now);
+	cargo->demand_tick = now;
+	cargo->price = quote(cargo);
+
+	price_index_move(&cargo->item->prices, port, old, cargo->price);
+}
+
+/*
+ * Records that players bought an amount of cargo from port, or sold it if
+ * negative, and reprices it. Must be called with the items_lock of the port
+ * held for writing.
+ */
+void port_traded(struct port *port, struct cargo *cargo, const long bought)
+{
+	const unsigned long now = economy_now();
+
+	cargo->demand = decay_demand(cargo, now) + bought;
+	cargo->demand_tick = now;
+	port_reprice(port, cargo);
+}
+
+/*
+ * Reprices all cargo of port, see port_reprice()
+ */
+void port_reprice_all(struct port *port)
+{
+	struct cargo *cargo;
+
+	list_for_each_entry(cargo, &port->items, list)
+		port_reprice(port, cargo);
+}
+
+/*
+ * Copies the requirement lists of the port type to the port's own cargo. We
+ * can't do this before all the port items are constructed and added or we
+ * wouldn't be able to look them up.
+ */
+void port_link_requirements(struct port *port)
+{
+	struct cargo *type_cargo, *cargo, *req;
+	struct list_head *lh;
+
+	list_for_each_entry(type_cargo, &port->type->items, list) {
+		cargo = port_cargo(port, type_cargo->item);
+		if (!cargo)
+			continue;
+		ptrlist_for_each_entry(req, &type_cargo->requires, lh)
+			ptrlist_push(&cargo->requires, port_cargo(port, req->item));
+	}
 }
 
 #define PORT_CARGO_RANDOMNESS 0.5
+#define PORT_CARGO_RANDOM_NUMS 3	/* Random numbers needed per cargo */
 static int port_genesis(struct port *port, struct planet *planet)
 {
 	port->planet = planet;
 	port->system = planet->system;
 	port->type = ptrlist_random(&planet->type->port_types);
 
-	struct cargo *port_cargo, *cargo, *req;
-	struct list_head *lh;
+	struct cargo *port_cargo, *cargo;
+	uint64_t *rnd, *r;
+
+	/* All random numbers needed for the cargo are drawn in one go */
+	rnd = malloc(MAX(PORT_CARGO_RANDOM_NUMS * list_len(&port->type->items), 1) * sizeof(*rnd));
+	if (!rnd)
+		return -1;
+	mtrandom_fill(rnd, PORT_CARGO_RANDOM_NUMS * list_len(&port->type->items));
+
+	r = rnd;
 	list_for_each_entry(port_cargo, &port->type->items, list) {
 		cargo = malloc(sizeof(*cargo));
 		if (!cargo)
@@ -60,73 +214,118 @@ static int port_genesis(struct port *port, struct planet *planet)
 
 		cargo->item = port_cargo->item;
 		cargo->max = port_cargo->max * (1 - PORT_CARGO_RANDOMNESS)
-			+ mtrandom_ulong(port_cargo->max * PORT_CARGO_RANDOMNESS * 2);
+			+ mtrandom_to_ulong(*r++, port_cargo->max * PORT_CARGO_RANDOMNESS * 2);
 		cargo->daily_change = port_cargo->daily_change * (1 - PORT_CARGO_RANDOMNESS)
-			+ mtrandom_long(port_cargo->daily_change * PORT_CARGO_RANDOMNESS * 2);
-		cargo->price = port_cargo->item->base_price;
+			+ mtrandom_to_long(*r++, port_cargo->daily_change * PORT_CARGO_RANDOMNESS * 2);
 
-		cargo->amount = mtrandom_ulong(cargo->max);
-		if (cargo->amount > 10)
-			cargo->amount = pow(5, log10(cargo->amount));
+		*cargo->amount = mtrandom_to_ulong(*r++, cargo->max);
+		if (*cargo->amount > 10)
+			*cargo->amount = pow(5, log10(*cargo->amount));
+		cargo->price = quote(cargo);
 
-		if (st_add_string(&port->item_names, cargo->item->name, cargo))
+		if (port_add_cargo(port, cargo)) {
+			cargo_free(cargo);
+			free(cargo);
 			goto err;
-
-		list_add(&cargo->list, &port->items);
-	}
-
-	/*
-	 * We can't copy the requirement lists before all the port items are constructed
-	 * and registered in the string tree or we wouldn't be able to look them up.
-	 */
-	list_for_each_entry(port_cargo, &port->type->items, list) {
-		cargo = st_lookup_string(&port->item_names, port_cargo->item->name);
-		ptrlist_for_each_entry(req, &port_cargo->requires, lh)
-			ptrlist_push(&cargo->requires, st_lookup_string(&port->item_names, req->item->name));
+		}
 	}
 
-	port->name = create_unique_name(&univ.avail_port_names);
+	free(rnd);
 
-	list_add(&port->list, &univ.ports);
+	port_link_requirements(port);
 
 	return 0;
 
 err:
-	port_free(port);
+	free(rnd);
 	return -1;
 }
 
-#define PORT_MAXNUM 3
-#define PORT_MUL_ODDS 2
+/*
+ * Names the port and makes it known to the rest of the universe. This is kept
+ * apart from port_genesis() because it draws names from, and inserts into,
+ * universe-wide structures; genesis calls it for one port at a time in a
+ * fixed order once all constellations have been populated. A port that
+ * already has a name, such as one read from a snapshot, keeps it.
+ */
+int port_register(struct port *port)
+{
+	struct cargo *cargo;
+
+	if (!port->name)
+		port->name = create_numbered_name(&univ.avail_port_names);
+	if (!port->name)
+		return -1;
+
+	pthread_rwlock_wrlock(&univ.portnames_lock);
+	st_add_string(&univ.portnames, port->name, port);
+	pthread_rwlock_unlock(&univ.portnames_lock);
+
+	pthread_rwlock_wrlock(&univ.ports_lock);
+	if (economy_add_port(&univ.economy, port)) {
+		pthread_rwlock_unlock(&univ.ports_lock);
+		return -1;
+	}
+	list_add(&port->list, &univ.ports);
+	pthread_rwlock_unlock(&univ.ports_lock);
+
+	list_for_each_entry(cargo, &port->items, list) {
+		if (item_add_port(cargo->item, port))
+			return -1;
+		if (price_index_add(&cargo->item->prices, port, cargo->price))
+			return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Registers all ports in a system, the ones orbiting on their own first.
+ */
+int port_register_system(struct system *s)
+{
+	struct list_head *li, *lj;
+	struct planet *planet;
+	struct port *port;
+
+	ptrlist_for_each_entry(port, &s->ports, li) {
+		if (port_register(port))
+			return -1;
+	}
+
+	ptrlist_for_each_entry(planet, &s->planets, li) {
+		ptrlist_for_each_entry(port, &planet->ports, lj) {
+			if (port_register(port))
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
 void port_populate_planet(struct planet* planet)
 {
 	struct port *b;
-	int num;
+	unsigned long num;
 
 	num = 0;
 
 	if (ptrlist_len(&planet->type->port_types) > 0) {
-		while (num < PORT_MAXNUM && mtrandom_uint(UINT_MAX) < UINT_MAX / PORT_MUL_ODDS)
+		while (num < univ.settings.ports_max && mtrandom_uint(UINT_MAX) < UINT_MAX / PORT_MUL_ODDS)
 			num++;
 	} else {
 		num = 0;
 	}
 
-	pthread_rwlock_wrlock(&univ.portnames_lock);
-
-	for (int i = 0; i < num; i++) {
+	for (unsigned long i = 0; i < num; i++) {
 		b = malloc(sizeof(*b));
 		if (!b)
-			goto unlock;
+			return;
 		port_init(b);
 		if (port_genesis(b, planet)) {
-			free(b);
-			goto unlock;
+			port_free(b);
+			return;
 		}
 		ptrlist_push(&planet->ports, b);
-		st_add_string(&univ.portnames, b->name, b);
 	}
-
-unlock:
-	pthread_rwlock_unlock(&univ.portnames_lock);
 }
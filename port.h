@@ -2,12 +2,18 @@
 #define _HAS_PORT_H
 
 #include <pthread.h>
+#include "cargo.h"
+#include "item.h"
 #include "list.h"
+#include "market.h"
 #include "parseconfig.h"
 #include "planet.h"
 #include "port_type.h"
 #include "ptrlist.h"
 
+/* Every port on a planet is added with a chance of 1 in PORT_MUL_ODDS */
+#define PORT_MUL_ODDS 2
+
 struct port {
 	char *name;
 	struct port_type *type;
@@ -15,12 +21,32 @@ struct port {
 	struct system *system;
 	struct list_head items;
 	pthread_rwlock_t items_lock;
-	struct st_root item_names;
+	struct cargo **item_cargo;	/* The cargo in items by item ID, see port_cargo() */
 	struct ptrlist players;
+	struct economy_block *economy;	/* Where the stock is once registered */
+	unsigned int economy_run;
+	struct market market;
 	struct list_head list;
 };
 
+/*
+ * The port's cargo of item, or NULL if it doesn't trade it
+ */
+static inline struct cargo* port_cargo(const struct port * const port, const struct item * const item)
+{
+	return port->item_cargo ? port->item_cargo[item->id] : NULL;
+}
+
+void port_init(struct port *port);
+int port_add_cargo(struct port *port, struct cargo *cargo);
 void port_populate_planet(struct planet* planet);
+void port_link_requirements(struct port *port);
+long port_demand(const struct cargo *cargo);
+void port_reprice(struct port *port, struct cargo *cargo);
+void port_reprice_all(struct port *port);
+void port_traded(struct port *port, struct cargo *cargo, const long bought);
+int port_register(struct port *port);
+int port_register_system(struct system *s);
 
 void port_free(struct port *b);
 
@@ -1,180 +1,284 @@
 #include <limits.h>
 #include <pthread.h>
-#include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <unistd.h>
 #include "port.h"
-#include "cargo.h"
-#include "item.h"
+#include "port_update.h"
+#include "common.h"
+#include "economy.h"
 #include "log.h"
+#include "scheduler.h"
+#include "threadpool.h"
 #include "universe.h"
 
-#define PORT_UPDATE_INTERVAL 10		/* in seconds, no larger than once a day */
-
-#define SECONDS_PER_DAY (24 * 60 * 60)
-#define PORT_UPDATE_FRACTION (SECONDS_PER_DAY / PORT_UPDATE_INTERVAL)
+/*
+ * Only pending runs, see economy.h, are updated on a tick. They are handed
+ * to the worker pool in shards of a number of runs, which is the unit of
+ * work one thread does without looking up. A shard is kept small enough to
+ * finish within PORT_UPDATE_SHARD_DEADLINE, as the ports in it can't trade
+ * until it is done. The shard size is halved after a tick where a shard
+ * missed it, and grows back when shards are fast again.
+ */
+#define PORT_UPDATE_SHARD_SIZE 1024	/* in ports */
+#define PORT_UPDATE_MIN_SHARD_SIZE 16
+#define PORT_UPDATE_SHARD_DEADLINE 0.05	/* in seconds */
+#define PORT_UPDATE_SHARDS_PER_THREAD 4
+
+struct port_update_tick {
+	struct economy_run **runs;
+	unsigned long num_runs, shard_size;
+	unsigned long shard_overruns;	/* Updated atomically */
+	uint64_t slowest_shard;		/* In nanoseconds, updated atomically */
+};
+
+static struct port_update_stats stats;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t now_ns()
+{
+	struct timespec now;
 
-pthread_t thread;
-int terminate;
+	clock_gettime(CLOCK_MONOTONIC, &now);
 
-pthread_condattr_t termination_attr;
-pthread_cond_t termination_cond;
-pthread_mutex_t termination_lock;
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
 
-static void update_port(struct port *port, uint32_t iteration)
+static void update_run(struct economy_run *run)
 {
-	struct cargo *cargo;
-	long change, mod, fraction_iteration;
+	struct port *port = run->port;
+
+	if (!port)
+		return;
 
 	pthread_rwlock_wrlock(&port->items_lock);
+	economy_tick_run(run);
+	port_reprice_all(port);
+	pthread_rwlock_unlock(&port->items_lock);
+}
 
-	list_for_each_entry(cargo, &port->items, list) {
-		if (!cargo->daily_change)
-			continue;
+/*
+ * The stock of ports that aren't pending changes without anyone looking, so
+ * their prices are brought up to date by a sweep over all runs instead. It
+ * gets round once every PORT_REPRICE_TICKS ticks, repricing a share of the
+ * runs on each, and carries on from where the last tick left it.
+ */
+#define PORT_REPRICE_TICKS 360		/* An hour of game time */
+static unsigned long reprice_block, reprice_run;
+static pthread_mutex_t reprice_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Must be called with ports_lock held
+ */
+static void reprice_runs(struct economy *e, const unsigned long ticks)
+{
+	struct economy_block *b;
+	struct economy_run *run;
+	unsigned long runs = 0, n;
 
-		change = cargo->daily_change / PORT_UPDATE_FRACTION;
-		mod = cargo->daily_change % PORT_UPDATE_FRACTION;
-		fraction_iteration = PORT_UPDATE_FRACTION / cargo->daily_change;
+	for (unsigned long i = 0; i < e->num_blocks; i++)
+		runs += e->blocks[i]->num_runs;
+	n = MIN(runs, (runs * ticks + PORT_REPRICE_TICKS - 1) / PORT_REPRICE_TICKS);
 
-		if (mod && fraction_iteration && iteration % fraction_iteration == 0) {
-			if (cargo->daily_change > 0)
-				change++;
-			else if (cargo->daily_change < 0)
-				change--;
-		}
+	pthread_mutex_lock(&reprice_lock);
 
-		if (change < 0 && cargo->amount < -change)
-			change = -cargo->amount;
-		else if (change > 0 && cargo->max - cargo->amount < change)
-			change = cargo->max - cargo->amount;
-
-		struct cargo *req;
-		struct list_head *lh;
-		ptrlist_for_each_entry(req, &cargo->requires, lh) {
-			if (change > 0 && req->amount < change)
-				change = req->amount;
-			else if (change < 0 && req->amount < -change)
-				change = -req->amount;
+	while (n > 0) {
+		if (reprice_block >= e->num_blocks) {
+			reprice_block = 0;
+			reprice_run = 0;
 		}
 
-		cargo->amount += change;
-
-		if (change < 0) {
-			ptrlist_for_each_entry(req, &cargo->requires, lh)
-				req->amount += change;
-		} else {
-			ptrlist_for_each_entry(req, &cargo->requires, lh)
-				req->amount -= change;
+		b = e->blocks[reprice_block];
+		if (reprice_run >= b->num_runs) {
+			reprice_block++;
+			reprice_run = 0;
+			continue;
 		}
-	}
 
-	pthread_rwlock_unlock(&port->items_lock);
-}
+		run = &b->runs[reprice_run++];
+		n--;
+		if (!run->port)
+			continue;
 
-static void update_all_ports(uint32_t iteration)
-{
-	struct port *port;
+		pthread_rwlock_wrlock(&run->port->items_lock);
+		port_reprice_all(run->port);
+		pthread_rwlock_unlock(&run->port->items_lock);
+	}
 
-	list_for_each_entry(port, &univ.ports, list)
-		update_port(port, iteration);
+	pthread_mutex_unlock(&reprice_lock);
 }
 
-static void* port_update_worker(void *ptr)
+static void update_shard(void *data, unsigned long idx)
 {
-	struct timespec next, now;
-	uint32_t iteration = 0;
+	struct port_update_tick *tick = data;
+	unsigned long first = idx * tick->shard_size;
+	unsigned long last = MIN(first + tick->shard_size, tick->num_runs);
+	uint64_t start, elapsed, slowest;
 
-	if (clock_gettime(CLOCK_MONOTONIC, &next))
-		goto clock_err;
+	start = now_ns();
 
-	do {
-		pthread_rwlock_rdlock(&univ.ports_lock);
-		update_all_ports(iteration);
-		pthread_rwlock_unlock(&univ.ports_lock);
+	for (unsigned long i = first; i < last; i++)
+		update_run(tick->runs[i]);
 
-		iteration++;
-		if (iteration >= PORT_UPDATE_FRACTION)
-			iteration = 0;
+	elapsed = now_ns() - start;
+	if (elapsed > PORT_UPDATE_SHARD_DEADLINE * 1e9)
+		__atomic_add_fetch(&tick->shard_overruns, 1, __ATOMIC_RELAXED);
 
-		next.tv_sec += PORT_UPDATE_INTERVAL;
-
-		do {
-			pthread_mutex_lock(&termination_lock);
-			if (terminate) {
-				pthread_mutex_unlock(&termination_lock);
-				break;
-			}
-			pthread_cond_timedwait(&termination_cond, &termination_lock, &next);
-			pthread_mutex_unlock(&termination_lock);
+	slowest = __atomic_load_n(&tick->slowest_shard, __ATOMIC_RELAXED);
+	while (elapsed > slowest &&
+			!__atomic_compare_exchange_n(&tick->slowest_shard, &slowest, elapsed,
+				0, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
 
-			if (clock_gettime(CLOCK_MONOTONIC, &now))
-				goto clock_err;
+/*
+ * Moves the economy of u on by a number of ticks, one when the server runs,
+ * and updates the ports that are pending, in shards of at most shard_size
+ * ports. Fewer ports are put in each shard if
+ * that is what it takes to give every worker thread a few of them. All
+ * other ports are caught up when they are next used, and repriced a few at
+ * a time, see reprice_runs().
+ *
+ * The counters in stats are added to and the rest describe this tick.
+ */
+void update_ports(struct universe *u, const unsigned long ticks, unsigned long shard_size,
+		struct port_update_stats *stats)
+{
+	struct economy *e = &u->economy;
+	struct port_update_tick tick;
+	struct economy_run *run, *_run;
+	struct list_head runs;
+	unsigned long i, num_shards, spread;
+	uint64_t start;
+
+	memset(&tick, 0, sizeof(tick));
+	INIT_LIST_HEAD(&runs);
+	start = now_ns();
+
+	pthread_rwlock_rdlock(&u->ports_lock);
+
+	economy_advance(e, ticks);
+	economy_take_pending(e, &runs);
+	tick.num_runs = list_len(&runs);
+
+	spread = (workers.num + 1) * PORT_UPDATE_SHARDS_PER_THREAD;
+	shard_size = MAX(MIN(shard_size, (tick.num_runs + spread - 1) / spread), 1);
+
+	tick.runs = malloc(MAX(tick.num_runs, 1) * sizeof(*tick.runs));
+	if (tick.runs) {
+		i = 0;
+		list_for_each_entry(run, &runs, list)
+			tick.runs[i++] = run;
+
+		tick.shard_size = shard_size;
+		num_shards = (tick.num_runs + shard_size - 1) / shard_size;
+		threadpool_for(&workers, num_shards, update_shard, &tick);
+	} else {
+		/* One shard, on this thread */
+		list_for_each_entry_safe(run, _run, &runs, list)
+			update_run(run);
+		shard_size = tick.num_runs;
+		num_shards = 1;
+		tick.slowest_shard = now_ns() - start;
+	}
 
-		} while (!terminate && now.tv_sec < next.tv_sec);
+	economy_put_pending(e, &runs);
+	reprice_runs(e, ticks);
+
+	pthread_rwlock_unlock(&u->ports_lock);
+	free(tick.runs);
+
+	stats->ticks++;
+	stats->ports = tick.num_runs;
+	stats->shards = num_shards;
+	stats->shard_size = shard_size;
+	stats->shard_overruns += tick.shard_overruns;
+	stats->slowest_shard = tick.slowest_shard / 1e9;
+	stats->duration = (now_ns() - start) / 1e9;
+	stats->max_duration = MAX(stats->max_duration, stats->duration);
+	stats->ports_per_second = stats->duration > 0 ? tick.num_runs / stats->duration : 0;
+
+	if (stats->duration > PORT_UPDATE_INTERVAL) {
+		stats->overruns++;
+		log_printfn(LOG_PORT_UPDATE, "updating %lu ports took %.3f s, longer than the %d s interval",
+				tick.num_runs, stats->duration, PORT_UPDATE_INTERVAL);
+	}
+}
 
-	} while (!terminate);
+void port_update_get_stats(struct port_update_stats *s)
+{
+	pthread_mutex_lock(&stats_lock);
+	*s = stats;
+	pthread_mutex_unlock(&stats_lock);
+}
 
-	return NULL;
+/*
+ * Ticks run as a scheduler event every PORT_UPDATE_INTERVAL seconds of game
+ * time, which adds itself back until stop_updating_ports().
+ */
+static struct sched_event update_event;
+static pthread_mutex_t update_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t update_cond = PTHREAD_COND_INITIALIZER;
+static int updating, stopped;
+static unsigned long shard_size = PORT_UPDATE_SHARD_SIZE;
+
+static void port_update_event(struct sched_event *ev)
+{
+	struct port_update_stats tick;
 
-clock_err:
-	log_printfn(LOG_PORT_UPDATE, "clock_gettime() failed");
-	return NULL;
+	pthread_mutex_lock(&update_lock);
+	if (stopped) {
+		pthread_mutex_unlock(&update_lock);
+		return;
+	}
+	updating = 1;
+	pthread_mutex_unlock(&update_lock);
+
+	port_update_get_stats(&tick);
+	update_ports(&univ, 1, shard_size, &tick);
+
+	pthread_mutex_lock(&stats_lock);
+	stats = tick;
+	pthread_mutex_unlock(&stats_lock);
+
+	if (tick.slowest_shard > PORT_UPDATE_SHARD_DEADLINE)
+		shard_size = MAX(tick.shard_size / 2, PORT_UPDATE_MIN_SHARD_SIZE);
+	else if (tick.slowest_shard < PORT_UPDATE_SHARD_DEADLINE / 4)
+		shard_size = MIN(shard_size * 2, PORT_UPDATE_SHARD_SIZE);
+
+	pthread_mutex_lock(&update_lock);
+	updating = 0;
+	if (!stopped)
+		sched_add(&sched, ev, ev->when + PORT_UPDATE_INTERVAL * 1000);
+	pthread_cond_broadcast(&update_cond);
+	pthread_mutex_unlock(&update_lock);
 }
 
+/*
+ * The first tick is run right away. The scheduler must be running.
+ */
 int start_updating_ports(void)
 {
-	sigset_t old, new;
-
-	sigfillset(&new);
-
-	if (pthread_condattr_init(&termination_attr))
-		goto err;
-
-	if (pthread_condattr_setclock(&termination_attr, CLOCK_MONOTONIC))
-		goto err_free_attr;
-
-	if (pthread_mutex_init(&termination_lock, NULL))
-		goto err_free_attr;
-
-	if (pthread_cond_init(&termination_cond, &termination_attr))
-		goto err_free_mutex;
-
-	if (pthread_sigmask(SIG_SETMASK, &new, &old))
-		goto err_free_mutex;
-
-	if (pthread_create(&thread, NULL, port_update_worker, NULL))
-		goto err_free_cond;
-
-	if (pthread_sigmask(SIG_SETMASK, &old, NULL))
-		goto err_cancel_thread;
+	pthread_mutex_lock(&update_lock);
+	stopped = 0;
+	sched_event_init(&update_event, port_update_event);
+	sched_add(&sched, &update_event, sched_now(&sched));
+	pthread_mutex_unlock(&update_lock);
 
 	return 0;
-
-err_cancel_thread:
-	pthread_cancel(thread);
-err_free_cond:
-	pthread_cond_destroy(&termination_cond);
-err_free_mutex:
-	pthread_mutex_destroy(&termination_lock);
-err_free_attr:
-	pthread_condattr_destroy(&termination_attr);
-err:
-	return -1;
 }
 
+/*
+ * Returns once no tick is running and no more will be
+ */
 void stop_updating_ports(void)
 {
-	pthread_mutex_lock(&termination_lock);
-	terminate = 1;
-	pthread_cond_signal(&termination_cond);
-	pthread_mutex_unlock(&termination_lock);
-
-	pthread_join(thread, NULL);
-
-	pthread_cond_destroy(&termination_cond);
-	pthread_condattr_destroy(&termination_attr);
-	pthread_mutex_destroy(&termination_lock);
+	pthread_mutex_lock(&update_lock);
+	stopped = 1;
+	sched_cancel(&sched, &update_event);
+	while (updating)
+		pthread_cond_wait(&update_cond, &update_lock);
+	pthread_mutex_unlock(&update_lock);
 }
@@ -1,6 +1,29 @@
 #ifndef _HAS_PORT_UPDATE_H
 #define _HAS_PORT_UPDATE_H
 
+#include <stdint.h>
+#include "universe.h"
+
+#define PORT_UPDATE_INTERVAL 10		/* in seconds of game time, no larger than once a day */
+#define PORT_UPDATE_TICKS_PER_DAY (24 * 60 * 60 / PORT_UPDATE_INTERVAL)
+
+struct port_update_stats {
+	unsigned long ticks;
+	unsigned long overruns;		/* Ticks longer than PORT_UPDATE_INTERVAL */
+	unsigned long shard_overruns;	/* Shards that missed their deadline */
+	unsigned long ports;		/* Pending, and so updated, in the last tick */
+	unsigned long shards;		/* In the last tick */
+	unsigned long shard_size;	/* Most ports in a shard in the last tick */
+	double duration;		/* Seconds the last tick took */
+	double max_duration;		/* Seconds the slowest tick took */
+	double slowest_shard;		/* Seconds, in the last tick */
+	double ports_per_second;	/* In the last tick */
+};
+
+void update_ports(struct universe *u, const unsigned long ticks, unsigned long shard_size,
+		struct port_update_stats *stats);
+void port_update_get_stats(struct port_update_stats *stats);
+
 int start_updating_ports(void);
 void stop_updating_ports(void);
 
@@ -0,0 +1,171 @@
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include "price_index.h"
+
+void price_index_init(struct price_index *index)
+{
+	memset(index, 0, sizeof(*index));
+	pthread_rwlock_init(&index->lock, NULL);
+}
+
+void price_index_free(struct price_index *index)
+{
+	free(index->entries);
+	pthread_rwlock_destroy(&index->lock);
+}
+
+static int entry_before(const struct price_entry * const e, const long price,
+		const struct port * const port)
+{
+	if (e->price != price)
+		return e->price < price;
+
+	return e->port < port;
+}
+
+/*
+ * Returns the index of the first entry not before price and port. Must be
+ * called with the index lock held.
+ */
+static size_t find_entry(const struct price_index * const index, const long price,
+		const struct port * const port)
+{
+	size_t lo = 0, hi = index->num_entries, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (entry_before(&index->entries[mid], price, port))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+#define PRICE_INDEX_MIN_ALLOC 16
+int price_index_add(struct price_index *index, struct port *port, const long price)
+{
+	struct price_entry *entries;
+	size_t alloc, idx;
+
+	pthread_rwlock_wrlock(&index->lock);
+
+	if (index->num_entries == index->alloc_entries) {
+		alloc = MAX(index->alloc_entries * 2, PRICE_INDEX_MIN_ALLOC);
+		entries = realloc(index->entries, alloc * sizeof(*entries));
+		if (!entries) {
+			pthread_rwlock_unlock(&index->lock);
+			return -1;
+		}
+		index->entries = entries;
+		index->alloc_entries = alloc;
+	}
+
+	idx = find_entry(index, price, port);
+	memmove(&index->entries[idx + 1], &index->entries[idx],
+			(index->num_entries - idx) * sizeof(*index->entries));
+
+	index->entries[idx].price = price;
+	index->entries[idx].port = port;
+	index->num_entries++;
+	index->sum += price;
+
+	pthread_rwlock_unlock(&index->lock);
+
+	return 0;
+}
+
+/*
+ * It is not an error to remove a port that was never added, just as with
+ * item_rm_port().
+ */
+void price_index_rm(struct price_index *index, struct port *port, const long price)
+{
+	size_t idx;
+
+	pthread_rwlock_wrlock(&index->lock);
+
+	idx = find_entry(index, price, port);
+	if (idx < index->num_entries && index->entries[idx].port == port) {
+		index->num_entries--;
+		memmove(&index->entries[idx], &index->entries[idx + 1],
+				(index->num_entries - idx) * sizeof(*index->entries));
+		index->sum -= price;
+	}
+
+	pthread_rwlock_unlock(&index->lock);
+}
+
+/*
+ * Changes the price of port from old, shifting only the entries in between
+ * one step towards where it was.
+ */
+void price_index_move(struct price_index *index, struct port *port, const long old, const long price)
+{
+	size_t from, to;
+
+	if (old == price)
+		return;
+
+	pthread_rwlock_wrlock(&index->lock);
+
+	from = find_entry(index, old, port);
+	if (from == index->num_entries || index->entries[from].port != port) {
+		pthread_rwlock_unlock(&index->lock);
+		return;
+	}
+
+	to = find_entry(index, price, port);
+	if (to > from) {
+		/* Past itself, which is about to move out of the way */
+		to--;
+		memmove(&index->entries[from], &index->entries[from + 1],
+				(to - from) * sizeof(*index->entries));
+	} else {
+		memmove(&index->entries[to + 1], &index->entries[to],
+				(from - to) * sizeof(*index->entries));
+	}
+
+	index->entries[to].price = price;
+	index->entries[to].port = port;
+	index->sum += price - old;
+
+	pthread_rwlock_unlock(&index->lock);
+}
+
+/*
+ * Sums up the index, and copies up to num of the cheapest and the most
+ * expensive entries to cheapest and dearest, either of which may be NULL.
+ * The most expensive come first in dearest. Returns how many were copied to
+ * each.
+ */
+unsigned long price_index_get(struct price_index *index, struct price_summary *summary,
+		struct price_entry *cheapest, struct price_entry *dearest, const unsigned long num)
+{
+	unsigned long n;
+
+	pthread_rwlock_rdlock(&index->lock);
+
+	n = MIN(num, index->num_entries);
+
+	memset(summary, 0, sizeof(*summary));
+	summary->ports = index->num_entries;
+	if (index->num_entries) {
+		summary->min = index->entries[0].price;
+		summary->max = index->entries[index->num_entries - 1].price;
+		summary->avg = index->sum / (long)index->num_entries;
+	}
+
+	for (unsigned long i = 0; i < n; i++) {
+		if (cheapest)
+			cheapest[i] = index->entries[i];
+		if (dearest)
+			dearest[i] = index->entries[index->num_entries - 1 - i];
+	}
+
+	pthread_rwlock_unlock(&index->lock);
+
+	return n;
+}
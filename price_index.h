@@ -0,0 +1,48 @@
+#ifndef _HAS_PRICE_INDEX_H
+#define _HAS_PRICE_INDEX_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+struct port;
+
+/*
+ * The price of an item at every port trading it, kept sorted by price (and
+ * by port within a price) so that the cheapest and the most expensive ports
+ * are at either end. It is changed whenever the price at a port is, see
+ * port_reprice(), and never rebuilt. As prices move a little at a time, a
+ * change usually only shifts the entries between the old and the new place.
+ *
+ * Must be changed with the items_lock of the port held for writing, which
+ * keeps the price in the entry the same as cargo->price. The index lock is
+ * taken last and nothing is locked while holding it.
+ */
+struct price_entry {
+	long price;
+	struct port *port;
+};
+
+struct price_index {
+	pthread_rwlock_t lock;
+	struct price_entry *entries;	/* Cheapest first */
+	size_t num_entries;
+	size_t alloc_entries;
+	long sum;
+};
+
+struct price_summary {
+	unsigned long ports;
+	long min, max, avg;
+};
+
+void price_index_init(struct price_index *index);
+void price_index_free(struct price_index *index);
+
+int price_index_add(struct price_index *index, struct port *port, const long price);
+void price_index_rm(struct price_index *index, struct port *port, const long price);
+void price_index_move(struct price_index *index, struct port *port, const long old, const long price);
+
+unsigned long price_index_get(struct price_index *index, struct price_summary *summary,
+		struct price_entry *cheapest, struct price_entry *dearest, const unsigned long num);
+
+#endif
@@ -0,0 +1,30 @@
+#include <stdio.h>
+#include <time.h>
+#include "common.h"
+#include "progress.h"
+
+void progress_init(struct progress *p, const char *what, const unsigned long total)
+{
+	p->what = what;
+	p->total = total;
+	p->next = total / PROGRESS_STEPS;
+	clock_gettime(CLOCK_MONOTONIC, &p->start);
+}
+
+void progress_update(struct progress *p, const unsigned long done)
+{
+	struct timespec now;
+	double elapsed;
+
+	if (!p->total || !done || (done < p->next && done < p->total))
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	elapsed = (now.tv_sec - p->start.tv_sec) + (now.tv_nsec - p->start.tv_nsec) / 1e9;
+
+	printf("  %s: %lu of %lu (%lu%%) after %.1f s, %.1f s left\n", p->what,
+			done, p->total, done * 100 / p->total, elapsed,
+			elapsed * (p->total - done) / done);
+
+	p->next = done + MAX(p->total / PROGRESS_STEPS, 1);
+}
@@ -0,0 +1,22 @@
+#ifndef _HAS_PROGRESS_H
+#define _HAS_PROGRESS_H
+
+#include <time.h>
+
+/*
+ * Creating a large universe takes a while, so the slow phases of genesis
+ * print how far they have come, about every 1/PROGRESS_STEPS of the way.
+ */
+#define PROGRESS_STEPS 20
+
+struct progress {
+	const char *what;
+	unsigned long total;
+	unsigned long next;		/* Print again when this much is done */
+	struct timespec start;
+};
+
+void progress_init(struct progress *p, const char *what, const unsigned long total);
+void progress_update(struct progress *p, const unsigned long done);
+
+#endif
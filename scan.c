@@ -0,0 +1,272 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cargo.h"
+#include "common.h"
+#include "item.h"
+#include "list.h"
+#include "port.h"
+#include "ptrlist.h"
+#include "scan.h"
+#include "system.h"
+#include "threadpool.h"
+#include "universe.h"
+
+/*
+ * Port stock is copied into a flat array one port at a time, holding each
+ * items_lock only for as long as it takes to copy that port. All the
+ * pairing is then done on the copy without holding any locks at all.
+ */
+struct scan_cargo {
+	struct item *item;
+	long amount, max, price;
+};
+
+struct scan_port {
+	struct port *port;
+	unsigned long dist;		/* Distance from origin */
+	size_t first, num;		/* Slice of the scan_cargo array */
+};
+
+struct scan {
+	struct system *origin;
+	struct scan_port *ports;
+	size_t nports;
+	struct scan_cargo *cargo;
+	struct item **items;
+	struct scan_pair *pairs;	/* num pairs per item */
+	size_t num;
+};
+
+#define SCAN_PARALLEL_PORTS 256		/* Don't bother the pool below this many ports */
+#define SCAN_CHUNK_PORTS 64
+#define SCAN_PARALLEL_ITEMS 4
+
+static void snapshot_port(struct scan *scan, struct scan_port *sp)
+{
+	struct cargo *c;
+	struct scan_cargo *sc = &scan->cargo[sp->first];
+	size_t n = 0;
+
+	pthread_rwlock_rdlock(&sp->port->items_lock);
+	list_for_each_entry(c, &sp->port->items, list) {
+		if (n == sp->num)
+			break;
+		sc[n].item = c->item;
+		sc[n].amount = cargo_amount(c);
+		sc[n].max = c->max;
+		sc[n].price = c->price;
+		n++;
+	}
+	pthread_rwlock_unlock(&sp->port->items_lock);
+}
+
+static void snapshot_chunk(void *_scan, unsigned long chunk)
+{
+	struct scan *scan = _scan;
+	size_t first = chunk * SCAN_CHUNK_PORTS;
+	size_t last = MIN(first + SCAN_CHUNK_PORTS, scan->nports);
+
+	for (size_t i = first; i < last; i++)
+		snapshot_port(scan, &scan->ports[i]);
+}
+
+/*
+ * Inserts pair into the sorted (best first) array pairs of length *len,
+ * which can hold at most num pairs.
+ */
+static void insert_pair(struct scan_pair *pairs, size_t *len, const size_t num,
+		const struct scan_pair *pair)
+{
+	size_t i;
+
+	if (*len == num && pairs[num - 1].score >= pair->score)
+		return;
+
+	i = (*len < num ? (*len)++ : num - 1);
+	while (i > 0 && pairs[i - 1].score < pair->score) {
+		pairs[i] = pairs[i - 1];
+		i--;
+	}
+	pairs[i] = *pair;
+}
+
+/*
+ * Ports selling an item are only ever paired with ports buying it, so the
+ * candidates for each side are gathered first to keep the pairing loop tight.
+ */
+struct scan_side {
+	struct scan_port *port;
+	struct scan_cargo *cargo;
+};
+
+static void gather_sides(struct scan *scan, struct item *item,
+		struct scan_side *sellers, size_t *nsellers,
+		struct scan_side *buyers, size_t *nbuyers)
+{
+	struct scan_port *sp;
+	struct scan_cargo *c;
+
+	*nsellers = 0;
+	*nbuyers = 0;
+
+	for (size_t i = 0; i < scan->nports; i++) {
+		sp = &scan->ports[i];
+		for (c = &scan->cargo[sp->first]; c < &scan->cargo[sp->first + sp->num]; c++) {
+			if (c->item != item)
+				continue;
+
+			if (c->amount > 0) {
+				sellers[*nsellers].port = sp;
+				sellers[(*nsellers)++].cargo = c;
+			}
+			if (c->amount < c->max) {
+				buyers[*nbuyers].port = sp;
+				buyers[(*nbuyers)++].cargo = c;
+			}
+		}
+	}
+}
+
+static size_t pair_item(struct scan *scan, struct item *item, struct scan_pair *pairs)
+{
+	struct scan_side *sellers, *buyers, *b, *s;
+	struct scan_pair pair;
+	size_t nsellers, nbuyers, len = 0;
+
+	sellers = malloc(MAX(scan->nports, 1) * sizeof(*sellers));
+	buyers = malloc(MAX(scan->nports, 1) * sizeof(*buyers));
+	if (!sellers || !buyers)
+		goto out;
+
+	gather_sides(scan, item, sellers, &nsellers, buyers, &nbuyers);
+
+	for (b = sellers; b < sellers + nsellers; b++) {
+		for (s = buyers; s < buyers + nbuyers; s++) {
+			if (s->port == b->port || s->cargo->price <= b->cargo->price)
+				continue;
+
+			pair.item = item;
+			pair.buy = b->port->port;
+			pair.sell = s->port->port;
+			pair.buy_price = b->cargo->price;
+			pair.sell_price = s->cargo->price;
+			pair.amount = MIN(b->cargo->amount, s->cargo->max - s->cargo->amount);
+			pair.distance = b->port->dist
+				+ system_distance(pair.buy->system, pair.sell->system);
+			pair.score = (double)(pair.sell_price - pair.buy_price) * pair.amount
+				/ (1.0 + pair.distance / (double)TICK_PER_LY);
+
+			insert_pair(pairs, &len, scan->num, &pair);
+		}
+	}
+
+out:
+	free(buyers);
+	free(sellers);
+	return len;
+}
+
+static void pair_item_worker(void *_scan, unsigned long idx)
+{
+	struct scan *scan = _scan;
+	struct scan_pair *pairs = &scan->pairs[idx * scan->num];
+	size_t len;
+
+	len = pair_item(scan, scan->items[idx], pairs);
+
+	/* Mark the unused slots so the merge can skip them */
+	for (; len < scan->num; len++)
+		pairs[len].item = NULL;
+}
+
+long scan_trade_routes(struct system *origin, const long radius,
+		struct item *item, struct scan_pair *pairs, const size_t num)
+{
+	struct scan scan;
+	struct ptrlist neigh;
+	struct list_head *lh;
+	struct port *port;
+	struct item *it;
+	size_t i, nitems, ncargo, len;
+	long r = -1;
+
+	memset(&scan, 0, sizeof(scan));
+	scan.origin = origin;
+	scan.num = num;
+
+	if (!num)
+		return 0;
+
+	ptrlist_init(&neigh);
+	get_neighbouring_ports(&neigh, origin, radius);
+
+	scan.nports = ptrlist_len(&neigh);
+	scan.ports = malloc(MAX(scan.nports, 1) * sizeof(*scan.ports));
+	if (!scan.ports)
+		goto out;
+
+	/*
+	 * The set of items traded by a port never changes after genesis, only
+	 * the amounts do, so it is safe to size the snapshot without locking.
+	 */
+	i = 0;
+	ncargo = 0;
+	ptrlist_for_each_entry(port, &neigh, lh) {
+		scan.ports[i].port = port;
+		scan.ports[i].dist = system_distance(origin, port->system);
+		scan.ports[i].first = ncargo;
+		scan.ports[i].num = list_len(&port->items);
+		ncargo += scan.ports[i].num;
+		i++;
+	}
+
+	scan.cargo = malloc(MAX(ncargo, 1) * sizeof(*scan.cargo));
+	if (!scan.cargo)
+		goto out;
+
+	if (scan.nports >= SCAN_PARALLEL_PORTS) {
+		threadpool_for(&workers, (scan.nports + SCAN_CHUNK_PORTS - 1) / SCAN_CHUNK_PORTS,
+				snapshot_chunk, &scan);
+	} else {
+		for (i = 0; i < scan.nports; i++)
+			snapshot_port(&scan, &scan.ports[i]);
+	}
+
+	nitems = (item ? 1 : list_len(&univ.items));
+
+	scan.items = malloc(MAX(nitems, 1) * sizeof(*scan.items));
+	scan.pairs = malloc(MAX(nitems, 1) * num * sizeof(*scan.pairs));
+	if (!scan.items || !scan.pairs)
+		goto out;
+
+	if (item) {
+		scan.items[0] = item;
+	} else {
+		i = 0;
+		list_for_each_entry(it, &univ.items, list)
+			scan.items[i++] = it;
+	}
+
+	if (nitems >= SCAN_PARALLEL_ITEMS && scan.nports >= SCAN_PARALLEL_PORTS) {
+		threadpool_for(&workers, nitems, pair_item_worker, &scan);
+	} else {
+		for (i = 0; i < nitems; i++)
+			pair_item_worker(&scan, i);
+	}
+
+	len = 0;
+	for (i = 0; i < nitems * num; i++) {
+		if (scan.pairs[i].item)
+			insert_pair(pairs, &len, num, &scan.pairs[i]);
+	}
+	r = len;
+
+out:
+	free(scan.pairs);
+	free(scan.items);
+	free(scan.cargo);
+	free(scan.ports);
+	ptrlist_free(&neigh);
+	return r;
+}
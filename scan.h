@@ -0,0 +1,26 @@
+#ifndef _HAS_SCAN_H
+#define _HAS_SCAN_H
+
+#include "item.h"
+#include "port.h"
+#include "system.h"
+
+struct scan_pair {
+	struct item *item;
+	struct port *buy;		/* Where to buy the item ... */
+	struct port *sell;		/* ... and where to sell it */
+	long buy_price, sell_price;
+	long amount;			/* How much the two ports can trade */
+	unsigned long distance;		/* Origin -> buy -> sell, in ticks */
+	double score;			/* Profit per light year travelled */
+};
+
+/*
+ * Finds the (at most) num best arbitrage opportunities among the ports within
+ * radius of origin and stores them in pairs, best first. If item is NULL, all
+ * items are considered. Returns the number of pairs found or -1 on error.
+ */
+long scan_trade_routes(struct system *origin, const long radius,
+		struct item *item, struct scan_pair *pairs, const size_t num);
+
+#endif
@@ -0,0 +1,510 @@
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "common.h"
+#include "list.h"
+#include "log.h"
+#include "scheduler.h"
+#include "threadpool.h"
+
+#define SCHED_WHEEL_MASK (SCHED_WHEEL_SLOTS - 1)
+#define SCHED_DUE SCHED_WHEEL_LEVELS	/* Level of events taken out to be run */
+#define SCHED_RUNNING (SCHED_DUE + 1)	/* And of those that have been started */
+
+struct scheduler sched;
+
+static void set_used(struct sched_wheel *w, const unsigned int slot)
+{
+	w->used[slot / 64] |= (uint64_t)1 << (slot % 64);
+}
+
+static void clear_used(struct sched_wheel *w, const unsigned int slot)
+{
+	w->used[slot / 64] &= ~((uint64_t)1 << (slot % 64));
+}
+
+/*
+ * The first slot from start on that isn't empty, or SCHED_WHEEL_SLOTS
+ */
+static unsigned int next_used(const struct sched_wheel *w, const unsigned int start)
+{
+	unsigned int i = start / 64;
+	uint64_t bits;
+
+	if (start >= SCHED_WHEEL_SLOTS)
+		return SCHED_WHEEL_SLOTS;
+
+	bits = w->used[i] & (~(uint64_t)0 << (start % 64));
+	while (!bits) {
+		if (++i == ARRAY_SIZE(w->used))
+			return SCHED_WHEEL_SLOTS;
+		bits = w->used[i];
+	}
+
+	return i * 64 + __builtin_ctzll(bits);
+}
+
+int sched_init(struct scheduler *s, const unsigned long rate)
+{
+	memset(s, 0, sizeof(*s));
+
+	for (int l = 0; l < SCHED_WHEEL_LEVELS; l++) {
+		for (int i = 0; i < SCHED_WHEEL_SLOTS; i++)
+			INIT_LIST_HEAD(&s->wheels[l].slots[i]);
+	}
+	s->rate = MAX(rate, 1);
+
+	if (pthread_mutex_init(&s->lock, NULL))
+		goto err;
+
+	if (pthread_condattr_init(&s->cond_attr))
+		goto err_free_mutex;
+
+	if (pthread_condattr_setclock(&s->cond_attr, CLOCK_MONOTONIC))
+		goto err_free_attr;
+
+	if (pthread_cond_init(&s->cond, &s->cond_attr))
+		goto err_free_attr;
+
+	if (pthread_cond_init(&s->done, NULL))
+		goto err_free_cond;
+
+	return 0;
+
+err_free_cond:
+	pthread_cond_destroy(&s->cond);
+err_free_attr:
+	pthread_condattr_destroy(&s->cond_attr);
+err_free_mutex:
+	pthread_mutex_destroy(&s->lock);
+err:
+	return -1;
+}
+
+/*
+ * Pending events are forgotten, not run
+ */
+void sched_free(struct scheduler *s)
+{
+	struct sched_event *ev, *_ev;
+
+	for (int l = 0; l < SCHED_WHEEL_LEVELS; l++) {
+		for (int i = 0; i < SCHED_WHEEL_SLOTS; i++) {
+			list_for_each_entry_safe(ev, _ev, &s->wheels[l].slots[i], list)
+				list_del_init(&ev->list);
+		}
+	}
+
+	free(s->batch);
+	pthread_cond_destroy(&s->done);
+	pthread_cond_destroy(&s->cond);
+	pthread_condattr_destroy(&s->cond_attr);
+	pthread_mutex_destroy(&s->lock);
+}
+
+void sched_event_init(struct sched_event *ev, void (*func)(struct sched_event *ev))
+{
+	memset(ev, 0, sizeof(*ev));
+	ev->func = func;
+	INIT_LIST_HEAD(&ev->list);
+}
+
+/*
+ * Puts ev in the lowest wheel that reaches ev->when from s->next. Events
+ * that are already due go in the slot of s->next. Must be called with the
+ * lock held.
+ */
+static void place(struct scheduler *s, struct sched_event *ev)
+{
+	uint64_t t = MAX(ev->when, s->next);
+	uint64_t delta = t - s->next;
+	unsigned int l;
+
+	for (l = 0; l < SCHED_WHEEL_LEVELS - 1; l++) {
+		if (delta < (uint64_t)1 << (SCHED_WHEEL_BITS * (l + 1)))
+			break;
+	}
+
+	if (delta >= (uint64_t)1 << (SCHED_WHEEL_BITS * SCHED_WHEEL_LEVELS))
+		t = s->next + ((uint64_t)1 << (SCHED_WHEEL_BITS * SCHED_WHEEL_LEVELS)) - 1;
+
+	ev->level = l;
+	ev->slot = (t >> (SCHED_WHEEL_BITS * l)) & SCHED_WHEEL_MASK;
+	list_add_tail(&ev->list, &s->wheels[l].slots[ev->slot]);
+	set_used(&s->wheels[l], ev->slot);
+	s->pending++;
+}
+
+/*
+ * Takes ev out of wherever it is. Must be called with the lock held.
+ */
+static int unlink_event(struct scheduler *s, struct sched_event *ev)
+{
+	if (list_empty(&ev->list))
+		return -1;
+
+	list_del_init(&ev->list);
+	if (ev->level < SCHED_WHEEL_LEVELS) {
+		s->pending--;
+		if (list_empty(&s->wheels[ev->level].slots[ev->slot]))
+			clear_used(&s->wheels[ev->level], ev->slot);
+	}
+
+	return 0;
+}
+
+/*
+ * Adds ev to be run at when, or moves it there if it was pending already
+ */
+void sched_add(struct scheduler *s, struct sched_event *ev, const uint64_t when)
+{
+	pthread_mutex_lock(&s->lock);
+
+	unlink_event(s, ev);
+	ev->when = when;
+	place(s, ev);
+
+	if (s->running && when < s->wake)
+		pthread_cond_signal(&s->cond);
+
+	pthread_mutex_unlock(&s->lock);
+}
+
+/*
+ * Returns 0 if ev was pending and now won't run, or -1 if it wasn't
+ * pending, which includes when it is running.
+ */
+int sched_cancel(struct scheduler *s, struct sched_event *ev)
+{
+	int r;
+
+	pthread_mutex_lock(&s->lock);
+	r = unlink_event(s, ev);
+	pthread_mutex_unlock(&s->lock);
+
+	return r;
+}
+
+/*
+ * Like sched_cancel(), but if ev is running, waits for it to return. Must
+ * not be called from an event, or with a lock held that ev->func takes.
+ */
+int sched_cancel_sync(struct scheduler *s, struct sched_event *ev)
+{
+	int r;
+
+	pthread_mutex_lock(&s->lock);
+	while ((r = unlink_event(s, ev)) && s->dispatching && ev->level == SCHED_RUNNING)
+		pthread_cond_wait(&s->done, &s->lock);
+	pthread_mutex_unlock(&s->lock);
+
+	return r;
+}
+
+/*
+ * Moves the events in the current slot of a wheel one level down, and the
+ * wheel above too if this one has come full circle
+ */
+static void cascade(struct scheduler *s, const unsigned int level)
+{
+	struct sched_wheel *w = &s->wheels[level];
+	const unsigned int idx = (s->next >> (SCHED_WHEEL_BITS * level)) & SCHED_WHEEL_MASK;
+	struct sched_event *ev, *_ev;
+	LIST_HEAD(events);
+
+	list_splice_init(&w->slots[idx], &events);
+	clear_used(w, idx);
+
+	list_for_each_entry_safe(ev, _ev, &events, list) {
+		list_del(&ev->list);
+		s->pending--;
+		place(s, ev);
+	}
+
+	if (!idx && level + 1 < SCHED_WHEEL_LEVELS)
+		cascade(s, level + 1);
+}
+
+static void move_to(struct scheduler *s, const uint64_t t)
+{
+	s->next = t;
+	if (!(t & SCHED_WHEEL_MASK))
+		cascade(s, 1);
+}
+
+/*
+ * The earliest game time anything can happen: when the first event is due,
+ * or when the next events further up are moved down, or UINT64_MAX if there
+ * are none. Must be called with the lock held.
+ */
+static uint64_t next_due(const struct scheduler *s)
+{
+	unsigned int shift, idx, p;
+
+	if (!s->pending)
+		return UINT64_MAX;
+
+	for (unsigned int l = 0; l < SCHED_WHEEL_LEVELS; l++) {
+		shift = SCHED_WHEEL_BITS * l;
+		idx = (s->next >> shift) & SCHED_WHEEL_MASK;
+
+		/* Above the first wheel, the current slot was moved down already */
+		p = next_used(&s->wheels[l], l ? idx + 1 : idx);
+		if (p < SCHED_WHEEL_SLOTS)
+			return ((s->next >> (shift + SCHED_WHEEL_BITS) << SCHED_WHEEL_BITS) + p) << shift;
+
+		/* Only ones that come round again after this wheel has */
+		if (next_used(&s->wheels[l], 0) < SCHED_WHEEL_SLOTS)
+			return ((s->next >> (shift + SCHED_WHEEL_BITS)) + 1) << (shift + SCHED_WHEEL_BITS);
+	}
+
+	return UINT64_MAX;
+}
+
+/*
+ * Moves time on to the next millisecond up to until with events due and
+ * takes them out into due. Returns 0 once there are none. Must be called
+ * with the lock held.
+ */
+static int collect(struct scheduler *s, const uint64_t until, struct list_head *due)
+{
+	struct sched_wheel *w = &s->wheels[0];
+	struct sched_event *ev;
+	uint64_t t;
+	unsigned int idx;
+
+	while (s->next <= until) {
+		t = next_due(s);
+		if (t > until) {
+			move_to(s, until + 1);
+			return 0;
+		}
+		move_to(s, t);
+
+		idx = s->next & SCHED_WHEEL_MASK;
+		if (list_empty(&w->slots[idx]))
+			continue;
+
+		list_splice_tail_init(&w->slots[idx], due);
+		clear_used(w, idx);
+		list_for_each_entry(ev, due, list) {
+			ev->level = SCHED_DUE;
+			s->pending--;
+		}
+
+		move_to(s, s->next + 1);
+		return 1;
+	}
+
+	return 0;
+}
+
+static void run_event(void *data, unsigned long idx)
+{
+	struct sched_event **batch = data;
+
+	batch[idx]->func(batch[idx]);
+}
+
+/*
+ * Runs the events in due on the worker pool and waits for them. Must be
+ * called with the lock held, which is dropped meanwhile. Events are marked
+ * as running, but the mark is not taken off afterwards as they may be gone
+ * by then; it only counts while dispatching is set.
+ */
+static unsigned long dispatch(struct scheduler *s, struct list_head *due)
+{
+	struct sched_event *ev, **batch;
+	unsigned long n = 0;
+
+	list_for_each_entry(ev, due, list)
+		n++;
+
+	if (n > s->alloc_batch) {
+		batch = realloc(s->batch, n * sizeof(*batch));
+		if (batch) {
+			s->batch = batch;
+			s->alloc_batch = n;
+		}
+	}
+
+	s->dispatching = 1;
+
+	if (n <= s->alloc_batch) {
+		n = 0;
+		while (!list_empty(due)) {
+			ev = list_first_entry(due, struct sched_event, list);
+			list_del_init(&ev->list);
+			ev->level = SCHED_RUNNING;
+			s->batch[n++] = ev;
+		}
+
+		pthread_mutex_unlock(&s->lock);
+		threadpool_for(&workers, n, run_event, s->batch);
+		pthread_mutex_lock(&s->lock);
+	} else {
+		/* One at a time, on this thread */
+		n = 0;
+		while (!list_empty(due)) {
+			ev = list_first_entry(due, struct sched_event, list);
+			list_del_init(&ev->list);
+			ev->level = SCHED_RUNNING;
+			pthread_mutex_unlock(&s->lock);
+			ev->func(ev);
+			pthread_mutex_lock(&s->lock);
+			pthread_cond_broadcast(&s->done);
+			n++;
+		}
+	}
+
+	s->dispatching = 0;
+	pthread_cond_broadcast(&s->done);
+	s->dispatched += n;
+
+	return n;
+}
+
+/*
+ * Runs everything due up to and including game time until, in order, and
+ * returns how many events that was. This is what the scheduler thread does
+ * as time passes, and it can be called directly to move time on when the
+ * thread isn't running. Not to be called from more than one thread at a
+ * time, or from an event.
+ */
+unsigned long sched_run_until(struct scheduler *s, const uint64_t until)
+{
+	unsigned long n = 0;
+	LIST_HEAD(due);
+
+	pthread_mutex_lock(&s->lock);
+	while (collect(s, until, &due))
+		n += dispatch(s, &due);
+	pthread_mutex_unlock(&s->lock);
+
+	return n;
+}
+
+/*
+ * Game time stands still unless the scheduler thread is running
+ */
+uint64_t sched_now(struct scheduler *s)
+{
+	struct timespec now;
+	uint64_t us;
+
+	if (!__atomic_load_n(&s->running, __ATOMIC_ACQUIRE))
+		return __atomic_load_n(&s->next, __ATOMIC_RELAXED);
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	us = (now.tv_sec - s->started.tv_sec) * 1000000 +
+		(now.tv_nsec - s->started.tv_nsec) / 1000;
+
+	return s->started_at + us * s->rate / 1000;
+}
+
+/*
+ * The real time at which it is game time t, rounded up
+ */
+static void real_time(const struct scheduler *s, const uint64_t t, struct timespec *ts)
+{
+	uint64_t us = ((t - s->started_at) * 1000 + s->rate - 1) / s->rate;
+
+	ts->tv_sec = s->started.tv_sec + us / 1000000;
+	ts->tv_nsec = s->started.tv_nsec + (us % 1000000) * 1000;
+	if (ts->tv_nsec >= 1000000000) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000;
+	}
+}
+
+static void* sched_worker(void *_s)
+{
+	struct scheduler *s = _s;
+	struct timespec ts;
+	uint64_t now, due;
+
+	pthread_mutex_lock(&s->lock);
+
+	while (!s->terminate) {
+		now = sched_now(s);
+		due = next_due(s);
+
+		if (due <= now) {
+			pthread_mutex_unlock(&s->lock);
+			sched_run_until(s, now);
+			pthread_mutex_lock(&s->lock);
+			continue;
+		}
+
+		s->wake = due;
+		if (due == UINT64_MAX) {
+			pthread_cond_wait(&s->cond, &s->lock);
+		} else {
+			real_time(s, due, &ts);
+			pthread_cond_timedwait(&s->cond, &s->lock, &ts);
+		}
+		s->wake = 0;
+	}
+
+	pthread_mutex_unlock(&s->lock);
+
+	return NULL;
+}
+
+/*
+ * Starts game time from where it is and runs events as they become due
+ */
+int sched_start(struct scheduler *s)
+{
+	sigset_t old, new;
+
+	sigfillset(&new);
+
+	if (clock_gettime(CLOCK_MONOTONIC, &s->started))
+		goto err;
+
+	s->started_at = s->next;
+	s->terminate = 0;
+	__atomic_store_n(&s->running, 1, __ATOMIC_RELEASE);
+
+	if (pthread_sigmask(SIG_SETMASK, &new, &old))
+		goto err_stop;
+
+	if (pthread_create(&s->thread, NULL, sched_worker, s))
+		goto err_restore_mask;
+
+	if (pthread_sigmask(SIG_SETMASK, &old, NULL))
+		goto err_cancel_thread;
+
+	log_printfn(LOG_SCHED, "game time runs %lu times as fast as real time", s->rate);
+
+	return 0;
+
+err_cancel_thread:
+	pthread_cancel(s->thread);
+	pthread_join(s->thread, NULL);
+err_restore_mask:
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+err_stop:
+	__atomic_store_n(&s->running, 0, __ATOMIC_RELEASE);
+err:
+	return -1;
+}
+
+/*
+ * Stops the thread after the events that are running, and game time with it
+ */
+void sched_stop(struct scheduler *s)
+{
+	pthread_mutex_lock(&s->lock);
+	s->terminate = 1;
+	pthread_cond_signal(&s->cond);
+	pthread_mutex_unlock(&s->lock);
+
+	pthread_join(s->thread, NULL);
+
+	__atomic_store_n(&s->running, 0, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,79 @@
+#ifndef _HAS_SCHEDULER_H
+#define _HAS_SCHEDULER_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include "list.h"
+
+/*
+ * Runs events at points in game time, which is measured in milliseconds and
+ * runs rate times as fast as real time. Due events are run on the worker
+ * pool, all events due at the same millisecond at once, and a millisecond
+ * is not started before the previous one is done.
+ *
+ * Pending events are kept in a hierarchical timing wheel: SCHED_WHEEL_LEVELS
+ * wheels of SCHED_WHEEL_SLOTS lists each, where a slot on one level spans
+ * all of the next lower wheel. An event goes into the lowest wheel that
+ * reaches far enough, and is moved one level down when time gets to its
+ * slot, so adding and cancelling one is O(1). Events further away than the
+ * wheels reach wait in the last slot of the top wheel and are put back.
+ *
+ * struct sched_event is embedded by whoever schedules something, and its
+ * func is called with it when it is due. It may be added again from there,
+ * but not freed; the scheduler is done with an event once sched_cancel_sync()
+ * has returned.
+ */
+#define SCHED_WHEEL_BITS 8
+#define SCHED_WHEEL_SLOTS (1 << SCHED_WHEEL_BITS)
+#define SCHED_WHEEL_LEVELS 4
+
+struct sched_event {
+	uint64_t when;			/* Game time in ms */
+	void (*func)(struct sched_event *ev);
+	unsigned int level, slot;	/* Where it is in the wheels */
+	struct list_head list;		/* Empty unless pending */
+};
+
+struct sched_wheel {
+	struct list_head slots[SCHED_WHEEL_SLOTS];
+	uint64_t used[SCHED_WHEEL_SLOTS / 64];	/* Slots that aren't empty */
+};
+
+struct scheduler {
+	struct sched_wheel wheels[SCHED_WHEEL_LEVELS];
+	uint64_t next;			/* Game time not yet run */
+	unsigned long pending;
+	unsigned long dispatched;	/* Events run so far */
+	unsigned long rate;		/* Game time per real time */
+	uint64_t wake;			/* Game time the thread sleeps until */
+	struct timespec started;	/* Real time when game time was started_at */
+	uint64_t started_at;
+	struct sched_event **batch;	/* Events being run */
+	unsigned long alloc_batch;
+	pthread_mutex_t lock;
+	pthread_condattr_t cond_attr;
+	pthread_cond_t cond;
+	pthread_cond_t done;		/* Signalled when a batch has run */
+	pthread_t thread;
+	int running, terminate;
+	int dispatching;
+};
+
+extern struct scheduler sched;
+
+int sched_init(struct scheduler *s, const unsigned long rate);
+void sched_free(struct scheduler *s);
+
+void sched_event_init(struct sched_event *ev, void (*func)(struct sched_event *ev));
+void sched_add(struct scheduler *s, struct sched_event *ev, const uint64_t when);
+int sched_cancel(struct scheduler *s, struct sched_event *ev);
+int sched_cancel_sync(struct scheduler *s, struct sched_event *ev);
+
+uint64_t sched_now(struct scheduler *s);
+unsigned long sched_run_until(struct scheduler *s, const uint64_t until);
+
+int sched_start(struct scheduler *s);
+void sched_stop(struct scheduler *s);
+
+#endif
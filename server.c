@@ -20,6 +20,7 @@
 #include "common.h"
 #include "buffer.h"
 #include "log.h"
+#include "npc.h"
 #include "server.h"
 #include "connection.h"
 
@@ -459,6 +460,9 @@ static void* server_main(void *_server)
 	if (start_updating_ports())
 		die("%s", "failed starting port update thread");
 
+	if (start_npcs(univ.settings.npcs))
+		die("%s", "failed starting NPC traders");
+
 	initialize_server_sockets(&sockets);
 	if (list_empty(&sockets))
 		die("%s", "server failed to bind");
@@ -480,6 +484,7 @@ static void* server_main(void *_server)
 	disconnect_peers(loop);
 	stop_and_free_server_watchers(&watchers, loop);
 	close_and_free_sockets(&sockets);
+	stop_npcs();
 	stop_updating_ports();
 
 	/*
@@ -4,6 +4,8 @@
 #include <pthread.h>
 #include "connection.h"
 
+struct connection;
+
 struct server {
 	pthread_t thread;
 	int fd[2];
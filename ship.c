@@ -6,30 +6,51 @@
 #include "cargo.h"
 #include "common.h"
 #include "item.h"
+#include "planet.h"
+#include "port.h"
+#include "scheduler.h"
 #include "stringtrie.h"
+#include "system.h"
+#include "universe.h"
 
 static void ship_init(struct ship *ship)
 {
 	memset(ship, 0, sizeof(*ship));
 	INIT_LIST_HEAD(&ship->list);
-	INIT_LIST_HEAD(&ship->cargo);
-	st_init(&ship->cargo_names);
+	sched_event_init(&ship->arrival, NULL);
 	pthread_rwlock_init(&ship->cargo_lock, NULL);
 }
 
+/*
+ * Stops a flight where it started. Must not be called with the owner's
+ * lock held, as an arrival that is running is waited for.
+ */
+void ship_cancel_flight(struct ship *ship)
+{
+	int in_flight;
+
+	if (!ship->owner)
+		return;
+
+	pthread_mutex_lock(&ship->owner->lock);
+	in_flight = ship->in_flight;
+	pthread_mutex_unlock(&ship->owner->lock);
+
+	if (!in_flight || sched_cancel_sync(&sched, &ship->arrival))
+		return;
+
+	pthread_mutex_lock(&ship->owner->lock);
+	ship->in_flight = 0;
+	pthread_mutex_unlock(&ship->owner->lock);
+}
+
 void ship_free(struct ship *ship)
 {
+	ship_cancel_flight(ship);
+
 	free(ship->name);
+	free(ship->hold);
 	pthread_rwlock_destroy(&ship->cargo_lock);
-	st_destroy(&ship->cargo_names, ST_DONT_FREE_DATA);
-
-	struct cargo *c, *_c;
-	list_for_each_entry_safe(c, _c, &ship->cargo, list) {
-		list_del(&c->list);
-		cargo_free(c);
-		free(c);
-	}
-
 }
 
 int ship_go(struct ship *ship, enum postype postype, void *pos)
@@ -40,6 +61,72 @@ int ship_go(struct ship *ship, enum postype postype, void *pos)
 	return 0;
 }
 
+/*
+ * Game time in ms to travel by hyperspace from one system to another
+ */
+uint64_t ship_travel_time(const struct ship * const ship, const struct system * const from,
+		const struct system * const to)
+{
+	uint64_t distance = system_distance(from, to);
+
+	return distance * 60 * 1000 / ((uint64_t)TICK_PER_LY * ship->type->speed);
+}
+
+/*
+ * Positions are saved by name, as the names of systems, planets and ports
+ * stay the same between server runs while their addresses do not.
+ */
+static const char* position_name(const enum postype postype, void *pos)
+{
+	switch (postype) {
+	case SYSTEM:
+		return ((struct system*)pos)->name;
+	case PORT:
+		return ((struct port*)pos)->name;
+	case PLANET:
+		return ((struct planet*)pos)->name;
+	default:
+		return NULL;
+	}
+}
+
+const char* ship_position_name(const struct ship * const ship)
+{
+	return position_name(ship->postype, ship->pos);
+}
+
+const char* ship_destination_name(const struct ship * const ship)
+{
+	return position_name(ship->dest_type, ship->dest);
+}
+
+void* ship_position_by_name(const enum postype postype, const char * const name)
+{
+	void *pos;
+
+	switch (postype) {
+	case SYSTEM:
+		pthread_rwlock_rdlock(&univ.systemnames_lock);
+		pos = st_lookup_exact(&univ.systemnames, name);
+		pthread_rwlock_unlock(&univ.systemnames_lock);
+		break;
+	case PORT:
+		pthread_rwlock_rdlock(&univ.portnames_lock);
+		pos = st_lookup_exact(&univ.portnames, name);
+		pthread_rwlock_unlock(&univ.portnames_lock);
+		break;
+	case PLANET:
+		pthread_rwlock_rdlock(&univ.planetnames_lock);
+		pos = st_lookup_exact(&univ.planetnames, name);
+		pthread_rwlock_unlock(&univ.planetnames_lock);
+		break;
+	default:
+		pos = NULL;
+	}
+
+	return pos;
+}
+
 int new_ship_to_player(struct ship_type *ship_type, struct player *player)
 {
 	struct ship *ship;
@@ -53,6 +140,10 @@ int new_ship_to_player(struct ship_type *ship_type, struct player *player)
 	if (!ship->name)
 		goto err;
 
+	ship->hold = calloc(MAX(univ.num_items, 1), sizeof(*ship->hold));
+	if (!ship->hold)
+		goto err;
+
 	ship->type = ship_type;
 	ship->owner = player;
 
@@ -66,76 +157,63 @@ err:
 	return -1;
 }
 
-static struct cargo* new_cargo_to_ship(struct ship * const ship, const struct cargo * const cargo)
+/*
+ * Must be called with the appropriate locks (i.e. ship->cargo_lock) held,
+ * and the port cargo settled since its items_lock was taken, see cargo.c
+ */
+long move_cargo_to_ship(struct ship * const ship, struct cargo * const cargo, long amount)
 {
-	struct cargo *ship_cargo;
+	long port_amount = cargo_settled_amount(cargo);
+	long *hold = &ship->hold[cargo->item->id];
 
-	ship_cargo = malloc(sizeof(*ship_cargo));
-	if (!ship_cargo)
-		return NULL;
+	assert(port_amount >= 0);
+	assert(*hold >= 0);
 
-	cargo_init(ship_cargo);
-	ship_cargo->item = cargo->item;
-	ship_cargo->max = LONG_MAX; /* FIXME */
-	if (st_add_string(&ship->cargo_names, cargo->item->name, ship_cargo)) {
-		cargo_free(ship_cargo);
-		free(ship_cargo);
-		return NULL;
-	}
+	amount = MIN(amount, port_amount);
+	amount = MIN(amount, ship_room(ship, cargo->item));
+	amount = MIN(amount, LONG_MAX - *hold);
 
-	list_add(&ship_cargo->list, &ship->cargo);
+	cargo_set_settled(cargo, port_amount - amount);
+	*hold += amount;
+	ship->load += amount * cargo->item->weight;
 
-	return ship_cargo;
+	return amount;
 }
 
 /*
- * Must be called with the appropriate locks (i.e. ship->cargo_lock) held
+ * Must be called with the appropriate locks (i.e. ship->cargo_lock) held,
+ * and the port cargo settled since its items_lock was taken, see cargo.c
  */
-int move_cargo_to_ship(struct ship * const ship, struct cargo * const cargo, long amount)
+long move_cargo_from_ship(struct ship * const ship, struct cargo * const cargo, long amount)
 {
-	assert(cargo->amount >= 0);
+	long port_amount = cargo_settled_amount(cargo);
+	long *hold = &ship->hold[cargo->item->id];
 
-	struct cargo *ship_cargo = st_lookup_string(&ship->cargo_names, cargo->item->name);
-	if (!ship_cargo) {
-		ship_cargo = new_cargo_to_ship(ship, cargo);
-		if (!ship_cargo)
-			return -1;
-	}
-	assert(ship_cargo->amount <= ship_cargo->max);
+	assert(port_amount >= 0);
+	assert(port_amount <= cargo->max);
 
-	amount = MIN(amount, cargo->amount);
-	amount = MIN(amount, ship_cargo->max - ship_cargo->amount);
+	amount = MIN(amount, *hold);
+	amount = MIN(amount, cargo->max - port_amount);
 
-	cargo->amount -= amount;
-	ship_cargo->amount += amount;
+	*hold -= amount;
+	ship->load -= amount * cargo->item->weight;
+	cargo_set_settled(cargo, port_amount + amount);
 
 	return amount;
 }
 
 /*
+ * Sets the amount of item in the hold. This is how saved ship state is put
+ * back, see wal.c.
+ *
  * Must be called with the appropriate locks (i.e. ship->cargo_lock) held
  */
-int move_cargo_from_ship(struct ship * const ship, struct cargo * const cargo, long amount)
+int ship_set_cargo(struct ship * const ship, struct item * const item, const long amount)
 {
-	struct cargo *ship_cargo;
+	long *hold = &ship->hold[item->id];
 
-	assert(cargo->amount >= 0);
-	assert(cargo->amount <= cargo->max);
-	ship_cargo = st_lookup_string(&ship->cargo_names, cargo->item->name);
-	assert(ship_cargo);
+	ship->load += (MAX(amount, 0) - *hold) * item->weight;
+	*hold = MAX(amount, 0);
 
-	amount = MIN(amount, ship_cargo->amount);
-	amount = MIN(amount, cargo->max - cargo->amount);
-
-	ship_cargo->amount -= amount;
-	cargo->amount += amount;
-
-	if (!ship_cargo->amount) {
-		st_rm_string(&ship->cargo_names, cargo->item->name);
-		list_del(&ship_cargo->list);
-		cargo_free(ship_cargo);
-		free(ship_cargo);
-	}
-
-	return amount;
+	return 0;
 }
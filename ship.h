@@ -1,9 +1,14 @@
 #ifndef _HAS_SHIP_H
 #define _HAS_SHIP_H
 
+#include <limits.h>
 #include <pthread.h>
+#include <stdint.h>
 #include "cargo.h"
+#include "common.h"
+#include "item.h"
 #include "list.h"
+#include "scheduler.h"
 #include "ship_type.h"
 
 enum postype {
@@ -14,28 +19,65 @@ enum postype {
 	SHIP
 };
 
+struct system;
+
+/*
+ * Travel takes game time. A ship in flight stays where it left from until
+ * its arrival event runs, and is saved there, so a ship that is still in
+ * flight when the server stops has not left. See player_travel().
+ */
+#define SHIP_JUMP_SLOWDOWN 4		/* Jumps take this much longer than hyperspace */
+#define SHIP_SUBLIGHT_TIME (30 * 1000)	/* in ms, to enter or leave orbit */
+
 struct ship {
 	char *name;
 	struct ship_type *type;
 	struct player *owner;
 	enum postype postype;
 	void *pos;
+	int in_flight;			/* Protected by the owner's lock */
+	enum postype dest_type;		/* Where the flight goes */
+	void *dest;
+	struct sched_event arrival;
 	pthread_rwlock_t cargo_lock;
-	struct list_head cargo;
-	struct st_root cargo_names;
+	long *hold;			/* Amount of every item, by item ID */
+	long load;			/* Weight of the hold */
 	struct list_head list;
 };
 
 #include "player.h"
 
 void ship_free(struct ship *ship);
+void ship_cancel_flight(struct ship *ship);
 int ship_go(struct ship *ship, enum postype postype, void *pos);
+uint64_t ship_travel_time(const struct ship * const ship, const struct system * const from,
+		const struct system * const to);
+const char* ship_position_name(const struct ship * const ship);
+const char* ship_destination_name(const struct ship * const ship);
+void* ship_position_by_name(const enum postype postype, const char * const name);
 int new_ship_to_player(struct ship_type *ship_type, struct player *player);
 
 /*
  * Must be called with the appropriate locks (i.e. ship->cargo_lock) held
  */
-int move_cargo_to_ship(struct ship * const ship, struct cargo * const cargo, long amount);
-int move_cargo_from_ship(struct ship * const ship, struct cargo * const cargo, long amount);
+long move_cargo_to_ship(struct ship * const ship, struct cargo * const cargo, long amount);
+long move_cargo_from_ship(struct ship * const ship, struct cargo * const cargo, long amount);
+int ship_set_cargo(struct ship * const ship, struct item * const item, const long amount);
+
+static inline long ship_cargo_amount(const struct ship * const ship, const struct item * const item)
+{
+	return ship->hold[item->id];
+}
+
+/*
+ * How many more of item fit in the hold
+ */
+static inline long ship_room(const struct ship * const ship, const struct item * const item)
+{
+	if (item->weight <= 0)
+		return LONG_MAX;
+
+	return MAX(ship->type->carry_weight - ship->load, 0) / item->weight;
+}
 
 #endif
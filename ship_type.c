@@ -14,6 +14,7 @@
 static void ship_type_init(struct ship_type * const type)
 {
 	memset(type, 0, sizeof(*type));
+	type->speed = SHIP_TYPE_DEFAULT_SPEED;
 	INIT_LIST_HEAD(&type->list);
 }
 
@@ -41,12 +42,23 @@ static int set_carry_weight(struct ship_type *type, struct config *conf)
 	return 0;
 }
 
+static int set_speed(struct ship_type *type, struct config *conf)
+{
+	if (conf->str || conf->l <= 0)
+		return -1;
+
+	type->speed = conf->l;
+	return 0;
+}
+
 static int build_command_tree(struct st_root *root)
 {
 	if (st_add_string(root, "carryweight", set_carry_weight))
 		return -1;
 	if (st_add_string(root, "description", set_description))
 		return -1;
+	if (st_add_string(root, "speed", set_speed))
+		return -1;
 
 	return 0;
 }
@@ -4,10 +4,13 @@
 #include "list.h"
 #include "universe.h"
 
+#define SHIP_TYPE_DEFAULT_SPEED 10
+
 struct ship_type {
 	char *name;
 	char *desc;
 	int carry_weight;
+	unsigned long speed;		/* Lightyears per minute of game time in hyperspace */
 	struct list_head list;
 };
 
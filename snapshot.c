@@ -0,0 +1,1317 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "cargo.h"
+#include "civ.h"
+#include "common.h"
+#include "item.h"
+#include "log.h"
+#include "market.h"
+#include "mtrandom.h"
+#include "names.h"
+#include "planet.h"
+#include "planet_type.h"
+#include "player.h"
+#include "port.h"
+#include "port_type.h"
+#include "ptrlist.h"
+#include "rbtree.h"
+#include "ship.h"
+#include "ship_type.h"
+#include "snapshot.h"
+#include "star.h"
+#include "stringtrie.h"
+#include "system.h"
+#include "universe.h"
+#include "wal.h"
+
+static const size_t record_size[SNAPSHOT_SECTION_NUM] = {
+	[SNAPSHOT_STRINGS] = sizeof(char),
+	[SNAPSHOT_SYSTEMS] = sizeof(struct snapshot_system),
+	[SNAPSHOT_STARS]   = sizeof(struct snapshot_star),
+	[SNAPSHOT_PLANETS] = sizeof(struct snapshot_planet),
+	[SNAPSHOT_PORTS]   = sizeof(struct snapshot_port),
+	[SNAPSHOT_CARGO]   = sizeof(struct snapshot_cargo),
+	[SNAPSHOT_INDICES] = sizeof(uint32_t),
+	[SNAPSHOT_CIVS]    = sizeof(struct snapshot_civ),
+	[SNAPSHOT_PLAYERS] = sizeof(struct snapshot_player),
+	[SNAPSHOT_SHIPS]   = sizeof(struct snapshot_ship),
+	[SNAPSHOT_ORDERS]  = sizeof(struct snapshot_order),
+};
+
+#define SNAPSHOT_ALIGN(x) (((x) + 7) & ~(uint64_t)7)
+
+static struct name_list* name_list(struct universe *u, const enum snapshot_name_lists list)
+{
+	switch (list) {
+	case SNAPSHOT_CONSTELLATION_NAMES:
+		return &u->avail_constellations;
+	case SNAPSHOT_PORT_NAMES:
+		return &u->avail_port_names;
+	case SNAPSHOT_PLAYER_NAMES:
+		return &u->avail_player_names;
+	default:
+		bug("%s", "illegal execution point");
+	}
+}
+
+/*
+ * While saving, every section is built in memory and written out in one go
+ * when the whole universe has been walked.
+ */
+struct snapshot_buf {
+	char *data;
+	size_t len;
+	size_t alloc;
+};
+
+struct system_index {
+	const struct system *system;
+	uint32_t idx;
+};
+
+struct snapshot_writer {
+	struct snapshot_buf sections[SNAPSHOT_SECTION_NUM];
+	struct st_root shared;		/* Type and item names already written */
+	struct system_index *index;	/* Sorted on system pointer */
+	size_t num_systems;
+	int failed;
+};
+
+#define SNAPSHOT_BUF_MIN_ALLOC 4096
+static void* buf_push(struct snapshot_buf *b, const size_t size)
+{
+	size_t alloc;
+	char *data;
+
+	if (b->len + size > b->alloc) {
+		alloc = MAX(b->alloc * 2, MAX(b->len + size, SNAPSHOT_BUF_MIN_ALLOC));
+		data = realloc(b->data, alloc);
+		if (!data)
+			return NULL;
+		b->data = data;
+		b->alloc = alloc;
+	}
+
+	data = b->data + b->len;
+	b->len += size;
+	memset(data, 0, size);
+
+	return data;
+}
+
+static void* push_record(struct snapshot_writer *w, const enum snapshot_sections section)
+{
+	void *rec = buf_push(&w->sections[section], record_size[section]);
+
+	if (!rec)
+		w->failed = 1;
+
+	return rec;
+}
+
+static uint32_t num_records(const struct snapshot_writer * const w,
+		const enum snapshot_sections section)
+{
+	return w->sections[section].len / record_size[section];
+}
+
+static uint32_t add_string(struct snapshot_writer *w, const char * const string)
+{
+	uint32_t offset = num_records(w, SNAPSHOT_STRINGS);
+	char *dst;
+
+	if (!string)
+		return SNAPSHOT_NO_STRING;
+
+	dst = buf_push(&w->sections[SNAPSHOT_STRINGS], strlen(string) + 1);
+	if (!dst) {
+		w->failed = 1;
+		return SNAPSHOT_NO_STRING;
+	}
+	strcpy(dst, string);
+
+	return offset;
+}
+
+/*
+ * Type and item names are repeated all over the universe, so they are only
+ * written once. The tree stores offset + 1, as a null pointer means not found.
+ */
+static uint32_t add_shared_string(struct snapshot_writer *w, const char * const string)
+{
+	uintptr_t offset;
+
+	offset = (uintptr_t)st_lookup_exact(&w->shared, string);
+	if (offset)
+		return offset - 1;
+
+	offset = add_string(w, string);
+	if (offset == SNAPSHOT_NO_STRING)
+		return offset;
+
+	if (st_add_string(&w->shared, string, (void*)(offset + 1)))
+		w->failed = 1;
+
+	return offset;
+}
+
+static int cmp_system_index(const void *_a, const void *_b)
+{
+	const struct system_index *a = _a;
+	const struct system_index *b = _b;
+
+	if ((uintptr_t)a->system < (uintptr_t)b->system)
+		return -1;
+	else if ((uintptr_t)a->system > (uintptr_t)b->system)
+		return 1;
+	else
+		return 0;
+}
+
+static int build_system_index(struct snapshot_writer *w, struct universe *u)
+{
+	struct list_head *lh;
+	struct system *s;
+	size_t i = 0;
+
+	w->num_systems = ptrlist_len(&u->systems);
+	w->index = malloc(MAX(w->num_systems, 1) * sizeof(*w->index));
+	if (!w->index)
+		return -1;
+
+	ptrlist_for_each_entry(s, &u->systems, lh) {
+		w->index[i].system = s;
+		w->index[i].idx = i;
+		i++;
+	}
+
+	qsort(w->index, w->num_systems, sizeof(*w->index), cmp_system_index);
+
+	return 0;
+}
+
+static uint32_t system_to_index(const struct snapshot_writer * const w,
+		const struct system * const system)
+{
+	struct system_index key = { .system = system };
+	struct system_index *found;
+
+	found = bsearch(&key, w->index, w->num_systems, sizeof(*w->index), cmp_system_index);
+	if (!found)
+		return SNAPSHOT_NO_INDEX;
+
+	return found->idx;
+}
+
+static int add_index(struct snapshot_writer *w, const struct system * const system)
+{
+	uint32_t *idx;
+
+	idx = push_record(w, SNAPSHOT_INDICES);
+	if (!idx)
+		return -1;
+
+	*idx = system_to_index(w, system);
+	if (*idx == SNAPSHOT_NO_INDEX) {
+		w->failed = 1;
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Must be called with the lock protecting the list held
+ */
+static uint32_t save_cargo(struct snapshot_writer *w, struct list_head *list)
+{
+	struct snapshot_cargo *c;
+	struct cargo *cargo;
+	uint32_t num = 0;
+
+	list_for_each_entry(cargo, list, list) {
+		c = push_record(w, SNAPSHOT_CARGO);
+		if (!c)
+			break;
+
+		c->item = add_shared_string(w, cargo->item->name);
+		c->min = cargo->min;
+		c->max = cargo->max;
+		c->amount = cargo_amount(cargo);
+		c->daily_change = cargo->daily_change;
+		c->price = cargo->price;
+		c->demand = port_demand(cargo);
+		num++;
+	}
+
+	return num;
+}
+
+/*
+ * Ship cargo is saved as port cargo is, with no limits or price. Must be
+ * called with ship->cargo_lock held.
+ */
+static uint32_t save_hold(struct snapshot_writer *w, struct ship *ship)
+{
+	struct snapshot_cargo *c;
+	struct item *item;
+	uint32_t num = 0;
+
+	list_for_each_entry(item, &univ.items, list) {
+		if (!ship_cargo_amount(ship, item))
+			continue;
+
+		c = push_record(w, SNAPSHOT_CARGO);
+		if (!c)
+			break;
+
+		memset(c, 0, sizeof(*c));
+		c->item = add_shared_string(w, item->name);
+		c->max = LONG_MAX;
+		c->amount = ship_cargo_amount(ship, item);
+		num++;
+	}
+
+	return num;
+}
+
+static int save_port(struct snapshot_writer *w, struct port *port)
+{
+	struct snapshot_port *rec;
+	uint32_t first, num;
+
+	first = num_records(w, SNAPSHOT_CARGO);
+
+	pthread_rwlock_rdlock(&port->items_lock);
+	num = save_cargo(w, &port->items);
+	pthread_rwlock_unlock(&port->items_lock);
+
+	rec = push_record(w, SNAPSHOT_PORTS);
+	if (!rec)
+		return -1;
+
+	rec->name = add_string(w, port->name);
+	rec->type = add_shared_string(w, port->type->name);
+	rec->first_cargo = first;
+	rec->num_cargo = num;
+
+	return 0;
+}
+
+static int save_planet(struct snapshot_writer *w, struct planet *planet)
+{
+	struct snapshot_planet *rec;
+	struct list_head *lh;
+	struct port *port;
+	uint32_t first, num = 0;
+
+	first = num_records(w, SNAPSHOT_PORTS);
+	ptrlist_for_each_entry(port, &planet->ports, lh) {
+		if (save_port(w, port))
+			return -1;
+		num++;
+	}
+
+	rec = push_record(w, SNAPSHOT_PLANETS);
+	if (!rec)
+		return -1;
+
+	rec->name = add_string(w, planet->name);
+	rec->gname = add_string(w, planet->gname);
+	rec->type = add_shared_string(w, planet->type->name);
+	rec->dia = planet->dia;
+	rec->dist = planet->dist;
+	rec->life = planet->life;
+	rec->first_port = first;
+	rec->num_ports = num;
+
+	return 0;
+}
+
+static int save_star(struct snapshot_writer *w, struct star *star)
+{
+	struct snapshot_star *rec;
+
+	rec = push_record(w, SNAPSHOT_STARS);
+	if (!rec)
+		return -1;
+
+	rec->name = add_string(w, star->name);
+	rec->cls = star->cls;
+	rec->lum = star->lum;
+	rec->hab = star->hab;
+	rec->lumval = star->lumval;
+	rec->hablow = star->hablow;
+	rec->habhigh = star->habhigh;
+	rec->temp = star->temp;
+
+	return 0;
+}
+
+static int save_system(struct snapshot_writer *w, struct system *s)
+{
+	struct snapshot_system rec;
+	struct snapshot_system *dst;
+	struct list_head *lh;
+	struct star *star;
+	struct planet *planet;
+	struct port *port;
+	struct system *link;
+
+	memset(&rec, 0, sizeof(rec));
+
+	rec.first_star = num_records(w, SNAPSHOT_STARS);
+	ptrlist_for_each_entry(star, &s->stars, lh) {
+		if (save_star(w, star))
+			return -1;
+		rec.num_stars++;
+	}
+
+	rec.first_planet = num_records(w, SNAPSHOT_PLANETS);
+	ptrlist_for_each_entry(planet, &s->planets, lh) {
+		if (save_planet(w, planet))
+			return -1;
+		rec.num_planets++;
+	}
+
+	rec.first_port = num_records(w, SNAPSHOT_PORTS);
+	ptrlist_for_each_entry(port, &s->ports, lh) {
+		if (save_port(w, port))
+			return -1;
+		rec.num_ports++;
+	}
+
+	rec.first_link = num_records(w, SNAPSHOT_INDICES);
+	ptrlist_for_each_entry(link, &s->links, lh) {
+		if (add_index(w, link))
+			return -1;
+		rec.num_links++;
+	}
+
+	rec.name = add_string(w, s->name);
+	rec.hab = s->hab;
+	rec.x = s->x;
+	rec.y = s->y;
+	rec.r = s->r;
+	rec.phi = s->phi;
+	rec.hablow = s->hablow;
+	rec.habhigh = s->habhigh;
+
+	dst = push_record(w, SNAPSHOT_SYSTEMS);
+	if (!dst)
+		return -1;
+	*dst = rec;
+
+	return 0;
+}
+
+static int save_civ(struct snapshot_writer *w, struct civ *c)
+{
+	struct snapshot_civ rec;
+	struct snapshot_civ *dst;
+	struct list_head *lh;
+	struct system *s;
+
+	memset(&rec, 0, sizeof(rec));
+
+	rec.first_system = num_records(w, SNAPSHOT_INDICES);
+	ptrlist_for_each_entry(s, &c->systems, lh) {
+		if (add_index(w, s))
+			return -1;
+		rec.num_systems++;
+	}
+
+	rec.name = add_string(w, c->name);
+	rec.home = (c->home ? system_to_index(w, c->home) : SNAPSHOT_NO_INDEX);
+
+	dst = push_record(w, SNAPSHOT_CIVS);
+	if (!dst)
+		return -1;
+	*dst = rec;
+
+	return 0;
+}
+
+static int save_ship(struct snapshot_writer *w, struct ship *ship)
+{
+	struct snapshot_ship *rec;
+	uint32_t first, num;
+
+	first = num_records(w, SNAPSHOT_CARGO);
+
+	pthread_rwlock_rdlock(&ship->cargo_lock);
+	num = save_hold(w, ship);
+	pthread_rwlock_unlock(&ship->cargo_lock);
+
+	rec = push_record(w, SNAPSHOT_SHIPS);
+	if (!rec)
+		return -1;
+
+	rec->name = add_string(w, ship->name);
+	rec->type = add_shared_string(w, ship->type->name);
+	rec->postype = ship->postype;
+	rec->pos = add_string(w, ship_position_name(ship));
+	rec->first_cargo = first;
+	rec->num_cargo = num;
+
+	return 0;
+}
+
+static int save_order(struct snapshot_writer *w, struct order *order)
+{
+	struct snapshot_order *rec;
+
+	rec = push_record(w, SNAPSHOT_ORDERS);
+	if (!rec)
+		return -1;
+
+	memset(rec, 0, sizeof(*rec));
+	rec->port = add_shared_string(w, order->port->name);
+	rec->item = add_shared_string(w, order->item->name);
+	rec->side = order->side;
+	rec->id = order->id;
+	rec->price = order->price;
+	rec->amount = order->amount;
+	rec->goods = order->goods;
+	rec->credits = order->credits;
+
+	return 0;
+}
+
+/*
+ * Must be called with univ.players_lock held
+ */
+static int save_player(struct snapshot_writer *w, struct player *player)
+{
+	struct snapshot_player rec;
+	struct snapshot_player *dst;
+	struct order *order;
+	struct ship *ship;
+	int r;
+
+	/* Players are given a ship as soon as they are created */
+	if (list_empty(&player->ships))
+		return 0;
+
+	memset(&rec, 0, sizeof(rec));
+
+	rec.first_ship = num_records(w, SNAPSHOT_SHIPS);
+	list_for_each_entry(ship, &player->ships, list) {
+		if (ship == player->pos)
+			rec.ship = rec.num_ships;
+		if (save_ship(w, ship))
+			return -1;
+		rec.num_ships++;
+	}
+
+	rec.first_order = num_records(w, SNAPSHOT_ORDERS);
+	list_for_each_entry(order, &player->orders, owner_list) {
+		pthread_rwlock_rdlock(&order->port->market.lock);
+		r = save_order(w, order);
+		pthread_rwlock_unlock(&order->port->market.lock);
+		if (r)
+			return -1;
+		rec.num_orders++;
+	}
+
+	rec.name = add_string(w, player->name);
+	rec.secret = add_string(w, player->secret);
+	rec.credits = player->credits;
+
+	dst = push_record(w, SNAPSHOT_PLAYERS);
+	if (!dst)
+		return -1;
+	*dst = rec;
+
+	return 0;
+}
+
+static int write_all(const int fd, const void *data, size_t len)
+{
+	const char *p = data;
+	ssize_t r;
+
+	while (len > 0) {
+		r = write(fd, p, len);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r < 0)
+			return -1;
+		p += r;
+		len -= r;
+	}
+
+	return 0;
+}
+
+/*
+ * The snapshot is written to a temporary file that is renamed over the old
+ * one once it is safely on disk, so there always is a complete snapshot.
+ */
+static int write_snapshot(struct snapshot_writer *w, struct snapshot_header *header,
+		const char * const file)
+{
+	static const char padding[8];
+	uint64_t offset;
+	char *tmp;
+	int fd;
+
+	offset = SNAPSHOT_ALIGN(sizeof(*header));
+	for (int i = 0; i < SNAPSHOT_SECTION_NUM; i++) {
+		header->sections[i].offset = offset;
+		header->sections[i].num = w->sections[i].len / record_size[i];
+		header->sections[i].size = record_size[i];
+		offset += SNAPSHOT_ALIGN(w->sections[i].len);
+
+		if (header->sections[i].num >= UINT32_MAX) {
+			log_printfn(LOG_MAIN, "universe is too large for a snapshot");
+			return -1;
+		}
+	}
+
+	tmp = malloc(strlen(file) + strlen(".tmp") + 1);
+	if (!tmp)
+		return -1;
+	sprintf(tmp, "%s.tmp", file);
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		goto err;
+
+	if (write_all(fd, header, sizeof(*header)))
+		goto err_close;
+	if (write_all(fd, padding, SNAPSHOT_ALIGN(sizeof(*header)) - sizeof(*header)))
+		goto err_close;
+
+	for (int i = 0; i < SNAPSHOT_SECTION_NUM; i++) {
+		if (write_all(fd, w->sections[i].data, w->sections[i].len))
+			goto err_close;
+		if (write_all(fd, padding, SNAPSHOT_ALIGN(w->sections[i].len) - w->sections[i].len))
+			goto err_close;
+	}
+
+	if (fsync(fd))
+		goto err_close;
+	if (close(fd))
+		goto err_unlink;
+	if (rename(tmp, file))
+		goto err_unlink;
+
+	free(tmp);
+	return 0;
+
+err_close:
+	close(fd);
+err_unlink:
+	unlink(tmp);
+err:
+	log_printfn(LOG_MAIN, "could not write snapshot %s: %s", tmp, strerror(errno));
+	free(tmp);
+	return -1;
+}
+
+/*
+ * Writes the universe to file. Nothing may change the players while it is
+ * saved, as their orders and ships are walked without their locks, so a
+ * running server saves from a forked child, see checkpoint().
+ */
+int snapshot_save(struct universe *u, const char * const file)
+{
+	struct snapshot_writer w;
+	struct snapshot_header header;
+	struct list_head *lh;
+	struct system *s;
+	struct civ *c;
+	struct player *player;
+	int r = -1;
+
+	memset(&w, 0, sizeof(w));
+	st_init(&w.shared);
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+	header.version = SNAPSHOT_VERSION;
+	header.byte_order = SNAPSHOT_BYTE_ORDER;
+	header.seed = mtrandom_master_seed();
+	header.created = u->created;
+	header.inhabited_systems = u->inhabited_systems;
+	header.wal_lsn = wal_last_lsn(&wal);
+	for (int i = 0; i < SNAPSHOT_NAME_LIST_NUM; i++)
+		names_get_state(name_list(u, i), &header.names[i]);
+
+	if (build_system_index(&w, u))
+		goto out;
+
+	ptrlist_for_each_entry(s, &u->systems, lh) {
+		if (save_system(&w, s))
+			goto out;
+	}
+
+	list_for_each_entry(c, &u->civs, list) {
+		if (save_civ(&w, c))
+			goto out;
+	}
+
+	pthread_rwlock_rdlock(&u->players_lock);
+	list_for_each_entry(player, &u->players, list) {
+		if (save_player(&w, player))
+			break;
+	}
+	pthread_rwlock_unlock(&u->players_lock);
+
+	if (w.failed)
+		goto out;
+
+	r = write_snapshot(&w, &header, file);
+
+out:
+	if (r)
+		log_printfn(LOG_MAIN, "saving snapshot %s failed", file);
+	else
+		log_printfn(LOG_MAIN, "saved %lu systems to snapshot %s",
+				ptrlist_len(&u->systems), file);
+
+	for (int i = 0; i < SNAPSHOT_SECTION_NUM; i++)
+		free(w.sections[i].data);
+	st_destroy(&w.shared, ST_DONT_FREE_DATA);
+	free(w.index);
+
+	return r;
+}
+
+/*
+ * When loading, the file is mapped and every record is checked against the
+ * header before it is used, so a damaged file is refused rather than trusted.
+ */
+struct snapshot_reader {
+	const char *map;
+	size_t size;
+	const struct snapshot_header *header;
+	const void *sections[SNAPSHOT_SECTION_NUM];
+	uint64_t num[SNAPSHOT_SECTION_NUM];
+	struct universe *u;
+	struct st_root planet_types;
+	struct system **systems;
+};
+
+static int check_header(struct snapshot_reader *r)
+{
+	const struct snapshot_header *h = r->header;
+	const struct snapshot_section *section;
+	const char *strings;
+
+	if (r->size < sizeof(*h) || memcmp(h->magic, SNAPSHOT_MAGIC, sizeof(h->magic))) {
+		log_printfn(LOG_MAIN, "not a snapshot");
+		return -1;
+	}
+
+	if (h->version != SNAPSHOT_VERSION || h->byte_order != SNAPSHOT_BYTE_ORDER) {
+		log_printfn(LOG_MAIN, "unsupported snapshot version %u or byte order %x",
+				h->version, h->byte_order);
+		return -1;
+	}
+
+	for (int i = 0; i < SNAPSHOT_SECTION_NUM; i++) {
+		section = &h->sections[i];
+
+		if (section->size != record_size[i] || section->offset % 8 ||
+				section->num >= UINT32_MAX || section->offset > r->size ||
+				section->num * section->size > r->size - section->offset) {
+			log_printfn(LOG_MAIN, "snapshot section %d is damaged", i);
+			return -1;
+		}
+
+		r->sections[i] = r->map + section->offset;
+		r->num[i] = section->num;
+	}
+
+	strings = r->sections[SNAPSHOT_STRINGS];
+	if (r->num[SNAPSHOT_STRINGS] && strings[r->num[SNAPSHOT_STRINGS] - 1] != '\0') {
+		log_printfn(LOG_MAIN, "snapshot strings are not terminated");
+		return -1;
+	}
+
+	return 0;
+}
+
+static const char* get_string(const struct snapshot_reader * const r, const uint32_t offset)
+{
+	if (offset >= r->num[SNAPSHOT_STRINGS])
+		return NULL;
+
+	return (const char*)r->sections[SNAPSHOT_STRINGS] + offset;
+}
+
+static int is_range_valid(const struct snapshot_reader * const r,
+		const enum snapshot_sections section, const uint32_t first, const uint32_t num)
+{
+	return (uint64_t)first + num <= r->num[section];
+}
+
+static int load_port(struct snapshot_reader *r, const struct snapshot_port * const rec,
+		struct planet *planet, struct system *system)
+{
+	const struct snapshot_cargo *c;
+	const char *name, *type, *item;
+	struct cargo *cargo;
+	struct port *port;
+
+	name = get_string(r, rec->name);
+	type = get_string(r, rec->type);
+	if (!name || !type || !is_range_valid(r, SNAPSHOT_CARGO, rec->first_cargo, rec->num_cargo))
+		goto damaged;
+
+	port = malloc(sizeof(*port));
+	if (!port)
+		return -1;
+	port_init(port);
+	port->planet = planet;
+	port->system = system;
+
+	if (planet)
+		ptrlist_push(&planet->ports, port);
+	else
+		ptrlist_push(&system->ports, port);
+
+	port->type = st_lookup_exact(&r->u->port_type_names, type);
+	if (!port->type) {
+		log_printfn(LOG_MAIN, "snapshot port type %s is not in the config", type);
+		return -1;
+	}
+
+	port->name = strdup(name);
+	if (!port->name)
+		return -1;
+	if (names_take(&r->u->avail_port_names, port->name))
+		return -1;
+
+	c = (const struct snapshot_cargo*)r->sections[SNAPSHOT_CARGO] + rec->first_cargo;
+	for (uint32_t i = 0; i < rec->num_cargo; i++, c++) {
+		item = get_string(r, c->item);
+		if (!item)
+			goto damaged;
+
+		cargo = malloc(sizeof(*cargo));
+		if (!cargo)
+			return -1;
+		cargo_init(cargo);
+
+		cargo->item = st_lookup_exact(&r->u->item_names, item);
+		if (!cargo->item) {
+			log_printfn(LOG_MAIN, "snapshot item %s is not in the config", item);
+			free(cargo);
+			return -1;
+		}
+
+		cargo->min = c->min;
+		cargo->max = c->max;
+		*cargo->amount = c->amount;
+		cargo->daily_change = c->daily_change;
+		cargo->price = c->price;
+		cargo->demand = c->demand;
+
+		if (port_add_cargo(port, cargo)) {
+			cargo_free(cargo);
+			free(cargo);
+			return -1;
+		}
+	}
+
+	port_link_requirements(port);
+
+	return 0;
+
+damaged:
+	log_printfn(LOG_MAIN, "snapshot port is damaged");
+	return -1;
+}
+
+static int load_planet(struct snapshot_reader *r, const struct snapshot_planet * const rec,
+		struct system *system)
+{
+	const struct snapshot_port *port;
+	const char *name, *gname, *type;
+	struct planet *planet;
+
+	name = get_string(r, rec->name);
+	gname = get_string(r, rec->gname);
+	type = get_string(r, rec->type);
+	if (!name || !type || !is_range_valid(r, SNAPSHOT_PORTS, rec->first_port, rec->num_ports)) {
+		log_printfn(LOG_MAIN, "snapshot planet is damaged");
+		return -1;
+	}
+
+	planet = malloc(sizeof(*planet));
+	if (!planet)
+		return -1;
+	planet_init(planet);
+	planet->system = system;
+	ptrlist_push(&system->planets, planet);
+
+	planet->type = st_lookup_exact(&r->planet_types, type);
+	if (!planet->type) {
+		log_printfn(LOG_MAIN, "snapshot planet type %s is not in the config", type);
+		return -1;
+	}
+
+	planet->dia = rec->dia;
+	planet->dist = rec->dist;
+	planet->life = rec->life;
+
+	planet->name = strdup(name);
+	if (!planet->name)
+		return -1;
+	st_add_string(&r->u->planetnames, planet->name, planet);
+
+	if (gname) {
+		planet->gname = strdup(gname);
+		if (!planet->gname)
+			return -1;
+		st_add_string(&r->u->planetnames, planet->gname, planet);
+	}
+
+	port = (const struct snapshot_port*)r->sections[SNAPSHOT_PORTS] + rec->first_port;
+	for (uint32_t i = 0; i < rec->num_ports; i++) {
+		if (load_port(r, &port[i], planet, system))
+			return -1;
+	}
+
+	return 0;
+}
+
+static int load_star(struct snapshot_reader *r, const struct snapshot_star * const rec,
+		struct system *system)
+{
+	const char *name;
+	struct star *star;
+
+	name = get_string(r, rec->name);
+	if (!name) {
+		log_printfn(LOG_MAIN, "snapshot star is damaged");
+		return -1;
+	}
+
+	star = malloc(sizeof(*star));
+	if (!star)
+		return -1;
+
+	star->name = strdup(name);
+	if (!star->name) {
+		free(star);
+		return -1;
+	}
+
+	star->cls = rec->cls;
+	star->lum = rec->lum;
+	star->hab = rec->hab;
+	star->lumval = rec->lumval;
+	star->hablow = rec->hablow;
+	star->habhigh = rec->habhigh;
+	star->temp = rec->temp;
+
+	ptrlist_push(&system->stars, star);
+
+	return 0;
+}
+
+static int load_system(struct snapshot_reader *r, const struct snapshot_system * const rec,
+		const uint32_t idx)
+{
+	const struct snapshot_star *star;
+	const struct snapshot_planet *planet;
+	const struct snapshot_port *port;
+	const char *name;
+	struct system *s;
+
+	name = get_string(r, rec->name);
+	if (!name || !is_range_valid(r, SNAPSHOT_STARS, rec->first_star, rec->num_stars) ||
+			!is_range_valid(r, SNAPSHOT_PLANETS, rec->first_planet, rec->num_planets) ||
+			!is_range_valid(r, SNAPSHOT_PORTS, rec->first_port, rec->num_ports) ||
+			!is_range_valid(r, SNAPSHOT_INDICES, rec->first_link, rec->num_links)) {
+		log_printfn(LOG_MAIN, "snapshot system %u is damaged", idx);
+		return -1;
+	}
+
+	s = malloc(sizeof(*s));
+	if (!s)
+		return -1;
+	if (system_create(s, (char*)name)) {
+		free(s);
+		return -1;
+	}
+
+	if (system_move(s, rec->x, rec->y)) {
+		log_printfn(LOG_MAIN, "snapshot system %s is at the same x as another system", name);
+		system_free(s);
+		return -1;
+	}
+
+	ptrlist_push(&r->u->systems, s);
+	st_add_string(&r->u->systemnames, s->name, s);
+	r->systems[idx] = s;
+
+	s->hab = rec->hab;
+	s->r = rec->r;
+	s->phi = rec->phi;
+	s->hablow = rec->hablow;
+	s->habhigh = rec->habhigh;
+
+	star = (const struct snapshot_star*)r->sections[SNAPSHOT_STARS] + rec->first_star;
+	for (uint32_t i = 0; i < rec->num_stars; i++) {
+		if (load_star(r, &star[i], s))
+			return -1;
+	}
+
+	planet = (const struct snapshot_planet*)r->sections[SNAPSHOT_PLANETS] + rec->first_planet;
+	for (uint32_t i = 0; i < rec->num_planets; i++) {
+		if (load_planet(r, &planet[i], s))
+			return -1;
+	}
+
+	port = (const struct snapshot_port*)r->sections[SNAPSHOT_PORTS] + rec->first_port;
+	for (uint32_t i = 0; i < rec->num_ports; i++) {
+		if (load_port(r, &port[i], NULL, s))
+			return -1;
+	}
+
+	return 0;
+}
+
+static struct system* index_to_system(const struct snapshot_reader * const r, const uint32_t first,
+		const uint32_t i)
+{
+	const uint32_t *indices = r->sections[SNAPSHOT_INDICES];
+	uint32_t idx = indices[first + i];
+
+	if (idx >= r->num[SNAPSHOT_SYSTEMS])
+		return NULL;
+
+	return r->systems[idx];
+}
+
+static int load_links(struct snapshot_reader *r, const struct snapshot_system * const rec,
+		struct system *s)
+{
+	struct system *link;
+
+	for (uint32_t i = 0; i < rec->num_links; i++) {
+		link = index_to_system(r, rec->first_link, i);
+		if (!link) {
+			log_printfn(LOG_MAIN, "snapshot links of %s are damaged", s->name);
+			return -1;
+		}
+		ptrlist_push(&s->links, link);
+	}
+
+	return 0;
+}
+
+/*
+ * Civs are defined in the config, the snapshot only says where they live.
+ * Civs that had no home when the snapshot was taken are dropped, just as
+ * genesis does.
+ */
+static int load_civ(struct snapshot_reader *r, const struct snapshot_civ * const rec)
+{
+	const char *name;
+	struct system *s;
+	struct civ *c;
+
+	name = get_string(r, rec->name);
+	if (!name || (rec->home != SNAPSHOT_NO_INDEX && rec->home >= r->num[SNAPSHOT_SYSTEMS]) ||
+			!is_range_valid(r, SNAPSHOT_INDICES, rec->first_system, rec->num_systems)) {
+		log_printfn(LOG_MAIN, "snapshot civ is damaged");
+		return -1;
+	}
+
+	list_for_each_entry(c, &r->u->civs, list) {
+		if (!strcmp(c->name, name))
+			break;
+	}
+	if (&c->list == &r->u->civs) {
+		log_printfn(LOG_MAIN, "snapshot civ %s is not in the config", name);
+		return -1;
+	}
+
+	if (rec->home != SNAPSHOT_NO_INDEX)
+		c->home = r->systems[rec->home];
+
+	for (uint32_t i = 0; i < rec->num_systems; i++) {
+		s = index_to_system(r, rec->first_system, i);
+		if (!s) {
+			log_printfn(LOG_MAIN, "snapshot systems of %s are damaged", name);
+			return -1;
+		}
+		s->owner = c;
+		ptrlist_push(&c->systems, s);
+	}
+
+	return 0;
+}
+
+/*
+ * The ship is added to the front of the player's ships. It is moved to its
+ * position unless it is the player's current ship, whose position is returned
+ * in current_pos so the player can be placed there.
+ */
+static int load_ship(struct snapshot_reader *r, const struct snapshot_ship * const rec,
+		struct player *player, const int is_current, void **current_pos)
+{
+	const struct snapshot_cargo *c;
+	const char *name, *type, *pos_name, *item_name;
+	struct ship_type *ship_type;
+	struct item *item;
+	struct ship *ship;
+	void *pos;
+
+	name = get_string(r, rec->name);
+	type = get_string(r, rec->type);
+	pos_name = get_string(r, rec->pos);
+	if (!name || !type || !pos_name ||
+			!is_range_valid(r, SNAPSHOT_CARGO, rec->first_cargo, rec->num_cargo))
+		goto damaged;
+
+	ship_type = st_lookup_exact(&r->u->ship_type_names, type);
+	if (!ship_type) {
+		log_printfn(LOG_MAIN, "snapshot ship type %s is not in the config", type);
+		return -1;
+	}
+
+	pos = ship_position_by_name(rec->postype, pos_name);
+	if (!pos) {
+		log_printfn(LOG_MAIN, "snapshot position %s of ship %s is not in the universe",
+				pos_name, name);
+		return -1;
+	}
+
+	if (new_ship_to_player(ship_type, player))
+		return -1;
+	ship = list_first_entry(&player->ships, struct ship, list);
+
+	free(ship->name);
+	ship->name = strdup(name);
+	if (!ship->name)
+		return -1;
+
+	c = (const struct snapshot_cargo*)r->sections[SNAPSHOT_CARGO] + rec->first_cargo;
+	for (uint32_t i = 0; i < rec->num_cargo; i++, c++) {
+		item_name = get_string(r, c->item);
+		if (!item_name)
+			goto damaged;
+
+		item = st_lookup_exact(&r->u->item_names, item_name);
+		if (!item) {
+			log_printfn(LOG_MAIN, "snapshot item %s is not in the config", item_name);
+			return -1;
+		}
+
+		if (ship_set_cargo(ship, item, c->amount))
+			return -1;
+	}
+
+	if (!is_current)
+		return ship_go(ship, rec->postype, pos);
+
+	player->pos = ship;
+	player->postype = SHIP;
+	*current_pos = pos;
+
+	return 0;
+
+damaged:
+	log_printfn(LOG_MAIN, "snapshot ship is damaged");
+	return -1;
+}
+
+static int load_order(struct snapshot_reader *r, const struct snapshot_order * const rec,
+		struct player *player)
+{
+	const char *port_name, *item_name;
+	struct port *port;
+	struct item *item;
+
+	port_name = get_string(r, rec->port);
+	item_name = get_string(r, rec->item);
+	if (!port_name || !item_name || (rec->side != ORDER_BUY && rec->side != ORDER_SELL)) {
+		log_printfn(LOG_MAIN, "snapshot order is damaged");
+		return -1;
+	}
+
+	port = ship_position_by_name(PORT, port_name);
+	item = st_lookup_exact(&r->u->item_names, item_name);
+	if (!port || !item) {
+		log_printfn(LOG_MAIN, "snapshot order at %s for %s is not in the universe",
+				port_name, item_name);
+		return -1;
+	}
+
+	return market_restore_order(player, port, item, rec->id, rec->side, rec->price,
+			rec->amount, rec->goods, rec->credits);
+}
+
+static int load_player(struct snapshot_reader *r, const struct snapshot_player * const rec)
+{
+	const struct snapshot_order *orders;
+	const struct snapshot_ship *ships;
+	struct player *player;
+	void *pos = NULL;
+	const char *name, *secret;
+
+	name = get_string(r, rec->name);
+	secret = get_string(r, rec->secret);
+	if (!name || !secret || strlen(secret) > PLAYER_SECRET_LEN ||
+			!rec->num_ships || rec->ship >= rec->num_ships ||
+			!is_range_valid(r, SNAPSHOT_SHIPS, rec->first_ship, rec->num_ships) ||
+			!is_range_valid(r, SNAPSHOT_ORDERS, rec->first_order, rec->num_orders)) {
+		log_printfn(LOG_MAIN, "snapshot player is damaged");
+		return -1;
+	}
+
+	player = player_create(name);
+	if (!player)
+		return -1;
+	player->credits = rec->credits;
+	strcpy(player->secret, secret);
+
+	/* new_ship_to_player() adds to the front, so load backwards to keep the order */
+	ships = (const struct snapshot_ship*)r->sections[SNAPSHOT_SHIPS] + rec->first_ship;
+	for (uint32_t i = rec->num_ships; i-- > 0;) {
+		if (load_ship(r, &ships[i], player, i == rec->ship, &pos))
+			return -1;
+	}
+
+	orders = (const struct snapshot_order*)r->sections[SNAPSHOT_ORDERS] + rec->first_order;
+	for (uint32_t i = 0; i < rec->num_orders; i++) {
+		if (load_order(r, &orders[i], player))
+			return -1;
+	}
+
+	return player_place(player, ships[rec->ship].postype, pos);
+}
+
+static int load_universe(struct snapshot_reader *r)
+{
+	const struct snapshot_system *systems = r->sections[SNAPSHOT_SYSTEMS];
+	const struct snapshot_civ *civs = r->sections[SNAPSHOT_CIVS];
+	const struct snapshot_player *players = r->sections[SNAPSHOT_PLAYERS];
+	struct planet_type *type;
+	struct rb_node *node;
+
+	list_for_each_entry(type, &r->u->planet_types, list) {
+		if (st_add_string(&r->planet_types, type->name, type))
+			return -1;
+	}
+
+	r->systems = calloc(MAX(r->num[SNAPSHOT_SYSTEMS], 1), sizeof(*r->systems));
+	if (!r->systems)
+		return -1;
+
+	for (uint32_t i = 0; i < r->num[SNAPSHOT_SYSTEMS]; i++) {
+		if (load_system(r, &systems[i], i))
+			return -1;
+	}
+
+	/* Links can point at any system, so they need a second pass */
+	for (uint32_t i = 0; i < r->num[SNAPSHOT_SYSTEMS]; i++) {
+		if (load_links(r, &systems[i], r->systems[i]))
+			return -1;
+	}
+
+	for (uint32_t i = 0; i < r->num[SNAPSHOT_CIVS]; i++) {
+		if (load_civ(r, &civs[i]))
+			return -1;
+	}
+	civ_remove_homeless(&r->u->civs);
+
+	r->u->created = r->header->created;
+	r->u->inhabited_systems = r->header->inhabited_systems;
+	for (int i = 0; i < SNAPSHOT_NAME_LIST_NUM; i++)
+		names_set_state(name_list(r->u, i), &r->header->names[i]);
+
+	/* In the same order as genesis, see populate_constellations() */
+	for (node = rb_first(&r->u->x_rbtree); node; node = rb_next(node)) {
+		if (port_register_system(rb_entry(node, struct system, x_rbtree)))
+			return -1;
+	}
+
+	for (uint32_t i = 0; i < r->num[SNAPSHOT_PLAYERS]; i++) {
+		if (load_player(r, &players[i]))
+			return -1;
+	}
+	r->u->wal_lsn = r->header->wal_lsn;
+
+	mtrandom_seed(r->header->seed);
+
+	return 0;
+}
+
+/*
+ * Creates the universe from a snapshot instead of genesis. The config must
+ * already be loaded, as the snapshot refers to civs, items and types by name.
+ * The file is mapped rather than read, so the kernel reads it ahead as the
+ * records are decoded, and the mapping is dropped once the universe is built.
+ *
+ * Must be called before the server is started. On failure the universe may
+ * be partly loaded and should be freed.
+ */
+int snapshot_load(struct universe *u, const char * const file)
+{
+	struct snapshot_reader r;
+	struct stat st;
+	void *map;
+	int fd;
+	int ret = -1;
+
+	memset(&r, 0, sizeof(r));
+	r.u = u;
+	st_init(&r.planet_types);
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0) {
+		log_printfn(LOG_MAIN, "could not open snapshot %s: %s", file, strerror(errno));
+		goto out;
+	}
+
+	if (fstat(fd, &st) || st.st_size == 0) {
+		log_printfn(LOG_MAIN, "could not read snapshot %s", file);
+		close(fd);
+		goto out;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		log_printfn(LOG_MAIN, "could not map snapshot %s: %s", file, strerror(errno));
+		goto out;
+	}
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+	r.map = map;
+	r.size = st.st_size;
+	r.header = map;
+
+	if (!check_header(&r))
+		ret = load_universe(&r);
+
+	munmap(map, st.st_size);
+
+out:
+	if (ret)
+		log_printfn(LOG_MAIN, "loading snapshot %s failed", file);
+	else
+		log_printfn(LOG_MAIN, "loaded %lu systems from snapshot %s",
+				ptrlist_len(&u->systems), file);
+
+	st_destroy(&r.planet_types, ST_DONT_FREE_DATA);
+	free(r.systems);
+
+	return ret;
+}
@@ -0,0 +1,159 @@
+#ifndef _HAS_SNAPSHOT_H
+#define _HAS_SNAPSHOT_H
+
+#include <stdint.h>
+#include "names.h"
+#include "universe.h"
+
+/*
+ * A snapshot is the universe written to a single file, so a server can start
+ * from it instead of running genesis again. The file is position independent:
+ * records refer to each other by index and to strings by offset into the
+ * string section, never by pointer.
+ *
+ * The file starts with a struct snapshot_header followed by the sections it
+ * describes, each one an array of fixed size records aligned to 8 bytes.
+ * Numbers are stored in host byte order, which byte_order records.
+ *
+ * Everything a record owns is stored as a range (first, num) into the next
+ * section down: systems own stars, planets, ports and links, planets own
+ * ports, ports own cargo. Civs own their systems, in the order they were
+ * claimed. Players own ships and orders, and ships own cargo. Planet, port,
+ * ship and item types, the positions of ships and the ports of orders are
+ * stored by name and looked up when loading.
+ *
+ * wal_lsn is the last WAL record that was appended when the snapshot was
+ * started. The snapshot reflects at least that record, and perhaps some of
+ * the ones after it, see wal.h.
+ */
+#define SNAPSHOT_MAGIC "YASTGSNP"
+#define SNAPSHOT_VERSION 5
+#define SNAPSHOT_BYTE_ORDER 0x01020304
+#define SNAPSHOT_NO_STRING UINT32_MAX
+#define SNAPSHOT_NO_INDEX UINT32_MAX
+
+#define SNAPSHOT_DEFAULT_FILE "yastg.snapshot"
+
+enum snapshot_sections {
+	SNAPSHOT_STRINGS,		/* char, null terminated strings */
+	SNAPSHOT_SYSTEMS,		/* struct snapshot_system */
+	SNAPSHOT_STARS,			/* struct snapshot_star */
+	SNAPSHOT_PLANETS,		/* struct snapshot_planet */
+	SNAPSHOT_PORTS,			/* struct snapshot_port */
+	SNAPSHOT_CARGO,			/* struct snapshot_cargo */
+	SNAPSHOT_INDICES,		/* uint32_t system indices */
+	SNAPSHOT_CIVS,			/* struct snapshot_civ */
+	SNAPSHOT_PLAYERS,		/* struct snapshot_player */
+	SNAPSHOT_SHIPS,			/* struct snapshot_ship */
+	SNAPSHOT_ORDERS,		/* struct snapshot_order */
+	SNAPSHOT_SECTION_NUM
+};
+
+enum snapshot_name_lists {
+	SNAPSHOT_CONSTELLATION_NAMES,
+	SNAPSHOT_PORT_NAMES,
+	SNAPSHOT_PLAYER_NAMES,
+	SNAPSHOT_NAME_LIST_NUM
+};
+
+struct snapshot_section {
+	uint64_t offset;		/* From the start of the file */
+	uint64_t num;			/* Number of records */
+	uint64_t size;			/* Size of one record */
+};
+
+struct snapshot_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	uint64_t seed;
+	int64_t created;
+	uint64_t inhabited_systems;
+	uint64_t wal_lsn;
+	struct names_state names[SNAPSHOT_NAME_LIST_NUM];
+	struct snapshot_section sections[SNAPSHOT_SECTION_NUM];
+};
+
+struct snapshot_system {
+	uint32_t name;
+	int32_t hab;
+	int64_t x, y;
+	uint64_t r;
+	double phi;
+	uint32_t hablow, habhigh;
+	uint32_t first_star, num_stars;
+	uint32_t first_planet, num_planets;
+	uint32_t first_port, num_ports;
+	uint32_t first_link, num_links;
+};
+
+struct snapshot_star {
+	uint32_t name;
+	int32_t cls, lum, hab;
+	uint32_t lumval;
+	uint32_t hablow, habhigh;
+	uint32_t temp;
+};
+
+struct snapshot_planet {
+	uint32_t name;
+	uint32_t gname;
+	uint32_t type;
+	uint32_t dia, dist, life;
+	uint32_t first_port, num_ports;
+};
+
+struct snapshot_port {
+	uint32_t name;
+	uint32_t type;
+	uint32_t first_cargo, num_cargo;
+};
+
+struct snapshot_cargo {
+	uint32_t item;
+	uint32_t unused;
+	int64_t min, max;
+	int64_t amount;
+	int64_t daily_change;
+	int64_t price;
+	int64_t demand;
+};
+
+struct snapshot_civ {
+	uint32_t name;
+	uint32_t home;
+	uint32_t first_system, num_systems;
+};
+
+struct snapshot_player {
+	uint32_t name;
+	uint32_t secret;
+	uint32_t ship;			/* The current one, counted from first_ship */
+	uint32_t first_ship, num_ships;
+	uint32_t first_order, num_orders;
+	int64_t credits;
+};
+
+struct snapshot_ship {
+	uint32_t name;
+	uint32_t type;
+	uint32_t postype;
+	uint32_t pos;			/* Name of the system, planet or port */
+	uint32_t first_cargo, num_cargo;
+};
+
+struct snapshot_order {
+	uint32_t port;
+	uint32_t item;
+	uint32_t side;
+	uint32_t unused;
+	uint64_t id;
+	int64_t price;
+	int64_t amount;
+	int64_t goods, credits;
+};
+
+int snapshot_save(struct universe *u, const char * const file);
+int snapshot_load(struct universe *u, const char * const file);
+
+#endif
@@ -19,6 +19,7 @@ void system_init(struct system *s)
 	s->phi = 0.0;
 
 	rb_init_node(&s->x_rbtree);
+	INIT_LIST_HEAD(&s->grid_list);
 	ptrlist_init(&s->stars);
 	ptrlist_init(&s->planets);
 	ptrlist_init(&s->ports);
@@ -53,20 +54,30 @@ void system_free(struct system *s)
 	free(s);
 }
 
-#define STELLAR_MUL_HAB -50
 int system_create(struct system *s, char *name)
 {
-	struct star *sol;
-	struct list_head *lh;
-
 	system_init(s);
 
 	s->name = strdup(name);
+	if (!s->name)
+		return -1;
+
+	return 0;
+}
 
-	if (star_populate_system(s)) {
-		free(s->name);
+/*
+ * Generates the stars, planets and ports of a system. Everything generated
+ * belongs to the system alone, apart from the planet names, so different
+ * systems can be populated in parallel.
+ */
+#define STELLAR_MUL_HAB -50
+int system_populate(struct system *s)
+{
+	struct star *sol;
+	struct list_head *lh;
+
+	if (star_populate_system(s))
 		return -1;
-	}
 
 	s->hab = 0;
 
@@ -81,8 +92,6 @@ int system_create(struct system *s, char *name)
 	if (planet_populate_system(s))
 		return -1;
 
-	printf("  Number of planets: %lu\n", ptrlist_len(&s->planets));
-
 	return 0;
 }
 
@@ -13,6 +13,7 @@ struct system {
 	char *gname;
 	long x, y;
 	struct rb_node x_rbtree;
+	struct list_head grid_list;
 	unsigned long r;
 	double phi;
 	int hab;
@@ -21,11 +22,15 @@ struct system {
 	struct ptrlist planets;
 	struct ptrlist ports;
 	struct ptrlist links;
+	/* Only kept up to date for owned systems, see civ.c */
+	unsigned long border_unowned;	/* Unowned systems close by */
+	unsigned long border_foreign;	/* Systems of other civs close by */
 	struct list_head list;
 };
 
 void system_init(struct system *s);
 int system_create(struct system *s, char *name);
+int system_populate(struct system *s);
 void system_free(struct system *s);
 
 unsigned long system_distance(const struct system * const a, const struct system * const b);
@@ -0,0 +1,122 @@
+/*
+ * Writes checkpoints of a small universe with a player in it, both directly
+ * and from the checkpoint thread, and checks that they are the same file
+ * snapshot_save() writes when nothing changes in between.
+ */
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "checkpoint.h"
+#include "civ.h"
+#include "item.h"
+#include "log.h"
+#include "mtrandom.h"
+#include "names.h"
+#include "planet_type.h"
+#include "player.h"
+#include "port.h"
+#include "port_type.h"
+#include "ship.h"
+#include "ship_type.h"
+#include "snapshot.h"
+#include "threadpool.h"
+#include "universe.h"
+#include "universe_fixture.h"
+
+#define NUM_TESTS 4
+#define NUM_SYSTEMS 200
+#define SNAPSHOT_FILE "checkpoint_test.snapshot"
+#define CHECKPOINT_FILE "checkpoint_test.1"
+#define TIMED_CHECKPOINT_FILE "checkpoint_test.2"
+#define BAD_CHECKPOINT_FILE "checkpoint_test.none/checkpoint"
+
+static void add_player()
+{
+	struct player *player;
+	struct port *port;
+
+	player = player_create(NULL);
+	assert(player);
+	assert(!new_ship_to_player(list_first_entry(&univ.ship_types, struct ship_type, list), player));
+	player->pos = list_first_entry(&player->ships, struct ship, list);
+	player->postype = SHIP;
+
+	port = list_first_entry(&univ.ports, struct port, list);
+	player_go(player, PORT, port);
+}
+
+static char* read_file(const char * const file, size_t *len)
+{
+	FILE *f;
+	char *data;
+
+	f = fopen(file, "r");
+	assert(f);
+	assert(!fseek(f, 0, SEEK_END));
+	*len = ftell(f);
+	rewind(f);
+
+	data = malloc(*len);
+	assert(data);
+	assert(fread(data, 1, *len, f) == *len);
+	fclose(f);
+
+	return data;
+}
+
+static void assert_same_file(const char * const a, const char * const b)
+{
+	char *first, *second;
+	size_t first_len, second_len;
+
+	first = read_file(a, &first_len);
+	second = read_file(b, &second_len);
+	assert(first_len == second_len);
+	assert(!memcmp(first, second, first_len));
+
+	free(second);
+	free(first);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int tests = 0;
+	struct checkpoint_stats stats;
+
+	log_init("checkpoint_test.log");
+	mtrandom_seed(42);
+	assert(!threadpool_init(&workers, 2));
+
+	fixture_create_universe(NUM_SYSTEMS, FIXTURE_PLAYER_NAMES);
+	add_player();
+	assert(!snapshot_save(&univ, SNAPSHOT_FILE));
+	tests++;
+
+	assert(!checkpoint(&univ, CHECKPOINT_FILE, &stats));
+	assert(stats.duration >= stats.pause);
+	assert_same_file(SNAPSHOT_FILE, CHECKPOINT_FILE);
+	tests++;
+
+	/* The server goes on if the child fails */
+	assert(checkpoint(&univ, BAD_CHECKPOINT_FILE, &stats));
+	assert(access(BAD_CHECKPOINT_FILE, F_OK));
+	tests++;
+
+	unlink(TIMED_CHECKPOINT_FILE);
+	assert(!start_checkpoints(TIMED_CHECKPOINT_FILE, 1));
+	sleep(2);
+	stop_checkpoints();
+	assert_same_file(SNAPSHOT_FILE, TIMED_CHECKPOINT_FILE);
+	tests++;
+
+	fixture_destroy_universe();
+	unlink(TIMED_CHECKPOINT_FILE);
+	unlink(CHECKPOINT_FILE);
+	unlink(SNAPSHOT_FILE);
+	threadpool_free(&workers);
+	log_close();
+
+	assert(tests == NUM_TESTS);
+}
@@ -1,10 +1,17 @@
 #include <assert.h>
 #include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include "cli.h"
+#include "cli_stats.h"
 #include "list.h"
 
-#define NUM_TESTS 57
+#define NUM_TESTS 65
+#define STATS_CALLS 1000
+#define STATS_THREADS 4
 
 struct test_data {
 	const char cmd[32];
@@ -190,6 +197,115 @@ static int do_run_invalid_cmds_test(struct st_root *head)
 	return tests;
 }
 
+static struct st_root *self_root;
+static int remove_self(void *data, char *string)
+{
+	return cli_rm_cmd(self_root, "selfrm");
+}
+char remove_self_help[] = "Removes itself";
+
+static void* run_stats_cmds(void *head)
+{
+	for (int i = 0; i < STATS_CALLS; i++)
+		assert(cli_run_cmd(head, "statbar") == 1);
+
+	return NULL;
+}
+
+static void check_stats(const char * const cmd, const uint64_t calls, const uint64_t errors)
+{
+	struct cli_cmd_stats *stats = malloc(sizeof(*stats));
+	unsigned int id = cli_stats_id(cmd);
+
+	assert(stats);
+	assert(!strcmp(cli_stats_get(id, stats), cmd));
+	assert(stats->calls == calls && stats->errors == errors);
+	assert(stats->latency.count == calls);
+	if (calls)
+		assert(histogram_percentile(&stats->latency, 50) <= stats->latency.max);
+
+	free(stats);
+}
+
+static int do_stats_tests(struct st_root *head)
+{
+	unsigned int tests = 0;
+	struct cli_cmd_stats *unknown = malloc(sizeof(*unknown)), *after = malloc(sizeof(*after));
+	pthread_t threads[STATS_THREADS];
+	char file[] = "/tmp/cli_test.XXXXXX", line[256], expected[64];
+	unsigned int id;
+	int data = 0, found = 0, fd;
+	FILE *f;
+
+	assert(unknown && after);
+
+	id = cli_stats_id("statfoo");
+	assert(id != CLI_STATS_UNKNOWN && id < cli_stats_num());
+	assert(cli_stats_id("statfoo") == id);
+	assert(cli_stats_id("statfo") != id);
+	tests++;
+
+	assert(!cli_add_cmd(head, "statfoo", &return_int, &data, return_int_help));
+	for (int i = 0; i < STATS_CALLS; i++) {
+		data = i % 4 == 0;
+		assert(cli_run_cmd(head, "statfoo") == data);
+	}
+	check_stats("statfoo", STATS_CALLS, STATS_CALLS / 4);
+	tests++;
+
+	/* Abbreviated, it is still the same command */
+	assert(cli_run_cmd(head, "statf") == data);
+	check_stats("statfoo", STATS_CALLS + 1, STATS_CALLS / 4);
+	tests++;
+
+	assert(!strcmp(cli_stats_get(CLI_STATS_UNKNOWN, unknown), "(unknown)"));
+	assert(cli_run_cmd(head, "nosuchcmd") < 0);
+	cli_stats_get(CLI_STATS_UNKNOWN, after);
+	assert(after->calls == unknown->calls + 1 && after->errors == unknown->errors + 1);
+	tests++;
+
+	/* Counted by every thread on its own, and kept when they are gone */
+	assert(!cli_add_cmd(head, "statbar", &return_one, NULL, return_one_help));
+	for (int i = 0; i < STATS_THREADS; i++)
+		assert(!pthread_create(&threads[i], NULL, run_stats_cmds, head));
+	for (int i = 0; i < STATS_THREADS; i++)
+		pthread_join(threads[i], NULL);
+	check_stats("statbar", STATS_THREADS * STATS_CALLS, STATS_THREADS * STATS_CALLS);
+	tests++;
+
+	self_root = head;
+	assert(!cli_add_cmd(head, "selfrm", &remove_self, NULL, remove_self_help));
+	assert(cli_run_cmd(head, "selfrm") == 0);
+	assert(cli_run_cmd(head, "selfrm") < 0);
+	check_stats("selfrm", 1, 0);
+	tests++;
+
+	fd = mkstemp(file);
+	assert(fd >= 0);
+	close(fd);
+	assert(!cli_stats_export(file));
+	snprintf(expected, sizeof(expected), "statfoo,%d,%d,", STATS_CALLS + 1, STATS_CALLS / 4);
+	f = fopen(file, "r");
+	assert(f);
+	assert(fgets(line, sizeof(line), f) && !strncmp(line, "command,calls,errors,", 21));
+	while (fgets(line, sizeof(line), f))
+		found += !strncmp(line, expected, strlen(expected));
+	fclose(f);
+	unlink(file);
+	assert(found == 1);
+	tests++;
+
+	assert(cli_stats_export("/nonexistent/dir/file") < 0);
+	tests++;
+
+	assert(!cli_rm_cmd(head, "statfoo"));
+	assert(!cli_rm_cmd(head, "statbar"));
+	free(after);
+	free(unknown);
+
+	return tests;
+}
+
 int main(int argc, char *argv[])
 {
 	unsigned int tests = 0;
@@ -202,6 +318,7 @@ int main(int argc, char *argv[])
 	tests += do_data_tests(&head);
 	tests += do_param_tests(&head);
 	tests += do_run_invalid_cmds_test(&head);
+	tests += do_stats_tests(&head);
 
 	assert(tests == NUM_TESTS);
 
@@ -0,0 +1,241 @@
+/*
+ * Loads the data files, saves them to a config cache and loads the cache into
+ * a fresh universe, which must then save to the very same cache. Also checks
+ * that touching a data file keeps the cache, while changing it or the list of
+ * files does not.
+ */
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "civ.h"
+#include "confcache.h"
+#include "item.h"
+#include "log.h"
+#include "mtrandom.h"
+#include "names.h"
+#include "planet_type.h"
+#include "port_type.h"
+#include "ship_type.h"
+#include "universe.h"
+#include "universe_fixture.h"
+
+#define NUM_TESTS 6
+#define CACHE_FILE "confcache_test.cache"
+#define SECOND_CACHE_FILE "confcache_test.cache2"
+#define ITEMS_FILE "confcache_test.items"
+
+struct confcache_source sources[] = {
+	{ .key = "civilizations",	.file = "foociv" },
+	{ .key = "civilizations",	.file = "grazny" },
+	{ .key = "civilizations",	.file = "terran" },
+	{ .key = "constellations",	.file = "constellations" },
+	{ .key = "firstnames",		.file = "firstnames" },
+	{ .key = "surnames",		.file = "surnames" },
+	{ .key = "placenames",		.file = "placenames" },
+	{ .key = "placeprefix",		.file = "placeprefix" },
+	{ .key = "placesuffix",		.file = "placesuffix" },
+	{ .key = "items",		.file = ITEMS_FILE },
+	{ .key = "ships",		.file = "ships" },
+	{ .key = "ports",		.file = "ports" },
+	{ .key = "planets",		.file = "planets" },
+};
+#define ITEMS_SOURCE 9
+
+static const char* source(const char * const key)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(sources); i++) {
+		if (!strcmp(sources[i].key, key))
+			return sources[i].file;
+	}
+
+	assert(0);
+	return NULL;
+}
+
+static void init_universe()
+{
+	universe_init(&univ);
+	names_init(&univ.avail_constellations);
+	names_init(&univ.avail_port_names);
+	names_init(&univ.avail_player_names);
+}
+
+static void load_from_files()
+{
+	for (size_t i = 0; i < 3; i++)
+		assert(!load_civs_from_file(sources[i].file, &univ));
+	assert(!load_items_from_file(source("items"), &univ));
+	assert(!load_ships_from_file(source("ships"), &univ));
+	assert(!load_ports_from_file(source("ports"), &univ));
+	assert(!load_planets_from_file(source("planets"), &univ));
+
+	names_load(&univ.avail_constellations, NULL, source("constellations"), NULL, NULL);
+	names_load(&univ.avail_port_names, source("placeprefix"), source("placenames"),
+			NULL, source("placesuffix"));
+	names_load(&univ.avail_player_names, NULL, source("firstnames"), source("surnames"), NULL);
+}
+
+static void destroy_universe()
+{
+	struct civ *c, *_c;
+
+	list_for_each_entry_safe(c, _c, &univ.civs, list) {
+		list_del(&c->list);
+		civ_free(c);
+		free(c);
+	}
+
+	names_free(&univ.avail_constellations);
+	names_free(&univ.avail_port_names);
+	names_free(&univ.avail_player_names);
+	confcache_release();
+
+	universe_free(&univ);
+}
+
+static char* read_file(const char * const file, size_t *len)
+{
+	FILE *f;
+	char *data;
+
+	f = fopen(file, "r");
+	assert(f);
+	assert(!fseek(f, 0, SEEK_END));
+	*len = ftell(f);
+	rewind(f);
+
+	data = malloc(*len);
+	assert(data);
+	assert(fread(data, 1, *len, f) == *len);
+	fclose(f);
+
+	return data;
+}
+
+static void write_file(const char * const file, const char * const data, const size_t len)
+{
+	FILE *f;
+
+	f = fopen(file, "w");
+	assert(f);
+	assert(fwrite(data, 1, len, f) == len);
+	fclose(f);
+}
+
+static void assert_same_file(const char * const a, const char * const b)
+{
+	char *first, *second;
+	size_t first_len, second_len;
+
+	first = read_file(a, &first_len);
+	second = read_file(b, &second_len);
+	assert(first_len == second_len);
+	assert(!memcmp(first, second, first_len));
+
+	free(second);
+	free(first);
+}
+
+static int load_cache(const char * const cache, const size_t num)
+{
+	int r;
+
+	init_universe();
+	r = confcache_load(&univ, cache, sources, num);
+	if (r)
+		assert(list_empty(&univ.items) && list_empty(&univ.civs) &&
+				!is_names_loaded(&univ.avail_player_names));
+	destroy_universe();
+
+	return r;
+}
+
+/*
+ * Moves the modification time of a file a second into the future
+ */
+static void touch(const char * const file)
+{
+	struct timeval now[2];
+
+	gettimeofday(&now[0], NULL);
+	now[0].tv_sec += 1;
+	now[1] = now[0];
+	assert(!utimes(file, now));
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int tests = 0;
+	uint64_t capacity;
+	char *items, *data, *name;
+	size_t len, data_len;
+
+	log_init("confcache_test.log");
+	mtrandom_seed(42);
+
+	for (size_t i = 0; i < ARRAY_SIZE(sources); i++) {
+		if (i != ITEMS_SOURCE)
+			sources[i].file = fixture_data_file(sources[i].file);
+	}
+
+	/* The items are copied so that they can be changed */
+	name = fixture_data_file("items");
+	items = read_file(name, &len);
+	free(name);
+	write_file(ITEMS_FILE, items, len);
+
+	init_universe();
+	load_from_files();
+	capacity = names_capacity(&univ.avail_player_names);
+	assert(!confcache_save(&univ, CACHE_FILE, sources, ARRAY_SIZE(sources)));
+	destroy_universe();
+	tests++;
+
+	init_universe();
+	assert(!confcache_load(&univ, CACHE_FILE, sources, ARRAY_SIZE(sources)));
+	assert(names_capacity(&univ.avail_player_names) == capacity);
+	name = create_unique_name(&univ.avail_player_names);
+	assert(name);
+	free(name);
+	assert(!confcache_save(&univ, SECOND_CACHE_FILE, sources, ARRAY_SIZE(sources)));
+	destroy_universe();
+	assert_same_file(CACHE_FILE, SECOND_CACHE_FILE);
+	tests++;
+
+	/* Fewer files than the cache was built from */
+	assert(load_cache(CACHE_FILE, ARRAY_SIZE(sources) - 1) == 1);
+	tests++;
+
+	touch(ITEMS_FILE);
+	assert(load_cache(CACHE_FILE, ARRAY_SIZE(sources)) == 0);
+	tests++;
+
+	data = read_file(SECOND_CACHE_FILE, &data_len);
+	data[data_len / 2] ^= 1;
+	write_file(SECOND_CACHE_FILE, data, data_len);
+	free(data);
+	assert(load_cache(SECOND_CACHE_FILE, ARRAY_SIZE(sources)) == 1);
+	tests++;
+
+	/* A change that keeps the size must be found by the hash */
+	items[len - 2] = items[len - 2] == '1' ? '2' : '1';
+	write_file(ITEMS_FILE, items, len);
+	touch(ITEMS_FILE);
+	assert(load_cache(CACHE_FILE, ARRAY_SIZE(sources)) == 1);
+	tests++;
+
+	free(items);
+	for (size_t i = 0; i < ARRAY_SIZE(sources); i++) {
+		if (i != ITEMS_SOURCE)
+			free((char*)sources[i].file);
+	}
+	unlink(SECOND_CACHE_FILE);
+	unlink(CACHE_FILE);
+	unlink(ITEMS_FILE);
+	log_close();
+
+	assert(tests == NUM_TESTS);
+}
@@ -1,143 +1,739 @@
-#include <stdio.h>
-#include <unistd.h>
+/*
+ * Generates load on a server by playing it over many connections at once,
+ * and measures how long it takes to answer each command, from sending it
+ * until the prompt comes back.
+ *
+ * Connections are opened evenly over the ramp-up time and then send
+ * commands until the run is over, each waiting for the answer to the last
+ * one and then thinking for a while, exponentially distributed around the
+ * think time. Commands are either drawn at random from a weighted mix, by
+ * default one of looking around, travelling, docking and trading, or read
+ * line by line from a script that every connection runs over and over. In a
+ * mix, only commands that make sense where the player is are drawn.
+ *
+ * Commands may name a $system, $port or $item, which is replaced by one the
+ * connection has seen in the output of look, ports or trade, or by looking
+ * around instead if it hasn't seen any yet.
+ *
+ * The results are printed as CSV, a line per command with its count, how
+ * many the server didn't understand, commands per second, and mean,
+ * percentiles and max of the latency in microseconds. Anything else goes to
+ * stderr.
+ *
+ * Usage: conntest [-c connections] [-r ramp-up s] [-d duration s]
+ *                 [-t think time ms] [-j threads] [-m mix | -s script]
+ *                 <address> <port>
+ *
+ * where mix is a list of command:weight, such as "look:10,ports:1".
+ */
 #include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <math.h>
+#include <netdb.h>
+#include <poll.h>
 #include <pthread.h>
 #include <stdint.h>
-#include <limits.h>
-#include <errno.h>
-#include <string.h>
+#include <stdio.h>
 #include <stdlib.h>
-#include <netdb.h>
-#include <arpa/inet.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
 #include <sys/socket.h>
 #include <sys/types.h>
-#include <sys/queue.h>
+#include "common.h"
+#include "histogram.h"
+
+#define DEFAULT_CONNECTIONS 512
+#define DEFAULT_DURATION 60		/* s */
+#define DEFAULT_THINK_TIME 1000		/* ms */
+#define DEFAULT_MIX "look:20,map:5,ports:10,go:5,dock:10,trade:15,buy:10,sell:10,leave:5"
+
+#define PROMPT "yastg> "
+#define UNKNOWN_CMD "Unknown command or syntax error"
+
+#define MAX_TEMPLATES 64
+#define MAX_NAMES 32			/* Of each kind, per connection */
+#define MAX_RECV (1 << 20)
+#define POLL_TIMEOUT 100		/* ms */
+#define THINK_TIME_CAP 10		/* Times the think time */
+
+enum place {
+	IN_SPACE = 1,
+	IN_ORBIT = 2,
+	DOCKED = 4,
+	IN_FLIGHT = 8
+};
+#define ANYWHERE (IN_SPACE | IN_ORBIT | DOCKED | IN_FLIGHT)
+
+/* Where the commands of the default mix make sense, and what they need */
+static const struct {
+	const char *name;
+	const char *template;
+	unsigned int places;
+} known_commands[] = {
+	{ "look",	"look",		ANYWHERE },
+	{ "map",	"map",		IN_SPACE },
+	{ "ports",	"ports",	ANYWHERE },
+	{ "inventory",	"inventory",	ANYWHERE },
+	{ "go",		"go $system",	IN_SPACE },
+	{ "dock",	"dock $port",	IN_SPACE | IN_ORBIT },
+	{ "trade",	"trade",	DOCKED },
+	{ "buy",	"buy 1 $item",	DOCKED },
+	{ "sell",	"sell 1 $item",	DOCKED },
+	{ "leave",	"leave",	DOCKED | IN_ORBIT },
+};
 
-struct connect_info {
-	char *host;
-	uint16_t port;
+struct template {
+	char *text;
+	unsigned int weight;
+	unsigned int places;
+	unsigned int stat;		/* Index into the stats of each thread */
+};
+
+struct names {
+	char *names[MAX_NAMES];
+	unsigned int num;
+};
+
+enum client_state {
+	NOT_CONNECTED,
+	LOGGING_IN,
+	THINKING,
+	WAITING,
+	CLOSED
+};
+
+struct client {
 	int fd;
-	struct sockaddr_in server_addr;
-	SLIST_ENTRY(connect_info) list;
+	enum client_state state;
+	unsigned int place;
+	char *buf;
+	size_t len, size;
+	uint64_t next;			/* When to connect, or to send the next command */
+	uint64_t sent;
+	unsigned int stat;		/* Of the command waited for */
+	unsigned int line;		/* Of the script */
+	struct names systems, ports, items;
+};
+
+struct command_stats {
+	uint64_t errors;
+	struct histogram latency;	/* in us */
+};
+
+struct worker {
+	pthread_t thread;
+	struct client *clients;
+	unsigned int num;
+	unsigned int seed;
+	struct command_stats *stats;
+	unsigned long connected, failed, dropped;
 };
-SLIST_HEAD(connect_head, connect_info) conn_list;
 
-#define NUM_CONN 512
-int initialize_connections(struct connect_head *list, char *host, uint16_t port)
+static struct template templates[MAX_TEMPLATES];
+static unsigned int num_templates;
+static int scripted;
+
+/* The first word of every command, which is what stats are kept by */
+static char *stat_names[MAX_TEMPLATES + 1];
+static unsigned int num_stats;
+
+static struct addrinfo *server;
+static uint64_t start_time, end_time, ramp_up, think_time;
+static unsigned int num_clients;
+
+static uint64_t now_us()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static unsigned int stat_index(const char * const cmd)
+{
+	size_t len = strcspn(cmd, " ");
+	unsigned int i;
+
+	for (i = 0; i < num_stats; i++) {
+		if (strlen(stat_names[i]) == len && !strncmp(stat_names[i], cmd, len))
+			return i;
+	}
+
+	stat_names[num_stats] = strndup(cmd, len);
+	assert(stat_names[num_stats]);
+
+	return num_stats++;
+}
+
+static void add_template(const char * const text, const unsigned int weight,
+		const unsigned int places)
+{
+	struct template *t;
+
+	if (num_templates == MAX_TEMPLATES) {
+		fprintf(stderr, "conntest: too many commands, at most %d\n", MAX_TEMPLATES);
+		exit(EXIT_FAILURE);
+	}
+
+	t = &templates[num_templates++];
+	t->text = strdup(text);
+	assert(t->text);
+	t->weight = weight;
+	t->places = places;
+	t->stat = stat_index(text);
+}
+
+/*
+ * Parses command:weight[,...], where a command known_commands has is given
+ * its template and places, and anything else is sent as it is
+ */
+static void parse_mix(const char * const mix)
+{
+	char *copy = strdup(mix), *item, *save, *colon;
+	unsigned int i;
+	long weight;
+
+	assert(copy);
+
+	for (item = strtok_r(copy, ",", &save); item; item = strtok_r(NULL, ",", &save)) {
+		weight = 1;
+		colon = strrchr(item, ':');
+		if (colon) {
+			*colon = '\0';
+			weight = strtol(colon + 1, NULL, 10);
+		}
+		if (weight <= 0 || !*item) {
+			fprintf(stderr, "conntest: bad command in mix: %s\n", item);
+			exit(EXIT_FAILURE);
+		}
+
+		for (i = 0; i < sizeof(known_commands) / sizeof(*known_commands); i++) {
+			if (!strcmp(known_commands[i].name, item))
+				break;
+		}
+
+		if (i < sizeof(known_commands) / sizeof(*known_commands))
+			add_template(known_commands[i].template, weight, known_commands[i].places);
+		else
+			add_template(item, weight, ANYWHERE);
+	}
+
+	free(copy);
+}
+
+static void load_script(const char * const file)
+{
+	FILE *f = fopen(file, "r");
+	char line[256];
+	size_t len;
+
+	if (!f) {
+		fprintf(stderr, "conntest: could not open %s: %s\n", file, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		len = strcspn(line, "\r\n");
+		line[len] = '\0';
+		if (len && line[0] != '#')
+			add_template(line, 1, ANYWHERE);
+	}
+
+	fclose(f);
+	scripted = 1;
+
+	if (!num_templates) {
+		fprintf(stderr, "conntest: no commands in %s\n", file);
+		exit(EXIT_FAILURE);
+	}
+}
+
+static void names_clear(struct names *names)
+{
+	for (unsigned int i = 0; i < names->num; i++)
+		free(names->names[i]);
+	names->num = 0;
+}
+
+static void names_add(struct names *names, const char *name, size_t len)
+{
+	while (len && name[len - 1] == ' ')
+		len--;
+	if (!len || names->num == MAX_NAMES)
+		return;
+
+	names->names[names->num] = strndup(name, len);
+	assert(names->names[names->num]);
+	names->num++;
+}
+
+#define NAME_WIDTH 26		/* Of the name column in ports and trade */
+static int starts_with(const char * const line, const char * const prefix)
+{
+	return !strncmp(line, prefix, strlen(prefix));
+}
+
+/*
+ * Learns where the player is and what it can go to, dock at and trade from
+ * what the server said
+ */
+static void parse_output(struct client *c)
 {
-	struct connect_info *info;
+	struct names *list = NULL;
+	char *line, *end;
+	int columns = 0;
+	size_t len;
 
-	for (unsigned int i = 0; i < NUM_CONN; i++) {
-		info = malloc(sizeof(*info));
-		assert(info);
-		memset(info, 0, sizeof(*info));
-		info->host = host;
-		info->port = port;
+	for (line = c->buf; line < c->buf + c->len; line = end + 1) {
+		end = memchr(line, '\n', c->buf + c->len - line);
+		if (!end)
+			break;
+		*end = '\0';
+		len = end - line;
 
-		info->fd = socket(AF_INET, SOCK_STREAM, 0);
-		assert(info->fd >= 0);
+		if (starts_with(line, "System ") && strstr(line, "(coordinates")) {
+			c->place = IN_SPACE;
+		} else if (starts_with(line, "Station ") && strstr(line, ", orbiting")) {
+			c->place = DOCKED;
+		} else if (starts_with(line, "Planet ") && strstr(line, " in system ")) {
+			c->place = IN_ORBIT;
+			names_clear(&c->ports);
+		} else if (starts_with(line, "Arriving in ") || starts_with(line, "In flight to ")) {
+			c->place = IN_FLIGHT;
+		}
 
-		memset(&info->server_addr, 0, sizeof(info->server_addr));
-		info->server_addr.sin_family = AF_INET;
-		info->server_addr.sin_port = htons(info->port);
-		assert(inet_pton(AF_INET, info->host, &info->server_addr.sin_addr));
+		if (list && line[0] == ' ' && line[1] == ' ' && !columns) {
+			names_add(list, line + 2, len - 2);
+			continue;
+		}
+		if (list && columns && len > NAME_WIDTH && line[NAME_WIDTH] == ' ') {
+			/* Only ports in this system, at no distance, can be docked at */
+			if (list != &c->ports || (len >= 4 && !strcmp(end - 4, " 0.0")))
+				names_add(list, line, NAME_WIDTH);
+			continue;
+		}
+		list = NULL;
+		columns = 0;
 
-		SLIST_INSERT_HEAD(list, info, list);
+		if (starts_with(line, "This system has hyperspace links to")) {
+			list = &c->systems;
+			names_clear(list);
+		} else if (!strcmp(line, "Ports:") || !strcmp(line, "Orbital stations:")) {
+			list = &c->ports;
+		} else if (starts_with(line, "List of ports within")) {
+			/* The header of the columns comes next */
+			list = &c->ports;
+			names_clear(list);
+		} else if (starts_with(line, "Name ") && strstr(line, "Light yrs")) {
+			list = &c->ports;
+			columns = 1;
+		} else if (starts_with(line, "Item ") && strstr(line, "In stock")) {
+			list = &c->items;
+			names_clear(list);
+			columns = 1;
+		}
 	}
 
-	return 0;
+	c->len = 0;
 }
 
-int establish_connections(struct connect_head *list)
+static const char* pick_name(struct worker *w, const struct names * const names)
 {
-	struct connect_info *info;
+	return names->num ? names->names[rand_r(&w->seed) % names->num] : NULL;
+}
+
+/*
+ * Fills in the names in a template. Returns -1 if one isn't known yet.
+ */
+static int expand(struct worker *w, struct client *c, const char *text,
+		char *out, const size_t size)
+{
+	const struct { const char *var; struct names *names; } vars[] = {
+		{ "$system", &c->systems },
+		{ "$port", &c->ports },
+		{ "$item", &c->items },
+	};
+	const char *name, *dollar;
+	size_t len = 0;
+	unsigned int i;
+
+	while ((dollar = strchr(text, '$'))) {
+		for (i = 0; i < sizeof(vars) / sizeof(*vars); i++) {
+			if (starts_with(dollar, vars[i].var))
+				break;
+		}
+		if (i == sizeof(vars) / sizeof(*vars))
+			return -1;
 
-	SLIST_FOREACH(info, list, list) {
-		printf("establishing\n");
-		connect(info->fd, (struct sockaddr*)&info->server_addr, sizeof(info->server_addr));
-		assert(info->fd > 0);
+		name = pick_name(w, vars[i].names);
+		if (!name)
+			return -1;
+
+		len += snprintf(out + len, size - MIN(len, size), "%.*s%s",
+				(int)(dollar - text), text, name);
+		text = dollar + strlen(vars[i].var);
 	}
+	len += snprintf(out + len, size - MIN(len, size), "%s\n", text);
 
-	return 0;
+	return len < size ? 0 : -1;
 }
 
-static char data[] = "\n";
-int write_on_connections(struct connect_head *list)
+static const struct template* pick_template(struct worker *w, struct client *c)
 {
-	struct connect_info *info;
-	int n;
+	unsigned int total = 0, r;
+
+	if (scripted)
+		return &templates[c->line++ % num_templates];
 
-	SLIST_FOREACH(info, list, list) {
-		printf("writing\n");
-		n = write(info->fd, data, strlen(data));
-		assert(n > 0);
-		assert((unsigned int)n == strlen(data));
+	for (unsigned int i = 0; i < num_templates; i++) {
+		if (templates[i].places & c->place)
+			total += templates[i].weight;
 	}
+	if (!total)
+		return NULL;
 
-	return 0;
+	r = rand_r(&w->seed) % total;
+	for (unsigned int i = 0; i < num_templates; i++) {
+		if (!(templates[i].places & c->place))
+			continue;
+		if (r < templates[i].weight)
+			return &templates[i];
+		r -= templates[i].weight;
+	}
+
+	return NULL;
 }
 
-int close_connections(struct connect_head *list)
+static uint64_t think(struct worker *w)
 {
-	struct connect_info *info;
+	double u = rand_r(&w->seed) / ((double)RAND_MAX + 1);
+
+	if (!think_time)
+		return 0;
 
-	SLIST_FOREACH(info, list, list) {
-		printf("closing\n");
-		close(info->fd);
+	return MIN(-log(1 - u) * think_time, THINK_TIME_CAP * think_time);
+}
+
+static void close_client(struct worker *w, struct client *c, const int dropped)
+{
+	close(c->fd);
+	c->fd = -1;
+	c->state = CLOSED;
+	if (dropped)
+		w->dropped++;
+}
+
+static void send_command(struct worker *w, struct client *c, const uint64_t now)
+{
+	const struct template *t = pick_template(w, c);
+	char cmd[512];
+	size_t len, sent = 0;
+	ssize_t r;
+
+	/* Whatever came without being asked for, such as arrivals */
+	parse_output(c);
+
+	if (!t || expand(w, c, t->text, cmd, sizeof(cmd))) {
+		c->stat = stat_index("look");
+		strcpy(cmd, "look\n");
+	} else {
+		c->stat = t->stat;
+	}
+
+	len = strlen(cmd);
+	while (sent < len) {
+		r = write(c->fd, cmd + sent, len - sent);
+		if (r <= 0) {
+			close_client(w, c, 1);
+			return;
+		}
+		sent += r;
+	}
+
+	c->state = WAITING;
+	c->sent = now;
+}
+
+static void connect_client(struct worker *w, struct client *c, const uint64_t now)
+{
+	c->fd = socket(server->ai_family, server->ai_socktype, server->ai_protocol);
+	if (c->fd < 0 || connect(c->fd, server->ai_addr, server->ai_addrlen)) {
+		if (c->fd >= 0)
+			close(c->fd);
+		c->fd = -1;
+		c->state = CLOSED;
+		w->failed++;
+		return;
 	}
 
-	return 0;
+	c->state = LOGGING_IN;
+	c->place = IN_SPACE;
+	w->connected++;
 }
 
-int free_connections(struct connect_head *list)
+static void handle_answer(struct worker *w, struct client *c, const uint64_t now)
 {
-	struct connect_info *info;
+	struct command_stats *s;
 
-	while (!SLIST_EMPTY(list)) {
-		info = SLIST_FIRST(list);
-		SLIST_REMOVE_HEAD(list, list);
-		free(info);
+	if (c->state == WAITING) {
+		s = &w->stats[c->stat];
+		histogram_add(&s->latency, now - c->sent);
+		c->buf[c->len] = '\0';
+		if (strstr(c->buf, UNKNOWN_CMD))
+			s->errors++;
 	}
 
-	return 0;
+	parse_output(c);
+	c->state = THINKING;
+	c->next = now + think(w);
+}
+
+static void receive(struct worker *w, struct client *c, const uint64_t now)
+{
+	ssize_t r;
+
+	if (c->size - c->len < 4096 + 1) {
+		c->size = c->size ? c->size * 2 : 8192;
+		if (c->size > MAX_RECV) {
+			fprintf(stderr, "conntest: too much output without a prompt\n");
+			close_client(w, c, 1);
+			return;
+		}
+		c->buf = realloc(c->buf, c->size);
+		assert(c->buf);
+	}
+
+	r = read(c->fd, c->buf + c->len, c->size - c->len - 1);
+	if (r <= 0) {
+		close_client(w, c, 1);
+		return;
+	}
+	c->len += r;
+
+	if (c->len >= strlen(PROMPT) &&
+			!memcmp(c->buf + c->len - strlen(PROMPT), PROMPT, strlen(PROMPT)))
+		handle_answer(w, c, now);
+}
+
+static void* run_worker(void *data)
+{
+	struct worker *w = data;
+	struct pollfd *fds = calloc(w->num, sizeof(*fds));
+	struct client **polled = calloc(w->num, sizeof(*polled));
+	struct client *c;
+	uint64_t now, wake;
+	unsigned int n;
+	int timeout;
+
+	assert(fds && polled);
+
+	while ((now = now_us()) < end_time) {
+		wake = now + POLL_TIMEOUT * 1000;
+		n = 0;
+
+		for (unsigned int i = 0; i < w->num; i++) {
+			c = &w->clients[i];
+
+			if (c->state == NOT_CONNECTED && c->next <= now)
+				connect_client(w, c, now);
+			else if (c->state == THINKING && c->next <= now)
+				send_command(w, c, now);
+
+			if ((c->state == NOT_CONNECTED || c->state == THINKING) && c->next < wake)
+				wake = c->next;
+
+			if (c->state == LOGGING_IN || c->state == THINKING || c->state == WAITING) {
+				fds[n].fd = c->fd;
+				fds[n].events = POLLIN;
+				polled[n++] = c;
+			}
+		}
+
+		timeout = wake > now ? (wake - now + 999) / 1000 : 0;
+		if (poll(fds, n, timeout) <= 0)
+			continue;
+
+		now = now_us();
+		for (unsigned int i = 0; i < n; i++) {
+			if (fds[i].revents)
+				receive(w, polled[i], now);
+		}
+	}
+
+	for (unsigned int i = 0; i < w->num; i++) {
+		c = &w->clients[i];
+		if (c->fd >= 0)
+			close(c->fd);
+		names_clear(&c->systems);
+		names_clear(&c->ports);
+		names_clear(&c->items);
+		free(c->buf);
+	}
+
+	free(polled);
+	free(fds);
+
+	return NULL;
+}
+
+static void print_stats(const char * const name, const struct command_stats * const s,
+		const double secs)
+{
+	const struct histogram *h = &s->latency;
+
+	printf("%s,%"PRIu64",%"PRIu64",%.1f,%.0f,%"PRIu64",%"PRIu64",%"PRIu64",%"PRIu64"\n",
+			name, h->count, s->errors, h->count / secs, histogram_mean(h),
+			histogram_percentile(h, 50), histogram_percentile(h, 99),
+			histogram_percentile(h, 99.9), h->max);
+}
+
+static void usage(const char * const name)
+{
+	fprintf(stderr,
+			"syntax:  %s [-c connections] [-r ramp-up s] [-d duration s]\n"
+			"            [-t think time ms] [-j threads] [-m mix | -s script]\n"
+			"            <address> <port>\n"
+			"purpose: play the server at address:port over many connections\n"
+			"         and print the latency of every command as CSV.\n"
+			"         The default is %d connections for %d s, thinking for\n"
+			"         %d ms on average, with the mix %s\n",
+			name, DEFAULT_CONNECTIONS, DEFAULT_DURATION, DEFAULT_THINK_TIME,
+			DEFAULT_MIX);
+	exit(EXIT_FAILURE);
 }
 
-#define CONN_SLEEP 2
 int main(int argc, char *argv[])
 {
+	struct addrinfo hints;
+	struct worker *workers;
+	struct command_stats *total, *all;
+	unsigned long connected = 0, failed = 0, dropped = 0;
+	unsigned int threads = 1, k;
+	double duration = DEFAULT_DURATION, ramp = 0, secs;
+	const char *mix = DEFAULT_MIX, *script = NULL;
+	int opt, r;
+
+	num_clients = DEFAULT_CONNECTIONS;
+	think_time = DEFAULT_THINK_TIME * 1000;
+
+	while ((opt = getopt(argc, argv, "c:r:d:t:j:m:s:")) != -1) {
+		switch (opt) {
+		case 'c':
+			num_clients = strtoul(optarg, NULL, 10);
+			break;
+		case 'r':
+			ramp = strtod(optarg, NULL);
+			break;
+		case 'd':
+			duration = strtod(optarg, NULL);
+			break;
+		case 't':
+			think_time = strtod(optarg, NULL) * 1000;
+			break;
+		case 'j':
+			threads = strtoul(optarg, NULL, 10);
+			break;
+		case 'm':
+			mix = optarg;
+			break;
+		case 's':
+			script = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
 
-	if (argc != 3) {
-		fprintf(stderr,
-				"syntax:  %s <address> <port>\n"
-				"purpose: establish %d simultaneous connections to address:port\n"
-				"         keeping them open for %d seconds, then closing them.\n"
-				"         This is useful for testing networked servers.\n",
-				argv[0], NUM_CONN, CONN_SLEEP);
-		exit(1);
+	if (argc - optind != 2 || !num_clients || !threads || duration <= 0 || ramp < 0)
+		usage(argv[0]);
+	threads = MIN(threads, num_clients);
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	r = getaddrinfo(argv[optind], argv[optind + 1], &hints, &server);
+	if (r) {
+		fprintf(stderr, "conntest: %s:%s: %s\n", argv[optind], argv[optind + 1],
+				gai_strerror(r));
+		exit(EXIT_FAILURE);
 	}
 
-	long l;
-	char *p;
-	errno = 0;
-	l = strtol(argv[2], &p, 10);
-	if (errno != 0 || !p || *p != '\0' || l < 1 || l > UINT16_MAX) {
-		fprintf(stderr, "port %s is not numeric or not in range\n", argv[2]);
-		exit(1);
+	if (script)
+		load_script(script);
+	else
+		parse_mix(mix);
+	/* Looked around instead of commands that can't be sent */
+	stat_index("look");
+
+	workers = calloc(threads, sizeof(*workers));
+	assert(workers);
+	for (unsigned int i = 0; i < threads; i++) {
+		workers[i].clients = calloc(num_clients / threads + 1, sizeof(struct client));
+		workers[i].stats = calloc(num_stats, sizeof(struct command_stats));
+		workers[i].seed = i + 1;
+		assert(workers[i].clients && workers[i].stats);
 	}
 
-	struct connect_head conn_list = SLIST_HEAD_INITIALIZER(conn_list);
-	initialize_connections(&conn_list, argv[1], l);
+	ramp_up = ramp * 1000000;
+	start_time = now_us();
+	end_time = start_time + ramp_up + duration * 1000000;
+
+	/* Round robin over the threads, and evenly over the ramp-up */
+	for (unsigned int i = 0; i < num_clients; i++) {
+		struct worker *w = &workers[i % threads];
+		struct client *c = &w->clients[w->num++];
+
+		c->fd = -1;
+		c->next = start_time + ramp_up * i / num_clients;
+	}
 
-	establish_connections(&conn_list);
+	fprintf(stderr, "conntest: %u connections to %s:%s over %.1f s, for %.1f s, "
+			"thinking %.0f ms, %u threads\n", num_clients, argv[optind],
+			argv[optind + 1], ramp, duration, think_time / 1000.0, threads);
+
+	for (unsigned int i = 0; i < threads; i++)
+		assert(!pthread_create(&workers[i].thread, NULL, run_worker, &workers[i]));
+
+	total = calloc(num_stats, sizeof(*total));
+	all = calloc(1, sizeof(*all));
+	assert(total && all);
+
+	for (unsigned int i = 0; i < threads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		for (k = 0; k < num_stats; k++) {
+			total[k].errors += workers[i].stats[k].errors;
+			histogram_merge(&total[k].latency, &workers[i].stats[k].latency);
+			all->errors += workers[i].stats[k].errors;
+			histogram_merge(&all->latency, &workers[i].stats[k].latency);
+		}
+		connected += workers[i].connected;
+		failed += workers[i].failed;
+		dropped += workers[i].dropped;
+		free(workers[i].stats);
+		free(workers[i].clients);
+	}
 
-	sleep(CONN_SLEEP);
-	write_on_connections(&conn_list);
+	secs = (now_us() - start_time) / 1e6;
+	fprintf(stderr, "conntest: %lu connected, %lu failed to connect, %lu dropped, %.1f s\n",
+			connected, failed, dropped, secs);
 
-	sleep(CONN_SLEEP);
-	write_on_connections(&conn_list);
+	printf("command,count,errors,per_second,mean_us,p50_us,p99_us,p999_us,max_us\n");
+	for (k = 0; k < num_stats; k++)
+		print_stats(stat_names[k], &total[k], secs);
+	print_stats("all", all, secs);
 
-	close_connections(&conn_list);
-	free_connections(&conn_list);
+	for (k = 0; k < num_stats; k++)
+		free(stat_names[k]);
+	for (k = 0; k < num_templates; k++)
+		free(templates[k].text);
+	free(all);
+	free(total);
+	free(workers);
+	freeaddrinfo(server);
 
-	return 0;
+	return failed || dropped ? EXIT_FAILURE : 0;
 }
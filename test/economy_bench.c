@@ -0,0 +1,223 @@
+/*
+ * Fills the economy with ports holding a total of a million cargo slots (or
+ * as many as given) and times port update ticks: the bare kernel over every
+ * block, update_ports() with its locking and sharding on the worker pool,
+ * which only ticks the ports with requirements, and catching all the others
+ * up when they are read. The per-port walk over lists of cargo that the
+ * economy replaced is timed on the same ports for comparison.
+ *
+ * Usage: economy_bench [slots] [threads]
+ */
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "cargo.h"
+#include "economy.h"
+#include "item.h"
+#include "log.h"
+#include "mtrandom.h"
+#include "port.h"
+#include "port_update.h"
+#include "threadpool.h"
+#include "universe.h"
+
+#define DEFAULT_SLOTS 1000000
+#define CARGO_PER_PORT 8
+#define REQUIRES_EVERY 16		/* Ports, the rest require nothing */
+#define NUM_TICKS 100
+
+static double elapsed(const struct timespec * const start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/*
+ * Ports with a spread of daily changes, where the last cargo of every
+ * REQUIRES_EVERY port is made from the one before it.
+ */
+static void create_ports(const unsigned long slots, struct item *item)
+{
+	struct port *port;
+	struct cargo *cargo, *prev;
+	unsigned long n = 0, ports = 0;
+
+	while (n < slots) {
+		port = malloc(sizeof(*port));
+		assert(port);
+		port_init(port);
+
+		prev = NULL;
+		for (int i = 0; i < CARGO_PER_PORT && n < slots; i++, n++) {
+			cargo = malloc(sizeof(*cargo));
+			assert(cargo);
+			cargo_init(cargo);
+
+			cargo->item = item;
+			cargo->max = 10000;
+			*cargo->amount = mtrandom_ulong(cargo->max);
+			cargo->daily_change = (long)mtrandom_ulong(20000) - 10000;
+			if (i == CARGO_PER_PORT - 1 && prev && ports % REQUIRES_EVERY == 0)
+				ptrlist_push(&cargo->requires, prev);
+
+			list_add_tail(&cargo->list, &port->items);
+			prev = cargo;
+		}
+
+		assert(!economy_add_port(&univ.economy, port));
+		list_add(&port->list, &univ.ports);
+		ports++;
+	}
+}
+
+static void free_ports()
+{
+	struct port *port, *_port;
+	struct cargo *cargo, *_cargo;
+
+	list_for_each_entry_safe(port, _port, &univ.ports, list) {
+		list_del(&port->list);
+		economy_rm_port(&univ.economy, port);
+		list_for_each_entry_safe(cargo, _cargo, &port->items, list) {
+			cargo_free(cargo);
+			free(cargo);
+		}
+		pthread_rwlock_destroy(&port->items_lock);
+		free(port->item_cargo);
+		ptrlist_free(&port->players);
+		free(port);
+	}
+}
+
+/*
+ * How ports were updated before the economy
+ */
+static void update_port_list(struct port *port, uint32_t iteration)
+{
+	const long fraction = PORT_UPDATE_TICKS_PER_DAY;
+	struct cargo *cargo, *req;
+	struct list_head *lh;
+	long change, mod, fraction_iteration;
+
+	pthread_rwlock_wrlock(&port->items_lock);
+
+	list_for_each_entry(cargo, &port->items, list) {
+		if (!cargo->daily_change)
+			continue;
+
+		change = cargo->daily_change / fraction;
+		mod = cargo->daily_change % fraction;
+		fraction_iteration = fraction / cargo->daily_change;
+
+		if (mod && fraction_iteration && iteration % fraction_iteration == 0)
+			change += cargo->daily_change > 0 ? 1 : -1;
+
+		if (change < 0 && *cargo->amount < -change)
+			change = -*cargo->amount;
+		else if (change > 0 && cargo->max - *cargo->amount < change)
+			change = cargo->max - *cargo->amount;
+
+		ptrlist_for_each_entry(req, &cargo->requires, lh) {
+			if (change > 0 && *req->amount < change)
+				change = *req->amount;
+			else if (change < 0 && *req->amount < -change)
+				change = -*req->amount;
+		}
+
+		*cargo->amount += change;
+		ptrlist_for_each_entry(req, &cargo->requires, lh)
+			*req->amount -= labs(change);
+	}
+
+	pthread_rwlock_unlock(&port->items_lock);
+}
+
+static void report(const char * const what, const unsigned long slots, const double secs)
+{
+	printf("economy_bench: %-28s %8.3f ms/tick, %6.2f ns/slot, %.0f slots/s\n", what,
+			secs * 1000 / NUM_TICKS, secs * 1e9 / NUM_TICKS / slots,
+			(double)slots * NUM_TICKS / secs);
+}
+
+int main(int argc, char *argv[])
+{
+	struct port_update_stats stats;
+	struct timespec start;
+	struct economy_block *b;
+	struct port *port;
+	struct cargo *cargo;
+	long sum = 0;
+	struct item item;
+	unsigned long slots = DEFAULT_SLOTS;
+	unsigned int threads = threadpool_default_size();
+
+	if (argc > 1)
+		slots = strtoul(argv[1], NULL, 0);
+	if (argc > 2)
+		threads = strtoul(argv[2], NULL, 0);
+
+	log_init("economy_bench.log");
+	mtrandom_seed(42);
+	if (threadpool_init(&workers, threads))
+		return EXIT_FAILURE;
+
+	universe_init(&univ);
+	item_init(&item);
+	create_ports(slots, &item);
+
+	printf("economy_bench: %lu slots in %lu blocks, %u threads\n",
+			slots, univ.economy.num_blocks, workers.num);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < NUM_TICKS; i++) {
+		for (unsigned long j = 0; j < univ.economy.num_blocks; j++) {
+			b = univ.economy.blocks[j];
+			economy_update(b, 0, b->used);
+		}
+	}
+	report("kernel, one thread:", slots, elapsed(&start));
+
+	memset(&stats, 0, sizeof(stats));
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < NUM_TICKS; i++)
+		update_ports(&univ, 1, ECONOMY_BLOCK_SLOTS, &stats);
+	report("update_ports():", slots, elapsed(&start));
+	printf("economy_bench: %lu pending ports in %lu shards of up to %lu, slowest %.3f ms\n",
+			stats.ports, stats.shards, stats.shard_size, stats.slowest_shard * 1000);
+
+	/* Every port read once per tick, which is far more than players do */
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < NUM_TICKS; i++) {
+		economy_advance(&univ.economy, 1);
+		list_for_each_entry(port, &univ.ports, list) {
+			list_for_each_entry(cargo, &port->items, list)
+				sum += cargo_amount(cargo);
+		}
+	}
+	report("cargo_amount(), one thread:", slots, elapsed(&start));
+	printf("economy_bench: (total stock %ld)\n", sum / NUM_TICKS);
+
+	/* Back to the stock in each struct cargo, as it was */
+	list_for_each_entry(port, &univ.ports, list)
+		economy_rm_port(&univ.economy, port);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (uint32_t i = 0; i < NUM_TICKS; i++) {
+		list_for_each_entry(port, &univ.ports, list)
+			update_port_list(port, i);
+	}
+	report("list walk, one thread:", slots, elapsed(&start));
+
+	free_ports();
+	item_free(&item);
+	universe_free(&univ);
+	threadpool_free(&workers);
+	log_close();
+
+	return 0;
+}
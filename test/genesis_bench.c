@@ -0,0 +1,80 @@
+/*
+ * Creates a universe from the shipped data files and reports how fast
+ * genesis was and how much memory the universe takes, which are the numbers
+ * behind the estimates in universe_estimate_size() and universe_genesis().
+ *
+ * Usage: genesis_bench [systems] [seed]
+ */
+#include <assert.h>
+#include <inttypes.h>
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "civ.h"
+#include "item.h"
+#include "log.h"
+#include "mtrandom.h"
+#include "names.h"
+#include "planet_type.h"
+#include "port_type.h"
+#include "threadpool.h"
+#include "universe.h"
+#include "universe_fixture.h"
+
+#define DEFAULT_SYSTEMS 20000
+#define DEFAULT_SEED 42
+
+static size_t heap_used()
+{
+#if __GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33)
+	struct mallinfo2 mi = mallinfo2();
+#else
+	struct mallinfo mi = mallinfo();
+#endif
+
+	return mi.uordblks + mi.hblkhd;
+}
+
+static double elapsed(const struct timespec * const start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+	struct timespec start;
+	size_t before, after;
+	double secs;
+
+	log_init("genesis_bench.log");
+	mtrandom_seed(argc > 2 ? strtoull(argv[2], NULL, 0) : DEFAULT_SEED);
+	if (threadpool_init(&workers, threadpool_default_size()))
+		return EXIT_FAILURE;
+
+	fixture_create_config(argc > 1 ? strtoul(argv[1], NULL, 0) : DEFAULT_SYSTEMS,
+			FIXTURE_NO_PLAYER_NAMES);
+
+	before = heap_used();
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	if (universe_genesis(&univ))
+		return EXIT_FAILURE;
+
+	secs = elapsed(&start);
+	after = heap_used();
+
+	printf("genesis_bench: %lu systems using %u threads in %.2f s, %.0f systems/s\n",
+			ptrlist_len(&univ.systems), workers.num, secs,
+			ptrlist_len(&univ.systems) / secs);
+	printf("genesis_bench: %.0f bytes/system measured, %.0f bytes/system estimated\n",
+			(double)(after - before) / ptrlist_len(&univ.systems),
+			(double)universe_estimate_size(&univ) / univ.settings.systems);
+
+	return 0;
+}
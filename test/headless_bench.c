@@ -0,0 +1,137 @@
+/*
+ * Runs player commands through headless clients and times them: each of a
+ * few commands on its own on one thread, then a mix of them on a client per
+ * thread of the worker pool. Nothing goes over the network, so this is the
+ * cost of the commands themselves and of getting their output.
+ *
+ * Usage: headless_bench [commands] [systems] [threads]
+ */
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "civ.h"
+#include "headless.h"
+#include "item.h"
+#include "log.h"
+#include "mtrandom.h"
+#include "names.h"
+#include "planet_type.h"
+#include "port_type.h"
+#include "ship_type.h"
+#include "threadpool.h"
+#include "universe.h"
+#include "universe_fixture.h"
+
+#define DEFAULT_COMMANDS 1000000
+#define DEFAULT_SYSTEMS 1000
+
+static const char *mix[] = {
+	"look",
+	"inventory",
+	"ports",
+	"map",
+	"help",
+	"no such command",
+};
+#define MIX_SIZE (sizeof(mix) / sizeof(*mix))
+
+struct bench_client {
+	struct headless client;
+	unsigned long commands;
+	size_t output;			/* Bytes, so that it can't be optimized away */
+};
+
+static double elapsed(const struct timespec * const start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void run_mix(void *data, unsigned long idx)
+{
+	struct bench_client *b = (struct bench_client*)data + idx;
+
+	for (unsigned long i = 0; i < b->commands; i++) {
+		headless_run(&b->client, mix[i % MIX_SIZE]);
+		b->output += b->client.out.idx;
+	}
+}
+
+static void report(const char * const what, const unsigned long commands,
+		const unsigned int threads, const double secs)
+{
+	printf("headless_bench: %-24s %8.0f ns/command, %.0f commands/s, %.0f commands/s per thread\n",
+			what, secs * 1e9 / commands, commands / secs, commands / secs / threads);
+}
+
+int main(int argc, char *argv[])
+{
+	struct bench_client *clients;
+	struct headless client;
+	struct timespec start;
+	unsigned long commands = DEFAULT_COMMANDS, each;
+	unsigned int threads = threadpool_default_size();
+	size_t output = 0;
+	char what[32];
+
+	if (argc > 1)
+		commands = strtoul(argv[1], NULL, 0);
+	if (argc > 3)
+		threads = strtoul(argv[3], NULL, 0);
+
+	log_init("headless_bench.log");
+	mtrandom_seed(42);
+	if (threadpool_init(&workers, threads))
+		return EXIT_FAILURE;
+
+	fixture_create_config(argc > 2 ? strtoul(argv[2], NULL, 0) : DEFAULT_SYSTEMS,
+			FIXTURE_PLAYER_NAMES);
+
+	if (universe_genesis(&univ))
+		return EXIT_FAILURE;
+
+	printf("headless_bench: %lu commands, %lu systems, %u threads\n",
+			commands, univ.settings.systems, workers.num + 1);
+
+	assert(!headless_init(&client));
+	each = commands / MIX_SIZE;
+	for (unsigned int c = 0; c < MIX_SIZE; c++) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (unsigned long i = 0; i < each; i++) {
+			headless_run(&client, mix[c]);
+			output += client.out.idx;
+		}
+		snprintf(what, sizeof(what), "\"%s\":", mix[c]);
+		report(what, each, 1, elapsed(&start));
+	}
+	headless_free(&client);
+
+	clients = calloc(workers.num + 1, sizeof(*clients));
+	assert(clients);
+	for (unsigned int i = 0; i <= workers.num; i++) {
+		assert(!headless_init(&clients[i].client));
+		clients[i].commands = commands / (workers.num + 1);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	threadpool_for(&workers, workers.num + 1, run_mix, clients);
+	report("mix, client per thread:", commands / (workers.num + 1) * (workers.num + 1),
+			workers.num + 1, elapsed(&start));
+
+	for (unsigned int i = 0; i <= workers.num; i++) {
+		output += clients[i].output;
+		headless_free(&clients[i].client);
+	}
+	printf("headless_bench: %zu bytes of output\n", output);
+
+	free(clients);
+	threadpool_free(&workers);
+	log_close();
+
+	return 0;
+}
@@ -0,0 +1,220 @@
+/*
+ * Headless clients: logging in, running commands and scripts, and getting
+ * back what the player was told. A client that goes away leaves its player
+ * to be resumed by another, just as with connections.
+ */
+#include <assert.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "civ.h"
+#include "common.h"
+#include "headless.h"
+#include "item.h"
+#include "log.h"
+#include "mtrandom.h"
+#include "names.h"
+#include "planet_type.h"
+#include "player.h"
+#include "port_type.h"
+#include "ptrlist.h"
+#include "ship_type.h"
+#include "stringtrie.h"
+#include "system.h"
+#include "threadpool.h"
+#include "universe.h"
+#include "universe_fixture.h"
+
+#define NUM_TESTS 6
+#define NUM_SYSTEMS 50
+
+static void test_login()
+{
+	struct headless client;
+	struct system *home = ptrlist_entry(&univ.systems, 0);
+
+	assert(!headless_init(&client));
+	assert(client.player && client.player->client == &client);
+	assert(strstr(headless_output(&client), client.player->name));
+	assert(strstr(headless_output(&client), home->name));
+
+	assert(headless_run(&client, "look") >= 0);
+	assert(strstr(headless_output(&client), home->name));
+
+	/* Only what the last command said is kept */
+	assert(headless_run(&client, "help") >= 0);
+	assert(strstr(headless_output(&client), "look"));
+	assert(!strstr(headless_output(&client), client.player->name));
+
+	assert(headless_run(&client, "no such command") < 0);
+	assert(!*headless_output(&client));
+
+	assert(!client.quit);
+	assert(headless_run(&client, "quit") >= 0);
+	assert(client.quit);
+	assert(!strcmp(headless_output(&client), "Bye!\n"));
+
+	headless_free(&client);
+}
+
+static void test_script()
+{
+	struct headless client;
+
+	assert(!headless_init(&client));
+
+	assert(headless_run_script(&client, "look\n\nwhere\nfoo\ninventory") == 1);
+	assert(strstr(headless_output(&client), "Stars:"));
+	assert(strstr(headless_output(&client), "is empty"));
+
+	/* Nothing after quit is run */
+	assert(headless_run_script(&client, "look\nquit\nfoo\nbar\n") == 0);
+	assert(client.quit);
+
+	headless_free(&client);
+}
+
+static void test_resume()
+{
+	struct headless first, second;
+	struct player *player;
+	char cmd[256];
+
+	assert(!headless_init(&first));
+	player = first.player;
+	player->credits = 12345;
+	assert(strlen(player->secret) == PLAYER_SECRET_LEN);
+	headless_free(&first);
+
+	/* Kept, waiting to be resumed */
+	assert(st_lookup_exact(&univ.playernames, player->name) == player);
+	assert(!player->client);
+
+	/* Not without the secret */
+	assert(!headless_init(&second));
+	snprintf(cmd, sizeof(cmd), "resume %s", player->name);
+	assert(headless_run(&second, cmd) >= 0);
+	assert(second.player != player && !player->client);
+	snprintf(cmd, sizeof(cmd), "resume %s %s", player->name, "0123456789abcdef");
+	assert(headless_run(&second, cmd) >= 0);
+	assert(second.player != player && !player->client);
+	assert(strstr(headless_output(&second), "There is no player"));
+
+	snprintf(cmd, sizeof(cmd), "resume %s %s", player->name, player->secret);
+	assert(headless_run(&second, cmd) >= 0);
+	assert(second.player == player && player->client == &second);
+	assert(strstr(headless_output(&second), "Welcome back"));
+	assert(player->credits == 12345);
+
+	/* Only one client at a time */
+	assert(!headless_init(&first));
+	assert(headless_run(&first, cmd) >= 0);
+	assert(first.player != player);
+	assert(strstr(headless_output(&first), "There is no player"));
+
+	headless_free(&first);
+	headless_free(&second);
+}
+
+#define NUM_CLIENTS 4
+static void test_expiry()
+{
+	struct headless clients[NUM_CLIENTS], client;
+	char *names[NUM_CLIENTS];
+	struct player *player;
+
+	/* Only the last two to go away are kept, of these and earlier tests */
+	univ.settings.detached_max = 2;
+	for (int i = 0; i < NUM_CLIENTS; i++) {
+		assert(!headless_init(&clients[i]));
+		names[i] = strdup(clients[i].player->name);
+		assert(names[i]);
+	}
+	for (int i = 0; i < NUM_CLIENTS; i++)
+		headless_free(&clients[i]);
+
+	assert(univ.num_detached == univ.settings.detached_max);
+	for (int i = 0; i < NUM_CLIENTS; i++)
+		assert(!st_lookup_exact(&univ.playernames, names[i]) == (i < NUM_CLIENTS - 2));
+
+	/* Nor those that have waited too long */
+	univ.settings.detached_max = 0;
+	univ.settings.detached_expiry = 60;
+	player = st_lookup_exact(&univ.playernames, names[NUM_CLIENTS - 2]);
+	player->detached_at -= 61;
+	assert(!headless_init(&client));
+	headless_free(&client);
+	assert(!st_lookup_exact(&univ.playernames, names[NUM_CLIENTS - 2]));
+	assert(st_lookup_exact(&univ.playernames, names[NUM_CLIENTS - 1]));
+
+	for (int i = 0; i < NUM_CLIENTS; i++)
+		free(names[i]);
+}
+
+/*
+ * The largest radius scan and where take, from a system away from the
+ * origin, where the search bounds would overflow if they weren't limited
+ */
+static void test_radius()
+{
+	struct headless client;
+	struct list_head *lh;
+	struct system *far = NULL, *s;
+	char cmd[64];
+
+	ptrlist_for_each_entry(s, &univ.systems, lh) {
+		if (s->x && s->y) {
+			far = s;
+			break;
+		}
+	}
+	assert(far);
+
+	assert(!headless_init(&client));
+	player_go(client.player, SYSTEM, far);
+
+	snprintf(cmd, sizeof(cmd), "scan %ld", LONG_MAX / TICK_PER_LY);
+	assert(headless_run(&client, cmd) >= 0);
+	assert(!strstr(headless_output(&client), "syntax"));
+
+	snprintf(cmd, sizeof(cmd), "where %s %ld",
+			list_first_entry(&univ.items, struct item, list)->name, LONG_MAX / TICK_PER_LY);
+	assert(headless_run(&client, cmd) >= 0);
+	assert(!strstr(headless_output(&client), "syntax"));
+
+	headless_free(&client);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int tests = 0;
+
+	log_init("headless_test.log");
+	mtrandom_seed(42);
+	assert(!threadpool_init(&workers, 4));
+
+	fixture_create_universe(NUM_SYSTEMS, FIXTURE_PLAYER_NAMES);
+	tests++;
+
+	test_login();
+	tests++;
+
+	test_script();
+	tests++;
+
+	test_resume();
+	tests++;
+
+	test_expiry();
+	tests++;
+
+	test_radius();
+	tests++;
+
+	fixture_destroy_universe();
+	threadpool_free(&workers);
+	log_close();
+
+	assert(tests == NUM_TESTS);
+}
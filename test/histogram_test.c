@@ -0,0 +1,147 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include "histogram.h"
+#include "mtrandom.h"
+
+#define NUM_TESTS 4
+#define NUM_VALUES 100000
+
+static int cmp_u64(const void *_a, const void *_b)
+{
+	const uint64_t *a = _a, *b = _b;
+
+	return (*a > *b) - (*a < *b);
+}
+
+/*
+ * Every value is counted in the bucket whose range it is in, and no bucket
+ * is wider than 1/HISTOGRAM_SUB_BUCKETS of the values in it
+ */
+static void test_buckets()
+{
+	unsigned int b;
+	uint64_t v;
+
+	for (b = 1; b < HISTOGRAM_BUCKETS; b++)
+		assert(histogram_bucket_max(b) > histogram_bucket_max(b - 1));
+	assert(histogram_bucket(UINT64_MAX) == HISTOGRAM_BUCKETS - 1);
+	assert(histogram_bucket_max(HISTOGRAM_BUCKETS - 1) == UINT64_MAX);
+
+	for (v = 0; v < 4096; v++)
+		assert(histogram_bucket(v) <= histogram_bucket(v + 1));
+
+	for (int i = 0; i < NUM_VALUES; i++) {
+		v = mtrandom_uint64(UINT64_MAX) >> mtrandom_uint(64);
+		b = histogram_bucket(v);
+		assert(v <= histogram_bucket_max(b));
+		assert(!b || v > histogram_bucket_max(b - 1));
+		assert(histogram_bucket_max(b) - v <= v / HISTOGRAM_SUB_BUCKETS);
+	}
+}
+
+/*
+ * Percentiles are never below the exact ones, and at most a bucket above
+ */
+static void check_percentiles(const struct histogram * const h, uint64_t *values,
+		const unsigned long num)
+{
+	const double percentiles[] = { 0, 1, 50, 90, 99, 99.9, 100 };
+	uint64_t exact, p;
+	unsigned long rank;
+
+	qsort(values, num, sizeof(*values), cmp_u64);
+
+	for (unsigned int i = 0; i < sizeof(percentiles) / sizeof(*percentiles); i++) {
+		rank = percentiles[i] / 100.0 * num + 0.5;
+		rank = rank < 1 ? 1 : (rank > num ? num : rank);
+		exact = values[rank - 1];
+
+		p = histogram_percentile(h, percentiles[i]);
+		assert(p >= exact && p - exact <= exact / HISTOGRAM_SUB_BUCKETS);
+	}
+
+	assert(histogram_percentile(h, 100) == values[num - 1]);
+	assert(h->max == values[num - 1]);
+}
+
+static void test_percentiles()
+{
+	struct histogram *h = malloc(sizeof(*h));
+	uint64_t *values = malloc(NUM_VALUES * sizeof(*values));
+	uint64_t sum = 0;
+
+	assert(h && values);
+	histogram_init(h);
+	assert(histogram_percentile(h, 50) == 0 && histogram_mean(h) == 0);
+
+	for (int i = 0; i < NUM_VALUES; i++) {
+		values[i] = mtrandom_uint64(1000000);
+		sum += values[i];
+		histogram_add(h, values[i]);
+	}
+
+	assert(h->count == NUM_VALUES && h->sum == sum);
+	assert(histogram_mean(h) == (double)sum / NUM_VALUES);
+	check_percentiles(h, values, NUM_VALUES);
+
+	free(values);
+	free(h);
+}
+
+/*
+ * Merging histograms gives the histogram of all their values
+ */
+static void test_merge()
+{
+	struct histogram *a = malloc(sizeof(*a)), *b = malloc(sizeof(*b));
+	struct histogram *all = malloc(sizeof(*all));
+	uint64_t *values = malloc(NUM_VALUES * sizeof(*values));
+
+	assert(a && b && all && values);
+	histogram_init(a);
+	histogram_init(b);
+
+	for (int i = 0; i < NUM_VALUES; i++) {
+		/* Skewed towards small values, as latencies are */
+		values[i] = mtrandom_uint64(1 << mtrandom_uint(30));
+		histogram_add(i % 3 ? a : b, values[i]);
+	}
+
+	histogram_init(all);
+	histogram_merge(all, a);
+	histogram_merge(all, b);
+	assert(all->count == NUM_VALUES);
+	assert(all->max == MAX(a->max, b->max));
+	check_percentiles(all, values, NUM_VALUES);
+
+	free(values);
+	free(all);
+	free(b);
+	free(a);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int tests = 0;
+
+	mtrandom_seed(42);
+
+	test_buckets();
+	tests++;
+
+	test_percentiles();
+	tests++;
+
+	test_merge();
+	tests++;
+
+	/* Small values are exact */
+	for (uint64_t v = 0; v < HISTOGRAM_SUB_BUCKETS * 2; v++)
+		assert(histogram_bucket_max(histogram_bucket(v)) == v);
+	tests++;
+
+	assert(tests == NUM_TESTS);
+}
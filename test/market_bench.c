@@ -0,0 +1,206 @@
+/*
+ * Posts random limit orders around a price to the market of one port and
+ * times them, with every tenth order cancelling one instead and the traders
+ * now and then collecting what their orders got. Then does the same with a
+ * port per thread on the worker pool, where the markets never contend.
+ *
+ * Usage: market_bench [orders] [threads]
+ */
+#include <assert.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "item.h"
+#include "log.h"
+#include "market.h"
+#include "mtrandom.h"
+#include "player.h"
+#include "port.h"
+#include "ship.h"
+#include "ship_type.h"
+#include "threadpool.h"
+#include "universe.h"
+
+#define DEFAULT_ORDERS 1000000
+#define TRADERS_PER_PORT 64
+#define CANCEL_EVERY 10			/* Orders */
+#define COLLECT_EVERY 64		/* Orders of the same trader, on average */
+#define MID_PRICE 1000
+#define SPREAD 20
+#define MAX_AMOUNT 10
+
+struct bench_port {
+	struct port *port;
+	struct player traders[TRADERS_PER_PORT];
+	unsigned long orders;
+	unsigned long filled;
+};
+
+static struct item item;
+static struct ship_type ship_type;
+
+static double elapsed(const struct timespec * const start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void create_port(struct bench_port *b)
+{
+	struct player *player;
+	struct ship *ship;
+
+	b->port = malloc(sizeof(*b->port));
+	assert(b->port);
+	port_init(b->port);
+	b->port->name = strdup("Bench port");
+	assert(b->port->name);
+
+	for (int i = 0; i < TRADERS_PER_PORT; i++) {
+		player = &b->traders[i];
+		memset(player, 0, sizeof(*player));
+		INIT_LIST_HEAD(&player->ships);
+		INIT_LIST_HEAD(&player->orders);
+		pthread_mutex_init(&player->lock, NULL);
+		assert(asprintf(&player->name, "Trader %d", i) > 0);
+
+		assert(!new_ship_to_player(&ship_type, player));
+		ship = list_first_entry(&player->ships, struct ship, list);
+		player->pos = ship;
+		player->postype = SHIP;
+		player->credits = LONG_MAX / 2;
+		ship_set_cargo(ship, &item, LONG_MAX / 2);
+	}
+}
+
+static void free_port(struct bench_port *b)
+{
+	struct ship *ship, *_ship;
+
+	/* The orders go with the pool of the market */
+	port_free(b->port);
+
+	for (int i = 0; i < TRADERS_PER_PORT; i++) {
+		list_for_each_entry_safe(ship, _ship, &b->traders[i].ships, list) {
+			ship_free(ship);
+			free(ship);
+		}
+		pthread_mutex_destroy(&b->traders[i].lock);
+		free(b->traders[i].name);
+	}
+}
+
+static void run_port(void *data, unsigned long idx)
+{
+	struct bench_port *b = (struct bench_port*)data + idx;
+	struct player *player;
+	struct order *order;
+	enum order_side side;
+	enum trade_status status;
+	uint64_t id;
+	long filled;
+
+	for (unsigned long i = 0; i < b->orders; i++) {
+		player = &b->traders[mtrandom_ulong(TRADERS_PER_PORT)];
+
+		pthread_mutex_lock(&player->lock);
+
+		if (i % CANCEL_EVERY == CANCEL_EVERY - 1 && !list_empty(&player->orders)) {
+			order = list_last_entry(&player->orders, struct order, owner_list);
+			market_cancel(b->port, player, order->id);
+		} else {
+			side = mtrandom_ulong(2) ? ORDER_BUY : ORDER_SELL;
+			status = market_post(b->port, player, &item, side,
+					MID_PRICE - SPREAD + mtrandom_ulong(2 * SPREAD + 1),
+					1 + mtrandom_ulong(MAX_AMOUNT), &id, &filled);
+			assert(status == TRADE_OK);
+			b->filled += filled;
+		}
+
+		if (!mtrandom_ulong(COLLECT_EVERY))
+			market_collect(b->port, player);
+
+		pthread_mutex_unlock(&player->lock);
+	}
+}
+
+static void report(const char * const what, const unsigned long orders,
+		const unsigned int threads, const double secs)
+{
+	printf("market_bench: %-24s %8.0f ns/order, %.0f orders/s, %.0f orders/s per thread\n",
+			what, secs * 1e9 / orders, orders / secs, orders / secs / threads);
+}
+
+int main(int argc, char *argv[])
+{
+	struct bench_port *ports;
+	struct price_level bids[1], asks[1];
+	struct timespec start;
+	unsigned long orders = DEFAULT_ORDERS, filled = 0;
+	unsigned int threads = threadpool_default_size();
+
+	if (argc > 1)
+		orders = strtoul(argv[1], NULL, 0);
+	if (argc > 2)
+		threads = strtoul(argv[2], NULL, 0);
+
+	log_init("market_bench.log");
+	mtrandom_seed(42);
+	if (threadpool_init(&workers, threads))
+		return EXIT_FAILURE;
+
+	universe_init(&univ);
+	item_init(&item);
+	item.name = strdup("Bench goods");
+	item.id = univ.num_items++;
+	ship_type.carry_weight = INT_MAX;
+
+	ports = calloc(workers.num, sizeof(*ports));
+	assert(ports);
+	for (unsigned int i = 0; i < workers.num; i++)
+		create_port(&ports[i]);
+
+	printf("market_bench: %lu orders, %d traders per port, %u threads\n",
+			orders, TRADERS_PER_PORT, workers.num);
+
+	ports[0].orders = orders;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	run_port(ports, 0);
+	report("one port, one thread:", orders, 1, elapsed(&start));
+
+	market_depth(ports[0].port, &item, ORDER_BUY, bids, 1);
+	market_depth(ports[0].port, &item, ORDER_SELL, asks, 1);
+	printf("market_bench: %lu filled, best bid %ld, best ask %ld\n",
+			ports[0].filled, bids[0].price, asks[0].price);
+
+	for (unsigned int i = 0; i < workers.num; i++) {
+		free_port(&ports[i]);
+		create_port(&ports[i]);
+		ports[i].orders = orders / workers.num;
+		ports[i].filled = 0;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	threadpool_for(&workers, workers.num, run_port, ports);
+	report("a port per thread:", orders / workers.num * workers.num,
+			workers.num, elapsed(&start));
+
+	for (unsigned int i = 0; i < workers.num; i++) {
+		filled += ports[i].filled;
+		free_port(&ports[i]);
+	}
+	printf("market_bench: %lu filled\n", filled);
+
+	free(ports);
+	item_free(&item);
+	universe_free(&univ);
+	threadpool_free(&workers);
+	log_close();
+
+	return 0;
+}
@@ -0,0 +1,376 @@
+/*
+ * Trades between players on the market of a port: orders are filled by price
+ * and then by time, what is left of them waits in the book, cancelling hands
+ * everything back, and the books come back the same from a snapshot and the
+ * write-ahead log. Then a lot of players post and cancel orders at once,
+ * checking that no credits or goods are made or lost.
+ */
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "civ.h"
+#include "cli.h"
+#include "common.h"
+#include "item.h"
+#include "log.h"
+#include "market.h"
+#include "mtrandom.h"
+#include "names.h"
+#include "planet_type.h"
+#include "player.h"
+#include "port.h"
+#include "port_type.h"
+#include "ptrlist.h"
+#include "ship.h"
+#include "ship_type.h"
+#include "snapshot.h"
+#include "system.h"
+#include "threadpool.h"
+#include "universe.h"
+#include "wal.h"
+#include "universe_fixture.h"
+
+#define NUM_TESTS 5
+#define NUM_SYSTEMS 50
+#define NUM_TRADERS 64
+#define NUM_ROUNDS 2000
+#define CREDITS 100000
+#define GOODS 5
+#define SNAPSHOT_FILE "market_test.snapshot"
+#define WAL_FILE "market_test.wal"
+
+static struct port *port;
+static struct item *item;
+static struct player *traders[NUM_TRADERS];
+
+static struct player* dock()
+{
+	struct ship_type *ship_type = list_first_entry(&univ.ship_types, struct ship_type, list);
+	struct player *player;
+
+	player = player_create(NULL);
+	assert(player);
+	assert(!new_ship_to_player(ship_type, player));
+	player->pos = list_first_entry(&player->ships, struct ship, list);
+	player->postype = SHIP;
+	player->credits = CREDITS;
+	ship_set_cargo(player->pos, item, GOODS);
+
+	player_go(player, SYSTEM, port->system);
+	player_go(player, PORT, port);
+
+	return player;
+}
+
+static long held(struct player *player)
+{
+	return ship_cargo_amount(player->pos, item);
+}
+
+static uint64_t post(struct player *player, const enum order_side side,
+		const long price, const long amount, const long filled)
+{
+	uint64_t id;
+	long f;
+
+	assert(market_post(port, player, item, side, price, amount, &id, &f) == TRADE_OK);
+	assert(f == filled);
+
+	return id;
+}
+
+static void check_level(const enum order_side side, const unsigned int i,
+		const long price, const long amount)
+{
+	struct price_level levels[8];
+
+	assert(market_depth(port, item, side, levels, ARRAY_SIZE(levels)) > i);
+	assert(levels[i].price == price);
+	assert(levels[i].amount == amount);
+}
+
+static unsigned long depth(const enum order_side side)
+{
+	struct price_level levels[8];
+
+	return market_depth(port, item, side, levels, ARRAY_SIZE(levels));
+}
+
+static void test_priority()
+{
+	struct player *a = traders[0], *b = traders[1], *c = traders[2], *d = traders[3];
+	struct order *order;
+	uint64_t id_a, id_b, id_c, id;
+	long f;
+
+	id_a = post(a, ORDER_SELL, 12, 3, 0);
+	id_b = post(b, ORDER_SELL, 10, 2, 0);
+	id_c = post(c, ORDER_SELL, 10, 2, 0);
+	assert(held(a) == GOODS - 3 && held(b) == GOODS - 2);
+	check_level(ORDER_SELL, 0, 10, 4);
+	check_level(ORDER_SELL, 1, 12, 3);
+
+	/* Best price first, and the oldest order at it first */
+	post(d, ORDER_BUY, 11, 3, 3);
+	assert(held(d) == GOODS + 3);
+	assert(d->credits == CREDITS - 3 * 10);
+	assert(list_empty(&d->orders));
+
+	order = market_find_order(b, port, id_b);
+	assert(order && !order->amount && !order->in_book && order->credits == 20);
+	order = market_find_order(c, port, id_c);
+	assert(order && order->amount == 1 && order->in_book && order->credits == 10);
+	check_level(ORDER_SELL, 0, 10, 1);
+
+	/* Not enough to buy or sell with */
+	assert(market_post(port, d, item, ORDER_BUY, CREDITS, 2, &id, &f) == TRADE_NO_CREDITS);
+	assert(market_post(port, a, item, ORDER_SELL, 1, GOODS, &id, &f) == TRADE_NOT_ENOUGH);
+
+	/* Nothing crosses, so it waits */
+	post(d, ORDER_BUY, 9, 2, 0);
+	check_level(ORDER_BUY, 0, 9, 2);
+	assert(d->credits == CREDITS - 3 * 10 - 2 * 9);
+
+	assert(id_a < id_b && id_b < id_c);
+}
+
+static void test_cancel_and_collect()
+{
+	struct player *a = traders[0], *b = traders[1], *c = traders[2], *d = traders[3];
+	struct order *order;
+
+	/* The order waits for b to collect */
+	assert(!cli_run_cmd(&b->cli, "orders"));
+	assert(b->credits == CREDITS + 20);
+	assert(list_empty(&b->orders));
+
+	/* c still has one for sale */
+	assert(!cli_run_cmd(&c->cli, "orders"));
+	assert(c->credits == CREDITS + 10);
+	order = list_first_entry(&c->orders, struct order, owner_list);
+	assert(order->amount == 1 && !order->credits);
+
+	order = list_first_entry(&a->orders, struct order, owner_list);
+	assert(!market_cancel(port, a, order->id));
+	assert(market_cancel(port, a, order->id) == -1);
+	assert(held(a) == GOODS && a->credits == CREDITS);
+	assert(list_empty(&a->orders));
+
+	order = list_first_entry(&d->orders, struct order, owner_list);
+	assert(!market_cancel(port, d, order->id));
+	assert(d->credits == CREDITS - 3 * 10);
+
+	check_level(ORDER_SELL, 0, 10, 1);
+	assert(!depth(ORDER_BUY));
+}
+
+/*
+ * What the orders and books look like, to compare after loading
+ */
+struct state {
+	long credits[4], held[4];
+	unsigned long orders[4];
+	struct price_level bids[8], asks[8];
+	unsigned long num_bids, num_asks;
+};
+
+static void get_state(struct state *s)
+{
+	struct order *order;
+
+	memset(s, 0, sizeof(*s));
+	for (int i = 0; i < 4; i++) {
+		s->credits[i] = traders[i]->credits;
+		s->held[i] = held(traders[i]);
+		list_for_each_entry(order, &traders[i]->orders, owner_list)
+			s->orders[i] += order->id * 1000 + order->amount * 100 + order->goods * 10 + order->credits;
+	}
+	s->num_bids = market_depth(port, item, ORDER_BUY, s->bids, ARRAY_SIZE(s->bids));
+	s->num_asks = market_depth(port, item, ORDER_SELL, s->asks, ARRAY_SIZE(s->asks));
+}
+
+static void check_state(const struct state * const s)
+{
+	struct state now;
+
+	get_state(&now);
+	assert(!memcmp(now.credits, s->credits, sizeof(s->credits)));
+	assert(!memcmp(now.held, s->held, sizeof(s->held)));
+	assert(!memcmp(now.orders, s->orders, sizeof(s->orders)));
+	assert(now.num_bids == s->num_bids && now.num_asks == s->num_asks);
+	for (unsigned long i = 0; i < s->num_bids; i++)
+		assert(now.bids[i].price == s->bids[i].price && now.bids[i].amount == s->bids[i].amount);
+	for (unsigned long i = 0; i < s->num_asks; i++)
+		assert(now.asks[i].price == s->asks[i].price && now.asks[i].amount == s->asks[i].amount);
+}
+
+/*
+ * Finds everything again by name after the universe has been loaded
+ */
+static void find_again(char *names[4], const char * const port_name, const char * const item_name)
+{
+	port = ship_position_by_name(PORT, port_name);
+	item = st_lookup_exact(&univ.item_names, item_name);
+	assert(port && item);
+
+	for (int i = 0; i < 4; i++) {
+		traders[i] = st_lookup_exact(&univ.playernames, names[i]);
+		assert(traders[i]);
+	}
+}
+
+static void test_persistence()
+{
+	struct player *a = traders[0], *b = traders[1];
+	char *names[4], *port_name, *item_name;
+	struct state s;
+
+	post(a, ORDER_SELL, 11, 2, 0);
+	post(b, ORDER_BUY, 8, 1, 0);
+	post(b, ORDER_BUY, 9, 1, 0);
+
+	for (int i = 0; i < 4; i++)
+		names[i] = strdup(traders[i]->name);
+	port_name = strdup(port->name);
+	item_name = strdup(item->name);
+
+	assert(!snapshot_save(&univ, SNAPSHOT_FILE));
+	get_state(&s);
+	fixture_destroy_universe();
+
+	fixture_create_config(NUM_SYSTEMS, FIXTURE_PLAYER_NAMES);
+	assert(!snapshot_load(&univ, SNAPSHOT_FILE));
+	find_again(names, port_name, item_name);
+	check_state(&s);
+
+	/* Changes after the snapshot come from the log */
+	unlink(WAL_FILE);
+	wal_init(&wal);
+	assert(!wal_open(&wal, WAL_FILE, SNAPSHOT_FILE));
+	post(traders[3], ORDER_BUY, 11, 3, 3);
+	post(traders[2], ORDER_BUY, 8, 1, 0);
+	assert(!market_cancel(port, traders[1], list_first_entry(&traders[1]->orders,
+					struct order, owner_list)->id));
+	assert(!cli_run_cmd(&traders[0]->cli, "orders"));
+	wal_close(&wal);
+	get_state(&s);
+	fixture_destroy_universe();
+
+	fixture_create_config(NUM_SYSTEMS, FIXTURE_PLAYER_NAMES);
+	assert(!snapshot_load(&univ, SNAPSHOT_FILE));
+	wal_init(&wal);
+	assert(!wal_replay(&wal, WAL_FILE, univ.wal_lsn));
+	find_again(names, port_name, item_name);
+	check_state(&s);
+
+	for (int i = 0; i < 4; i++)
+		free(names[i]);
+	free(port_name);
+	free(item_name);
+	unlink(SNAPSHOT_FILE);
+	unlink(WAL_FILE);
+}
+
+static void random_orders(void *data, unsigned long idx)
+{
+	struct player *player = traders[idx];
+	struct order *order;
+	uint64_t id;
+	long filled;
+
+	pthread_mutex_lock(&player->lock);
+
+	for (int i = 0; i < NUM_ROUNDS; i++) {
+		if (!list_empty(&player->orders) && !mtrandom_ulong(4)) {
+			order = list_last_entry(&player->orders, struct order, owner_list);
+			market_cancel(port, player, order->id);
+		} else {
+			market_post(port, player, item, mtrandom_ulong(2) ? ORDER_BUY : ORDER_SELL,
+					95 + mtrandom_ulong(10), 1 + mtrandom_ulong(3), &id, &filled);
+		}
+	}
+
+	pthread_mutex_unlock(&player->lock);
+}
+
+static void totals(long *credits, long *goods)
+{
+	struct order *order;
+
+	*credits = *goods = 0;
+	for (int i = 0; i < NUM_TRADERS; i++) {
+		*credits += traders[i]->credits;
+		*goods += held(traders[i]);
+		list_for_each_entry(order, &traders[i]->orders, owner_list) {
+			*credits += order->credits;
+			*goods += order->goods;
+			if (order->side == ORDER_BUY)
+				*credits += order->price * order->amount;
+			else
+				*goods += order->amount;
+		}
+	}
+}
+
+static void test_concurrent()
+{
+	long credits, goods, c, g;
+	struct order *order, *_order;
+
+	for (int i = 4; i < NUM_TRADERS; i++)
+		traders[i] = dock();
+	totals(&credits, &goods);
+
+	threadpool_for(&workers, NUM_TRADERS, random_orders, NULL);
+
+	totals(&c, &g);
+	assert(c == credits && g == goods);
+
+	for (int i = 0; i < NUM_TRADERS; i++) {
+		list_for_each_entry_safe(order, _order, &traders[i]->orders, owner_list)
+			assert(!market_cancel(port, traders[i], order->id));
+		assert(!cli_run_cmd(&traders[i]->cli, "orders"));
+	}
+	assert(!depth(ORDER_BUY));
+	assert(!depth(ORDER_SELL));
+
+	totals(&c, &g);
+	assert(c == credits && g == goods);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int tests = 0;
+
+	log_init("market_test.log");
+	mtrandom_seed(42);
+	assert(!threadpool_init(&workers, 4));
+	fixture_create_config(NUM_SYSTEMS, FIXTURE_PLAYER_NAMES);
+	assert(!universe_genesis(&univ));
+
+	port = list_first_entry(&univ.ports, struct port, list);
+	item = list_first_entry(&univ.items, struct item, list);
+	for (int i = 0; i < 4; i++)
+		traders[i] = dock();
+	tests++;
+
+	test_priority();
+	tests++;
+
+	test_cancel_and_collect();
+	tests++;
+
+	test_persistence();
+	tests++;
+
+	test_concurrent();
+	tests++;
+
+	fixture_destroy_universe();
+	threadpool_free(&workers);
+	log_close();
+
+	assert(tests == NUM_TESTS);
+}
@@ -0,0 +1,176 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mtrandom.h"
+
+#define NUM_TESTS 11
+#define NUM_NUMBERS 1000
+#define NUM_THREADS 4
+
+static int test_seed_is_reproducible()
+{
+	int tests = 0;
+	uint64_t first[NUM_NUMBERS];
+
+	mtrandom_seed(42);
+	for (int i = 0; i < NUM_NUMBERS; i++)
+		first[i] = mtrandom_uint64(UINT64_MAX);
+
+	mtrandom_seed(42);
+	for (int i = 0; i < NUM_NUMBERS; i++)
+		assert(mtrandom_uint64(UINT64_MAX) == first[i]);
+	tests++;
+
+	mtrandom_seed(43);
+	assert(mtrandom_uint64(UINT64_MAX) != first[0]);
+	tests++;
+
+	assert(mtrandom_master_seed() == 43);
+	tests++;
+
+	return tests;
+}
+
+static int test_streams()
+{
+	int tests = 0;
+	struct mtrandom_stream a, b, c;
+	struct mtrandom_stream *prev;
+	uint64_t ra[NUM_NUMBERS];
+	int same = 0;
+
+	mtrandom_seed(42);
+	mtrandom_stream_init(&a, 1);
+	mtrandom_stream_init(&b, 1);
+	mtrandom_stream_init(&c, 2);
+
+	prev = mtrandom_set_stream(&a);
+	assert(prev == NULL);
+	for (int i = 0; i < NUM_NUMBERS; i++)
+		ra[i] = mtrandom_uint64(UINT64_MAX);
+	tests++;
+
+	/* Drawing from the thread's own stream must not disturb b */
+	mtrandom_set_stream(NULL);
+	mtrandom_uint64(UINT64_MAX);
+
+	assert(mtrandom_set_stream(&b) == NULL);
+	for (int i = 0; i < NUM_NUMBERS; i++)
+		assert(mtrandom_uint64(UINT64_MAX) == ra[i]);
+	tests++;
+
+	mtrandom_set_stream(&c);
+	for (int i = 0; i < NUM_NUMBERS; i++)
+		same += (mtrandom_uint64(UINT64_MAX) == ra[i]);
+	assert(same == 0);
+	tests++;
+
+	assert(mtrandom_set_stream(NULL) == &c);
+	tests++;
+
+	return tests;
+}
+
+static int test_fill()
+{
+	int tests = 0;
+	struct mtrandom_stream a, b;
+	uint64_t buf[NUM_NUMBERS];
+
+	mtrandom_seed(42);
+	mtrandom_stream_init(&a, 7);
+	mtrandom_stream_init(&b, 7);
+
+	mtrandom_set_stream(&a);
+	mtrandom_fill(buf, 3);
+	mtrandom_fill(buf + 3, NUM_NUMBERS - 3);
+
+	mtrandom_set_stream(&b);
+	for (int i = 0; i < NUM_NUMBERS; i++)
+		assert(mtrandom_uint64(UINT64_MAX) == buf[i]);
+	tests++;
+
+	mtrandom_set_stream(NULL);
+
+	return tests;
+}
+
+static int test_ranges()
+{
+	int tests = 0;
+	unsigned int u;
+	long l;
+	double d;
+
+	mtrandom_seed(42);
+
+	for (int i = 0; i < NUM_NUMBERS; i++) {
+		u = mtrandom_uint(10);
+		assert(u < 10);
+		l = mtrandom_long(-10);
+		assert(l > -10 && l <= 0);
+		l = mtrandom_to_long(mtrandom_uint64(UINT64_MAX), 10);
+		assert(l >= 0 && l < 10);
+		d = mtrandom_double(10.0);
+		assert(d >= 0.0 && d < 10.0);
+	}
+	tests++;
+
+	assert(mtrandom_uint(0) == 0 && mtrandom_long(0) == 0 && mtrandom_to_ulong(1234, 0) == 0);
+	tests++;
+
+	return tests;
+}
+
+static void* draw(void *_out)
+{
+	uint64_t *out = _out;
+
+	for (int i = 0; i < NUM_NUMBERS; i++)
+		out[i] = mtrandom_uint64(UINT64_MAX);
+
+	return NULL;
+}
+
+/*
+ * Threads that don't select a stream of their own must still not share one.
+ * Run under a race detector this also checks that they don't share state.
+ */
+static int test_thread_streams()
+{
+	int tests = 0;
+	pthread_t threads[NUM_THREADS];
+	uint64_t *out;
+
+	out = malloc(NUM_THREADS * NUM_NUMBERS * sizeof(*out));
+	assert(out);
+
+	mtrandom_seed(42);
+	for (int i = 0; i < NUM_THREADS; i++)
+		assert(!pthread_create(&threads[i], NULL, draw, &out[i * NUM_NUMBERS]));
+	for (int i = 0; i < NUM_THREADS; i++)
+		pthread_join(threads[i], NULL);
+
+	for (int i = 1; i < NUM_THREADS; i++)
+		assert(memcmp(&out[0], &out[i * NUM_NUMBERS], NUM_NUMBERS * sizeof(*out)));
+	tests++;
+
+	free(out);
+
+	return tests;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int tests = 0;
+
+	tests += test_seed_is_reproducible();
+	tests += test_streams();
+	tests += test_fill();
+	tests += test_ranges();
+	tests += test_thread_streams();
+
+	assert(tests == NUM_TESTS);
+}
@@ -0,0 +1,194 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mtrandom.h"
+#include "names.h"
+#include "ptrarray.h"
+#include "stringtrie.h"
+
+#define NUM_TESTS 12
+
+static struct ptrarray* fill(struct ptrarray *a, const char * const prefix, const int num)
+{
+	char buf[32];
+
+	for (int i = 0; i < num; i++) {
+		snprintf(buf, sizeof(buf), "%s%d", prefix, i);
+		a = ptrarray_add(a, strdup(buf));
+		assert(a);
+	}
+
+	return a;
+}
+
+/*
+ * Draws names until the list is exhausted and checks that they are all
+ * different. Returns the number of names drawn.
+ */
+static uint64_t draw_all(struct name_list *l)
+{
+	struct st_root seen;
+	uint64_t num = 0;
+	char *name;
+
+	st_init(&seen);
+
+	while ((name = create_unique_name(l))) {
+		assert(!st_lookup_exact(&seen, name));
+		assert(!st_add_string(&seen, name, name));
+		num++;
+	}
+
+	st_destroy(&seen, ST_DO_FREE_DATA);
+
+	return num;
+}
+
+static int test_empty_list()
+{
+	int tests = 0;
+	struct name_list l;
+
+	names_init(&l);
+
+	assert(names_capacity(&l) == 0);
+	tests++;
+
+	assert(create_unique_name(&l) == NULL);
+	tests++;
+
+	names_free(&l);
+
+	return tests;
+}
+
+static int test_exhaust_list()
+{
+	int tests = 0;
+	struct name_list l;
+
+	names_init(&l);
+	l.prefix = fill(l.prefix, "Pre", 3);
+	l.suffix = fill(l.suffix, "Suf", 4);
+	l.first = fill(l.first, "First", 13);
+
+	assert(names_capacity(&l) == (3 + 4) * 13);
+	tests++;
+
+	assert(names_left(&l) == names_capacity(&l));
+	tests++;
+
+	assert(draw_all(&l) == names_capacity(&l));
+	tests++;
+
+	assert(names_left(&l) == 0);
+	tests++;
+
+	assert(create_unique_name(&l) == NULL);
+	tests++;
+
+	names_free(&l);
+
+	return tests;
+}
+
+/*
+ * "A B" + "C" and "A" + "B C" are different combinations spelling the same
+ * name, which must only be handed out once.
+ */
+static int test_duplicate_spellings()
+{
+	int tests = 0;
+	struct name_list l;
+
+	names_init(&l);
+	l.first = ptrarray_add(l.first, strdup("A"));
+	l.first = ptrarray_add(l.first, strdup("A B"));
+	l.second = ptrarray_add(l.second, strdup("C"));
+	l.second = ptrarray_add(l.second, strdup("B C"));
+
+	assert(draw_all(&l) == 3);
+	tests++;
+
+	names_free(&l);
+
+	return tests;
+}
+
+/*
+ * Checks the cycle walking for a range of sizes, including some just above
+ * and below powers of four.
+ */
+static int test_capacities()
+{
+	int tests = 0;
+	struct name_list l;
+	const int sizes[] = { 1, 2, 3, 4, 5, 15, 16, 17, 63, 64, 65, 1000 };
+
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		names_init(&l);
+		l.first = fill(l.first, "Name", sizes[i]);
+		assert(draw_all(&l) == (uint64_t)sizes[i]);
+		names_free(&l);
+	}
+	tests++;
+
+	return tests;
+}
+
+/*
+ * Numbered names keep coming after the list is exhausted, and must not clash
+ * with names in the list that already happen to end in a number.
+ */
+static int test_numbered_names()
+{
+	int tests = 0;
+	struct name_list l;
+	struct st_root seen;
+	char *name;
+
+	names_init(&l);
+	l.first = ptrarray_add(l.first, strdup("Orion"));
+	l.first = ptrarray_add(l.first, strdup("Orion 2"));
+	l.first = ptrarray_add(l.first, strdup("Lyra"));
+	st_init(&seen);
+
+	for (int i = 0; i < 3 * 4; i++) {
+		name = create_numbered_name(&l);
+		assert(name);
+		assert(!st_lookup_exact(&seen, name));
+		assert(!st_add_string(&seen, name, name));
+	}
+	tests++;
+
+	assert(st_lookup_exact(&seen, "Orion 3") && st_lookup_exact(&seen, "Lyra 4"));
+	tests++;
+
+	/* The plain variant still reports the current round as exhausted */
+	while (names_left(&l))
+		free(create_numbered_name(&l));
+	assert(create_unique_name(&l) == NULL);
+	tests++;
+
+	st_destroy(&seen, ST_DO_FREE_DATA);
+	names_free(&l);
+
+	return tests;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int tests = 0;
+
+	mtrandom_seed(42);
+
+	tests += test_empty_list();
+	tests += test_exhaust_list();
+	tests += test_duplicate_spellings();
+	tests += test_capacities();
+	tests += test_numbered_names();
+
+	assert(tests == NUM_TESTS);
+}
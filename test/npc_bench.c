@@ -0,0 +1,114 @@
+/*
+ * Creates a universe from the shipped data files, lets NPC traders loose in
+ * it and times their ticks, first on the calling thread alone and then on
+ * the whole worker pool. Every tick moves game time on by a minute, so most
+ * agents that are due have arrived somewhere and have selling, planning and
+ * buying to do.
+ *
+ * Usage: npc_bench [agents] [ticks] [systems] [threads]
+ */
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "civ.h"
+#include "item.h"
+#include "log.h"
+#include "mtrandom.h"
+#include "names.h"
+#include "npc.h"
+#include "planet_type.h"
+#include "port_type.h"
+#include "ship_type.h"
+#include "threadpool.h"
+#include "universe.h"
+#include "universe_fixture.h"
+
+#define DEFAULT_AGENTS 10000
+#define DEFAULT_TICKS 100
+#define DEFAULT_SYSTEMS 1000
+#define TICK (60 * 1000)		/* in ms of game time */
+
+static double elapsed(const struct timespec * const start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/*
+ * Runs ticks of a fresh set of agents on the worker pool as it is
+ */
+static void run(const char * const what, const unsigned long agents, const unsigned long ticks)
+{
+	struct npc_pool pool;
+	struct npc_stats stats;
+	struct timespec start;
+	uint64_t now = 0;
+	double secs;
+
+	if (npc_pool_init(&pool, agents, now)) {
+		fprintf(stderr, "npc_bench: could not create %lu agents\n", agents);
+		exit(EXIT_FAILURE);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (unsigned long i = 0; i < ticks; i++, now += TICK)
+		npc_tick(&pool, now);
+	secs = elapsed(&start);
+
+	npc_get_stats(&pool, &stats);
+	printf("npc_bench: %-20s %8.0f ns/decision, %.0f decisions/s, %.0f decisions/s per thread\n",
+			what, secs * 1e9 / stats.decisions, stats.decisions / secs,
+			stats.decisions / secs / (workers.num + 1));
+	printf("npc_bench: %-20s %lu decisions, %lu trades, %lu arrivals, %lu idle\n",
+			"", stats.decisions, stats.trades, stats.arrivals, stats.idle);
+
+	npc_pool_free(&pool);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long agents = DEFAULT_AGENTS, ticks = DEFAULT_TICKS;
+	unsigned int threads = threadpool_default_size();
+
+	if (argc > 1)
+		agents = strtoul(argv[1], NULL, 0);
+	if (argc > 2)
+		ticks = strtoul(argv[2], NULL, 0);
+	if (argc > 4)
+		threads = strtoul(argv[4], NULL, 0);
+
+	log_init("npc_bench.log");
+	mtrandom_seed(42);
+	if (threadpool_init(&workers, threadpool_default_size()))
+		return EXIT_FAILURE;
+
+	fixture_create_config(argc > 3 ? strtoul(argv[3], NULL, 0) : DEFAULT_SYSTEMS,
+			FIXTURE_NO_PLAYER_NAMES);
+
+	if (universe_genesis(&univ))
+		return EXIT_FAILURE;
+
+	printf("npc_bench: %lu agents, %lu ticks, %lu systems, %u threads\n",
+			agents, ticks, univ.settings.systems, threads + 1);
+
+	/* With no threads of its own, the pool runs everything on the caller */
+	threadpool_free(&workers);
+	if (threadpool_init(&workers, 0))
+		return EXIT_FAILURE;
+	run("one thread:", agents, ticks);
+
+	threadpool_free(&workers);
+	if (threadpool_init(&workers, threads))
+		return EXIT_FAILURE;
+	run("worker pool:", agents, ticks);
+
+	threadpool_free(&workers);
+	log_close();
+
+	return 0;
+}
@@ -0,0 +1,180 @@
+/*
+ * NPC traders in a small universe: every agent starts out docked, and a day
+ * of ticks later they have traded and flown between ports without ever
+ * going below zero credits or over what their holds carry. No goods appear
+ * or vanish in their trades, and the price index of every item agrees with
+ * the prices at the ports they have moved.
+ */
+#include <assert.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "civ.h"
+#include "common.h"
+#include "item.h"
+#include "log.h"
+#include "mtrandom.h"
+#include "names.h"
+#include "npc.h"
+#include "planet_type.h"
+#include "player.h"
+#include "port.h"
+#include "port_type.h"
+#include "price_index.h"
+#include "ptrlist.h"
+#include "ship.h"
+#include "ship_type.h"
+#include "system.h"
+#include "threadpool.h"
+#include "universe.h"
+#include "universe_fixture.h"
+
+#define NUM_TESTS 2
+#define NUM_SYSTEMS 50
+#define NUM_AGENTS 1000
+#define TICK (60 * 1000)		/* in ms of game time */
+#define NUM_TICKS (24 * 60)
+
+/*
+ * The amount of every item at all ports and in the holds of all agents
+ */
+static long* count_goods(struct npc_pool *pool)
+{
+	long *goods = calloc(univ.num_items, sizeof(*goods));
+	struct port *port;
+	struct cargo *c;
+	struct item *item;
+
+	assert(goods);
+
+	list_for_each_entry(port, &univ.ports, list) {
+		list_for_each_entry(c, &port->items, list)
+			goods[c->item->id] += cargo_amount(c);
+	}
+
+	for (unsigned long i = 0; i < pool->num; i++) {
+		list_for_each_entry(item, &univ.items, list)
+			goods[item->id] += ship_cargo_amount(pool->agents[i].ship, item);
+	}
+
+	return goods;
+}
+
+static void check_agents(struct npc_pool *pool)
+{
+	struct npc *npc;
+
+	for (unsigned long i = 0; i < pool->num; i++) {
+		npc = &pool->agents[i];
+		assert(npc->player->credits >= 0);
+		assert(npc->ship->load >= 0);
+		assert(npc->ship->load <= npc->ship->type->carry_weight);
+		assert(npc->port);
+		if (npc->state == NPC_DOCKED)
+			assert(npc->ship->postype == PORT && npc->ship->pos == npc->port);
+	}
+}
+
+static void check_prices()
+{
+	struct price_entry *entries;
+	struct price_summary summary;
+	struct item *item;
+	unsigned long n;
+
+	list_for_each_entry(item, &univ.items, list) {
+		entries = malloc(MAX(item->num_postings, 1) * sizeof(*entries));
+		assert(entries);
+
+		n = price_index_get(&item->prices, &summary, entries, NULL, item->num_postings);
+		assert(n == item->num_postings);
+		for (unsigned long i = 0; i < n; i++) {
+			assert(port_cargo(entries[i].port, item)->price == entries[i].price);
+			if (i > 0)
+				assert(entries[i - 1].price <= entries[i].price);
+		}
+
+		free(entries);
+	}
+}
+
+static void test_empty()
+{
+	struct npc_pool pool;
+	struct npc_stats stats;
+
+	assert(!npc_pool_init(&pool, 0, 0));
+	npc_tick(&pool, 0);
+	npc_get_stats(&pool, &stats);
+	assert(!stats.decisions);
+	npc_pool_free(&pool);
+}
+
+static void test_trading()
+{
+	struct npc_pool pool;
+	struct npc_stats stats;
+	long *before, *after;
+	uint64_t now = 0;
+
+	assert(!npc_pool_init(&pool, NUM_AGENTS, now));
+	assert(pool.num == NUM_AGENTS);
+	check_agents(&pool);
+	before = count_goods(&pool);
+
+	/* Everyone is due at first */
+	npc_tick(&pool, now);
+	npc_get_stats(&pool, &stats);
+	assert(stats.decisions == NUM_AGENTS);
+	assert(stats.trades > 0);
+	check_agents(&pool);
+
+	for (int i = 0; i < NUM_TICKS; i++) {
+		now += TICK;
+		npc_tick(&pool, now);
+	}
+
+	npc_get_stats(&pool, &stats);
+	assert(stats.decisions > NUM_AGENTS);
+	assert(stats.arrivals > 0);
+	assert(stats.trades > NUM_AGENTS);
+	assert(stats.idle <= stats.decisions);
+	check_agents(&pool);
+	check_prices();
+
+	after = count_goods(&pool);
+	for (unsigned long i = 0; i < univ.num_items; i++)
+		assert(before[i] == after[i]);
+
+	/* No one is due again before the time it was given */
+	for (unsigned long i = 0; i < pool.num; i++)
+		assert(pool.due[i] > now);
+
+	free(after);
+	free(before);
+	npc_pool_free(&pool);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int tests = 0;
+
+	log_init("npc_test.log");
+	mtrandom_seed(42);
+	assert(!threadpool_init(&workers, 4));
+
+	fixture_create_universe(NUM_SYSTEMS, FIXTURE_NO_PLAYER_NAMES);
+
+	test_empty();
+	tests++;
+
+	test_trading();
+	tests++;
+
+	fixture_destroy_universe();
+	threadpool_free(&workers);
+	log_close();
+
+	assert(tests == NUM_TESTS);
+}
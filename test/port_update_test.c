@@ -0,0 +1,201 @@
+/*
+ * Updates the ports of a small universe a number of times in shards of a few
+ * ports and again as one big shard, starting from the same amounts, and
+ * checks that both end up with the same cargo. Then checks that a day in
+ * two steps, with ports caught up on demand, ends up where ticking every
+ * port on every tick does.
+ */
+#include <assert.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cargo.h"
+#include "civ.h"
+#include "economy.h"
+#include "item.h"
+#include "log.h"
+#include "mtrandom.h"
+#include "names.h"
+#include "planet_type.h"
+#include "port.h"
+#include "port_type.h"
+#include "port_update.h"
+#include "ship_type.h"
+#include "threadpool.h"
+#include "universe.h"
+#include "universe_fixture.h"
+
+#define NUM_TESTS 4
+#define NUM_SYSTEMS 200
+#define NUM_TICKS 10
+#define SMALL_SHARD 3
+#define LAZY_TICKS PORT_UPDATE_TICKS_PER_DAY
+
+static unsigned long count_cargo()
+{
+	struct port *port;
+	struct cargo *cargo;
+	unsigned long num = 0;
+
+	list_for_each_entry(port, &univ.ports, list) {
+		list_for_each_entry(cargo, &port->items, list)
+			num++;
+	}
+
+	return num;
+}
+
+static void get_amounts(long *amounts)
+{
+	struct port *port;
+	struct cargo *cargo;
+
+	list_for_each_entry(port, &univ.ports, list) {
+		list_for_each_entry(cargo, &port->items, list)
+			*amounts++ = cargo_amount(cargo);
+	}
+}
+
+/*
+ * As last stored, without catching up
+ */
+static void get_raw_amounts(long *amounts)
+{
+	struct port *port;
+	struct cargo *cargo;
+
+	list_for_each_entry(port, &univ.ports, list) {
+		list_for_each_entry(cargo, &port->items, list)
+			*amounts++ = *cargo->amount;
+	}
+}
+
+/*
+ * Also forgets the fractions of units the ticks have added up so far
+ */
+static void set_amounts(const long *amounts)
+{
+	struct port *port;
+	struct cargo *cargo;
+
+	list_for_each_entry(port, &univ.ports, list) {
+		list_for_each_entry(cargo, &port->items, list)
+			cargo_set_amount(cargo, *amounts++);
+	}
+
+	for (unsigned long i = 0; i < univ.economy.num_blocks; i++)
+		memset(univ.economy.blocks[i]->fraction, 0, sizeof(univ.economy.blocks[i]->fraction));
+}
+
+/*
+ * Nearly fills the first cargo of every port and empties the second, to have
+ * the amounts run into their limits
+ */
+static void trade(int lazy)
+{
+	struct port *port;
+	struct cargo *first, *second;
+
+	list_for_each_entry(port, &univ.ports, list) {
+		first = list_first_entry(&port->items, struct cargo, list);
+		second = list_entry(first->list.next, struct cargo, list);
+
+		if (lazy) {
+			cargo_set_amount(first, first->max - 1);
+			if (&second->list != &port->items)
+				cargo_set_amount(second, 0);
+		} else {
+			*first->amount = first->max - 1;
+			if (&second->list != &port->items)
+				*second->amount = 0;
+		}
+	}
+}
+
+static void run_ticks(const unsigned long shard_size, struct port_update_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+
+	for (int i = 0; i < NUM_TICKS; i++)
+		update_ports(&univ, 1, shard_size, stats);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int tests = 0;
+	struct port_update_stats stats;
+	unsigned long num_ports = 0, num_cargo;
+	long *start, *sharded, *whole;
+	struct port *port;
+
+	log_init("port_update_test.log");
+	mtrandom_seed(42);
+	assert(!threadpool_init(&workers, 4));
+
+	fixture_create_universe(NUM_SYSTEMS, FIXTURE_NO_PLAYER_NAMES);
+	list_for_each_entry(port, &univ.ports, list)
+		num_ports++;
+	assert(num_ports > SMALL_SHARD);
+
+	num_cargo = count_cargo();
+	start = malloc(num_cargo * sizeof(*start));
+	sharded = malloc(num_cargo * sizeof(*sharded));
+	whole = malloc(num_cargo * sizeof(*whole));
+	assert(start && sharded && whole);
+	get_amounts(start);
+
+	run_ticks(SMALL_SHARD, &stats);
+	get_amounts(sharded);
+	assert(stats.ticks == NUM_TICKS);
+	assert(stats.ports > 0 && stats.ports < num_ports);
+	assert(stats.shard_size <= SMALL_SHARD);
+	assert(stats.shards == (stats.ports + stats.shard_size - 1) / stats.shard_size);
+	assert(stats.max_duration >= stats.duration);
+	assert(memcmp(start, sharded, num_cargo * sizeof(*start)));
+	tests++;
+
+	/* One big shard is still split up so every thread gets some */
+	set_amounts(start);
+	run_ticks(ULONG_MAX, &stats);
+	get_amounts(whole);
+	assert(stats.ticks == NUM_TICKS);
+	assert(stats.shards > 1);
+	tests++;
+
+	assert(!memcmp(sharded, whole, num_cargo * sizeof(*sharded)));
+	tests++;
+
+	/*
+	 * Half of the ticks in one go, a trade, and the other half, and again
+	 * ticking every slot by hand. This leaves the economy out of step, so
+	 * it goes last.
+	 */
+	set_amounts(start);
+	memset(&stats, 0, sizeof(stats));
+	update_ports(&univ, LAZY_TICKS / 2, ULONG_MAX, &stats);
+	trade(1);
+	update_ports(&univ, LAZY_TICKS - LAZY_TICKS / 2, ULONG_MAX, &stats);
+	get_amounts(whole);
+	assert(stats.ports < num_ports);
+
+	set_amounts(start);
+	for (int i = 0; i < LAZY_TICKS; i++) {
+		if (i == LAZY_TICKS / 2)
+			trade(0);
+		for (unsigned long j = 0; j < univ.economy.num_blocks; j++)
+			economy_update(univ.economy.blocks[j], 0, univ.economy.blocks[j]->used);
+	}
+	get_raw_amounts(sharded);
+	assert(!memcmp(sharded, whole, num_cargo * sizeof(*sharded)));
+	tests++;
+
+	free(whole);
+	free(sharded);
+	free(start);
+	fixture_destroy_universe();
+	threadpool_free(&workers);
+	log_close();
+
+	assert(tests == NUM_TESTS);
+}
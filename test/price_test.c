@@ -0,0 +1,300 @@
+/*
+ * Prices and the price index: the index on its own against a plain array,
+ * then a small universe where the index must agree with the price at every
+ * port after genesis, trades and ticks. A trade moves the price with the
+ * stock and the demand it leaves, which then decays, and the sweep over the
+ * ports brings every price up to date within the hour.
+ */
+#include <assert.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "civ.h"
+#include "cli.h"
+#include "common.h"
+#include "item.h"
+#include "log.h"
+#include "mtrandom.h"
+#include "names.h"
+#include "planet_type.h"
+#include "player.h"
+#include "port.h"
+#include "port_type.h"
+#include "port_update.h"
+#include "price_index.h"
+#include "ptrlist.h"
+#include "ship.h"
+#include "ship_type.h"
+#include "system.h"
+#include "threadpool.h"
+#include "trade.h"
+#include "universe.h"
+#include "universe_fixture.h"
+
+#define NUM_TESTS 4
+#define NUM_SYSTEMS 50
+#define NUM_FAKE_PORTS 200
+#define NUM_INDEX_OPS 20000
+#define CREDITS 1000000
+#define STOCK 10
+
+/* The ports in the index are never looked at, so these do */
+static char fake_ports[NUM_FAKE_PORTS];
+
+static void check_index(struct price_index *index, const long *prices, const unsigned long num)
+{
+	struct price_entry *entries = malloc(MAX(num, 1) * sizeof(*entries));
+	struct price_entry *dearest = malloc(MAX(num, 1) * sizeof(*entries));
+	struct price_summary summary;
+	unsigned long n = 0;
+	long sum = 0, min = LONG_MAX, max = LONG_MIN;
+
+	assert(entries && dearest);
+	for (unsigned long i = 0; i < num; i++) {
+		if (prices[i] < 0)
+			continue;
+		n++;
+		sum += prices[i];
+		min = MIN(min, prices[i]);
+		max = MAX(max, prices[i]);
+	}
+
+	assert(price_index_get(index, &summary, entries, dearest, num) == n);
+	assert(summary.ports == n);
+	if (n) {
+		assert(summary.min == min && summary.max == max && summary.avg == sum / (long)n);
+		assert(entries[0].price == min && dearest[0].price == max);
+	}
+
+	for (unsigned long i = 0; i < n; i++) {
+		assert(entries[i].price == prices[(char*)entries[i].port - fake_ports]);
+		assert(!memcmp(&entries[i], &dearest[n - 1 - i], sizeof(*entries)));
+		if (i > 0)
+			assert(entries[i - 1].price < entries[i].price ||
+					(entries[i - 1].price == entries[i].price &&
+					 entries[i - 1].port < entries[i].port));
+	}
+
+	free(dearest);
+	free(entries);
+}
+
+static void test_index()
+{
+	struct price_index index;
+	long prices[NUM_FAKE_PORTS];
+	struct port *port;
+	unsigned long i;
+	long price;
+
+	price_index_init(&index);
+	for (i = 0; i < NUM_FAKE_PORTS; i++)
+		prices[i] = -1;
+
+	for (int n = 0; n < NUM_INDEX_OPS; n++) {
+		i = mtrandom_ulong(NUM_FAKE_PORTS);
+		port = (struct port*)&fake_ports[i];
+		price = mtrandom_ulong(50);
+
+		if (prices[i] < 0) {
+			assert(!price_index_add(&index, port, price));
+			prices[i] = price;
+		} else if (!mtrandom_ulong(8)) {
+			price_index_rm(&index, port, prices[i]);
+			prices[i] = -1;
+		} else {
+			price_index_move(&index, port, prices[i], price);
+			prices[i] = price;
+		}
+
+		if (n % 100 == 0)
+			check_index(&index, prices, NUM_FAKE_PORTS);
+	}
+	check_index(&index, prices, NUM_FAKE_PORTS);
+
+	price_index_free(&index);
+}
+
+/*
+ * Every entry in the index of every item is the price at its port, and
+ * every port trading the item is in it
+ */
+static void check_universe()
+{
+	struct price_entry *entries;
+	struct price_summary summary;
+	struct item *item;
+	unsigned long n;
+	long sum;
+
+	list_for_each_entry(item, &univ.items, list) {
+		entries = malloc(MAX(item->num_postings, 1) * sizeof(*entries));
+		assert(entries);
+
+		n = price_index_get(&item->prices, &summary, entries, NULL, item->num_postings);
+		assert(n == item->num_postings && summary.ports == n);
+
+		sum = 0;
+		for (unsigned long i = 0; i < n; i++) {
+			assert(port_cargo(entries[i].port, item)->price == entries[i].price);
+			if (i > 0)
+				assert(entries[i - 1].price <= entries[i].price);
+			sum += entries[i].price;
+		}
+		if (n)
+			assert(summary.avg == sum / (long)n);
+
+		free(entries);
+	}
+}
+
+static struct cargo* find_cargo(struct port **port)
+{
+	struct cargo *c;
+
+	list_for_each_entry((*port), &univ.ports, list) {
+		list_for_each_entry(c, &(*port)->items, list) {
+			if (c->item->base_price > 0 && c->item->weight > 0 &&
+					c->item->weight * STOCK <= 10000)
+				return c;
+		}
+	}
+
+	assert(0);
+}
+
+static long expected(const struct item * const item, const double factor)
+{
+	return lround(item->base_price * factor);
+}
+
+/*
+ * With the max brought down to twice the stock, buying all of it doubles
+ * the price: empty stock makes it 2 times the base price instead of 1.25,
+ * and the demand of half the max adds a quarter to that.
+ */
+static void test_trade()
+{
+	struct ship_type *ship_type = list_first_entry(&univ.ship_types, struct ship_type, list);
+	struct player *player;
+	struct ship *ship;
+	struct port *port;
+	struct cargo *c = find_cargo(&port);
+	struct item *item = c->item;
+	struct trade trade;
+	char cmd[64];
+
+	player = player_create(NULL);
+	assert(player);
+	assert(!new_ship_to_player(ship_type, player));
+	ship = list_first_entry(&player->ships, struct ship, list);
+	ship->type->carry_weight = MAX(ship->type->carry_weight, item->weight * STOCK);
+	player->pos = ship;
+	player->postype = SHIP;
+	player->credits = CREDITS;
+	player_go(player, SYSTEM, port->system);
+	player_go(player, PORT, port);
+
+	pthread_rwlock_wrlock(&port->items_lock);
+	c->max = 2 * STOCK;
+	cargo_set_amount(c, STOCK);
+	c->demand = 0;
+	port_reprice(port, c);
+	pthread_rwlock_unlock(&port->items_lock);
+	assert(c->price == expected(item, 1.25));
+	check_universe();
+
+	/* Nothing to sell, so the buy is undone along with the price */
+	trade_init(&trade, player, ship, port);
+	assert(!trade_add_leg(&trade, item, STOCK, TRADE_BUY));
+	assert(!trade_add_leg(&trade, item, STOCK + 1, TRADE_SELL));
+	assert(trade_run(&trade) == TRADE_NOT_ENOUGH);
+	assert(c->price == expected(item, 1.25) && !c->demand);
+	check_universe();
+
+	trade_init(&trade, player, ship, port);
+	assert(!trade_add_leg(&trade, item, STOCK, TRADE_BUY));
+	assert(trade_run(&trade) == TRADE_OK);
+	assert(trade.legs[0].credits == STOCK * expected(item, 1.25));
+	assert(c->demand == STOCK);
+	assert(c->price == expected(item, 2.5));
+	check_universe();
+
+	/* A day later, half the demand is left */
+	economy_advance(&univ.economy, PORT_UPDATE_TICKS_PER_DAY);
+	pthread_rwlock_wrlock(&port->items_lock);
+	assert(port_demand(c) == STOCK / 2);
+	cargo_set_amount(c, 0);
+	port_reprice(port, c);
+	pthread_rwlock_unlock(&port->items_lock);
+	assert(c->price == expected(item, 2 * 1.125));
+
+	/* Selling it back makes up for the rest */
+	trade_init(&trade, player, ship, port);
+	assert(!trade_add_leg(&trade, item, STOCK / 2, TRADE_SELL));
+	assert(trade_run(&trade) == TRADE_OK);
+	assert(!c->demand);
+	assert(c->price == expected(item, 2 - 1.5 * STOCK / 2 / (2 * STOCK)));
+	check_universe();
+
+	snprintf(cmd, sizeof(cmd), "prices %s", item->name);
+	assert(!cli_run_cmd(&player->cli, cmd));
+	assert(!cli_run_cmd(&player->cli, "prices"));
+	assert(!cli_run_cmd(&player->cli, "prices no such item"));
+}
+
+/*
+ * After an hour of ticks, no price changes when repriced again
+ */
+static void test_sweep()
+{
+	struct port_update_stats stats;
+	struct port *port;
+	struct cargo *c;
+	long price;
+
+	memset(&stats, 0, sizeof(stats));
+	update_ports(&univ, PORT_UPDATE_TICKS_PER_DAY / 24, ULONG_MAX, &stats);
+
+	list_for_each_entry(port, &univ.ports, list) {
+		pthread_rwlock_wrlock(&port->items_lock);
+		list_for_each_entry(c, &port->items, list) {
+			price = c->price;
+			port_reprice(port, c);
+			assert(c->price == price);
+		}
+		pthread_rwlock_unlock(&port->items_lock);
+	}
+
+	check_universe();
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int tests = 0;
+
+	log_init("price_test.log");
+	mtrandom_seed(42);
+	assert(!threadpool_init(&workers, 4));
+
+	test_index();
+	tests++;
+
+	fixture_create_universe(NUM_SYSTEMS, FIXTURE_PLAYER_NAMES);
+	check_universe();
+	tests++;
+
+	test_trade();
+	tests++;
+
+	test_sweep();
+	tests++;
+
+	fixture_destroy_universe();
+	threadpool_free(&workers);
+	log_close();
+
+	assert(tests == NUM_TESTS);
+}
@@ -0,0 +1,205 @@
+/*
+ * Schedules a lot of events at random points in game time and moves time
+ * on in random steps, checking that every event runs once, not before it is
+ * due and no later than the step it is due in. Then checks cancelling,
+ * events further away than the wheels reach, an event that adds itself back,
+ * and the scheduler thread running time faster than real time.
+ */
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "common.h"
+#include "list.h"
+#include "log.h"
+#include "mtrandom.h"
+#include "scheduler.h"
+#include "threadpool.h"
+
+#define NUM_TESTS 5
+#define NUM_EVENTS 100000
+#define SPAN (1 << 22)			/* Reaches the third wheel */
+#define MAX_STEP 5000
+#define PERIOD 7
+#define NUM_PERIODS 1000
+#define FAST_RATE 1000
+#define THREAD_TIMEOUT 10		/* in seconds */
+
+struct test_event {
+	struct sched_event ev;
+	unsigned long runs;		/* Updated atomically */
+};
+
+struct test_event *events;
+uint64_t run_until;			/* Game time being run up to */
+
+static void count_run(struct sched_event *ev)
+{
+	struct test_event *t = list_entry(ev, struct test_event, ev);
+
+	assert(ev->when <= run_until);
+	__atomic_add_fetch(&t->runs, 1, __ATOMIC_RELAXED);
+}
+
+static void repeat(struct sched_event *ev)
+{
+	struct test_event *t = list_entry(ev, struct test_event, ev);
+
+	t->runs++;
+	sched_add(&sched, ev, ev->when + PERIOD);
+}
+
+static unsigned long run_to(const uint64_t until)
+{
+	run_until = until;
+	return sched_run_until(&sched, until);
+}
+
+static void test_random_events()
+{
+	uint64_t now = 0;
+	unsigned long run = 0, i;
+
+	for (i = 0; i < NUM_EVENTS; i++) {
+		sched_event_init(&events[i].ev, count_run);
+		sched_add(&sched, &events[i].ev, mtrandom_uint64(SPAN));
+	}
+	assert(sched.pending == NUM_EVENTS);
+
+	while (now < SPAN) {
+		now += mtrandom_uint64(MAX_STEP);
+		run += run_to(now);
+
+		for (i = 0; i < NUM_EVENTS; i++)
+			assert(events[i].runs == (events[i].ev.when <= now));
+	}
+
+	assert(run == NUM_EVENTS);
+	assert(sched.pending == 0);
+}
+
+static void test_cancel()
+{
+	uint64_t start = sched.next;
+	unsigned long i;
+
+	for (i = 0; i < NUM_EVENTS; i++) {
+		events[i].runs = 0;
+		sched_add(&sched, &events[i].ev, start + mtrandom_uint64(SPAN));
+	}
+
+	for (i = 0; i < NUM_EVENTS; i += 2)
+		assert(!sched_cancel(&sched, &events[i].ev));
+	assert(sched_cancel(&sched, &events[0].ev) == -1);
+
+	/* Adding a pending event again moves it */
+	sched_add(&sched, &events[1].ev, start + SPAN + 1);
+
+	assert(run_to(start + SPAN) == NUM_EVENTS / 2 - 1);
+	for (i = 0; i < NUM_EVENTS; i++)
+		assert(events[i].runs == (i % 2 && i != 1));
+
+	assert(run_to(start + SPAN + 1) == 1);
+	assert(events[1].runs == 1);
+	assert(sched.pending == 0);
+}
+
+static void test_far_events()
+{
+	uint64_t start = sched.next;
+	const uint64_t when[] = {
+		start + ((uint64_t)1 << 32) - 1,
+		start + ((uint64_t)1 << 32),
+		start + ((uint64_t)1 << 32) + 12345,
+		start + ((uint64_t)1 << 40) + 1,
+	};
+
+	for (unsigned int i = 0; i < ARRAY_SIZE(when); i++) {
+		events[i].runs = 0;
+		sched_add(&sched, &events[i].ev, when[i]);
+	}
+
+	for (unsigned int i = 0; i < ARRAY_SIZE(when); i++) {
+		assert(run_to(when[i] - 1) == 0);
+		assert(events[i].runs == 0);
+		assert(run_to(when[i]) == 1);
+		assert(events[i].runs == 1);
+	}
+}
+
+static void test_repeat()
+{
+	uint64_t start = sched.next;
+
+	events[0].runs = 0;
+	sched_event_init(&events[0].ev, repeat);
+	sched_add(&sched, &events[0].ev, start);
+
+	run_to(start + PERIOD * NUM_PERIODS);
+	assert(events[0].runs == NUM_PERIODS + 1);
+	assert(!sched_cancel(&sched, &events[0].ev));
+}
+
+static void test_thread()
+{
+	struct timespec delay = { .tv_sec = 0, .tv_nsec = 1000000 };
+	uint64_t start;
+	unsigned long i;
+
+	sched.rate = FAST_RATE;
+	assert(!sched_start(&sched));
+
+	/* A second of game time is a millisecond of real time */
+	start = sched_now(&sched);
+	run_until = UINT64_MAX;
+	sched_event_init(&events[0].ev, count_run);
+	events[0].runs = 0;
+	sched_add(&sched, &events[0].ev, start + 1000);
+
+	for (i = 0; i < THREAD_TIMEOUT * 1000; i++) {
+		if (__atomic_load_n(&events[0].runs, __ATOMIC_RELAXED))
+			break;
+		nanosleep(&delay, NULL);
+	}
+
+	sched_stop(&sched);
+	assert(events[0].runs == 1);
+	assert(sched.next > start + 1000);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int tests = 0;
+
+	log_init("scheduler_test.log");
+	mtrandom_seed(42);
+	assert(!threadpool_init(&workers, 4));
+	assert(!sched_init(&sched, 1));
+
+	events = malloc(NUM_EVENTS * sizeof(*events));
+	assert(events);
+	memset(events, 0, NUM_EVENTS * sizeof(*events));
+
+	test_random_events();
+	tests++;
+
+	test_cancel();
+	tests++;
+
+	test_far_events();
+	tests++;
+
+	test_repeat();
+	tests++;
+
+	test_thread();
+	tests++;
+
+	free(events);
+	sched_free(&sched);
+	threadpool_free(&workers);
+	log_close();
+
+	assert(tests == NUM_TESTS);
+}
@@ -0,0 +1,153 @@
+/*
+ * Creates a small universe from the shipped data files, saves it, loads it
+ * into a fresh universe and checks that saving that again gives the same file.
+ */
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "civ.h"
+#include "item.h"
+#include "log.h"
+#include "mtrandom.h"
+#include "names.h"
+#include "planet_type.h"
+#include "port.h"
+#include "port_type.h"
+#include "snapshot.h"
+#include "threadpool.h"
+#include "universe.h"
+#include "universe_fixture.h"
+
+#define NUM_TESTS 8
+#define NUM_SYSTEMS 500
+#define FIRST_FILE "snapshot_test.1"
+#define SECOND_FILE "snapshot_test.2"
+#define DAMAGED_FILE "snapshot_test.3"
+
+static char* read_file(const char * const file, size_t *len)
+{
+	FILE *f;
+	char *data;
+
+	f = fopen(file, "r");
+	assert(f);
+	assert(!fseek(f, 0, SEEK_END));
+	*len = ftell(f);
+	rewind(f);
+
+	data = malloc(*len);
+	assert(data);
+	assert(fread(data, 1, *len, f) == *len);
+	fclose(f);
+
+	return data;
+}
+
+static int test_round_trip()
+{
+	int tests = 0;
+	unsigned long systems, ports, inhabited;
+	char *first, *second;
+	size_t first_len, second_len;
+	struct system *s;
+
+	fixture_create_config(NUM_SYSTEMS, FIXTURE_NO_PLAYER_NAMES);
+	assert(!universe_genesis(&univ));
+	systems = ptrlist_len(&univ.systems);
+	ports = list_len(&univ.ports);
+	inhabited = univ.inhabited_systems;
+	assert(!snapshot_save(&univ, FIRST_FILE));
+	tests++;
+
+	fixture_destroy_universe();
+	fixture_create_config(NUM_SYSTEMS, FIXTURE_NO_PLAYER_NAMES);
+	assert(!snapshot_load(&univ, FIRST_FILE));
+	tests++;
+
+	assert(ptrlist_len(&univ.systems) == systems);
+	assert(list_len(&univ.ports) == ports);
+	assert(univ.inhabited_systems == inhabited);
+	tests++;
+
+	s = ptrlist_entry(&univ.systems, 0);
+	assert(st_lookup_exact(&univ.systemnames, s->name) == s);
+	assert(is_system_near(s->x, s->y, 1));
+	tests++;
+
+	/* Ports must be in the item postings again */
+	assert(!list_empty(&univ.ports));
+	assert(list_first_entry(&univ.ports, struct port, list)->name);
+	assert(!list_empty(&univ.items));
+	assert(list_first_entry(&univ.items, struct item, list)->num_postings > 0);
+	tests++;
+
+	assert(!snapshot_save(&univ, SECOND_FILE));
+	first = read_file(FIRST_FILE, &first_len);
+	second = read_file(SECOND_FILE, &second_len);
+	assert(first_len == second_len);
+	assert(!memcmp(first, second, first_len));
+	tests++;
+
+	free(second);
+	free(first);
+	fixture_destroy_universe();
+	unlink(SECOND_FILE);
+
+	return tests;
+}
+
+static int test_damaged()
+{
+	int tests = 0;
+	char *data;
+	size_t len;
+	FILE *f;
+
+	/* Cut off in the middle of the sections */
+	data = read_file(FIRST_FILE, &len);
+	f = fopen(DAMAGED_FILE, "w");
+	assert(f);
+	assert(fwrite(data, 1, len / 2, f) == len / 2);
+	fclose(f);
+
+	fixture_create_config(NUM_SYSTEMS, FIXTURE_NO_PLAYER_NAMES);
+	assert(snapshot_load(&univ, DAMAGED_FILE));
+	fixture_destroy_universe();
+	tests++;
+
+	data[0] = 'X';
+	f = fopen(DAMAGED_FILE, "w");
+	assert(f);
+	assert(fwrite(data, 1, len, f) == len);
+	fclose(f);
+
+	fixture_create_config(NUM_SYSTEMS, FIXTURE_NO_PLAYER_NAMES);
+	assert(snapshot_load(&univ, DAMAGED_FILE));
+	fixture_destroy_universe();
+	tests++;
+
+	free(data);
+	unlink(DAMAGED_FILE);
+
+	return tests;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int tests = 0;
+
+	log_init("snapshot_test.log");
+	mtrandom_seed(42);
+	assert(!threadpool_init(&workers, 2));
+
+	tests += test_round_trip();
+	tests += test_damaged();
+
+	unlink(FIRST_FILE);
+	threadpool_free(&workers);
+	log_close();
+
+	assert(tests == NUM_TESTS);
+}
@@ -0,0 +1,322 @@
+/*
+ * Trades in a small universe: a batch that goes through, batches that fail
+ * halfway and must leave nothing changed, the trade command, and a lot of
+ * ships trading at the same ports at once while others take the same locks
+ * in every order, checking that nothing deadlocks and no cargo is lost.
+ */
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "civ.h"
+#include "cli.h"
+#include "common.h"
+#include "item.h"
+#include "log.h"
+#include "mtrandom.h"
+#include "names.h"
+#include "planet_type.h"
+#include "player.h"
+#include "port.h"
+#include "port_type.h"
+#include "ptrlist.h"
+#include "ship.h"
+#include "ship_type.h"
+#include "system.h"
+#include "threadpool.h"
+#include "trade.h"
+#include "universe.h"
+#include "universe_fixture.h"
+
+#define NUM_TESTS 5
+#define NUM_SYSTEMS 50
+#define NUM_TRADERS 64
+#define NUM_ROUNDS 2000
+#define CREDITS 1000000
+
+struct trader {
+	struct player *player;
+	struct ship *ship;
+	struct port *port;
+};
+
+struct test_port {
+	struct port *port;
+	struct item *a, *b;		/* Two items the port has plenty of */
+};
+
+static struct trader traders[NUM_TRADERS];
+
+static void dock(struct trader *t, struct port *port)
+{
+	struct ship_type *ship_type = list_first_entry(&univ.ship_types, struct ship_type, list);
+
+	t->player = player_create(NULL);
+	assert(t->player);
+	assert(!new_ship_to_player(ship_type, t->player));
+	t->ship = list_first_entry(&t->player->ships, struct ship, list);
+	t->player->pos = t->ship;
+	t->player->postype = SHIP;
+	t->player->credits = CREDITS;
+	t->port = port;
+
+	player_go(t->player, SYSTEM, port->system);
+	player_go(t->player, PORT, port);
+}
+
+static struct test_port find_port()
+{
+	struct test_port m = { NULL, NULL, NULL };
+	struct cargo *c;
+
+	list_for_each_entry(m.port, &univ.ports, list) {
+		m.a = m.b = NULL;
+		list_for_each_entry(c, &m.port->items, list) {
+			if (cargo_amount(c) < 100 || !c->price || c->item->weight <= 0)
+				continue;
+			if (!m.a)
+				m.a = c->item;
+			else if (!m.b)
+				m.b = c->item;
+		}
+		if (m.b)
+			return m;
+	}
+
+	assert(0);
+}
+
+static long port_amount(const struct test_port * const m, struct item *item)
+{
+	return cargo_amount(port_cargo(m->port, item));
+}
+
+static long room(const struct trader * const t)
+{
+	return t->ship->type->carry_weight - t->ship->load;
+}
+
+static void test_batch(const struct test_port * const m)
+{
+	struct trader *t = &traders[0];
+	long a = port_amount(m, m->a), b = port_amount(m, m->b);
+	long price_a = port_cargo(m->port, m->a)->price;
+	long price_b = port_cargo(m->port, m->b)->price;
+	struct trade trade;
+
+	trade_init(&trade, t->player, t->ship, m->port);
+	assert(!trade_add_leg(&trade, m->a, 2, TRADE_BUY));
+	assert(!trade_add_leg(&trade, m->b, 3, TRADE_BUY));
+	assert(!trade_add_leg(&trade, m->a, 1, TRADE_SELL));
+	assert(trade_run(&trade) == TRADE_OK);
+
+	assert(ship_cargo_amount(t->ship, m->a) == 1);
+	assert(ship_cargo_amount(t->ship, m->b) == 3);
+	assert(port_amount(m, m->a) == a - 1);
+	assert(port_amount(m, m->b) == b - 3);
+	assert(t->player->credits == CREDITS - price_a - 3 * price_b);
+	assert(t->ship->load == m->a->weight + 3 * m->b->weight);
+}
+
+/*
+ * Runs a trade that must fail at its last leg and checks that nothing changed
+ */
+static void fail(const struct test_port * const m, struct trade *trade, const enum trade_status status)
+{
+	struct trader *t = &traders[0];
+	long a = port_amount(m, m->a), b = port_amount(m, m->b);
+	long hold_a = ship_cargo_amount(t->ship, m->a);
+	long hold_b = ship_cargo_amount(t->ship, m->b);
+	long credits = t->player->credits, load = t->ship->load;
+	struct cargo *ca = port_cargo(m->port, m->a), *cb = port_cargo(m->port, m->b);
+	long price_a = ca->price, price_b = cb->price;
+	long demand_a = ca->demand, demand_b = cb->demand;
+
+	assert(trade_run(trade) == status);
+	assert(trade->failed == trade->num_legs - 1);
+
+	assert(port_amount(m, m->a) == a);
+	assert(port_amount(m, m->b) == b);
+	assert(ship_cargo_amount(t->ship, m->a) == hold_a);
+	assert(ship_cargo_amount(t->ship, m->b) == hold_b);
+	assert(t->player->credits == credits);
+	assert(t->ship->load == load);
+	assert(ca->price == price_a && cb->price == price_b);
+	assert(ca->demand == demand_a && cb->demand == demand_b);
+}
+
+static void test_rollback(const struct test_port * const m)
+{
+	struct trader *t = &traders[0];
+	long price_b = port_cargo(m->port, m->b)->price;
+	struct trade trade;
+
+	/* More than the hold has */
+	trade_init(&trade, t->player, t->ship, m->port);
+	assert(!trade_add_leg(&trade, m->b, 1, TRADE_BUY));
+	assert(!trade_add_leg(&trade, m->a, TRADE_ALL, TRADE_SELL));
+	assert(!trade_add_leg(&trade, m->b, 10, TRADE_SELL));
+	fail(m, &trade, TRADE_NOT_ENOUGH);
+
+	/* More than fits */
+	trade_init(&trade, t->player, t->ship, m->port);
+	assert(!trade_add_leg(&trade, m->a, TRADE_ALL, TRADE_SELL));
+	assert(!trade_add_leg(&trade, m->b, (room(t) + m->a->weight) / m->b->weight + 1, TRADE_BUY));
+	fail(m, &trade, TRADE_NO_ROOM);
+
+	/* More than the player can pay for */
+	t->player->credits = price_b;
+	trade_init(&trade, t->player, t->ship, m->port);
+	assert(!trade_add_leg(&trade, m->b, 1, TRADE_BUY));
+	assert(!trade_add_leg(&trade, m->b, 1, TRADE_BUY));
+	fail(m, &trade, TRADE_NO_CREDITS);
+	t->player->credits = CREDITS;
+}
+
+static void test_command(const struct test_port * const m)
+{
+	struct trader *t = &traders[0];
+	long hold_a = ship_cargo_amount(t->ship, m->a);
+	long hold_b = ship_cargo_amount(t->ship, m->b);
+	char cmd[256];
+
+	snprintf(cmd, sizeof(cmd), "trade sell all %s, buy 1 %s", m->a->name, m->b->name);
+	assert(!cli_run_cmd(&t->player->cli, cmd));
+	assert(ship_cargo_amount(t->ship, m->a) == 0);
+	assert(ship_cargo_amount(t->ship, m->b) == hold_b + 1);
+
+	/* Nothing left to sell, so nothing is bought either */
+	assert(!cli_run_cmd(&t->player->cli, cmd));
+	assert(ship_cargo_amount(t->ship, m->b) == hold_b + 1);
+
+	assert(!cli_run_cmd(&t->player->cli, "trade"));
+	assert(!cli_run_cmd(&t->player->cli, "trade buy 1"));
+	assert(!cli_run_cmd(&t->player->cli, "trade steal 1 Steel"));
+
+	snprintf(cmd, sizeof(cmd), "sell all %s", m->b->name);
+	assert(!cli_run_cmd(&t->player->cli, cmd));
+	assert(ship_cargo_amount(t->ship, m->b) == 0);
+	assert(hold_a == 1);
+}
+
+static void random_trade(const struct test_port * const m, struct trader *t)
+{
+	struct item *items[] = { m->a, m->b };
+	struct trade trade;
+
+	for (int i = 0; i < NUM_ROUNDS; i++) {
+		trade_init(&trade, t->player, t->ship, t->port);
+		for (int j = 0; j < 3; j++)
+			trade_add_leg(&trade, items[mtrandom_ulong(2)], 1 + mtrandom_ulong(3),
+					mtrandom_ulong(2) ? TRADE_BUY : TRADE_SELL);
+		trade_run(&trade);
+	}
+}
+
+/*
+ * Takes the locks of two ports and two ships in a random order
+ */
+static void random_locks(struct trader *t, struct trader *u)
+{
+	struct trade_lock locks[4], tmp;
+	unsigned int i, j;
+
+	for (int round = 0; round < NUM_ROUNDS; round++) {
+		locks[0] = (struct trade_lock){ TRADE_LOCK_SHIP, &t->ship->cargo_lock };
+		locks[1] = (struct trade_lock){ TRADE_LOCK_PORT, &u->port->items_lock };
+		locks[2] = (struct trade_lock){ TRADE_LOCK_SHIP, &u->ship->cargo_lock };
+		locks[3] = (struct trade_lock){ TRADE_LOCK_PORT, &t->port->items_lock };
+		for (i = ARRAY_SIZE(locks) - 1; i > 0; i--) {
+			j = mtrandom_ulong(i + 1);
+			tmp = locks[i];
+			locks[i] = locks[j];
+			locks[j] = tmp;
+		}
+
+		trade_lock_all(locks, ARRAY_SIZE(locks));
+		trade_unlock_all(locks, ARRAY_SIZE(locks));
+	}
+}
+
+/*
+ * Every trader trades, and as many threads again take locks
+ */
+static void trade_or_lock(void *data, unsigned long idx)
+{
+	if (idx < NUM_TRADERS)
+		random_trade(data, &traders[idx]);
+	else
+		random_locks(&traders[idx % NUM_TRADERS], &traders[(idx * 7 + 1) % NUM_TRADERS]);
+}
+
+static void test_concurrent(const struct test_port * const m)
+{
+	struct test_port second = *m;
+	struct port *p;
+	long before, after;
+	unsigned long i;
+
+	/* Half of the ships are at another port with the same items */
+	second.port = m->port;
+	list_for_each_entry(p, &univ.ports, list) {
+		if (p != m->port && port_cargo(p, m->a) && port_cargo(p, m->b)) {
+			second.port = p;
+			break;
+		}
+	}
+
+	for (i = 1; i < NUM_TRADERS; i++)
+		dock(&traders[i], i % 2 ? second.port : m->port);
+
+	before = port_amount(m, m->a) + port_amount(m, m->b);
+	for (i = 0; i < NUM_TRADERS; i++) {
+		if (traders[i].port == m->port)
+			before += ship_cargo_amount(traders[i].ship, m->a) +
+				ship_cargo_amount(traders[i].ship, m->b);
+	}
+
+	threadpool_for(&workers, 2 * NUM_TRADERS, trade_or_lock, (void*)m);
+
+	after = port_amount(m, m->a) + port_amount(m, m->b);
+	for (i = 0; i < NUM_TRADERS; i++) {
+		if (traders[i].port == m->port)
+			after += ship_cargo_amount(traders[i].ship, m->a) +
+				ship_cargo_amount(traders[i].ship, m->b);
+		assert(traders[i].ship->load <= traders[i].ship->type->carry_weight);
+		assert(traders[i].player->credits >= 0);
+	}
+	assert(before == after);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int tests = 0;
+	struct test_port m;
+
+	log_init("trade_test.log");
+	mtrandom_seed(42);
+	assert(!threadpool_init(&workers, 4));
+	fixture_create_universe(NUM_SYSTEMS, FIXTURE_PLAYER_NAMES);
+
+	m = find_port();
+	dock(&traders[0], m.port);
+	tests++;
+
+	test_batch(&m);
+	tests++;
+
+	test_rollback(&m);
+	tests++;
+
+	test_command(&m);
+	tests++;
+
+	test_concurrent(&m);
+	tests++;
+
+	fixture_destroy_universe();
+	threadpool_free(&workers);
+	log_close();
+
+	assert(tests == NUM_TESTS);
+}
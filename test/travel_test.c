@@ -0,0 +1,143 @@
+/*
+ * Sends a lot of players jumping across a small universe at once, and moves
+ * game time on in steps, checking that every ship stays where it was and
+ * can't do anything but look around until its arrival, and is at its
+ * destination after it. A player that is destroyed in flight never arrives.
+ */
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "civ.h"
+#include "cli.h"
+#include "common.h"
+#include "item.h"
+#include "log.h"
+#include "mtrandom.h"
+#include "names.h"
+#include "planet_type.h"
+#include "player.h"
+#include "port_type.h"
+#include "ptrlist.h"
+#include "scheduler.h"
+#include "ship.h"
+#include "ship_type.h"
+#include "system.h"
+#include "threadpool.h"
+#include "universe.h"
+#include "universe_fixture.h"
+
+#define NUM_TESTS 4
+#define NUM_SYSTEMS 200
+#define NUM_PLAYERS 2000
+#define NUM_STEPS 50
+
+struct flight {
+	struct player *player;
+	struct system *from, *to;
+	uint64_t arrival;
+};
+
+static struct system* random_system()
+{
+	return ptrlist_entry(&univ.systems, mtrandom_ulong(ptrlist_len(&univ.systems)));
+}
+
+static struct ship* ship_of(const struct flight * const f)
+{
+	return f->player->pos;
+}
+
+static void depart(struct flight *f)
+{
+	struct ship_type *ship_type = list_first_entry(&univ.ship_types, struct ship_type, list);
+	struct ship *ship;
+	char cmd[256];
+
+	f->player = player_create(NULL);
+	assert(f->player);
+	assert(!new_ship_to_player(ship_type, f->player));
+	f->player->pos = list_first_entry(&f->player->ships, struct ship, list);
+	f->player->postype = SHIP;
+	ship = ship_of(f);
+
+	f->from = random_system();
+	do {
+		f->to = random_system();
+	} while (f->to == f->from);
+
+	player_go(f->player, SYSTEM, f->from);
+	f->arrival = sched_now(&sched) + ship_travel_time(ship, f->from, f->to) * SHIP_JUMP_SLOWDOWN;
+
+	snprintf(cmd, sizeof(cmd), "jump %s", f->to->name);
+	assert(!cli_run_cmd(&f->player->cli, cmd));
+}
+
+static void check(const struct flight * const f, const uint64_t now)
+{
+	struct ship *ship = ship_of(f);
+	char cmd[256];
+
+	snprintf(cmd, sizeof(cmd), "jump %s", f->from->name);
+
+	if (f->arrival <= now) {
+		assert(!ship->in_flight);
+		assert(ship->postype == SYSTEM && ship->pos == f->to);
+	} else {
+		assert(ship->in_flight);
+		assert(ship->postype == SYSTEM && ship->pos == f->from);
+		assert(cli_run_cmd(&f->player->cli, cmd) < 0);
+		assert(!cli_run_cmd(&f->player->cli, "look"));
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int tests = 0;
+	struct flight *flights, *gone;
+	uint64_t now, last = 0;
+	unsigned long i;
+
+	log_init("travel_test.log");
+	mtrandom_seed(42);
+	assert(!threadpool_init(&workers, 4));
+	assert(!sched_init(&sched, 1));
+	fixture_create_universe(NUM_SYSTEMS, FIXTURE_PLAYER_NAMES);
+
+	flights = malloc(NUM_PLAYERS * sizeof(*flights));
+	assert(flights);
+
+	for (i = 0; i < NUM_PLAYERS; i++) {
+		depart(&flights[i]);
+		last = MAX(last, flights[i].arrival);
+	}
+	assert(sched.pending == NUM_PLAYERS);
+	tests++;
+
+	/* Gone before it gets anywhere */
+	gone = &flights[NUM_PLAYERS - 1];
+	player_destroy(gone->player);
+	assert(sched.pending == NUM_PLAYERS - 1);
+	tests++;
+
+	for (int step = 1; step <= NUM_STEPS; step++) {
+		now = last * step / NUM_STEPS;
+		sched_run_until(&sched, now);
+		for (i = 0; i < NUM_PLAYERS - 1; i++)
+			check(&flights[i], now);
+	}
+	tests++;
+
+	assert(sched.pending == 0);
+	assert(sched.dispatched == NUM_PLAYERS - 1);
+	tests++;
+
+	free(flights);
+	fixture_destroy_universe();
+	sched_free(&sched);
+	threadpool_free(&workers);
+	log_close();
+
+	assert(tests == NUM_TESTS);
+}
@@ -0,0 +1,122 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "civ.h"
+#include "item.h"
+#include "names.h"
+#include "planet_type.h"
+#include "player.h"
+#include "port_type.h"
+#include "ship_type.h"
+#include "system.h"
+#include "universe.h"
+#include "universe_fixture.h"
+
+char* fixture_data_file(const char * const name)
+{
+	const char *srcdir = getenv("srcdir");
+	char *path;
+
+	if (!srcdir)
+		srcdir = ".";
+
+	path = malloc(strlen(srcdir) + strlen("/data/") + strlen(name) + 1);
+	assert(path);
+	sprintf(path, "%s/data/%s", srcdir, name);
+
+	return path;
+}
+
+static void load(int (*func)(const char * const, struct universe * const), const char * const name)
+{
+	char *file = fixture_data_file(name);
+
+	if (func(file, &univ)) {
+		fprintf(stderr, "universe_fixture: could not load %s\n", file);
+		exit(EXIT_FAILURE);
+	}
+
+	free(file);
+}
+
+static void load_names(struct name_list *l, const char * const prefix, const char * const first,
+		const char * const second, const char * const suffix)
+{
+	char *files[4] = { NULL, NULL, NULL, NULL };
+	const char *names[4] = { prefix, first, second, suffix };
+
+	for (int i = 0; i < 4; i++) {
+		if (names[i])
+			files[i] = fixture_data_file(names[i]);
+	}
+
+	names_load(l, files[0], files[1], files[2], files[3]);
+
+	for (int i = 0; i < 4; i++)
+		free(files[i]);
+}
+
+/*
+ * Loads everything universe_genesis() needs into univ, without creating any
+ * systems.
+ */
+void fixture_create_config(const unsigned long systems, const int player_names)
+{
+	universe_init(&univ);
+	names_init(&univ.avail_constellations);
+	names_init(&univ.avail_port_names);
+	names_init(&univ.avail_player_names);
+	univ.settings.systems = systems;
+
+	load(load_civs_from_file, "foociv");
+	load(load_civs_from_file, "grazny");
+	load(load_civs_from_file, "terran");
+	load(load_items_from_file, "items");
+	load(load_ports_from_file, "ports");
+	load(load_planets_from_file, "planets");
+	load(load_ships_from_file, "ships");
+
+	load_names(&univ.avail_constellations, NULL, "constellations", NULL, NULL);
+	load_names(&univ.avail_port_names, "placeprefix", "placenames", NULL, "placesuffix");
+	if (player_names)
+		load_names(&univ.avail_player_names, NULL, "firstnames", "surnames", NULL);
+}
+
+void fixture_create_universe(const unsigned long systems, const int player_names)
+{
+	fixture_create_config(systems, player_names);
+
+	if (universe_genesis(&univ)) {
+		fprintf(stderr, "universe_fixture: genesis failed\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+void fixture_destroy_universe(void)
+{
+	struct list_head *lh;
+	struct system *s;
+	struct civ *c, *_c;
+	struct player *p, *_p;
+
+	list_for_each_entry_safe(p, _p, &univ.players, list) {
+		list_del(&p->list);
+		player_free(p);
+	}
+
+	ptrlist_for_each_entry(s, &univ.systems, lh)
+		system_free(s);
+
+	list_for_each_entry_safe(c, _c, &univ.civs, list) {
+		list_del(&c->list);
+		civ_free(c);
+		free(c);
+	}
+
+	names_free(&univ.avail_constellations);
+	names_free(&univ.avail_port_names);
+	names_free(&univ.avail_player_names);
+
+	universe_free(&univ);
+}
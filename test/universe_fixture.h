@@ -0,0 +1,21 @@
+#ifndef _HAS_UNIVERSE_FIXTURE_H
+#define _HAS_UNIVERSE_FIXTURE_H
+
+/*
+ * A universe made from the shipped data files, for the tests and benchmarks
+ * that need one. The data files are looked up in $srcdir/data, as set by
+ * make check, or in ./data if srcdir isn't set. Failing to load any of them
+ * ends the program.
+ *
+ * Player names are only loaded if asked for, as only tests creating players
+ * by name need them.
+ */
+#define FIXTURE_NO_PLAYER_NAMES 0
+#define FIXTURE_PLAYER_NAMES 1
+
+char* fixture_data_file(const char * const name);
+void fixture_create_config(const unsigned long systems, const int player_names);
+void fixture_create_universe(const unsigned long systems, const int player_names);
+void fixture_destroy_universe(void);
+
+#endif
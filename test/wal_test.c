@@ -0,0 +1,318 @@
+/*
+ * Lets a player trade in a small universe with the write-ahead log open, then
+ * checks that replaying the log on top of the snapshot taken before gives the
+ * same player back, that a torn record at the end of the log is dropped and
+ * that the log is cut once a snapshot has been saved to the file it continues.
+ */
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "cargo.h"
+#include "civ.h"
+#include "cli.h"
+#include "item.h"
+#include "log.h"
+#include "mtrandom.h"
+#include "names.h"
+#include "planet_type.h"
+#include "player.h"
+#include "port.h"
+#include "port_type.h"
+#include "ship.h"
+#include "ship_type.h"
+#include "snapshot.h"
+#include "threadpool.h"
+#include "universe.h"
+#include "wal.h"
+#include "universe_fixture.h"
+
+#define NUM_TESTS 10
+#define NUM_SYSTEMS 200
+#define SNAPSHOT_FILE "wal_test.snapshot"
+#define SECOND_SNAPSHOT_FILE "wal_test.snapshot.2"
+#define WAL_FILE "wal_test.wal"
+#define CREDITS 1000000
+#define BUY_AMOUNT 5
+#define SECRET "0123456789abcdef"
+
+static void load_snapshot(const char * const file)
+{
+	fixture_create_config(NUM_SYSTEMS, FIXTURE_PLAYER_NAMES);
+	assert(!snapshot_load(&univ, file));
+	wal_init(&wal);
+}
+
+static long find_amount(struct list_head *list, const char * const item)
+{
+	struct cargo *cargo;
+
+	list_for_each_entry(cargo, list, list) {
+		if (!strcmp(cargo->item->name, item))
+			return cargo_amount(cargo);
+	}
+
+	return 0;
+}
+
+/*
+ * What the player should look like after the log has been replayed
+ */
+struct expected {
+	char *player;
+	char *port;
+	char *item;
+	long credits;
+	long ship_amount;
+	long port_amount;
+};
+
+static void check_player(const struct expected * const e)
+{
+	struct player *player;
+	struct ship *ship;
+	struct port *port;
+
+	player = st_lookup_exact(&univ.playernames, e->player);
+	assert(player);
+	assert(player->credits == e->credits);
+	assert(!strcmp(player->secret, SECRET));
+	assert(player->postype == SHIP);
+
+	ship = player->pos;
+	assert(ship->postype == PORT);
+	port = ship->pos;
+	assert(!strcmp(port->name, e->port));
+
+	assert(ship_cargo_amount(ship, st_lookup_exact(&univ.item_names, e->item)) == e->ship_amount);
+	assert(find_amount(&port->items, e->item) == e->port_amount);
+
+	/* Docked players can trade again */
+	assert(st_lookup_exact(&player->cli, "buy"));
+}
+
+static off_t file_size(const char * const file)
+{
+	struct stat st;
+
+	assert(!stat(file, &st));
+
+	return st.st_size;
+}
+
+static int test_replay(struct expected *e)
+{
+	int tests = 0;
+	char cmd[256];
+	struct player *player;
+	struct ship_type *ship_type;
+	struct port *port = NULL;
+	struct cargo *cargo = NULL, *c;
+
+	fixture_create_config(NUM_SYSTEMS, FIXTURE_PLAYER_NAMES);
+	assert(!universe_genesis(&univ));
+	assert(!snapshot_save(&univ, SNAPSHOT_FILE));
+
+	unlink(WAL_FILE);
+	wal_init(&wal);
+	assert(!wal_open(&wal, WAL_FILE, SNAPSHOT_FILE));
+	assert(wal_is_open(&wal));
+	tests++;
+
+	/* Any port that has some of anything to sell will do */
+	list_for_each_entry(port, &univ.ports, list) {
+		list_for_each_entry(c, &port->items, list) {
+			if (cargo_amount(c) >= BUY_AMOUNT * 2 && c->price > 0) {
+				cargo = c;
+				break;
+			}
+		}
+		if (cargo)
+			break;
+	}
+	assert(cargo);
+
+	player = player_create(NULL);
+	assert(player);
+	ship_type = list_first_entry(&univ.ship_types, struct ship_type, list);
+	assert(!new_ship_to_player(ship_type, player));
+	player->pos = list_first_entry(&player->ships, struct ship, list);
+	player->postype = SHIP;
+	player->credits = CREDITS;
+	strcpy(player->secret, SECRET);
+	wal_log_player(&wal, player);
+
+	player_go(player, SYSTEM, port->system);
+	player_go(player, PORT, port);
+
+	snprintf(cmd, sizeof(cmd), "buy %d %s", BUY_AMOUNT * 2, cargo->item->name);
+	assert(!cli_run_cmd(&player->cli, cmd));
+	snprintf(cmd, sizeof(cmd), "sell %d %s", BUY_AMOUNT, cargo->item->name);
+	assert(!cli_run_cmd(&player->cli, cmd));
+	assert(player->credits == CREDITS - BUY_AMOUNT * cargo->price);
+	tests++;
+
+	e->player = strdup(player->name);
+	e->port = strdup(port->name);
+	e->item = strdup(cargo->item->name);
+	e->credits = player->credits;
+	e->ship_amount = BUY_AMOUNT;
+	e->port_amount = cargo_amount(cargo);
+	assert(e->player && e->port && e->item);
+
+	/* Closing waits for everything appended to be written */
+	wal_close(&wal);
+	assert(!wal_is_open(&wal));
+	assert(wal.durable_lsn == wal_last_lsn(&wal));
+	assert(wal.records == 5);
+	tests++;
+
+	fixture_destroy_universe();
+	load_snapshot(SNAPSHOT_FILE);
+	assert(list_empty(&univ.players));
+	assert(!wal_replay(&wal, WAL_FILE, univ.wal_lsn));
+	assert(wal_last_lsn(&wal) == 5);
+	check_player(e);
+	tests++;
+
+	return tests;
+}
+
+static int test_snapshot_with_players(const struct expected * const e)
+{
+	int tests = 0;
+
+	/* The universe left by test_replay() has the player in it */
+	assert(!snapshot_save(&univ, SECOND_SNAPSHOT_FILE));
+	fixture_destroy_universe();
+
+	load_snapshot(SECOND_SNAPSHOT_FILE);
+	assert(univ.wal_lsn == 5);
+	check_player(e);
+
+	/* Everything in the log is already in the snapshot */
+	assert(!wal_replay(&wal, WAL_FILE, univ.wal_lsn));
+	check_player(e);
+	assert(list_len(&univ.players) == 1);
+	fixture_destroy_universe();
+	tests++;
+
+	unlink(SECOND_SNAPSHOT_FILE);
+
+	return tests;
+}
+
+static int test_torn_tail(const struct expected * const e)
+{
+	int tests = 0;
+	struct wal_record_header header;
+	off_t size;
+	FILE *f;
+
+	/* A record whose payload never made it to disk */
+	size = file_size(WAL_FILE);
+	memset(&header, 0, sizeof(header));
+	header.len = 100;
+	header.lsn = 6;
+	f = fopen(WAL_FILE, "a");
+	assert(f);
+	assert(fwrite(&header, sizeof(header), 1, f) == 1);
+	assert(fwrite("torn", 4, 1, f) == 1);
+	fclose(f);
+
+	load_snapshot(SNAPSHOT_FILE);
+	assert(!wal_replay(&wal, WAL_FILE, univ.wal_lsn));
+	assert(file_size(WAL_FILE) == size);
+	assert(wal_last_lsn(&wal) == 5);
+	check_player(e);
+	tests++;
+
+	/* New records follow the last good one */
+	assert(!wal_open(&wal, WAL_FILE, SNAPSHOT_FILE));
+	wal_log_move(&wal, st_lookup_exact(&univ.playernames, e->player));
+	wal_close(&wal);
+	assert(wal_last_lsn(&wal) == 6);
+	fixture_destroy_universe();
+
+	load_snapshot(SNAPSHOT_FILE);
+	assert(!wal_replay(&wal, WAL_FILE, univ.wal_lsn));
+	assert(wal_last_lsn(&wal) == 6);
+	check_player(e);
+	fixture_destroy_universe();
+	tests++;
+
+	return tests;
+}
+
+static int test_cut(const struct expected * const e)
+{
+	int tests = 0;
+	struct player *player;
+	uint64_t lsn;
+	off_t size;
+
+	load_snapshot(SNAPSHOT_FILE);
+	assert(!wal_replay(&wal, WAL_FILE, univ.wal_lsn));
+	assert(!wal_open(&wal, WAL_FILE, SNAPSHOT_FILE));
+	player = st_lookup_exact(&univ.playernames, e->player);
+	wal_log_move(&wal, player);
+	lsn = wal_last_lsn(&wal);
+	assert(lsn == 7);
+
+	/* A snapshot saved elsewhere doesn't make the log any less needed */
+	assert(!snapshot_save(&univ, SECOND_SNAPSHOT_FILE));
+	wal_saved(&wal, SECOND_SNAPSHOT_FILE, lsn);
+	assert(file_size(WAL_FILE) > 0);
+	unlink(SECOND_SNAPSHOT_FILE);
+	tests++;
+
+	assert(!snapshot_save(&univ, SNAPSHOT_FILE));
+	wal_saved(&wal, SNAPSHOT_FILE, lsn);
+	assert(file_size(WAL_FILE) == 0);
+	tests++;
+
+	/* Records after the cut are appended to the new file */
+	wal_log_move(&wal, player);
+	wal_close(&wal);
+	size = file_size(WAL_FILE);
+	assert(size > 0);
+	fixture_destroy_universe();
+
+	load_snapshot(SNAPSHOT_FILE);
+	assert(univ.wal_lsn == 7);
+	assert(!wal_replay(&wal, WAL_FILE, univ.wal_lsn));
+	assert(wal_last_lsn(&wal) == 8);
+	assert(file_size(WAL_FILE) == size);
+	check_player(e);
+	fixture_destroy_universe();
+	tests++;
+
+	return tests;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int tests = 0;
+	struct expected e;
+
+	log_init("wal_test.log");
+	mtrandom_seed(42);
+	assert(!threadpool_init(&workers, 2));
+
+	tests += test_replay(&e);
+	tests += test_snapshot_with_players(&e);
+	tests += test_torn_tail(&e);
+	tests += test_cut(&e);
+
+	free(e.player);
+	free(e.port);
+	free(e.item);
+	unlink(WAL_FILE);
+	unlink(SNAPSHOT_FILE);
+	threadpool_free(&workers);
+	log_close();
+
+	assert(tests == NUM_TESTS);
+}
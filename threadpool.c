@@ -0,0 +1,191 @@
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "list.h"
+#include "threadpool.h"
+
+#define THREADPOOL_MAX_THREADS 64
+
+struct threadpool workers;
+
+/*
+ * Hands out the next index of a job. Must be called with the pool lock held.
+ * The job is unlinked as soon as its last index has been handed out, which
+ * means nobody will touch it after that except whoever runs the last indices.
+ */
+static unsigned long job_next_idx(struct threadpool_job *job)
+{
+	unsigned long idx = job->next++;
+
+	if (job->next >= job->num)
+		list_del_init(&job->list);
+
+	return idx;
+}
+
+static void job_run_idx(struct threadpool *pool, struct threadpool_job *job,
+		unsigned long idx)
+{
+	const unsigned long num = job->num;
+
+	job->func(job->data, idx);
+
+	if (__atomic_add_fetch(&job->done, 1, __ATOMIC_ACQ_REL) == num) {
+		pthread_mutex_lock(&pool->lock);
+		pthread_cond_broadcast(&pool->done_cond);
+		pthread_mutex_unlock(&pool->lock);
+	}
+}
+
+static void* threadpool_worker(void *_pool)
+{
+	struct threadpool *pool = _pool;
+	struct threadpool_job *job;
+	unsigned long idx;
+
+	pthread_mutex_lock(&pool->lock);
+
+	do {
+		while (list_empty(&pool->jobs) && !pool->terminate)
+			pthread_cond_wait(&pool->work_cond, &pool->lock);
+
+		if (pool->terminate)
+			break;
+
+		job = list_first_entry(&pool->jobs, struct threadpool_job, list);
+		idx = job_next_idx(job);
+
+		pthread_mutex_unlock(&pool->lock);
+		job_run_idx(pool, job, idx);
+		pthread_mutex_lock(&pool->lock);
+	} while (1);
+
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+void threadpool_for(struct threadpool *pool, unsigned long num,
+		void (*func)(void *data, unsigned long idx), void *data)
+{
+	struct threadpool_job job;
+	unsigned long idx;
+
+	if (!num)
+		return;
+
+	/*
+	 * A pool without threads (e.g. one that failed to start, or a single
+	 * CPU machine) degrades into a plain loop.
+	 */
+	if (!pool->num) {
+		for (idx = 0; idx < num; idx++)
+			func(data, idx);
+		return;
+	}
+
+	memset(&job, 0, sizeof(job));
+	job.func = func;
+	job.data = data;
+	job.num = num;
+
+	pthread_mutex_lock(&pool->lock);
+	list_add_tail(&job.list, &pool->jobs);
+	pthread_cond_broadcast(&pool->work_cond);
+
+	while (job.next < job.num) {
+		idx = job_next_idx(&job);
+		pthread_mutex_unlock(&pool->lock);
+		job_run_idx(pool, &job, idx);
+		pthread_mutex_lock(&pool->lock);
+	}
+
+	while (__atomic_load_n(&job.done, __ATOMIC_ACQUIRE) < job.num)
+		pthread_cond_wait(&pool->done_cond, &pool->lock);
+
+	pthread_mutex_unlock(&pool->lock);
+}
+
+unsigned int threadpool_default_size(void)
+{
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (n < 1)
+		return 1;
+	if (n > THREADPOOL_MAX_THREADS)
+		return THREADPOOL_MAX_THREADS;
+
+	return n;
+}
+
+int threadpool_init(struct threadpool *pool, unsigned int threads)
+{
+	sigset_t old, new;
+	unsigned int i;
+
+	memset(pool, 0, sizeof(*pool));
+	INIT_LIST_HEAD(&pool->jobs);
+
+	if (pthread_mutex_init(&pool->lock, NULL))
+		goto err;
+	if (pthread_cond_init(&pool->work_cond, NULL))
+		goto err_free_mutex;
+	if (pthread_cond_init(&pool->done_cond, NULL))
+		goto err_free_work_cond;
+
+	if (!threads)
+		return 0;
+
+	pool->threads = malloc(threads * sizeof(*pool->threads));
+	if (!pool->threads)
+		goto err_free_done_cond;
+
+	sigfillset(&new);
+	if (pthread_sigmask(SIG_SETMASK, &new, &old))
+		goto err_free_threads;
+
+	for (i = 0; i < threads; i++) {
+		if (pthread_create(&pool->threads[i], NULL, threadpool_worker, pool))
+			break;
+		pool->num++;
+	}
+
+	if (pthread_sigmask(SIG_SETMASK, &old, NULL) || pool->num < threads) {
+		threadpool_free(pool);
+		return -1;
+	}
+
+	return 0;
+
+err_free_threads:
+	free(pool->threads);
+err_free_done_cond:
+	pthread_cond_destroy(&pool->done_cond);
+err_free_work_cond:
+	pthread_cond_destroy(&pool->work_cond);
+err_free_mutex:
+	pthread_mutex_destroy(&pool->lock);
+err:
+	return -1;
+}
+
+void threadpool_free(struct threadpool *pool)
+{
+	pthread_mutex_lock(&pool->lock);
+	pool->terminate = 1;
+	pthread_cond_broadcast(&pool->work_cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (unsigned int i = 0; i < pool->num; i++)
+		pthread_join(pool->threads[i], NULL);
+
+	free(pool->threads);
+	pool->threads = NULL;
+	pool->num = 0;
+
+	pthread_cond_destroy(&pool->done_cond);
+	pthread_cond_destroy(&pool->work_cond);
+	pthread_mutex_destroy(&pool->lock);
+}
@@ -0,0 +1,40 @@
+#ifndef _HAS_THREADPOOL_H
+#define _HAS_THREADPOOL_H
+
+#include <pthread.h>
+#include "list.h"
+
+struct threadpool_job {
+	void (*func)(void *data, unsigned long idx);
+	void *data;
+	unsigned long num;
+	unsigned long next;		/* Next index to hand out, protected by the pool lock */
+	unsigned long done;		/* Finished indices, updated atomically */
+	struct list_head list;
+};
+
+struct threadpool {
+	pthread_t *threads;
+	unsigned int num;
+	pthread_mutex_t lock;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+	struct list_head jobs;
+	int terminate;
+};
+
+extern struct threadpool workers;
+
+int threadpool_init(struct threadpool *pool, unsigned int threads);
+void threadpool_free(struct threadpool *pool);
+unsigned int threadpool_default_size(void);
+
+/*
+ * Runs func(data, i) for all i in [0, num) and waits for all of them to
+ * finish. The calling thread does its share of the work too, so it is safe
+ * to call this from any thread, including the pool threads themselves.
+ */
+void threadpool_for(struct threadpool *pool, unsigned long num,
+		void (*func)(void *data, unsigned long idx), void *data);
+
+#endif
@@ -0,0 +1,247 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "trade.h"
+#include "cargo.h"
+#include "common.h"
+#include "item.h"
+#include "log.h"
+#include "player.h"
+#include "port.h"
+#include "ship.h"
+#include "universe.h"
+#include "wal.h"
+
+static int lock_cmp(const void *_a, const void *_b)
+{
+	const struct trade_lock *a = _a, *b = _b;
+
+	if (a->rank != b->rank)
+		return a->rank < b->rank ? -1 : 1;
+	if (a->lock != b->lock)
+		return a->lock < b->lock ? -1 : 1;
+
+	return 0;
+}
+
+/*
+ * Write locks every lock in locks, which is sorted into the order they are
+ * taken in. A lock may be given more than once.
+ */
+void trade_lock_all(struct trade_lock *locks, unsigned int num)
+{
+	qsort(locks, num, sizeof(*locks), lock_cmp);
+
+	for (unsigned int i = 0; i < num; i++) {
+		if (i > 0 && locks[i].lock == locks[i - 1].lock)
+			continue;
+		pthread_rwlock_wrlock(locks[i].lock);
+	}
+}
+
+/*
+ * Must be given the locks just as trade_lock_all() left them
+ */
+void trade_unlock_all(struct trade_lock *locks, unsigned int num)
+{
+	for (unsigned int i = num; i-- > 0;) {
+		if (i > 0 && locks[i].lock == locks[i - 1].lock)
+			continue;
+		pthread_rwlock_unlock(locks[i].lock);
+	}
+}
+
+void trade_init(struct trade *trade, struct player *player, struct ship *ship, struct port *port)
+{
+	memset(trade, 0, sizeof(*trade));
+	trade->player = player;
+	trade->ship = ship;
+	trade->port = port;
+}
+
+int trade_add_leg(struct trade *trade, struct item *item, const long amount, const enum trade_dir dir)
+{
+	struct trade_leg *leg;
+
+	if (trade->num_legs >= TRADE_MAX_LEGS || amount <= 0)
+		return -1;
+
+	leg = &trade->legs[trade->num_legs++];
+	memset(leg, 0, sizeof(*leg));
+	leg->item = item;
+	leg->amount = amount;
+	leg->dir = dir;
+
+	return 0;
+}
+
+/*
+ * Whether leg got as much as it asked for
+ */
+static int leg_done(const struct trade_leg * const leg)
+{
+	if (leg->amount == TRADE_ALL)
+		return leg->done > 0;
+
+	return leg->done == leg->amount;
+}
+
+static enum trade_status buy(struct trade *trade, struct trade_leg *leg, struct cargo *cargo)
+{
+	struct player *player = trade->player;
+	long stock = cargo_settled_amount(cargo);
+	long affordable = LONG_MAX;
+	long amount = leg->amount;
+
+	if (cargo->price)
+		affordable = MAX(player->credits, 0) / cargo->price;
+	amount = MIN(amount, affordable);
+
+	leg->done = move_cargo_to_ship(trade->ship, cargo, amount);
+	leg->credits = leg->done * cargo->price;
+	player->credits -= leg->credits;
+	port_traded(trade->port, cargo, leg->done);
+
+	if (leg_done(leg))
+		return TRADE_OK;
+	else if (leg->done == stock)
+		return TRADE_NOT_ENOUGH;
+	else if (leg->done == affordable)
+		return TRADE_NO_CREDITS;
+	else
+		return TRADE_NO_ROOM;
+}
+
+static enum trade_status sell(struct trade *trade, struct trade_leg *leg, struct cargo *cargo)
+{
+	struct player *player = trade->player;
+	long held = ship_cargo_amount(trade->ship, leg->item);
+
+	leg->done = move_cargo_from_ship(trade->ship, cargo, leg->amount);
+	leg->credits = -leg->done * cargo->price;
+	player->credits -= leg->credits;
+	port_traded(trade->port, cargo, -leg->done);
+
+	if (leg_done(leg))
+		return TRADE_OK;
+	else if (leg->done == held)
+		return TRADE_NOT_ENOUGH;
+	else
+		return TRADE_NO_ROOM;
+}
+
+static enum trade_status run_leg(struct trade *trade, struct trade_leg *leg)
+{
+	struct cargo *cargo = port_cargo(trade->port, leg->item);
+
+	leg->done = 0;
+	leg->credits = 0;
+
+	if (!cargo)
+		return TRADE_NOT_TRADED;
+
+	leg->before.port_amount = cargo_settled_amount(cargo);
+	leg->before.hold = ship_cargo_amount(trade->ship, leg->item);
+	leg->before.credits = trade->player->credits;
+	leg->before.demand = cargo->demand;
+	leg->before.demand_tick = cargo->demand_tick;
+	leg->before.price = cargo->price;
+
+	switch (leg->dir) {
+	case TRADE_BUY:
+		return buy(trade, leg, cargo);
+	case TRADE_SELL:
+		return sell(trade, leg, cargo);
+	default:
+		bug("unknown trade direction %d\n", leg->dir);
+	}
+}
+
+/*
+ * Puts back everything leg changed as it was before it. Legs are undone last
+ * first, so each goes back to what the legs before it left. The stock was
+ * settled before the first leg, and stays as of that tick for as long as
+ * the locks are held, so nothing the economy made is lost with it. Demand
+ * and price go back as they were too, rather than being traded back at a
+ * tick that may have moved on.
+ */
+static void undo_leg(struct trade *trade, struct trade_leg *leg)
+{
+	struct cargo *cargo = port_cargo(trade->port, leg->item);
+
+	if (!leg->done)
+		return;
+
+	cargo_set_settled(cargo, leg->before.port_amount);
+	ship_set_cargo(trade->ship, leg->item, leg->before.hold);
+	trade->player->credits = leg->before.credits;
+
+	price_index_move(&leg->item->prices, trade->port, cargo->price, leg->before.price);
+	cargo->price = leg->before.price;
+	cargo->demand = leg->before.demand;
+	cargo->demand_tick = leg->before.demand_tick;
+
+	leg->done = 0;
+	leg->credits = 0;
+}
+
+/*
+ * Runs the legs of trade in order, so a leg can pay for the ones after it.
+ * If one of them can't be done in full, every leg before it is undone and
+ * its status is returned, with trade->failed set to it. A partial trade does
+ * as much of every leg as it can and returns the status of the first one
+ * that fell short, but leaves everything done.
+ *
+ * Must be called with the player's lock held, see struct player.
+ */
+enum trade_status trade_run(struct trade *trade)
+{
+	struct trade_lock locks[] = {
+		{ TRADE_LOCK_PORT, &trade->port->items_lock },
+		{ TRADE_LOCK_SHIP, &trade->ship->cargo_lock },
+	};
+	enum trade_status status = TRADE_OK, s;
+	struct trade_leg *leg;
+	struct cargo *cargo;
+	unsigned int i;
+
+	pthread_rwlock_rdlock(&univ.ports_lock);
+	trade_lock_all(locks, ARRAY_SIZE(locks));
+
+	/* Before anything is moved, so every leg is as of the same tick */
+	for (i = 0; i < trade->num_legs; i++) {
+		cargo = port_cargo(trade->port, trade->legs[i].item);
+		if (cargo)
+			cargo_settle(cargo);
+	}
+
+	for (i = 0; i < trade->num_legs; i++) {
+		s = run_leg(trade, &trade->legs[i]);
+		if (s == TRADE_OK || status != TRADE_OK)
+			continue;
+
+		status = s;
+		trade->failed = i;
+		if (!trade->partial)
+			break;
+	}
+
+	if (status != TRADE_OK && !trade->partial) {
+		undo_leg(trade, &trade->legs[i]);
+		while (i-- > 0)
+			undo_leg(trade, &trade->legs[i]);
+	}
+
+	for (i = 0; i < trade->num_legs; i++) {
+		leg = &trade->legs[i];
+		if (leg->done > 0)
+			wal_log_trade(&wal, trade->player, trade->port,
+					port_cargo(trade->port, leg->item),
+					ship_cargo_amount(trade->ship, leg->item));
+	}
+
+	trade_unlock_all(locks, ARRAY_SIZE(locks));
+	pthread_rwlock_unlock(&univ.ports_lock);
+
+	return status;
+}
@@ -0,0 +1,86 @@
+#ifndef _HAS_TRADE_H
+#define _HAS_TRADE_H
+
+#include <limits.h>
+#include <pthread.h>
+
+struct item;
+struct player;
+struct port;
+struct ship;
+
+/*
+ * A trade is a batch of legs between a player's ship and a port, done as a
+ * whole or not at all. Every lock involved is taken up front, in the order
+ * given by enum trade_lock_rank, so trades never wait for each other in a
+ * cycle no matter what they move between.
+ *
+ * A leg is done at the price the port asks before it, and the legs after it
+ * see the price it left, see port_traded().
+ */
+#define TRADE_ALL LONG_MAX		/* As much as possible, but at least one */
+#define TRADE_MAX_LEGS 16
+
+enum trade_dir {
+	TRADE_BUY,			/* Port to ship */
+	TRADE_SELL			/* Ship to port */
+};
+
+enum trade_status {
+	TRADE_OK = 0,
+	TRADE_NOT_TRADED,		/* The port doesn't trade the item */
+	TRADE_NOT_ENOUGH,		/* Not that much to buy or sell */
+	TRADE_NO_CREDITS,
+	TRADE_NO_ROOM,			/* The hold or port is full */
+	TRADE_ERROR			/* Out of memory */
+};
+
+struct trade_leg {
+	struct item *item;
+	long amount;			/* Or TRADE_ALL */
+	enum trade_dir dir;
+	long done;			/* How much was moved */
+	long credits;			/* What it cost, negative if it paid */
+	struct {			/* Everything it changes, to undo it */
+		long port_amount;
+		long hold;
+		long credits;
+		long demand;
+		unsigned long demand_tick;
+		long price;
+	} before;
+};
+
+struct trade {
+	struct player *player;
+	struct ship *ship;
+	struct port *port;
+	struct trade_leg legs[TRADE_MAX_LEGS];
+	unsigned int num_legs;
+	int partial;			/* Do as much of every leg as possible instead */
+	unsigned int failed;		/* The leg that could not be done */
+};
+
+/*
+ * Locks that may be held at once are taken by rank, and by address within
+ * a rank. ports_lock is always taken first, and only for reading.
+ */
+enum trade_lock_rank {
+	TRADE_LOCK_MARKET,		/* port->market.lock */
+	TRADE_LOCK_PORT,		/* port->items_lock */
+	TRADE_LOCK_SHIP			/* ship->cargo_lock */
+};
+
+struct trade_lock {
+	enum trade_lock_rank rank;
+	pthread_rwlock_t *lock;
+};
+
+void trade_lock_all(struct trade_lock *locks, unsigned int num);
+void trade_unlock_all(struct trade_lock *locks, unsigned int num);
+
+void trade_init(struct trade *trade, struct player *player, struct ship *ship, struct port *port);
+int trade_add_leg(struct trade *trade, struct item *item, const long amount, const enum trade_dir dir);
+enum trade_status trade_run(struct trade *trade);
+
+#endif
@@ -16,6 +16,7 @@
 #include "planet_type.h"
 #include "ship_type.h"
 #include "port.h"
+#include "port_update.h"
 #include "system.h"
 #include "civ.h"
 #include "star.h"
@@ -44,6 +45,90 @@
 
 struct universe univ;
 
+/*
+ * Besides the x tree, all systems are kept in a sparse grid of square cells
+ * so that looking for systems close to a point only has to look at a few
+ * cells instead of walking a band across the whole universe. Cells are
+ * created when the first system moves into them and are kept in a tree
+ * sorted on x and then y.
+ */
+struct grid_cell {
+	long x, y;
+	struct rb_node node;
+	struct list_head systems;
+};
+
+#define GRID_CELL_SIZE (150 * TICK_PER_LY)
+#define GRID_MAX_SPAN 8		/* Searches wider than this many cells walk the x tree */
+
+static long grid_coord(const long c)
+{
+	/* Round towards negative infinity, or the cells around 0 would be twice as wide */
+	return (c < 0 ? (c + 1) / GRID_CELL_SIZE - 1 : c / GRID_CELL_SIZE);
+}
+
+static struct grid_cell* grid_lookup(const long x, const long y)
+{
+	struct rb_node *node = univ.grid.rb_node;
+	struct grid_cell *cell;
+
+	while (node) {
+		cell = rb_entry(node, struct grid_cell, node);
+
+		if (x < cell->x || (x == cell->x && y < cell->y))
+			node = node->rb_left;
+		else if (x > cell->x || y > cell->y)
+			node = node->rb_right;
+		else
+			return cell;
+	}
+
+	return NULL;
+}
+
+static void grid_add(struct system * const s)
+{
+	struct rb_node **link = &univ.grid.rb_node;
+	struct rb_node *parent = NULL;
+	struct grid_cell *cell;
+	const long x = grid_coord(s->x);
+	const long y = grid_coord(s->y);
+
+	while (*link) {
+		parent = *link;
+		cell = rb_entry(parent, struct grid_cell, node);
+
+		if (x < cell->x || (x == cell->x && y < cell->y))
+			link = &(*link)->rb_left;
+		else if (x > cell->x || y > cell->y)
+			link = &(*link)->rb_right;
+		else
+			goto found;
+	}
+
+	cell = malloc(sizeof(*cell));
+	if (!cell)
+		die("%s", "out of memory when placing system");
+	cell->x = x;
+	cell->y = y;
+	INIT_LIST_HEAD(&cell->systems);
+	rb_link_node(&cell->node, parent, link);
+	rb_insert_color(&cell->node, &univ.grid);
+
+found:
+	list_add_tail(&s->grid_list, &cell->systems);
+}
+
+static void grid_free(struct rb_root * const root)
+{
+	struct rb_node *node;
+
+	while ((node = root->rb_node)) {
+		rb_erase(node, root);
+		free(rb_entry(node, struct grid_cell, node));
+	}
+}
+
 void universe_free(struct universe *u)
 {
 	ptrlist_free(&u->systems);
@@ -77,16 +162,21 @@ void universe_free(struct universe *u)
 		free(st);
 	}
 
+	grid_free(&u->grid);
+	economy_free(&u->economy);
+
 	pthread_rwlock_destroy(&u->ports_lock);
 	pthread_rwlock_destroy(&u->systemnames_lock);
 	pthread_rwlock_destroy(&u->planetnames_lock);
 	pthread_rwlock_destroy(&u->portnames_lock);
+	pthread_rwlock_destroy(&u->players_lock);
 	st_destroy(&u->port_type_names, ST_DONT_FREE_DATA);
 	st_destroy(&u->ship_type_names, ST_DONT_FREE_DATA);
 	st_destroy(&u->item_names, ST_DONT_FREE_DATA);
 	st_destroy(&u->systemnames, ST_DONT_FREE_DATA);
 	st_destroy(&u->planetnames, ST_DONT_FREE_DATA);
 	st_destroy(&u->portnames, ST_DONT_FREE_DATA);
+	st_destroy(&u->playernames, ST_DONT_FREE_DATA);
 	free(u->name);
 }
 
@@ -155,34 +245,73 @@ int cmp_system_distances(const void *_system1, const void *_system2, void *_orig
 		return (long)system_distance(origin, system1) - (long)system_distance(origin, system2);
 }
 
-unsigned long get_neighbouring_systems(struct ptrlist * const neighbours,
-		const struct system * const origin, const long max_distance)
+static int is_near(const long x, const long y, const struct system * const system,
+		const long min_y, const long max_y, const long max_distance)
+{
+	/*
+	 * The extra y-coordinate comparison before calculating the distance
+	 * improves performance quite considerably when measured (with perf
+	 * and gcc -O3) as the square root is quite slow.
+	 */
+	return system->y >= min_y && system->y <= max_y &&
+		(long)sqrt((double)(system->x - x) * (system->x - x) +
+			(double)(system->y - y) * (system->y - y)) < max_distance;
+}
+
+/*
+ * Adds all systems closer than max_distance to (x, y) to neighbours (which
+ * may be NULL if only the count is of interest). Returns the number of
+ * systems found.
+ */
+unsigned long get_systems_near(struct ptrlist * const neighbours,
+		const long x, const long y, const long max_distance)
 {
 	struct system *system;
+	struct grid_cell *cell;
 	long min_x, max_x;
 	long min_y, max_y;
 	struct rb_node *node;
 	unsigned long neighbour_count = 0;
 
-	min_x = origin->x - max_distance;
-	max_x = origin->x + max_distance;
-	min_y = origin->y - max_distance;
-	max_y = origin->y + max_distance;
+	/* Any distance may be asked for, so the bounds stop at what a long holds */
+	min_x = limit_sub_long(x, max_distance);
+	max_x = limit_add_long(x, max_distance);
+	min_y = limit_sub_long(y, max_distance);
+	max_y = limit_add_long(y, max_distance);
+
+	if (grid_coord(max_x) - grid_coord(min_x) < GRID_MAX_SPAN &&
+			grid_coord(max_y) - grid_coord(min_y) < GRID_MAX_SPAN) {
+		for (long cx = grid_coord(min_x); cx <= grid_coord(max_x); cx++) {
+			for (long cy = grid_coord(min_y); cy <= grid_coord(max_y); cy++) {
+				cell = grid_lookup(cx, cy);
+				if (!cell)
+					continue;
+
+				list_for_each_entry(system, &cell->systems, grid_list) {
+					if (!is_near(x, y, system, min_y, max_y, max_distance))
+						continue;
+
+					neighbour_count++;
+					if (neighbours)
+						ptrlist_push(neighbours, system);
+				}
+			}
+		}
+
+		return neighbour_count;
+	}
+
+	if (RB_EMPTY_ROOT(&univ.x_rbtree))
+		return 0;
+
 	system = get_first_system_after_x(&univ.x_rbtree, min_x);
 	node = &system->x_rbtree;
 
-	/*
-	 * The extra y-coordinate comparison before the call to
-	 * system_distance() improves performance quite considerably when
-	 * measured (with perf and gcc -O3) as system_distance() is quite slow.
-	 */
 	while (node && rb_entry(node, struct system, x_rbtree)->x <= max_x) {
 
 		system = rb_entry(node, struct system, x_rbtree);
 
-		if (system->y >= min_y && system->y <= max_y &&
-			(system_distance(origin, system) < max_distance)) {
-
+		if (is_near(x, y, system, min_y, max_y, max_distance)) {
 			neighbour_count++;
 			if (neighbours)
 				ptrlist_push(neighbours, system);
@@ -194,6 +323,60 @@ unsigned long get_neighbouring_systems(struct ptrlist * const neighbours,
 	return neighbour_count;
 }
 
+static int is_system_in_cell(const long cx, const long cy, const long x, const long y,
+		const long max_distance)
+{
+	struct grid_cell *cell = grid_lookup(cx, cy);
+	struct system *system;
+
+	if (!cell)
+		return 0;
+
+	list_for_each_entry(system, &cell->systems, grid_list) {
+		if (is_near(x, y, system, limit_sub_long(y, max_distance),
+					limit_add_long(y, max_distance), max_distance))
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Returns 1 if there is any system closer than max_distance to (x, y). This
+ * is much cheaper than counting them when the area is crowded, as it starts
+ * with the cell (x, y) is in and stops at the first system found.
+ */
+int is_system_near(const long x, const long y, const long max_distance)
+{
+	const long cx = grid_coord(x);
+	const long cy = grid_coord(y);
+	const long min_cx = grid_coord(limit_sub_long(x, max_distance));
+	const long max_cx = grid_coord(limit_add_long(x, max_distance));
+	const long min_cy = grid_coord(limit_sub_long(y, max_distance));
+	const long max_cy = grid_coord(limit_add_long(y, max_distance));
+
+	if (max_cx - min_cx >= GRID_MAX_SPAN || max_cy - min_cy >= GRID_MAX_SPAN)
+		return get_systems_near(NULL, x, y, max_distance) > 0;
+
+	if (is_system_in_cell(cx, cy, x, y, max_distance))
+		return 1;
+
+	for (long i = min_cx; i <= max_cx; i++) {
+		for (long j = min_cy; j <= max_cy; j++) {
+			if ((i != cx || j != cy) && is_system_in_cell(i, j, x, y, max_distance))
+				return 1;
+		}
+	}
+
+	return 0;
+}
+
+unsigned long get_neighbouring_systems(struct ptrlist * const neighbours,
+		const struct system * const origin, const long max_distance)
+{
+	return get_systems_near(neighbours, origin->x, origin->y, max_distance);
+}
+
 unsigned long get_neighbouring_ports(struct ptrlist * const neighbours,
 		struct system *origin, const long max_distance)
 {
@@ -267,40 +450,48 @@ static void insert_system_into_rbtree(struct system * const s)
 
 int system_move(struct system * const s, const long x, const long y)
 {
-	struct system *prev;
-
 	/*
 	 * All systems need to have unique x coordinates or there will be tree
 	 * collisions. This is the most sane place to do that check.
 	 */
-	if ((prev = get_system_at_x(x)))
+	if (get_system_at_x(x))
 		return 1;
 
 	/*
 	 * This function is also used to set a position for freshly created
-	 * systems which don't exist in the tree yet.
+	 * systems which don't exist in the tree or the grid yet.
 	 */
-	prev = get_system_at_x(s->x);
-	if (prev)
-		rb_erase(&prev->x_rbtree, &univ.x_rbtree);
+	if (!list_empty(&s->grid_list)) {
+		rb_erase(&s->x_rbtree, &univ.x_rbtree);
+		list_del_init(&s->grid_list);
+	}
 
 	s->x = x;
 	s->y = y;
 
 	insert_system_into_rbtree(s);
+	grid_add(s);
 
 	return 0;
 }
 
 void universe_init(struct universe *u)
 {
+	pthread_rwlockattr_t attr;
+
 	time(&u->created);
 	u->id = 0;
 	u->name = NULL;
 	ptrlist_init(&u->systems);
+	u->x_rbtree = RB_ROOT;
+	u->grid = RB_ROOT;
 	INIT_LIST_HEAD(&u->items);
 	INIT_LIST_HEAD(&u->ports);
-	pthread_rwlock_init(&u->ports_lock, NULL);
+	pthread_rwlockattr_init(&attr);
+	pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+	pthread_rwlock_init(&u->ports_lock, &attr);
+	pthread_rwlockattr_destroy(&attr);
+	economy_init(&u->economy, PORT_UPDATE_TICKS_PER_DAY);
 	INIT_LIST_HEAD(&u->port_types);
 	st_init(&u->port_type_names);
 	INIT_LIST_HEAD(&u->planet_types);
@@ -314,10 +505,96 @@ void universe_init(struct universe *u)
 	st_init(&u->portnames);
 	pthread_rwlock_init(&u->portnames_lock, NULL);
 	INIT_LIST_HEAD(&u->civs);
+	INIT_LIST_HEAD(&u->players);
+	INIT_LIST_HEAD(&u->detached_players);
+	u->num_detached = 0;
+	st_init(&u->playernames);
+	pthread_rwlock_init(&u->players_lock, NULL);
+	u->wal_lsn = 0;
+
+	/* A universe of about the size genesis always used to create */
+	u->settings.systems = 1536;
+	u->settings.constellation_min = 1;
+	u->settings.constellation_max = GREEK_N - 1;
+	u->settings.planets_max = 10;
+	u->settings.ports_max = 3;
+	u->settings.memory_mb = 0;
+	u->settings.checkpoint_interval = 0;
+	u->settings.clock_rate = 1;
+	u->settings.npcs = 0;
+	u->settings.detached_max = 10000;
+	u->settings.detached_expiry = 30 * 24 * 60 * 60;
+}
+
+/*
+ * Planets and ports are generated by adding one more with a chance of 1 in
+ * odds until it fails or max is reached. This is the expected number of them
+ * on top of the first.
+ */
+static double expected_extra(const unsigned long first, const unsigned long max,
+		const unsigned long odds)
+{
+	double p = 1.0, sum = 0.0;
+
+	for (unsigned long n = first; n < max && p > 1e-9; n++) {
+		p /= odds;
+		sum += p;
+	}
+
+	return sum;
 }
 
+/*
+ * The heap usage of each kind of object is the struct itself plus what
+ * hangs off it (names, list nodes, stars, cargo and index entries). These
+ * are averages measured with test/genesis_bench on the shipped data files.
+ */
+#define GENESIS_SYSTEM_BYTES 1400
+#define GENESIS_PLANET_BYTES 425
+#define GENESIS_PORT_BYTES 4500
+size_t universe_estimate_size(const struct universe * const u)
+{
+	const struct universe_settings * const settings = &u->settings;
+	struct planet_type *type;
+	unsigned long types = 0, port_types = 0;
+	double planets, ports;
+
+	/* Only planets of types that have any port types get ports */
+	list_for_each_entry(type, &u->planet_types, list) {
+		types++;
+		if (ptrlist_len(&type->port_types))
+			port_types++;
+	}
+
+	planets = 1 + expected_extra(1, settings->planets_max, PLANET_MUL_ODDS);
+	ports = expected_extra(0, settings->ports_max, PORT_MUL_ODDS);
+	if (types)
+		ports = ports * port_types / types;
+
+	return settings->systems * (GENESIS_SYSTEM_BYTES +
+			planets * (GENESIS_PLANET_BYTES + ports * GENESIS_PORT_BYTES));
+}
+
+/* Also measured with test/genesis_bench, on a single core */
+#define GENESIS_SYSTEMS_PER_SEC 25000
 int universe_genesis(struct universe *univ)
 {
+	const size_t size = universe_estimate_size(univ);
+
+	printf("Creating %lu systems, estimated to take %zu MiB and %lu s\n",
+			univ->settings.systems, size >> 20,
+			univ->settings.systems / GENESIS_SYSTEMS_PER_SEC);
+	log_printfn(LOG_MAIN, "creating %lu systems, estimated to take %zu MiB",
+			univ->settings.systems, size >> 20);
+
+	if (univ->settings.memory_mb && (size >> 20) > univ->settings.memory_mb) {
+		log_printfn(LOG_MAIN, "estimated size is over the memory budget of %lu MiB",
+				univ->settings.memory_mb);
+		printf("The estimated size is over the memory budget of %lu MiB\n",
+				univ->settings.memory_mb);
+		return -1;
+	}
+
 	/*
 	 * 1. Decide number of constellations in universe.
 	 * 2. For each constellation, create a number of systems, grouping them together.
@@ -1,6 +1,8 @@
 #ifndef _HAS_UNIVERSE_H
 #define _HAS_UNIVERSE_H
 
+#include <stdint.h>
+#include "economy.h"
 #include "list.h"
 #include "names.h"
 #include "ptrlist.h"
@@ -8,6 +10,24 @@
 #include "stringtrie.h"
 #include "system.h"
 
+/*
+ * Size of the universe created by genesis, set by the universe block in
+ * yastg.conf. See universe_init() for the defaults.
+ */
+struct universe_settings {
+	unsigned long systems;			/* Number of systems to create */
+	unsigned long constellation_min;	/* Systems per constellation */
+	unsigned long constellation_max;
+	unsigned long planets_max;		/* Planets per system */
+	unsigned long ports_max;		/* Ports per planet */
+	unsigned long memory_mb;		/* Refuse genesis above this estimate, 0 is no limit */
+	unsigned long checkpoint_interval;	/* Seconds between checkpoints, 0 is never */
+	unsigned long clock_rate;		/* Game time per real time, see scheduler.h */
+	unsigned long npcs;			/* NPC traders run by the server, see npc.h */
+	unsigned long detached_max;		/* Players kept waiting to be resumed, 0 is no limit */
+	unsigned long detached_expiry;		/* Seconds they are kept, 0 is forever */
+};
+
 struct universe {
 	size_t id;			/* ID of the universe (or the game?) */
 	char* name;			/* The name of the universe (or the game?) */
@@ -15,9 +35,13 @@ struct universe {
 	unsigned long inhabited_systems;
 	struct ptrlist systems;
 	struct rb_root x_rbtree;
+	struct rb_root grid;		/* struct grid_cell, see universe.c */
+	struct universe_settings settings;
 	struct list_head items;
+	unsigned int num_items;		/* Fixed once the config is loaded */
 	struct list_head ports;
-	pthread_rwlock_t ports_lock;
+	pthread_rwlock_t ports_lock;	/* Read locked to change any port, see checkpoint.c */
+	struct economy economy;		/* Stock of the ports */
 	struct list_head port_types;
 	struct st_root port_type_names;
 	struct list_head planet_types;
@@ -31,6 +55,12 @@ struct universe {
 	struct st_root portnames;
 	pthread_rwlock_t portnames_lock;
 	struct list_head civs;
+	struct list_head players;	/* Connected or not, see player_create() */
+	struct list_head detached_players;	/* Waiting to be resumed, see player_detach() */
+	unsigned long num_detached;
+	struct st_root playernames;
+	pthread_rwlock_t players_lock;
+	uint64_t wal_lsn;		/* Last WAL record reflected in the universe */
 	struct list_head list;
 	struct name_list avail_constellations;
 	struct name_list avail_port_names;
@@ -43,8 +73,12 @@ void universe_free(struct universe *u);
 struct universe* universe_create();
 void universe_init(struct universe *u);
 int universe_genesis(struct universe *univ);
+size_t universe_estimate_size(const struct universe * const u);
 
 int cmp_system_distances(const void *_system1, const void *_system2, void *_origin);
+unsigned long get_systems_near(struct ptrlist * const neighbours,
+		const long x, const long y, const long max_distance);
+int is_system_near(const long x, const long y, const long max_distance);
 unsigned long get_neighbouring_systems(struct ptrlist * const neighbours,
 		const struct system * const origin, const long max_distance);
 unsigned long get_neighbouring_ports(struct ptrlist * const neighbours,
@@ -0,0 +1,942 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "cargo.h"
+#include "common.h"
+#include "item.h"
+#include "log.h"
+#include "market.h"
+#include "player.h"
+#include "port.h"
+#include "ship.h"
+#include "ship_type.h"
+#include "stringtrie.h"
+#include "universe.h"
+#include "wal.h"
+
+struct wal wal = {
+	.fd = -1,
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+	.cut_cond = PTHREAD_COND_INITIALIZER,
+	.next_lsn = 1,
+};
+
+void wal_init(struct wal *w)
+{
+	memset(w, 0, sizeof(*w));
+	w->fd = -1;
+	w->next_lsn = 1;
+	pthread_mutex_init(&w->lock, NULL);
+	pthread_cond_init(&w->cond, NULL);
+	pthread_cond_init(&w->cut_cond, NULL);
+}
+
+/*
+ * FNV-1a, which is plenty to tell a torn or garbled record from a good one.
+ */
+#define WAL_CHECKSUM_BASIS 2166136261U
+#define WAL_CHECKSUM_PRIME 16777619U
+static uint32_t checksum(uint32_t sum, const void *data, const size_t len)
+{
+	const unsigned char *p = data;
+
+	for (size_t i = 0; i < len; i++)
+		sum = (sum ^ p[i]) * WAL_CHECKSUM_PRIME;
+
+	return sum;
+}
+
+/*
+ * Records are put together on the stack, outside the lock. The lock is only
+ * held to number the record and copy it into the pending buffer.
+ */
+#define WAL_MAX_PAYLOAD 1024
+struct wal_record {
+	char payload[WAL_MAX_PAYLOAD];
+	size_t len;
+	int overflow;
+};
+
+static void put(struct wal_record *rec, const void *data, const size_t len)
+{
+	if (rec->overflow || len > sizeof(rec->payload) - rec->len) {
+		rec->overflow = 1;
+		return;
+	}
+
+	memcpy(rec->payload + rec->len, data, len);
+	rec->len += len;
+}
+
+static void put_u8(struct wal_record *rec, const uint8_t u)
+{
+	put(rec, &u, sizeof(u));
+}
+
+static void put_i64(struct wal_record *rec, const int64_t i)
+{
+	put(rec, &i, sizeof(i));
+}
+
+static void put_string(struct wal_record *rec, const char * const s)
+{
+	size_t len = strlen(s) + 1;
+	uint16_t len16 = len;
+
+	if (len > UINT16_MAX) {
+		rec->overflow = 1;
+		return;
+	}
+
+	put(rec, &len16, sizeof(len16));
+	put(rec, s, len);
+}
+
+static void begin_record(struct wal_record *rec, const enum wal_record_type type)
+{
+	rec->len = 0;
+	rec->overflow = 0;
+	put_u8(rec, type);
+}
+
+#define WAL_BUF_MIN_ALLOC 65536
+static int buf_append(struct wal_buf *b, const void *data, const size_t len)
+{
+	size_t alloc;
+	char *p;
+
+	if (b->len + len > b->alloc) {
+		alloc = MAX(b->alloc * 2, MAX(b->len + len, WAL_BUF_MIN_ALLOC));
+		p = realloc(b->data, alloc);
+		if (!p)
+			return -1;
+		b->data = p;
+		b->alloc = alloc;
+	}
+
+	memcpy(b->data + b->len, data, len);
+	b->len += len;
+
+	return 0;
+}
+
+static void append_record(struct wal *w, struct wal_record *rec)
+{
+	struct wal_record_header header;
+	uint32_t sum;
+	size_t start;
+
+	if (rec->overflow) {
+		log_printfn(LOG_MAIN, "WAL record of type %d is too large, not saved", rec->payload[0]);
+		return;
+	}
+
+	header.len = rec->len;
+	sum = checksum(WAL_CHECKSUM_BASIS, rec->payload, rec->len);
+
+	pthread_mutex_lock(&w->lock);
+
+	if (!w->running) {
+		pthread_mutex_unlock(&w->lock);
+		return;
+	}
+
+	header.lsn = w->next_lsn;
+	header.checksum = checksum(sum, &header.lsn, sizeof(header.lsn));
+
+	start = w->pending.len;
+	if (buf_append(&w->pending, &header, sizeof(header)) ||
+			buf_append(&w->pending, rec->payload, rec->len)) {
+		w->pending.len = start;
+		if (!w->failed)
+			log_printfn(LOG_MAIN, "out of memory, WAL records are being lost");
+		w->failed = 1;
+	} else {
+		w->next_lsn++;
+		w->records++;
+		pthread_cond_signal(&w->cond);
+	}
+
+	pthread_mutex_unlock(&w->lock);
+}
+
+/*
+ * A record is only appended while the log is open, which it is not while
+ * replaying. Replaying runs the same code as the commands do, so that code
+ * doesn't need to know.
+ */
+void wal_log_player(struct wal *w, struct player *player)
+{
+	struct wal_record rec;
+	struct ship *ship = player->pos;
+
+	begin_record(&rec, WAL_PLAYER);
+	put_string(&rec, player->name);
+	put_string(&rec, ship->type->name);
+	put_i64(&rec, player->credits);
+	put_string(&rec, player->secret);
+	append_record(w, &rec);
+}
+
+void wal_log_player_rm(struct wal *w, struct player *player)
+{
+	struct wal_record rec;
+
+	begin_record(&rec, WAL_PLAYER_RM);
+	put_string(&rec, player->name);
+	append_record(w, &rec);
+}
+
+void wal_log_move(struct wal *w, struct player *player)
+{
+	struct wal_record rec;
+	struct ship *ship = player->pos;
+	const char *pos = ship_position_name(ship);
+
+	if (!pos)
+		return;
+
+	begin_record(&rec, WAL_MOVE);
+	put_string(&rec, player->name);
+	put_u8(&rec, ship->postype);
+	put_string(&rec, pos);
+	append_record(w, &rec);
+}
+
+/*
+ * Must be called with port->items_lock and the ship's cargo_lock held, so
+ * that records for the same port are appended in the order of the trades.
+ */
+void wal_log_trade(struct wal *w, struct player *player, struct port *port,
+		struct cargo *cargo, const long ship_amount)
+{
+	struct wal_record rec;
+
+	begin_record(&rec, WAL_TRADE);
+	put_string(&rec, player->name);
+	put_string(&rec, port->name);
+	put_string(&rec, cargo->item->name);
+	put_i64(&rec, cargo_amount(cargo));
+	put_i64(&rec, ship_amount);
+	put_i64(&rec, player->credits);
+	append_record(w, &rec);
+}
+
+/*
+ * Must be called with the market lock of the order's port held, so that
+ * records for the same order are appended in the order of the changes.
+ */
+void wal_log_order(struct wal *w, struct order *order)
+{
+	struct wal_record rec;
+
+	begin_record(&rec, WAL_ORDER);
+	put_string(&rec, order->owner->name);
+	put_string(&rec, order->port->name);
+	put_i64(&rec, order->id);
+	put_string(&rec, order->item->name);
+	put_u8(&rec, order->side);
+	put_i64(&rec, order->price);
+	put_i64(&rec, order->amount);
+	put_i64(&rec, order->goods);
+	put_i64(&rec, order->credits);
+	append_record(w, &rec);
+}
+
+/*
+ * Must be called with the ship's cargo_lock held
+ */
+void wal_log_hold(struct wal *w, struct player *player, struct item *item)
+{
+	struct wal_record rec;
+	struct ship *ship = player->pos;
+
+	begin_record(&rec, WAL_HOLD);
+	put_string(&rec, player->name);
+	put_string(&rec, item->name);
+	put_i64(&rec, ship_cargo_amount(ship, item));
+	put_i64(&rec, player->credits);
+	append_record(w, &rec);
+}
+
+static int write_all(const int fd, const void *data, size_t len)
+{
+	const char *p = data;
+	ssize_t r;
+
+	while (len > 0) {
+		r = write(fd, p, len);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r < 0)
+			return -1;
+		p += r;
+		len -= r;
+	}
+
+	return 0;
+}
+
+/*
+ * Rewrites the log without the records up to lsn. The rest is written to a
+ * new file that is renamed over the log once it is on disk, so the log is
+ * always either the old one or the new one, and the new file is appended to
+ * from then on. Only the commit thread writes to the log, so nothing is
+ * appended to it meanwhile.
+ */
+static int cut_log(struct wal *w, const uint64_t lsn)
+{
+	struct wal_record_header header;
+	const char *map = NULL, *p = NULL, *end = NULL;
+	struct stat st;
+	char *tmp;
+	int fd, tmpfd = -1, r = -1;
+
+	tmp = malloc(strlen(w->file) + strlen(".tmp") + 1);
+	if (!tmp)
+		return -1;
+	sprintf(tmp, "%s.tmp", w->file);
+
+	fd = open(w->file, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st))
+		goto out;
+
+	if (st.st_size) {
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map == MAP_FAILED) {
+			map = NULL;
+			goto out;
+		}
+		p = map;
+		end = map + st.st_size;
+	}
+
+	/* Everything in the file was written by the server, so only the headers need reading */
+	while ((size_t)(end - p) >= sizeof(header)) {
+		memcpy(&header, p, sizeof(header));
+		if (header.lsn > lsn || header.len > (size_t)(end - p) - sizeof(header))
+			break;
+		p += sizeof(header) + header.len;
+	}
+
+	tmpfd = open(tmp, O_WRONLY | O_APPEND | O_CREAT | O_TRUNC, 0644);
+	if (tmpfd < 0)
+		goto out;
+	if (write_all(tmpfd, p, end - p) || fdatasync(tmpfd) || rename(tmp, w->file)) {
+		unlink(tmp);
+		goto out;
+	}
+
+	log_printfn(LOG_MAIN, "cut WAL %s after LSN %"PRIu64" from %jd to %jd bytes",
+			w->file, lsn, (intmax_t)st.st_size, (intmax_t)(end - p));
+
+	close(w->fd);
+	w->fd = tmpfd;
+	tmpfd = -1;
+	r = 0;
+
+out:
+	if (r)
+		log_printfn(LOG_MAIN, "could not cut WAL %s: %s", w->file, strerror(errno));
+	if (tmpfd >= 0)
+		close(tmpfd);
+	if (map)
+		munmap((void*)map, st.st_size);
+	if (fd >= 0)
+		close(fd);
+	free(tmp);
+
+	return r;
+}
+
+/*
+ * Takes everything appended so far and makes it durable in one go. Records
+ * appended meanwhile pile up in the other buffer and become the next batch,
+ * so the busier the server, the more records each fdatasync() covers.
+ */
+static void* wal_commit_thread(void *_w)
+{
+	struct wal *w = _w;
+	struct wal_buf tmp;
+	uint64_t lsn;
+	int r;
+
+	pthread_mutex_lock(&w->lock);
+
+	while (1) {
+		while (!w->pending.len && w->cut_lsn <= w->cut_done_lsn && !w->terminate)
+			pthread_cond_wait(&w->cond, &w->lock);
+
+		/* Records to be cut that are still pending are written first */
+		if (w->cut_lsn > w->cut_done_lsn && (w->durable_lsn >= w->cut_lsn || !w->pending.len)) {
+			lsn = w->cut_lsn;
+			pthread_mutex_unlock(&w->lock);
+			cut_log(w, lsn);
+			pthread_mutex_lock(&w->lock);
+			w->cut_done_lsn = lsn;
+			pthread_cond_broadcast(&w->cut_cond);
+			continue;
+		}
+
+		if (!w->pending.len)
+			break;
+
+		tmp = w->writing;
+		w->writing = w->pending;
+		w->pending = tmp;
+		w->pending.len = 0;
+		lsn = w->next_lsn - 1;
+
+		pthread_mutex_unlock(&w->lock);
+
+		r = write_all(w->fd, w->writing.data, w->writing.len);
+		if (!r)
+			r = fdatasync(w->fd);
+		w->writing.len = 0;
+
+		pthread_mutex_lock(&w->lock);
+
+		if (r) {
+			if (!w->failed)
+				log_printfn(LOG_MAIN, "could not write WAL: %s", strerror(errno));
+			w->failed = 1;
+		} else {
+			w->durable_lsn = lsn;
+		}
+		w->commits++;
+	}
+
+	pthread_mutex_unlock(&w->lock);
+
+	return NULL;
+}
+
+/*
+ * A process forked to write a checkpoint reads the LSN of the global log, so
+ * fork() must not happen while another thread holds its lock.
+ */
+static void wal_prepare_fork()
+{
+	pthread_mutex_lock(&wal.lock);
+}
+
+static void wal_after_fork()
+{
+	pthread_mutex_unlock(&wal.lock);
+}
+
+static pthread_once_t wal_atfork_once = PTHREAD_ONCE_INIT;
+static void wal_register_atfork()
+{
+	if (pthread_atfork(wal_prepare_fork, wal_after_fork, wal_after_fork))
+		bug("%s", "could not register WAL fork handlers");
+}
+
+/*
+ * Starts appending to file, which continues the snapshot file snapshot (which
+ * may be NULL if there is none). Any records in it must have been replayed
+ * first, so that new records are numbered after them.
+ */
+int wal_open(struct wal *w, const char * const file, const char * const snapshot)
+{
+	sigset_t old, new;
+
+	pthread_once(&wal_atfork_once, wal_register_atfork);
+
+	w->file = strdup(file);
+	if (!w->file)
+		return -1;
+	if (snapshot) {
+		w->snapshot = strdup(snapshot);
+		if (!w->snapshot)
+			goto err_free;
+	}
+
+	w->fd = open(file, O_WRONLY | O_APPEND | O_CREAT, 0644);
+	if (w->fd < 0) {
+		log_printfn(LOG_MAIN, "could not open WAL %s: %s", file, strerror(errno));
+		goto err_free;
+	}
+
+	w->terminate = 0;
+	w->durable_lsn = w->next_lsn - 1;
+	w->cut_lsn = 0;
+	w->cut_done_lsn = 0;
+
+	sigfillset(&new);
+	if (pthread_sigmask(SIG_SETMASK, &new, &old))
+		goto err;
+
+	if (pthread_create(&w->thread, NULL, wal_commit_thread, w)) {
+		pthread_sigmask(SIG_SETMASK, &old, NULL);
+		goto err;
+	}
+
+	if (pthread_sigmask(SIG_SETMASK, &old, NULL))
+		bug("%s", "could not restore signal mask");
+
+	pthread_mutex_lock(&w->lock);
+	w->running = 1;
+	pthread_mutex_unlock(&w->lock);
+
+	log_printfn(LOG_MAIN, "appending to WAL %s from LSN %"PRIu64, file, w->next_lsn);
+
+	return 0;
+
+err:
+	close(w->fd);
+	w->fd = -1;
+err_free:
+	free(w->snapshot);
+	free(w->file);
+	w->snapshot = NULL;
+	w->file = NULL;
+	return -1;
+}
+
+/*
+ * Commits whatever is left and stops the commit thread.
+ */
+void wal_close(struct wal *w)
+{
+	pthread_mutex_lock(&w->lock);
+	if (!w->running) {
+		pthread_mutex_unlock(&w->lock);
+		return;
+	}
+	w->running = 0;
+	w->terminate = 1;
+	pthread_cond_signal(&w->cond);
+	pthread_mutex_unlock(&w->lock);
+
+	pthread_join(w->thread, NULL);
+	close(w->fd);
+	w->fd = -1;
+
+	log_printfn(LOG_MAIN, "WAL closed at LSN %"PRIu64" after %lu records in %lu commits",
+			w->durable_lsn, w->records, w->commits);
+
+	free(w->snapshot);
+	free(w->file);
+	w->snapshot = NULL;
+	w->file = NULL;
+	free(w->pending.data);
+	free(w->writing.data);
+	memset(&w->pending, 0, sizeof(w->pending));
+	memset(&w->writing, 0, sizeof(w->writing));
+}
+
+int wal_is_open(struct wal *w)
+{
+	int running;
+
+	pthread_mutex_lock(&w->lock);
+	running = w->running;
+	pthread_mutex_unlock(&w->lock);
+
+	return running;
+}
+
+/*
+ * Returns the LSN of the last record appended, which a snapshot taken now
+ * reflects at least.
+ */
+uint64_t wal_last_lsn(struct wal *w)
+{
+	uint64_t lsn;
+
+	pthread_mutex_lock(&w->lock);
+	lsn = w->next_lsn - 1;
+	pthread_mutex_unlock(&w->lock);
+
+	return lsn;
+}
+
+/*
+ * Tells the log that a snapshot reflecting every record up to lsn has been
+ * saved to file. If that is the snapshot the log continues, the records are
+ * no longer needed, and this waits for the commit thread to cut them off.
+ * A snapshot saved anywhere else changes nothing, as the server may be
+ * started from the old one.
+ */
+void wal_saved(struct wal *w, const char * const file, const uint64_t lsn)
+{
+	pthread_mutex_lock(&w->lock);
+
+	if (!w->running || !w->snapshot || strcmp(file, w->snapshot) || lsn <= w->cut_lsn) {
+		pthread_mutex_unlock(&w->lock);
+		return;
+	}
+
+	w->cut_lsn = lsn;
+	pthread_cond_signal(&w->cond);
+	while (w->running && w->cut_done_lsn < lsn)
+		pthread_cond_wait(&w->cut_cond, &w->lock);
+
+	pthread_mutex_unlock(&w->lock);
+}
+
+struct wal_reader {
+	const char *p;
+	const char *end;
+	int failed;
+};
+
+static void get(struct wal_reader *r, void *data, const size_t len)
+{
+	if (r->failed || len > (size_t)(r->end - r->p)) {
+		r->failed = 1;
+		memset(data, 0, len);
+		return;
+	}
+
+	memcpy(data, r->p, len);
+	r->p += len;
+}
+
+static uint8_t get_u8(struct wal_reader *r)
+{
+	uint8_t u;
+
+	get(r, &u, sizeof(u));
+
+	return u;
+}
+
+static int64_t get_i64(struct wal_reader *r)
+{
+	int64_t i;
+
+	get(r, &i, sizeof(i));
+
+	return i;
+}
+
+static const char* get_string(struct wal_reader *r)
+{
+	const char *s;
+	uint16_t len;
+
+	get(r, &len, sizeof(len));
+	if (r->failed || len == 0 || len > r->end - r->p || r->p[len - 1] != '\0') {
+		r->failed = 1;
+		return "";
+	}
+
+	s = r->p;
+	r->p += len;
+
+	return s;
+}
+
+static struct player* find_player(const char * const name)
+{
+	struct player *player;
+
+	pthread_rwlock_rdlock(&univ.players_lock);
+	player = st_lookup_exact(&univ.playernames, name);
+	pthread_rwlock_unlock(&univ.players_lock);
+
+	return player;
+}
+
+static int replay_player(struct wal_reader *r)
+{
+	const char *name = get_string(r);
+	const char *type = get_string(r);
+	int64_t credits = get_i64(r);
+	const char *secret = get_string(r);
+	struct ship_type *ship_type;
+	struct player *player;
+
+	if (r->failed || strlen(secret) > PLAYER_SECRET_LEN)
+		return -1;
+
+	player = find_player(name);
+	if (!player) {
+		ship_type = st_lookup_exact(&univ.ship_type_names, type);
+		if (!ship_type)
+			return -1;
+
+		player = player_create(name);
+		if (!player)
+			return -1;
+
+		if (new_ship_to_player(ship_type, player))
+			return -1;
+		player->pos = list_first_entry(&player->ships, struct ship, list);
+		player->postype = SHIP;
+	}
+
+	player->credits = credits;
+	strcpy(player->secret, secret);
+
+	return 0;
+}
+
+static int replay_player_rm(struct wal_reader *r)
+{
+	const char *name = get_string(r);
+	struct player *player;
+
+	if (r->failed)
+		return -1;
+
+	player = find_player(name);
+	if (!player)
+		return -1;
+
+	player_destroy(player);
+
+	return 0;
+}
+
+static int replay_move(struct wal_reader *r)
+{
+	const char *name = get_string(r);
+	enum postype postype = get_u8(r);
+	const char *pos_name = get_string(r);
+	struct player *player;
+	void *pos;
+
+	if (r->failed)
+		return -1;
+
+	player = find_player(name);
+	pos = ship_position_by_name(postype, pos_name);
+	if (!player || !pos)
+		return -1;
+
+	return player_place(player, postype, pos);
+}
+
+static int replay_trade(struct wal_reader *r)
+{
+	const char *name = get_string(r);
+	const char *port_name = get_string(r);
+	const char *item_name = get_string(r);
+	int64_t port_amount = get_i64(r);
+	int64_t ship_amount = get_i64(r);
+	int64_t credits = get_i64(r);
+	struct player *player;
+	struct port *port;
+	struct cargo *cargo;
+	struct item *item;
+	struct ship *ship;
+	long bought;
+	int ret;
+
+	if (r->failed)
+		return -1;
+
+	/* NPC traders aren't players that are saved, only the port's side is */
+	player = find_player(name);
+	port = ship_position_by_name(PORT, port_name);
+	if (!port)
+		return -1;
+
+	pthread_rwlock_wrlock(&port->items_lock);
+	item = st_lookup_exact(&univ.item_names, item_name);
+	cargo = item ? port_cargo(port, item) : NULL;
+	if (cargo) {
+		/* Whatever the port lost was bought from it */
+		cargo_settle(cargo);
+		bought = cargo_settled_amount(cargo) - port_amount;
+		cargo_set_settled(cargo, port_amount);
+		port_traded(port, cargo, bought);
+	}
+	pthread_rwlock_unlock(&port->items_lock);
+
+	if (!cargo)
+		return -1;
+	if (!player)
+		return 0;
+
+	ship = player->pos;
+	pthread_rwlock_wrlock(&ship->cargo_lock);
+	ret = ship_set_cargo(ship, cargo->item, ship_amount);
+	pthread_rwlock_unlock(&ship->cargo_lock);
+
+	player->credits = credits;
+
+	return ret;
+}
+
+static int replay_order(struct wal_reader *r)
+{
+	const char *name = get_string(r);
+	const char *port_name = get_string(r);
+	uint64_t id = get_i64(r);
+	const char *item_name = get_string(r);
+	enum order_side side = get_u8(r);
+	int64_t price = get_i64(r);
+	int64_t amount = get_i64(r);
+	int64_t goods = get_i64(r);
+	int64_t credits = get_i64(r);
+	struct player *player;
+	struct port *port;
+	struct item *item;
+
+	if (r->failed || (side != ORDER_BUY && side != ORDER_SELL))
+		return -1;
+
+	player = find_player(name);
+	port = ship_position_by_name(PORT, port_name);
+	item = st_lookup_exact(&univ.item_names, item_name);
+	if (!player || !port || !item)
+		return -1;
+
+	return market_restore_order(player, port, item, id, side, price, amount, goods, credits);
+}
+
+static int replay_hold(struct wal_reader *r)
+{
+	const char *name = get_string(r);
+	const char *item_name = get_string(r);
+	int64_t ship_amount = get_i64(r);
+	int64_t credits = get_i64(r);
+	struct player *player;
+	struct item *item;
+	struct ship *ship;
+	int ret;
+
+	if (r->failed)
+		return -1;
+
+	player = find_player(name);
+	item = st_lookup_exact(&univ.item_names, item_name);
+	if (!player || !item)
+		return -1;
+
+	ship = player->pos;
+	pthread_rwlock_wrlock(&ship->cargo_lock);
+	ret = ship_set_cargo(ship, item, ship_amount);
+	pthread_rwlock_unlock(&ship->cargo_lock);
+
+	player->credits = credits;
+
+	return ret;
+}
+
+static int replay_record(const char * const payload, const size_t len)
+{
+	struct wal_reader r = {
+		.p = payload,
+		.end = payload + len,
+	};
+
+	switch (get_u8(&r)) {
+	case WAL_PLAYER:
+		return replay_player(&r);
+	case WAL_PLAYER_RM:
+		return replay_player_rm(&r);
+	case WAL_MOVE:
+		return replay_move(&r);
+	case WAL_TRADE:
+		return replay_trade(&r);
+	case WAL_ORDER:
+		return replay_order(&r);
+	case WAL_HOLD:
+		return replay_hold(&r);
+	default:
+		return -1;
+	}
+}
+
+/*
+ * Brings the universe up to date with the records in file that come after
+ * after_lsn, the last record a snapshot reflects. Replaying stops at the
+ * first record that is torn or damaged, which is where the server stopped
+ * writing, and the file is cut off there so that new records can follow.
+ *
+ * Records that can't be applied, say because they refer to a port that
+ * isn't in the universe, are skipped.
+ */
+int wal_replay(struct wal *w, const char * const file, const uint64_t after_lsn)
+{
+	struct wal_record_header header;
+	unsigned long applied = 0, skipped = 0;
+	uint64_t last_lsn = 0;
+	const char *map, *p, *end;
+	struct stat st;
+	size_t valid;
+	int fd;
+
+	w->next_lsn = after_lsn + 1;
+
+	fd = open(file, O_RDWR);
+	if (fd < 0 && errno == ENOENT)
+		return 0;
+	if (fd < 0 || fstat(fd, &st)) {
+		log_printfn(LOG_MAIN, "could not open WAL %s: %s", file, strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+
+	if (st.st_size == 0) {
+		close(fd);
+		return 0;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		log_printfn(LOG_MAIN, "could not map WAL %s: %s", file, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	madvise((void*)map, st.st_size, MADV_SEQUENTIAL);
+
+	p = map;
+	end = map + st.st_size;
+	while ((size_t)(end - p) >= sizeof(header)) {
+		memcpy(&header, p, sizeof(header));
+		if (header.len > (size_t)(end - p) - sizeof(header))
+			break;
+		if (last_lsn && header.lsn != last_lsn + 1)
+			break;
+		if (checksum(checksum(WAL_CHECKSUM_BASIS, p + sizeof(header), header.len),
+					&header.lsn, sizeof(header.lsn)) != header.checksum)
+			break;
+
+		if (header.lsn > after_lsn) {
+			if (replay_record(p + sizeof(header), header.len))
+				skipped++;
+			else
+				applied++;
+		}
+
+		last_lsn = header.lsn;
+		p += sizeof(header) + header.len;
+	}
+
+	valid = p - map;
+	munmap((void*)map, st.st_size);
+
+	if (valid < (size_t)st.st_size) {
+		log_printfn(LOG_MAIN, "discarding %zu bytes of torn or damaged records at the end of WAL %s",
+				st.st_size - valid, file);
+		if (ftruncate(fd, valid)) {
+			log_printfn(LOG_MAIN, "could not truncate WAL %s: %s", file, strerror(errno));
+			close(fd);
+			return -1;
+		}
+	}
+	close(fd);
+
+	w->next_lsn = MAX(last_lsn, after_lsn) + 1;
+
+	log_printfn(LOG_MAIN, "replayed %lu records from WAL %s after LSN %"PRIu64", %lu skipped",
+			applied, file, after_lsn, skipped);
+
+	return 0;
+}
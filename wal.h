@@ -0,0 +1,93 @@
+#ifndef _HAS_WAL_H
+#define _HAS_WAL_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include "cargo.h"
+#include "market.h"
+#include "player.h"
+#include "port.h"
+
+/*
+ * The write-ahead log makes player state durable between snapshots. Every
+ * command that changes a player appends a record to it. A record holds the
+ * state that results from the change, not the change itself, so replaying a
+ * record that a snapshot already reflects is harmless.
+ *
+ * Appending only copies the record into memory. A commit thread writes
+ * whatever has been appended and calls fdatasync() for the whole batch, so
+ * players never wait for the disk. The price is that the records appended
+ * since the last commit are lost if the server crashes.
+ *
+ * On disk every record is a struct wal_record_header followed by len bytes
+ * of payload: the record type as one byte, then the fields of the record.
+ * Numbers are 8 bytes and strings are a 2 byte length, the string and a
+ * terminating null, all in host byte order.
+ *
+ * The log continues a snapshot file. Once a snapshot has been saved to that
+ * file, the records it reflects are cut off the log, see wal_saved(), so the
+ * log only holds what happened since the last snapshot.
+ */
+#define WAL_DEFAULT_FILE "yastg.wal"
+
+enum wal_record_type {
+	WAL_PLAYER = 1,		/* name, ship type, credits, secret */
+	WAL_PLAYER_RM,		/* name */
+	WAL_MOVE,		/* name, position type, position name */
+	WAL_TRADE,		/* name, port, item, port amount, ship amount, credits */
+	WAL_ORDER,		/* owner, port, id, item, side, price, amount, goods, credits */
+	WAL_HOLD,		/* name, item, ship amount, credits */
+};
+
+struct wal_record_header {
+	uint32_t len;			/* Of the payload */
+	uint32_t checksum;		/* Of the LSN and the payload */
+	uint64_t lsn;			/* Log sequence number, 1 and up */
+};
+
+struct wal_buf {
+	char *data;
+	size_t len;
+	size_t alloc;
+};
+
+struct wal {
+	int fd;
+	char *file;
+	char *snapshot;			/* The snapshot file the log continues */
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_cond_t cut_cond;
+	uint64_t cut_lsn;		/* Records up to here are to be cut off */
+	uint64_t cut_done_lsn;		/* ... and up to here have been */
+	struct wal_buf pending;		/* Appended, not yet handed to the commit thread */
+	struct wal_buf writing;		/* Being written by the commit thread */
+	uint64_t next_lsn;
+	uint64_t durable_lsn;		/* Everything up to here is on disk */
+	unsigned long records;
+	unsigned long commits;
+	int running;			/* Are records being appended? */
+	int terminate;
+	int failed;
+};
+
+extern struct wal wal;
+
+void wal_init(struct wal *w);
+int wal_replay(struct wal *w, const char * const file, const uint64_t after_lsn);
+int wal_open(struct wal *w, const char * const file, const char * const snapshot);
+void wal_close(struct wal *w);
+int wal_is_open(struct wal *w);
+uint64_t wal_last_lsn(struct wal *w);
+void wal_saved(struct wal *w, const char * const file, const uint64_t lsn);
+
+void wal_log_player(struct wal *w, struct player *player);
+void wal_log_player_rm(struct wal *w, struct player *player);
+void wal_log_move(struct wal *w, struct player *player);
+void wal_log_trade(struct wal *w, struct player *player, struct port *port,
+		struct cargo *cargo, const long ship_amount);
+void wal_log_order(struct wal *w, struct order *order);
+void wal_log_hold(struct wal *w, struct player *player, struct item *item);
+
+#endif